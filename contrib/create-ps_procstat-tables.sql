@@ -1,12 +1,17 @@
+-- The history is partitioned by day on the snapshot time, and every table
+-- repeats the time of its snapshot so that ps_maintain() can create and drop
+-- the partitions of all tables together.
 CREATE TABLE ps_snaps(
-	snap BIGSERIAL PRIMARY KEY,
+	snap BIGSERIAL,
 	note TEXT,
-	time TIMESTAMP WITH TIME ZONE DEFAULT NOW()
-);
+	time TIMESTAMP WITH TIME ZONE NOT NULL DEFAULT NOW(),
+	PRIMARY KEY (snap, time)
+) PARTITION BY RANGE (time);
 
 -- PostgreSQL Processes Stats
 CREATE TABLE ps_procstat(
 	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
 	pid INTEGER,
 	comm VARCHAR,
 	fullcomm VARCHAR,
@@ -55,15 +60,13 @@ CREATE TABLE ps_procstat(
 	query_start TIMESTAMP WITH TIME ZONE,
 	backend_start TIMESTAMP WITH TIME ZONE,
 	client_addr INET,
-	client_port INTEGER,
-	CONSTRAINT proc_snap
-		FOREIGN KEY (snap)
-		REFERENCES ps_snaps (snap)
-);
+	client_port INTEGER
+) PARTITION BY RANGE (time);
 
 -- PostgreSQL Database Stats
 CREATE TABLE ps_dbstat(
 	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
 	datid BIGINT,
 	datname NAME,
 	numbackends INTEGER,
@@ -71,15 +74,13 @@ CREATE TABLE ps_dbstat(
 	xact_rollback BIGINT,
 	blks_read BIGINT,
 	blks_hit BIGINT,
-	PRIMARY KEY (snap, datid),
-	CONSTRAINT db_snap
-		FOREIGN KEY (snap)
-		REFERENCES ps_snaps (snap)
-);
+	PRIMARY KEY (snap, datid, time)
+) PARTITION BY RANGE (time);
 
 -- PostgreSQL Table Stats
 CREATE TABLE ps_tablestat(
 	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
 	relid BIGINT,
 	schemaname NAME,
 	relname NAME,
@@ -94,15 +95,13 @@ CREATE TABLE ps_tablestat(
 	last_autovacuum TIMESTAMP WITH TIME ZONE,
 	last_analyze TIMESTAMP WITH TIME ZONE,
 	last_autoanalyze TIMESTAMP WITH TIME ZONE,
-	PRIMARY KEY (snap, relid),
-	CONSTRAINT table_snap
-		FOREIGN KEY (snap)
-		REFERENCES ps_snaps (snap)
-);
+	PRIMARY KEY (snap, relid, time)
+) PARTITION BY RANGE (time);
 
 -- PostgreSQL Index Stats
 CREATE TABLE ps_indexstat(
 	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
 	relid BIGINT,
 	indexrelid BIGINT,
 	schemaname NAME,
@@ -111,29 +110,26 @@ CREATE TABLE ps_indexstat(
 	idx_scan BIGINT,
 	idx_tup_read BIGINT,
 	idx_tup_fetch BIGINT,
-	PRIMARY KEY (snap, relid, indexrelid),
-	CONSTRAINT index_snap
-		FOREIGN KEY (snap)
-		REFERENCES ps_snaps (snap)
-);
+	PRIMARY KEY (snap, relid, indexrelid, time)
+) PARTITION BY RANGE (time);
 
 -- System Processor Stats
 CREATE TABLE ps_cpustat(
-	snap BIGINT PRIMARY KEY,
+	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
 	cpu_user BIGINT,
 	cpu_nice BIGINT,
 	cpu_system BIGINT,
 	cpu_idle BIGINT,
 	cpu_iowait BIGINT,
 	cpu_swap BIGINT,
-	CONSTRAINT cpu_snap
-		FOREIGN KEY (snap)
-		REFERENCES ps_snaps (snap)
-);
+	PRIMARY KEY (snap, time)
+) PARTITION BY RANGE (time);
 
 -- System Memory Stats
 CREATE TABLE ps_memstat(
-	snap BIGINT PRIMARY KEY,
+	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
 	memused BIGINT,
 	memfree BIGINT,
 	memshared BIGINT,
@@ -142,7 +138,105 @@ CREATE TABLE ps_memstat(
 	swapused BIGINT,
 	swapfree BIGINT,
 	swapcached BIGINT,
-	CONSTRAINT mem_snap
-		FOREIGN KEY (snap)
-		REFERENCES ps_snaps (snap)
-);
+	PRIMARY KEY (snap, time)
+) PARTITION BY RANGE (time);
+
+-- System Load Stats
+CREATE TABLE ps_loadstat(
+	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
+	load1 FLOAT,
+	load5 FLOAT,
+	load15 FLOAT,
+	last_pid INTEGER,
+	PRIMARY KEY (snap, time)
+) PARTITION BY RANGE (time);
+
+-- System Disk Stats
+CREATE TABLE ps_diskstat(
+	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
+	major SMALLINT,
+	minor SMALLINT,
+	devname TEXT,
+	reads_completed BIGINT,
+	reads_merged BIGINT,
+	sectors_read BIGINT,
+	readtime BIGINT,
+	writes_completed BIGINT,
+	writes_merged BIGINT,
+	sectors_written BIGINT,
+	writetime BIGINT,
+	current_io BIGINT,
+	iotime BIGINT,
+	totaliotime BIGINT,
+	PRIMARY KEY (snap, major, minor, time)
+) PARTITION BY RANGE (time);
+
+-- File System Capacity
+CREATE TABLE ps_fsstat(
+	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
+	name TEXT,
+	path TEXT,
+	mount_point TEXT,
+	bytes_total BIGINT,
+	bytes_available BIGINT,
+	inodes_total BIGINT,
+	inodes_available BIGINT,
+	PRIMARY KEY (snap, name, time)
+) PARTITION BY RANGE (time);
+
+-- Anomalies found by the pg_proctab worker, and until when it takes snapshots
+-- because of them.
+CREATE TABLE ps_anomalies(
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
+	metric TEXT NOT NULL,
+	object TEXT,
+	value FLOAT,
+	mean FLOAT,
+	stddev FLOAT,
+	zscore FLOAT,
+	burst_until TIMESTAMP WITH TIME ZONE
+) PARTITION BY RANGE (time);
+
+-- PostgreSQL Processes Stats, packed with pg_proctab.snap_storage = packed
+CREATE TABLE ps_procstat_packed(
+	snap BIGINT,
+	time TIMESTAMP WITH TIME ZONE NOT NULL,
+	base BIGINT NOT NULL,
+	prev BIGINT,
+	nprocs INTEGER,
+	data BYTEA,
+	PRIMARY KEY (snap, time)
+) PARTITION BY RANGE (time);
+
+-- Rollups of the system, disk and database statistics by ps_maintain(), one
+-- row per bucket, metric and device or database.  rate is the increase per
+-- second of counters and NULL for gauges.
+CREATE TABLE ps_rollup_minute(
+	bucket TIMESTAMP WITH TIME ZONE NOT NULL,
+	metric TEXT NOT NULL,
+	object TEXT NOT NULL,
+	samples INTEGER,
+	min FLOAT,
+	avg FLOAT,
+	max FLOAT,
+	rate FLOAT,
+	PRIMARY KEY (bucket, metric, object)
+) PARTITION BY RANGE (bucket);
+
+CREATE TABLE ps_rollup_hour(
+	bucket TIMESTAMP WITH TIME ZONE NOT NULL,
+	metric TEXT NOT NULL,
+	object TEXT NOT NULL,
+	samples INTEGER,
+	min FLOAT,
+	avg FLOAT,
+	max FLOAT,
+	rate FLOAT,
+	PRIMARY KEY (bucket, metric, object)
+) PARTITION BY RANGE (bucket);
+
+-- Create the first partitions.
+SELECT ps_maintain();
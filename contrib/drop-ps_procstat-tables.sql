@@ -1,3 +1,10 @@
+DROP TABLE ps_rollup_hour;
+DROP TABLE ps_rollup_minute;
+DROP TABLE ps_procstat_packed;
+DROP TABLE ps_anomalies;
+DROP TABLE ps_fsstat;
+DROP TABLE ps_diskstat;
+DROP TABLE ps_loadstat;
 DROP TABLE ps_indexstat;
 DROP TABLE ps_tablestat;
 DROP TABLE ps_dbstat;
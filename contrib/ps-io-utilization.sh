@@ -9,27 +9,13 @@ PID=$1
 SNAP1=$2
 SNAP2=$3
 
-A=( `psql --no-align --tuples-only --field-separator ' ' --command "SELECT syscr, syscw, reads, writes, cwrites FROM ps_snaps a, ps_procstat b WHERE pid = ${PID} AND a.snap = b.snap AND a.snap = ${SNAP1}"` )
+A=( `psql --no-align --tuples-only --field-separator ' ' --command "SELECT syscr, syscw, reads, writes, cwrites FROM ps_report_process(${SNAP1}, ${SNAP2}, ${PID}) WHERE status IS NULL"` )
 
-R1=${A[0]}
-W1=${A[1]}
-RB1=${A[2]}
-WB1=${A[3]}
-CWB1=${A[4]}
-
-A=( `psql --no-align --tuples-only --field-separator ' ' --command "SELECT syscr, syscw, reads, writes, cwrites FROM ps_snaps a, ps_procstat b WHERE pid = ${PID} AND a.snap = b.snap AND a.snap = ${SNAP2}"` )
-
-R2=${A[0]}
-W2=${A[1]}
-RB2=${A[2]}
-WB2=${A[3]}
-CWB2=${A[4]}
-
-R=$(( ${R2} - ${R1} ))
-W=$(( ${W2} - ${W1} ))
-RB=$(( ${RB2} - ${RB1} ))
-WB=$(( ${WB2} - ${WB1} ))
-CWB=$(( ${CWB2} - ${CWB1} ))
+R=${A[0]}
+W=${A[1]}
+RB=${A[2]}
+WB=${A[3]}
+CWB=${A[4]}
 
 echo "Reads = ${R}"
 echo "Writes = ${W}"
@@ -21,7 +21,6 @@ my $snap2 = $ARGV[2];
 my $psql = "psql --tuples-only --no-align --command";
 my $sql;
 my $temp;
-my @a1;
 my @a2;
 
 # Get the snapshot timestamps.
@@ -41,23 +40,14 @@ chomp $end_time;
 
 # Get database stats.
 
-$temp = "
-SELECT numbackends, xact_commit, xact_rollback, blks_read, blks_hit
-FROM ps_dbstat
+$sql = "
+SELECT xact_commit, xact_rollback, blks_read, blks_hit
+FROM ps_report_db($snap1, $snap2)
 WHERE datname = '$ENV{PGDATABASE}'
-  AND snap = %d
 ";
-
-$sql = sprintf($temp, $snap1);
-@a1 = split /\|/, `$psql "$sql"`;
-
-$sql = sprintf($temp, $snap2);
-@a2 = split /\|/, `$psql "$sql"`;
-
-my $xact_commit = $a2[1] - $a1[1];
-my $xact_rollback = $a2[2] - $a1[2];
-my $blks_read = $a2[3] - $a1[3];
-my $blks_hit = $a2[4] - $a1[4];
+my ($xact_commit, $xact_rollback, $blks_read, $blks_hit) =
+		split /\|/, `$psql "$sql"`;
+chomp $blks_hit;
 
 print "Database       : $ENV{PGDATABASE}\n";
 print "Snapshot Start : $start_time\n";
@@ -72,38 +62,17 @@ print "Blocks Read : $blks_read\n";
 print "Blocks Hit  : $blks_hit\n";
 print "\n";
 
-# FIXME: This simple logic breakds if tables are added or dropped between
-# snapshots.
-
-$temp = "
-SELECT schemaname, relname, seq_scan, seq_tup_read, idx_scan, idx_tup_fetch,
-	n_tup_ins, n_tup_upd, n_tup_del
-FROM ps_tablestat
-WHERE snap = %d
-ORDER BY schemaname, relname
-";
-
-$sql = sprintf($temp, $snap1);
-@a1 = split /\n/, `$psql "$sql"`;
-
-# Get the vaccum dates of the second snapshot.
-$temp = "
+# Tables added between the snapshots count from zero, dropped ones are left
+# out.
+$sql = "
 SELECT schemaname, relname, seq_scan, seq_tup_read, idx_scan, idx_tup_fetch,
 	n_tup_ins, n_tup_upd, n_tup_del, last_vacuum, last_autovacuum,
 	last_analyze, last_autoanalyze
-FROM ps_tablestat
-WHERE snap = %d
-ORDER BY schemaname, relname
+FROM ps_report_tables($snap1, $snap2)
+WHERE status IS DISTINCT FROM 'dropped'
 ";
-$sql = sprintf($temp, $snap2);
 @a2 = split /\n/, `$psql "$sql"`;
 
-unless (scalar @a1 == scalar @a2) {
-	print "Tables were added or dropped between snapshot $snap1 and $snap2\n";
-	print "This script can't handle that, aborting.\n";
-	exit(1);
-}
-
 my $length = 0;
 
 print "================\n";
@@ -113,23 +82,20 @@ print "================\n";
 # Run through all the names once just to see what the longest one is to
 # determine how to format the output.
 my @c = ();
-for (my $i = 0; $i < scalar @a1; $i++) {
-	my @b1 = split /\|/, $a1[$i];
+for (my $i = 0; $i < scalar @a2; $i++) {
 	my @b2 = split /\|/, $a2[$i];
 
 	# Some columns are NULL, set to 0.
 	for (my $i = 0; $i < 9; $i++) {
-		$b1[$i] = 0 unless ($b1[$i]);
 		$b2[$i] = 0 unless ($b2[$i]);
 	}
 	for (my $i = 9; $i < 13; $i++) {
 		$b2[$i] = 'N/A' unless ($b2[$i]);
 	}
-	my $name = "$b1[0].$b1[1]";
+	my $name = "$b2[0].$b2[1]";
 	$length = length $name if (length $name > $length);
-	push @c, ([$name, $b2[2] - $b1[2], $b2[3] - $b1[3], $b2[4] - $b1[4],
-			$b2[5] - $b1[5], $b2[6] - $b1[6], $b2[7] - $b1[7],
-			$b2[8] - $b1[8], "$b2[9]", "$b2[10]", "$b2[11]", "$b2[12]"]);
+	push @c, ([$name, $b2[2], $b2[3], $b2[4], $b2[5], $b2[6], $b2[7],
+			$b2[8], "$b2[9]", "$b2[10]", "$b2[11]", "$b2[12]"]);
 }
 
 my @header = ("Schema.Relation", "Seq Scan", "Seq Tup Read",
@@ -174,20 +140,11 @@ print"\n";
 
 # Display index stats.
 
-# FIXME: This simple logic breakds if indexes are added or dropped between
-# snapshots.
-
-$temp = "
+$sql = "
 SELECT schemaname, relname, indexrelname, idx_scan, idx_tup_read, idx_tup_fetch
-FROM ps_indexstat
-WHERE snap = %d
-ORDER BY schemaname, relname, indexrelname
+FROM ps_report_indexes($snap1, $snap2)
+WHERE status IS DISTINCT FROM 'dropped'
 ";
-
-$sql = sprintf($temp, $snap1);
-@a1 = split /\n/, `$psql "$sql"`;
-
-$sql = sprintf($temp, $snap2);
 @a2 = split /\n/, `$psql "$sql"`;
 
 print "================\n";
@@ -197,13 +154,12 @@ print "================\n";
 # Run through all the names once just to see what the longest one is to
 # determine how to format the output.
 @c = ();
-for (my $i = 0; $i < scalar @a1; $i++) {
-	my @b1 = split /\|/, $a1[$i];
+for (my $i = 0; $i < scalar @a2; $i++) {
 	my @b2 = split /\|/, $a2[$i];
 
-	my $name = "$b1[0].$b1[1].$b1[2]";
+	my $name = "$b2[0].$b2[1].$b2[2]";
 	$length = length $name if (length $name > $length);
-	push @c, ([$name, $b2[3] - $b1[3], $b2[4] - $b1[4], $b2[5] - $b1[5]]);
+	push @c, ([$name, $b2[3], $b2[4], $b2[5]]);
 }
 @header = ("Schema.Relation.Index", "Idx Scan", "Idx Tup Read",
 		"Idx Tup Fetch");
@@ -0,0 +1,1315 @@
+CREATE FUNCTION pg_taskstats(
+		OUT pid INTEGER,
+		OUT cpu_count BIGINT,
+		OUT cpu_delay_total BIGINT,
+		OUT blkio_count BIGINT,
+		OUT blkio_delay_total BIGINT,
+		OUT swapin_count BIGINT,
+		OUT swapin_delay_total BIGINT,
+		OUT reclaim_count BIGINT,
+		OUT reclaim_delay_total BIGINT,
+		OUT thrashing_count BIGINT,
+		OUT thrashing_delay_total BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_taskstats'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_proctab_perf(
+		OUT pid INTEGER,
+		OUT hardware BOOLEAN,
+		OUT cycles BIGINT,
+		OUT instructions BIGINT,
+		OUT cache_references BIGINT,
+		OUT cache_misses BIGINT,
+		OUT task_clock BIGINT,
+		OUT context_switches BIGINT,
+		OUT cpu_migrations BIGINT,
+		OUT page_faults BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab_perf'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_proctab_perf_delta(
+		OUT pid INTEGER,
+		OUT hardware BOOLEAN,
+		OUT elapsed FLOAT,
+		OUT cycles BIGINT,
+		OUT instructions BIGINT,
+		OUT cache_references BIGINT,
+		OUT cache_misses BIGINT,
+		OUT task_clock BIGINT,
+		OUT context_switches BIGINT,
+		OUT cpu_migrations BIGINT,
+		OUT page_faults BIGINT,
+		OUT ipc FLOAT,
+		OUT cache_miss_ratio FLOAT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab_perf_delta'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_set_backend_affinity(pid INTEGER, cpus INTEGER[])
+RETURNS BOOLEAN
+AS 'MODULE_PATHNAME', 'pg_set_backend_affinity'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_set_backend_nice(pid INTEGER, nice INTEGER)
+RETURNS BOOLEAN
+AS 'MODULE_PATHNAME', 'pg_set_backend_nice'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_set_backend_ioprio(pid INTEGER, class TEXT,
+		level INTEGER DEFAULT 4)
+RETURNS BOOLEAN
+AS 'MODULE_PATHNAME', 'pg_set_backend_ioprio'
+LANGUAGE C VOLATILE STRICT;
+
+REVOKE ALL ON FUNCTION pg_set_backend_affinity(INTEGER, INTEGER[]) FROM PUBLIC;
+REVOKE ALL ON FUNCTION pg_set_backend_nice(INTEGER, INTEGER) FROM PUBLIC;
+REVOKE ALL ON FUNCTION pg_set_backend_ioprio(INTEGER, TEXT, INTEGER) FROM PUBLIC;
+
+CREATE FUNCTION pg_check_process_policy(policy TEXT)
+RETURNS VOID
+AS 'MODULE_PATHNAME', 'pg_check_process_policy'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION pg_numa_maps(
+		OUT pid INTEGER,
+		OUT segment TEXT,
+		OUT node INTEGER,
+		OUT pages BIGINT,
+		OUT bytes BIGINT,
+		OUT local BOOLEAN)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_numa_maps'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_numa_nodes(
+		OUT node INTEGER,
+		OUT cpus TEXT,
+		OUT memtotal BIGINT,
+		OUT memfree BIGINT,
+		OUT memused BIGINT,
+		OUT filepages BIGINT,
+		OUT anonpages BIGINT,
+		OUT shmem BIGINT,
+		OUT hugepages_total BIGINT,
+		OUT hugepages_free BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_numa_nodes'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_cpu_numa_node(cpu INTEGER)
+RETURNS INTEGER
+AS 'MODULE_PATHNAME', 'pg_cpu_numa_node'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION pg_cpu_topology(
+		OUT cpu INTEGER,
+		OUT online BOOLEAN,
+		OUT package INTEGER,
+		OUT die INTEGER,
+		OUT core INTEGER,
+		OUT thread_siblings TEXT,
+		OUT node INTEGER,
+		OUT l1d_cache BIGINT,
+		OUT l1i_cache BIGINT,
+		OUT l2_cache BIGINT,
+		OUT l3_cache BIGINT,
+		OUT l3_shared_cpus TEXT,
+		OUT cur_freq BIGINT,
+		OUT max_freq BIGINT,
+		OUT core_throttle_count BIGINT,
+		OUT package_throttle_count BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_cpu_topology'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_cputime_percpu(
+		OUT cpu INTEGER,
+		OUT "user" BIGINT,
+		OUT nice BIGINT,
+		OUT system BIGINT,
+		OUT idle BIGINT,
+		OUT iowait BIGINT,
+		OUT irq BIGINT,
+		OUT softirq BIGINT,
+		OUT steal BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_cputime_percpu'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION ps_snap_stats(note TEXT)
+RETURNS BIGINT
+AS 'MODULE_PATHNAME', 'ps_snap_stats'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION ps_procstat_unpack(first BIGINT, last BIGINT,
+		OUT snap BIGINT,
+		OUT pid INTEGER,
+		OUT comm VARCHAR,
+		OUT fullcomm VARCHAR,
+		OUT state CHAR,
+		OUT ppid INTEGER,
+		OUT pgrp INTEGER,
+		OUT session INTEGER,
+		OUT tty_nr INTEGER,
+		OUT tpgid INTEGER,
+		OUT flags INTEGER,
+		OUT minflt BIGINT,
+		OUT cminflt BIGINT,
+		OUT majflt BIGINT,
+		OUT cmajflt BIGINT,
+		OUT utime BIGINT,
+		OUT stime BIGINT,
+		OUT cutime BIGINT,
+		OUT cstime BIGINT,
+		OUT priority BIGINT,
+		OUT nice BIGINT,
+		OUT num_threads BIGINT,
+		OUT itrealvalue BIGINT,
+		OUT starttime BIGINT,
+		OUT vsize BIGINT,
+		OUT rss BIGINT,
+		OUT exit_signal INTEGER,
+		OUT processor INTEGER,
+		OUT rt_priority BIGINT,
+		OUT policy BIGINT,
+		OUT delayacct_blkio_ticks BIGINT,
+		OUT uid INTEGER,
+		OUT username VARCHAR,
+		OUT rchar BIGINT,
+		OUT wchar BIGINT,
+		OUT syscr BIGINT,
+		OUT syscw BIGINT,
+		OUT reads BIGINT,
+		OUT writes BIGINT,
+		OUT cwrites BIGINT,
+		OUT datid BIGINT,
+		OUT datname NAME,
+		OUT usesysid BIGINT,
+		OUT usename NAME,
+		OUT current_query TEXT,
+		OUT waiting BOOLEAN,
+		OUT query_start TIMESTAMP WITH TIME ZONE,
+		OUT backend_start TIMESTAMP WITH TIME ZONE,
+		OUT client_addr INET,
+		OUT client_port INTEGER)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'ps_procstat_unpack'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION ps_procstat_unpack(BIGINT,
+		OUT snap BIGINT,
+		OUT pid INTEGER,
+		OUT comm VARCHAR,
+		OUT fullcomm VARCHAR,
+		OUT state CHAR,
+		OUT ppid INTEGER,
+		OUT pgrp INTEGER,
+		OUT session INTEGER,
+		OUT tty_nr INTEGER,
+		OUT tpgid INTEGER,
+		OUT flags INTEGER,
+		OUT minflt BIGINT,
+		OUT cminflt BIGINT,
+		OUT majflt BIGINT,
+		OUT cmajflt BIGINT,
+		OUT utime BIGINT,
+		OUT stime BIGINT,
+		OUT cutime BIGINT,
+		OUT cstime BIGINT,
+		OUT priority BIGINT,
+		OUT nice BIGINT,
+		OUT num_threads BIGINT,
+		OUT itrealvalue BIGINT,
+		OUT starttime BIGINT,
+		OUT vsize BIGINT,
+		OUT rss BIGINT,
+		OUT exit_signal INTEGER,
+		OUT processor INTEGER,
+		OUT rt_priority BIGINT,
+		OUT policy BIGINT,
+		OUT delayacct_blkio_ticks BIGINT,
+		OUT uid INTEGER,
+		OUT username VARCHAR,
+		OUT rchar BIGINT,
+		OUT wchar BIGINT,
+		OUT syscr BIGINT,
+		OUT syscw BIGINT,
+		OUT reads BIGINT,
+		OUT writes BIGINT,
+		OUT cwrites BIGINT,
+		OUT datid BIGINT,
+		OUT datname NAME,
+		OUT usesysid BIGINT,
+		OUT usename NAME,
+		OUT current_query TEXT,
+		OUT waiting BOOLEAN,
+		OUT query_start TIMESTAMP WITH TIME ZONE,
+		OUT backend_start TIMESTAMP WITH TIME ZONE,
+		OUT client_addr INET,
+		OUT client_port INTEGER)
+RETURNS SETOF record
+AS $$
+	SELECT * FROM ps_procstat_unpack($1, $1)
+$$ LANGUAGE SQL STABLE STRICT;
+
+CREATE FUNCTION ps_samples(first TIMESTAMP WITH TIME ZONE,
+		last TIMESTAMP WITH TIME ZONE,
+		OUT time TIMESTAMP WITH TIME ZONE,
+		OUT metric TEXT,
+		OUT object TEXT,
+		OUT value FLOAT,
+		OUT counter BOOLEAN)
+RETURNS SETOF record AS $$
+BEGIN
+	-- Processor counters are in ticks.
+	RETURN QUERY
+	SELECT c.time, v.metric, ''::TEXT, v.value, true
+	FROM ps_cpustat c,
+	     LATERAL (VALUES ('cpu_user', c.cpu_user::FLOAT),
+	                     ('cpu_nice', c.cpu_nice::FLOAT),
+	                     ('cpu_system', c.cpu_system::FLOAT),
+	                     ('cpu_idle', c.cpu_idle::FLOAT),
+	                     ('cpu_iowait', c.cpu_iowait::FLOAT)) v(metric, value)
+	WHERE c.time >= first AND c.time < last;
+
+	RETURN QUERY
+	SELECT m.time, v.metric, ''::TEXT, v.value, false
+	FROM ps_memstat m,
+	     LATERAL (VALUES ('memused', m.memused::FLOAT),
+	                     ('memfree', m.memfree::FLOAT),
+	                     ('memshared', m.memshared::FLOAT),
+	                     ('membuffers', m.membuffers::FLOAT),
+	                     ('memcached', m.memcached::FLOAT),
+	                     ('swapused', m.swapused::FLOAT),
+	                     ('swapfree', m.swapfree::FLOAT)) v(metric, value)
+	WHERE m.time >= first AND m.time < last;
+
+	RETURN QUERY
+	SELECT l.time, v.metric, ''::TEXT, v.value, false
+	FROM ps_loadstat l,
+	     LATERAL (VALUES ('load1', l.load1),
+	                     ('load5', l.load5),
+	                     ('load15', l.load15)) v(metric, value)
+	WHERE l.time >= first AND l.time < last;
+
+	RETURN QUERY
+	SELECT d.time, v.metric, d.devname, v.value, v.counter
+	FROM ps_diskstat d,
+	     LATERAL (VALUES ('reads_completed', d.reads_completed::FLOAT, true),
+	                     ('writes_completed', d.writes_completed::FLOAT,
+	                      true),
+	                     ('sectors_read', d.sectors_read::FLOAT, true),
+	                     ('sectors_written', d.sectors_written::FLOAT, true),
+	                     ('readtime', d.readtime::FLOAT, true),
+	                     ('writetime', d.writetime::FLOAT, true),
+	                     ('iotime', d.iotime::FLOAT, true),
+	                     ('current_io', d.current_io::FLOAT, false))
+	         v(metric, value, counter)
+	WHERE d.time >= first AND d.time < last;
+
+	RETURN QUERY
+	SELECT f.time, v.metric, f.name, v.value, false
+	FROM ps_fsstat f,
+	     LATERAL (VALUES ('bytes_available', f.bytes_available::FLOAT),
+	                     ('inodes_available', f.inodes_available::FLOAT))
+	         v(metric, value)
+	WHERE f.time >= first AND f.time < last;
+
+	RETURN QUERY
+	SELECT d.time, v.metric, d.datname::TEXT, v.value, v.counter
+	FROM ps_dbstat d,
+	     LATERAL (VALUES ('numbackends', d.numbackends::FLOAT, false),
+	                     ('xact_commit', d.xact_commit::FLOAT, true),
+	                     ('xact_rollback', d.xact_rollback::FLOAT, true),
+	                     ('blks_read', d.blks_read::FLOAT, true),
+	                     ('blks_hit', d.blks_hit::FLOAT, true))
+	         v(metric, value, counter)
+	WHERE d.time >= first AND d.time < last;
+END;
+$$ LANGUAGE plpgsql STABLE STRICT;
+
+CREATE FUNCTION ps_maintain(
+		raw_retention INTERVAL DEFAULT '7 days',
+		minute_retention INTERVAL DEFAULT '90 days',
+		hour_retention INTERVAL DEFAULT '2 years')
+RETURNS VOID AS $$
+DECLARE
+	raw_tables TEXT[] := ARRAY['ps_snaps', 'ps_procstat',
+			'ps_procstat_packed', 'ps_dbstat', 'ps_tablestat', 'ps_indexstat',
+			'ps_cpustat', 'ps_memstat', 'ps_loadstat', 'ps_diskstat',
+			'ps_fsstat', 'ps_anomalies'];
+	rollup_tables TEXT[] := ARRAY['ps_rollup_minute', 'ps_rollup_hour'];
+	retention INTERVAL;
+	today TIMESTAMP WITH TIME ZONE;
+	month TIMESTAMP WITH TIME ZONE;
+	start TIMESTAMP WITH TIME ZONE;
+	part RECORD;
+	t TEXT;
+	i INTEGER;
+BEGIN
+	-- Raw statistics go into daily partitions.  The function runs in UTC, so
+	-- these are UTC days, which line up with the keyframes of
+	-- ps_procstat_packed.
+	today := date_trunc('day', now());
+	FOREACH t IN ARRAY raw_tables LOOP
+		FOR i IN 0..1 LOOP
+			EXECUTE format('CREATE TABLE IF NOT EXISTS %I PARTITION OF %I '
+					'FOR VALUES FROM (%L) TO (%L)',
+					t || '_' || to_char(today + i * INTERVAL '1 day',
+							'YYYYMMDD'),
+					t, today + i * INTERVAL '1 day',
+					today + (i + 1) * INTERVAL '1 day');
+		END LOOP;
+	END LOOP;
+
+	-- Rollups go into monthly partitions, from the month of the oldest raw
+	-- statistics that still have to be rolled up.
+	SELECT date_trunc('month', min(s.time))
+	INTO start
+	FROM ps_snaps s;
+	month := date_trunc('month', now());
+	FOREACH t IN ARRAY rollup_tables LOOP
+		FOR part IN
+			SELECT m AS lower, m + INTERVAL '1 month' AS upper
+			FROM generate_series(least(start, month),
+					month + INTERVAL '1 month', INTERVAL '1 month') m
+		LOOP
+			EXECUTE format('CREATE TABLE IF NOT EXISTS %I PARTITION OF %I '
+					'FOR VALUES FROM (%L) TO (%L)',
+					t || '_' || to_char(part.lower, 'YYYYMM'),
+					t, part.lower, part.upper);
+		END LOOP;
+	END LOOP;
+
+	-- Roll up the complete minutes that are not rolled up yet.  The rate of
+	-- a counter is its increase per second since the sample before each
+	-- sample in the bucket, which may be in an earlier bucket, so the
+	-- samples are read from the last snapshot before the first bucket.  A
+	-- counter that went down was reset and increased by its value.
+	SELECT coalesce(max(bucket) + INTERVAL '1 minute',
+			(SELECT date_trunc('minute', min(s.time)) FROM ps_snaps s))
+	INTO start
+	FROM ps_rollup_minute;
+
+	IF start IS NOT NULL THEN
+		INSERT INTO ps_rollup_minute(bucket, metric, object, samples, min,
+				avg, max, rate)
+		SELECT date_trunc('minute', d.time), d.metric, d.object, count(*),
+				min(d.value), avg(d.value), max(d.value),
+				CASE WHEN d.counter AND
+				          sum(extract(epoch FROM d.time - d.prev_time)) > 0
+				     THEN sum(CASE WHEN d.value >= d.prev_value
+				                   THEN d.value - d.prev_value
+				                   ELSE d.value
+				              END) FILTER (WHERE d.prev_time IS NOT NULL) /
+				          sum(extract(epoch FROM d.time - d.prev_time))
+				END
+		FROM (SELECT s.time, s.metric, s.object, s.value, s.counter,
+		             lag(s.value) OVER w AS prev_value,
+		             lag(s.time) OVER w AS prev_time
+		      FROM ps_samples(coalesce((SELECT max(p.time)
+		                                FROM ps_snaps p
+		                                WHERE p.time < start), start),
+		                      date_trunc('minute', now())) s
+		      WINDOW w AS (PARTITION BY s.metric, s.object ORDER BY s.time))
+		     d
+		WHERE d.time >= start
+		GROUP BY 1, 2, 3, d.counter
+		ON CONFLICT DO NOTHING;
+	END IF;
+
+	-- Roll the complete hours up from the minutes.
+	SELECT coalesce(max(bucket) + INTERVAL '1 hour',
+			(SELECT date_trunc('hour', min(m.bucket))
+			 FROM ps_rollup_minute m))
+	INTO start
+	FROM ps_rollup_hour;
+
+	IF start IS NOT NULL THEN
+		INSERT INTO ps_rollup_hour(bucket, metric, object, samples, min,
+				avg, max, rate)
+		SELECT date_trunc('hour', m.bucket), m.metric, m.object,
+				sum(m.samples), min(m.min),
+				sum(m.avg * m.samples) / sum(m.samples), max(m.max),
+				avg(m.rate)
+		FROM ps_rollup_minute m
+		WHERE m.bucket >= start
+		  AND m.bucket < date_trunc('hour', now())
+		GROUP BY 1, 2, 3
+		ON CONFLICT DO NOTHING;
+	END IF;
+
+	-- Drop whole partitions once all of their rows are past the retention.
+	-- A NULL retention keeps everything.
+	FOREACH t IN ARRAY raw_tables || rollup_tables LOOP
+		IF t = 'ps_rollup_minute' THEN
+			retention := minute_retention;
+		ELSIF t = 'ps_rollup_hour' THEN
+			retention := hour_retention;
+		ELSE
+			retention := raw_retention;
+		END IF;
+		CONTINUE WHEN retention IS NULL;
+
+		FOR part IN
+			SELECT c.oid::REGCLASS AS name,
+					CASE WHEN t = ANY (rollup_tables)
+					     THEN to_timestamp(right(c.relname, 6), 'YYYYMM') +
+					          INTERVAL '1 month'
+					     ELSE to_timestamp(right(c.relname, 8), 'YYYYMMDD') +
+					          INTERVAL '1 day'
+					END AS upper
+			FROM pg_catalog.pg_inherits inh
+			     JOIN pg_catalog.pg_class c ON c.oid = inh.inhrelid
+			WHERE inh.inhparent = t::REGCLASS
+			  AND c.relname ~ CASE WHEN t = ANY (rollup_tables)
+			                       THEN '_[0-9]{6}$'
+			                       ELSE '_[0-9]{8}$'
+			                  END
+		LOOP
+			IF part.upper <= now() - retention THEN
+				RAISE DEBUG 'dropping partition %', part.name;
+				EXECUTE format('DROP TABLE %s', part.name);
+			END IF;
+		END LOOP;
+	END LOOP;
+END;
+$$ LANGUAGE plpgsql VOLATILE
+SET TimeZone = 'UTC';
+
+CREATE FUNCTION pg_clock_ticks()
+RETURNS INTEGER
+AS 'MODULE_PATHNAME', 'pg_clock_ticks'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION ps_report_db(snap1 BIGINT, snap2 BIGINT,
+		OUT datid BIGINT,
+		OUT datname NAME,
+		OUT status TEXT,
+		OUT elapsed FLOAT,
+		OUT numbackends INTEGER,
+		OUT xact_commit BIGINT,
+		OUT xact_rollback BIGINT,
+		OUT blks_read BIGINT,
+		OUT blks_hit BIGINT,
+		OUT hit_ratio FLOAT,
+		OUT commits_per_sec FLOAT)
+RETURNS SETOF record AS $$
+#variable_conflict use_column
+BEGIN
+	-- A database that only exists in one of the snapshots is reported with
+	-- a status of added or dropped; added ones count from zero.
+	RETURN QUERY
+	WITH t AS (
+		SELECT extract(epoch FROM s2.time - s1.time)::FLOAT AS elapsed
+		FROM ps_snaps s1, ps_snaps s2
+		WHERE s1.snap = snap1
+		  AND s2.snap = snap2
+	), d AS (
+		SELECT coalesce(b.datid, a.datid) AS datid,
+				coalesce(b.datname, a.datname) AS datname,
+				CASE WHEN a.datid IS NULL THEN 'added'
+				     WHEN b.datid IS NULL THEN 'dropped'
+				END AS status,
+				b.numbackends,
+				b.xact_commit - coalesce(a.xact_commit, 0) AS xact_commit,
+				b.xact_rollback - coalesce(a.xact_rollback, 0) AS xact_rollback,
+				b.blks_read - coalesce(a.blks_read, 0) AS blks_read,
+				b.blks_hit - coalesce(a.blks_hit, 0) AS blks_hit
+		FROM (SELECT * FROM ps_dbstat WHERE snap = snap1) a
+		     FULL JOIN (SELECT * FROM ps_dbstat WHERE snap = snap2) b
+		               ON b.datid = a.datid
+	)
+	SELECT d.datid, d.datname, d.status, t.elapsed, d.numbackends,
+			d.xact_commit, d.xact_rollback, d.blks_read, d.blks_hit,
+			d.blks_hit::FLOAT / nullif(d.blks_read + d.blks_hit, 0),
+			d.xact_commit / nullif(t.elapsed, 0)
+	FROM d, t
+	ORDER BY d.datname;
+END;
+$$ LANGUAGE plpgsql STABLE STRICT;
+
+CREATE FUNCTION ps_report_tables(snap1 BIGINT, snap2 BIGINT,
+		OUT relid BIGINT,
+		OUT schemaname NAME,
+		OUT relname NAME,
+		OUT status TEXT,
+		OUT seq_scan BIGINT,
+		OUT seq_tup_read BIGINT,
+		OUT idx_scan BIGINT,
+		OUT idx_tup_fetch BIGINT,
+		OUT n_tup_ins BIGINT,
+		OUT n_tup_upd BIGINT,
+		OUT n_tup_del BIGINT,
+		OUT last_vacuum TIMESTAMP WITH TIME ZONE,
+		OUT last_autovacuum TIMESTAMP WITH TIME ZONE,
+		OUT last_analyze TIMESTAMP WITH TIME ZONE,
+		OUT last_autoanalyze TIMESTAMP WITH TIME ZONE)
+RETURNS SETOF record AS $$
+#variable_conflict use_column
+BEGIN
+	RETURN QUERY
+	SELECT coalesce(b.relid, a.relid),
+			coalesce(b.schemaname, a.schemaname),
+			coalesce(b.relname, a.relname),
+			CASE WHEN a.relid IS NULL THEN 'added'
+			     WHEN b.relid IS NULL THEN 'dropped'
+			END,
+			b.seq_scan - coalesce(a.seq_scan, 0),
+			b.seq_tup_read - coalesce(a.seq_tup_read, 0),
+			coalesce(b.idx_scan, 0) - coalesce(a.idx_scan, 0),
+			coalesce(b.idx_tup_fetch, 0) - coalesce(a.idx_tup_fetch, 0),
+			b.n_tup_ins - coalesce(a.n_tup_ins, 0),
+			b.n_tup_upd - coalesce(a.n_tup_upd, 0),
+			b.n_tup_del - coalesce(a.n_tup_del, 0),
+			b.last_vacuum, b.last_autovacuum, b.last_analyze,
+			b.last_autoanalyze
+	FROM (SELECT * FROM ps_tablestat WHERE snap = snap1) a
+	     FULL JOIN (SELECT * FROM ps_tablestat WHERE snap = snap2) b
+	               ON b.relid = a.relid
+	ORDER BY 2, 3;
+END;
+$$ LANGUAGE plpgsql STABLE STRICT;
+
+CREATE FUNCTION ps_report_indexes(snap1 BIGINT, snap2 BIGINT,
+		OUT indexrelid BIGINT,
+		OUT schemaname NAME,
+		OUT relname NAME,
+		OUT indexrelname NAME,
+		OUT status TEXT,
+		OUT idx_scan BIGINT,
+		OUT idx_tup_read BIGINT,
+		OUT idx_tup_fetch BIGINT)
+RETURNS SETOF record AS $$
+#variable_conflict use_column
+BEGIN
+	RETURN QUERY
+	SELECT coalesce(b.indexrelid, a.indexrelid),
+			coalesce(b.schemaname, a.schemaname),
+			coalesce(b.relname, a.relname),
+			coalesce(b.indexrelname, a.indexrelname),
+			CASE WHEN a.indexrelid IS NULL THEN 'added'
+			     WHEN b.indexrelid IS NULL THEN 'dropped'
+			END,
+			b.idx_scan - coalesce(a.idx_scan, 0),
+			b.idx_tup_read - coalesce(a.idx_tup_read, 0),
+			b.idx_tup_fetch - coalesce(a.idx_tup_fetch, 0)
+	FROM (SELECT * FROM ps_indexstat WHERE snap = snap1) a
+	     FULL JOIN (SELECT * FROM ps_indexstat WHERE snap = snap2) b
+	               ON b.indexrelid = a.indexrelid
+	ORDER BY 2, 3, 4;
+END;
+$$ LANGUAGE plpgsql STABLE STRICT;
+
+CREATE FUNCTION ps_report_process(snap1 BIGINT, snap2 BIGINT,
+		process INTEGER DEFAULT NULL,
+		OUT pid INTEGER,
+		OUT comm VARCHAR,
+		OUT datname NAME,
+		OUT usename NAME,
+		OUT status TEXT,
+		OUT state CHAR,
+		OUT elapsed FLOAT,
+		OUT utime BIGINT,
+		OUT stime BIGINT,
+		OUT cpu_percent FLOAT,
+		OUT minflt BIGINT,
+		OUT majflt BIGINT,
+		OUT rss BIGINT,
+		OUT rchar BIGINT,
+		OUT wchar BIGINT,
+		OUT syscr BIGINT,
+		OUT syscw BIGINT,
+		OUT reads BIGINT,
+		OUT writes BIGINT,
+		OUT cwrites BIGINT)
+RETURNS SETOF record AS $$
+#variable_conflict use_column
+BEGIN
+	-- Processes are matched on pid and starttime so that a reused pid is
+	-- reported as one process dropped and another added.  Snapshots taken
+	-- with packed storage are unpacked first.
+	RETURN QUERY
+	WITH t AS (
+		SELECT extract(epoch FROM s2.time - s1.time)::FLOAT AS elapsed
+		FROM ps_snaps s1, ps_snaps s2
+		WHERE s1.snap = snap1
+		  AND s2.snap = snap2
+	), p AS (
+		SELECT p.snap, p.pid, p.comm, p.datname, p.usename, p.state,
+				p.starttime, p.utime, p.stime, p.minflt, p.majflt, p.rss,
+				p.rchar, p.wchar, p.syscr, p.syscw, p.reads, p.writes,
+				p.cwrites
+		FROM ps_procstat p
+		WHERE p.snap IN (snap1, snap2)
+		UNION ALL
+		SELECT u.snap, u.pid, u.comm, u.datname, u.usename, u.state,
+				u.starttime, u.utime, u.stime, u.minflt, u.majflt, u.rss,
+				u.rchar, u.wchar, u.syscr, u.syscw, u.reads, u.writes,
+				u.cwrites
+		FROM ps_procstat_unpack(snap1) u
+		UNION ALL
+		SELECT u.snap, u.pid, u.comm, u.datname, u.usename, u.state,
+				u.starttime, u.utime, u.stime, u.minflt, u.majflt, u.rss,
+				u.rchar, u.wchar, u.syscr, u.syscw, u.reads, u.writes,
+				u.cwrites
+		FROM ps_procstat_unpack(snap2) u
+	), d AS (
+		SELECT coalesce(b.pid, a.pid) AS pid,
+				coalesce(b.comm, a.comm) AS comm,
+				coalesce(b.datname, a.datname) AS datname,
+				coalesce(b.usename, a.usename) AS usename,
+				CASE WHEN a.pid IS NULL THEN 'added'
+				     WHEN b.pid IS NULL THEN 'dropped'
+				END AS status,
+				b.state,
+				b.utime - coalesce(a.utime, 0) AS utime,
+				b.stime - coalesce(a.stime, 0) AS stime,
+				b.minflt - coalesce(a.minflt, 0) AS minflt,
+				b.majflt - coalesce(a.majflt, 0) AS majflt,
+				b.rss,
+				b.rchar - coalesce(a.rchar, 0) AS rchar,
+				b.wchar - coalesce(a.wchar, 0) AS wchar,
+				b.syscr - coalesce(a.syscr, 0) AS syscr,
+				b.syscw - coalesce(a.syscw, 0) AS syscw,
+				b.reads - coalesce(a.reads, 0) AS reads,
+				b.writes - coalesce(a.writes, 0) AS writes,
+				b.cwrites - coalesce(a.cwrites, 0) AS cwrites
+		FROM (SELECT * FROM p WHERE p.snap = snap1) a
+		     FULL JOIN (SELECT * FROM p WHERE p.snap = snap2) b
+		               ON b.pid = a.pid
+		              AND b.starttime = a.starttime
+	)
+	SELECT d.pid, d.comm, d.datname, d.usename, d.status, d.state,
+			t.elapsed, d.utime, d.stime,
+			100 * (d.utime + d.stime)::FLOAT /
+					nullif(t.elapsed * pg_clock_ticks(), 0),
+			d.minflt, d.majflt, d.rss, d.rchar, d.wchar, d.syscr, d.syscw,
+			d.reads, d.writes, d.cwrites
+	FROM d, t
+	WHERE process IS NULL
+	   OR d.pid = process
+	ORDER BY d.pid, d.status NULLS FIRST;
+END;
+$$ LANGUAGE plpgsql STABLE;
+
+CREATE FUNCTION ps_report_system(snap1 BIGINT, snap2 BIGINT,
+		OUT elapsed FLOAT,
+		OUT cpu_user FLOAT,
+		OUT cpu_nice FLOAT,
+		OUT cpu_system FLOAT,
+		OUT cpu_idle FLOAT,
+		OUT cpu_iowait FLOAT,
+		OUT load1 FLOAT,
+		OUT load5 FLOAT,
+		OUT load15 FLOAT,
+		OUT memused BIGINT,
+		OUT memfree BIGINT,
+		OUT memcached BIGINT,
+		OUT swapused BIGINT,
+		OUT processes BIGINT)
+RETURNS SETOF record AS $$
+#variable_conflict use_column
+BEGIN
+	-- Processor time is the share of all ticks spent in each state between
+	-- the snapshots; the gauges are as of the second snapshot.
+	RETURN QUERY
+	WITH c AS (
+		SELECT b.cpu_user - a.cpu_user AS cpu_user,
+				b.cpu_nice - a.cpu_nice AS cpu_nice,
+				b.cpu_system - a.cpu_system AS cpu_system,
+				b.cpu_idle - a.cpu_idle AS cpu_idle,
+				b.cpu_iowait - a.cpu_iowait AS cpu_iowait
+		FROM ps_cpustat a, ps_cpustat b
+		WHERE a.snap = snap1
+		  AND b.snap = snap2
+	), ct AS (
+		SELECT c.*,
+				nullif(c.cpu_user + c.cpu_nice + c.cpu_system + c.cpu_idle +
+						c.cpu_iowait, 0)::FLOAT / 100 AS total
+		FROM c
+	)
+	SELECT extract(epoch FROM s2.time - s1.time)::FLOAT,
+			ct.cpu_user / ct.total, ct.cpu_nice / ct.total,
+			ct.cpu_system / ct.total, ct.cpu_idle / ct.total,
+			ct.cpu_iowait / ct.total,
+			l.load1, l.load5, l.load15,
+			m.memused, m.memfree, m.memcached, m.swapused,
+			(SELECT count(*)
+			 FROM ps_report_process(snap1, snap2) p
+			 WHERE p.status IS DISTINCT FROM 'dropped')
+	FROM ps_snaps s1
+	     JOIN ps_snaps s2 ON s2.snap = snap2
+	     LEFT JOIN ct ON true
+	     LEFT JOIN ps_loadstat l ON l.snap = snap2
+	     LEFT JOIN ps_memstat m ON m.snap = snap2
+	WHERE s1.snap = snap1;
+END;
+$$ LANGUAGE plpgsql STABLE STRICT;
+
+CREATE FUNCTION ps_report_disks(snap1 BIGINT, snap2 BIGINT,
+		OUT devname TEXT,
+		OUT status TEXT,
+		OUT elapsed FLOAT,
+		OUT reads_completed BIGINT,
+		OUT writes_completed BIGINT,
+		OUT bytes_read BIGINT,
+		OUT bytes_written BIGINT,
+		OUT read_bytes_per_sec FLOAT,
+		OUT write_bytes_per_sec FLOAT,
+		OUT utilization FLOAT)
+RETURNS SETOF record AS $$
+#variable_conflict use_column
+BEGIN
+	-- Sectors are always 512 bytes in /proc/diskstats and iotime is the
+	-- number of milliseconds the device was busy.
+	RETURN QUERY
+	WITH t AS (
+		SELECT extract(epoch FROM s2.time - s1.time)::FLOAT AS elapsed
+		FROM ps_snaps s1, ps_snaps s2
+		WHERE s1.snap = snap1
+		  AND s2.snap = snap2
+	), d AS (
+		SELECT coalesce(b.devname, a.devname) AS devname,
+				CASE WHEN a.devname IS NULL THEN 'added'
+				     WHEN b.devname IS NULL THEN 'dropped'
+				END AS status,
+				b.reads_completed - coalesce(a.reads_completed, 0)
+						AS reads_completed,
+				b.writes_completed - coalesce(a.writes_completed, 0)
+						AS writes_completed,
+				512 * (b.sectors_read - coalesce(a.sectors_read, 0))
+						AS bytes_read,
+				512 * (b.sectors_written - coalesce(a.sectors_written, 0))
+						AS bytes_written,
+				b.iotime - coalesce(a.iotime, 0) AS iotime
+		FROM (SELECT * FROM ps_diskstat WHERE snap = snap1) a
+		     FULL JOIN (SELECT * FROM ps_diskstat WHERE snap = snap2) b
+		               ON b.major = a.major
+		              AND b.minor = a.minor
+	)
+	SELECT d.devname, d.status, t.elapsed, d.reads_completed,
+			d.writes_completed, d.bytes_read, d.bytes_written,
+			d.bytes_read / nullif(t.elapsed, 0),
+			d.bytes_written / nullif(t.elapsed, 0),
+			100 * d.iotime::FLOAT / nullif(1000 * t.elapsed, 0)
+	FROM d, t
+	ORDER BY d.devname;
+END;
+$$ LANGUAGE plpgsql STABLE STRICT;
+
+CREATE FUNCTION pg_proctab_bench(fn REGPROCEDURE, loops INTEGER DEFAULT 10,
+		OUT rows BIGINT,
+		OUT seconds FLOAT,
+		OUT rows_per_sec FLOAT,
+		OUT bytes_per_row FLOAT)
+RETURNS record
+AS 'MODULE_PATHNAME', 'pg_proctab_bench'
+LANGUAGE C VOLATILE STRICT;
+
+-- The OUT parameters of pg_proctab() gained sample_age.
+DROP FUNCTION pg_proctab();
+CREATE FUNCTION pg_proctab(
+		OUT pid INTEGER,
+		OUT comm VARCHAR,
+		OUT fullcomm VARCHAR,
+		OUT state CHAR,
+		OUT ppid INTEGER,
+		OUT pgrp INTEGER,
+		OUT session INTEGER,
+		OUT tty_nr INTEGER,
+		OUT tpgid INTEGER,
+		OUT flags INTEGER,
+		OUT minflt BIGINT,
+		OUT cminflt BIGINT,
+		OUT majflt BIGINT,
+		OUT cmajflt BIGINT,
+		OUT utime BIGINT,
+		OUT stime BIGINT,
+		OUT cutime BIGINT,
+		OUT cstime BIGINT,
+		OUT priority BIGINT,
+		OUT nice BIGINT,
+		OUT num_threads BIGINT,
+		OUT itrealvalue BIGINT,
+		OUT starttime BIGINT,
+		OUT vsize BIGINT,
+		OUT rss BIGINT,
+		OUT exit_signal INTEGER,
+		OUT processor INTEGER,
+		OUT rt_priority BIGINT,
+		OUT policy BIGINT,
+		OUT delayacct_blkio_ticks BIGINT,
+		OUT uid INTEGER,
+		OUT username VARCHAR,
+		OUT rchar BIGINT,
+		OUT wchar BIGINT,
+		OUT syscr BIGINT,
+		OUT syscw BIGINT,
+		OUT reads BIGINT,
+		OUT writes BIGINT,
+		OUT cwrites BIGINT,
+		OUT sample_age INTERVAL)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION pg_proctab(pids INTEGER[], columns TEXT[] DEFAULT NULL,
+		OUT pid INTEGER,
+		OUT comm VARCHAR,
+		OUT fullcomm VARCHAR,
+		OUT state CHAR,
+		OUT ppid INTEGER,
+		OUT pgrp INTEGER,
+		OUT session INTEGER,
+		OUT tty_nr INTEGER,
+		OUT tpgid INTEGER,
+		OUT flags INTEGER,
+		OUT minflt BIGINT,
+		OUT cminflt BIGINT,
+		OUT majflt BIGINT,
+		OUT cmajflt BIGINT,
+		OUT utime BIGINT,
+		OUT stime BIGINT,
+		OUT cutime BIGINT,
+		OUT cstime BIGINT,
+		OUT priority BIGINT,
+		OUT nice BIGINT,
+		OUT num_threads BIGINT,
+		OUT itrealvalue BIGINT,
+		OUT starttime BIGINT,
+		OUT vsize BIGINT,
+		OUT rss BIGINT,
+		OUT exit_signal INTEGER,
+		OUT processor INTEGER,
+		OUT rt_priority BIGINT,
+		OUT policy BIGINT,
+		OUT delayacct_blkio_ticks BIGINT,
+		OUT uid INTEGER,
+		OUT username VARCHAR,
+		OUT rchar BIGINT,
+		OUT wchar BIGINT,
+		OUT syscr BIGINT,
+		OUT syscw BIGINT,
+		OUT reads BIGINT,
+		OUT writes BIGINT,
+		OUT cwrites BIGINT,
+		OUT sample_age INTERVAL)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_proctab(backend_types TEXT[],
+		datnames NAME[] DEFAULT NULL,
+		usenames NAME[] DEFAULT NULL,
+		only_active BOOLEAN DEFAULT false,
+		columns TEXT[] DEFAULT NULL,
+		OUT pid INTEGER,
+		OUT comm VARCHAR,
+		OUT fullcomm VARCHAR,
+		OUT state CHAR,
+		OUT ppid INTEGER,
+		OUT pgrp INTEGER,
+		OUT session INTEGER,
+		OUT tty_nr INTEGER,
+		OUT tpgid INTEGER,
+		OUT flags INTEGER,
+		OUT minflt BIGINT,
+		OUT cminflt BIGINT,
+		OUT majflt BIGINT,
+		OUT cmajflt BIGINT,
+		OUT utime BIGINT,
+		OUT stime BIGINT,
+		OUT cutime BIGINT,
+		OUT cstime BIGINT,
+		OUT priority BIGINT,
+		OUT nice BIGINT,
+		OUT num_threads BIGINT,
+		OUT itrealvalue BIGINT,
+		OUT starttime BIGINT,
+		OUT vsize BIGINT,
+		OUT rss BIGINT,
+		OUT exit_signal INTEGER,
+		OUT processor INTEGER,
+		OUT rt_priority BIGINT,
+		OUT policy BIGINT,
+		OUT delayacct_blkio_ticks BIGINT,
+		OUT uid INTEGER,
+		OUT username VARCHAR,
+		OUT rchar BIGINT,
+		OUT wchar BIGINT,
+		OUT syscr BIGINT,
+		OUT syscw BIGINT,
+		OUT reads BIGINT,
+		OUT writes BIGINT,
+		OUT cwrites BIGINT,
+		OUT sample_age INTERVAL)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_proctab_metrics()
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'pg_proctab_metrics'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_proctab_flight_recorder(
+		"from" TIMESTAMPTZ DEFAULT NULL,
+		"to" TIMESTAMPTZ DEFAULT NULL,
+		OUT sampled TIMESTAMPTZ,
+		OUT kind TEXT,
+		OUT pid INTEGER,
+		OUT name TEXT,
+		OUT metric TEXT,
+		OUT value BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab_flight_recorder'
+LANGUAGE C VOLATILE;
+
+REVOKE ALL ON FUNCTION pg_proctab_flight_recorder(TIMESTAMPTZ, TIMESTAMPTZ)
+		FROM PUBLIC;
+
+CREATE FUNCTION pg_proctab_stalls(
+		running_longer_than INTERVAL DEFAULT '5 seconds',
+		OUT state CHAR,
+		OUT wchan TEXT,
+		OUT stack TEXT,
+		OUT backends INTEGER,
+		OUT pids INTEGER[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab_stalls'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION pg_proctab_sockets(
+		OUT pid INTEGER,
+		OUT fd INTEGER,
+		OUT protocol TEXT,
+		OUT state TEXT,
+		OUT local_address TEXT,
+		OUT remote_address TEXT,
+		OUT tx_queue BIGINT,
+		OUT rx_queue BIGINT,
+		OUT retransmits BIGINT,
+		OUT inode BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab_sockets'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_netdev(
+		OUT interface TEXT,
+		OUT rx_bytes BIGINT,
+		OUT rx_packets BIGINT,
+		OUT rx_errors BIGINT,
+		OUT rx_dropped BIGINT,
+		OUT rx_fifo BIGINT,
+		OUT rx_frame BIGINT,
+		OUT rx_compressed BIGINT,
+		OUT rx_multicast BIGINT,
+		OUT tx_bytes BIGINT,
+		OUT tx_packets BIGINT,
+		OUT tx_errors BIGINT,
+		OUT tx_dropped BIGINT,
+		OUT tx_fifo BIGINT,
+		OUT tx_collisions BIGINT,
+		OUT tx_carrier BIGINT,
+		OUT tx_compressed BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_netdev'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_netdev_delta(
+		OUT interface TEXT,
+		OUT elapsed FLOAT,
+		OUT rx_bytes BIGINT,
+		OUT rx_packets BIGINT,
+		OUT rx_errors BIGINT,
+		OUT rx_dropped BIGINT,
+		OUT rx_fifo BIGINT,
+		OUT rx_frame BIGINT,
+		OUT rx_compressed BIGINT,
+		OUT rx_multicast BIGINT,
+		OUT tx_bytes BIGINT,
+		OUT tx_packets BIGINT,
+		OUT tx_errors BIGINT,
+		OUT tx_dropped BIGINT,
+		OUT tx_fifo BIGINT,
+		OUT tx_collisions BIGINT,
+		OUT tx_carrier BIGINT,
+		OUT tx_compressed BIGINT,
+		OUT rx_bytes_per_sec FLOAT,
+		OUT tx_bytes_per_sec FLOAT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_netdev_delta'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_fsusage(
+		OUT name TEXT,
+		OUT path TEXT,
+		OUT mount_point TEXT,
+		OUT fs_type TEXT,
+		OUT device TEXT,
+		OUT bytes_total BIGINT,
+		OUT bytes_free BIGINT,
+		OUT bytes_reserved BIGINT,
+		OUT bytes_available BIGINT,
+		OUT inodes_total BIGINT,
+		OUT inodes_free BIGINT,
+		OUT inodes_reserved BIGINT,
+		OUT inodes_available BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_fsusage'
+LANGUAGE C VOLATILE;
+
+REVOKE ALL ON FUNCTION pg_fsusage() FROM PUBLIC;
+
+CREATE FUNCTION ps_fsusage_forecast(
+		history INTERVAL DEFAULT '1 day',
+		OUT name TEXT,
+		OUT path TEXT,
+		OUT mount_point TEXT,
+		OUT bytes_available BIGINT,
+		OUT bytes_per_sec FLOAT,
+		OUT time_to_full INTERVAL,
+		OUT full_at TIMESTAMP WITH TIME ZONE,
+		OUT inodes_available BIGINT,
+		OUT inodes_per_sec FLOAT,
+		OUT time_to_inodes_full INTERVAL)
+RETURNS SETOF record AS $$
+#variable_conflict use_column
+BEGIN
+	-- The rate is the slope of the least squares line through the available
+	-- space of the snapshots in the history, and the forecast extends it from
+	-- the latest snapshot.  A file system that is not filling up, or would
+	-- take more than a century to, has no forecast.
+	RETURN QUERY
+	WITH h AS (
+		SELECT f.name, f.path, f.mount_point, f.time, f.bytes_available,
+				f.inodes_total, f.inodes_available,
+				row_number() OVER (PARTITION BY f.name
+				                   ORDER BY f.time DESC) AS latest
+		FROM ps_fsstat f
+		WHERE f.time >= now() - history
+	), r AS (
+		SELECT h.name,
+				-regr_slope(h.bytes_available::FLOAT,
+						extract(epoch FROM h.time)::FLOAT) AS bytes_per_sec,
+				-regr_slope(h.inodes_available::FLOAT,
+						extract(epoch FROM h.time)::FLOAT) AS inodes_per_sec
+		FROM h
+		GROUP BY h.name
+	), f AS (
+		SELECT h.name, h.path, h.mount_point, h.time, h.bytes_available,
+				r.bytes_per_sec,
+				CASE WHEN r.bytes_per_sec > 0
+				      AND h.bytes_available / r.bytes_per_sec < 3.15e9
+				     THEN h.bytes_available / r.bytes_per_sec
+				END AS bytes_seconds,
+				h.inodes_available,
+				CASE WHEN h.inodes_total > 0 THEN r.inodes_per_sec
+				END AS inodes_per_sec,
+				CASE WHEN h.inodes_total > 0
+				      AND r.inodes_per_sec > 0
+				      AND h.inodes_available / r.inodes_per_sec < 3.15e9
+				     THEN h.inodes_available / r.inodes_per_sec
+				END AS inodes_seconds
+		FROM h
+		     JOIN r ON r.name = h.name
+		WHERE h.latest = 1
+	)
+	SELECT f.name, f.path, f.mount_point, f.bytes_available, f.bytes_per_sec,
+			f.time + make_interval(secs => f.bytes_seconds) - now(),
+			f.time + make_interval(secs => f.bytes_seconds),
+			f.inodes_available, f.inodes_per_sec,
+			f.time + make_interval(secs => f.inodes_seconds) - now()
+	FROM f
+	ORDER BY 6 NULLS LAST, 1;
+END;
+$$ LANGUAGE plpgsql STABLE STRICT;
+
+CREATE FUNCTION pg_interrupts(
+		OUT irq TEXT,
+		OUT cpu INTEGER,
+		OUT count BIGINT,
+		OUT description TEXT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_interrupts'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_interrupts_delta(
+		OUT irq TEXT,
+		OUT cpu INTEGER,
+		OUT elapsed FLOAT,
+		OUT count BIGINT,
+		OUT per_sec FLOAT,
+		OUT description TEXT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_interrupts_delta'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_softirqs(
+		OUT softirq TEXT,
+		OUT cpu INTEGER,
+		OUT count BIGINT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_softirqs'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_softirqs_delta(
+		OUT softirq TEXT,
+		OUT cpu INTEGER,
+		OUT elapsed FLOAT,
+		OUT count BIGINT,
+		OUT per_sec FLOAT)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_softirqs_delta'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_proctab_accounting(
+		OUT backend_type TEXT,
+		OUT datid OID,
+		OUT usesysid OID,
+		OUT exits BIGINT,
+		OUT utime BIGINT,
+		OUT stime BIGINT,
+		OUT minflt BIGINT,
+		OUT majflt BIGINT,
+		OUT delayacct_blkio_ticks BIGINT,
+		OUT rchar BIGINT,
+		OUT wchar BIGINT,
+		OUT syscr BIGINT,
+		OUT syscw BIGINT,
+		OUT reads BIGINT,
+		OUT writes BIGINT,
+		OUT cwrites BIGINT,
+		OUT first_exit TIMESTAMP WITH TIME ZONE,
+		OUT last_exit TIMESTAMP WITH TIME ZONE,
+		OUT stats_reset TIMESTAMP WITH TIME ZONE)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab_accounting'
+LANGUAGE C VOLATILE;
+
+CREATE VIEW pg_proctab_accounting AS
+SELECT a.backend_type, a.datid, d.datname, a.usesysid, r.rolname AS usename,
+		a.exits, a.utime, a.stime, a.minflt, a.majflt,
+		a.delayacct_blkio_ticks, a.rchar, a.wchar, a.syscr, a.syscw, a.reads,
+		a.writes, a.cwrites, a.first_exit, a.last_exit, a.stats_reset
+FROM pg_proctab_accounting() a
+     LEFT JOIN pg_database d ON d.oid = a.datid
+     LEFT JOIN pg_roles r ON r.oid = a.usesysid;
+
+GRANT SELECT ON pg_proctab_accounting TO PUBLIC;
+
+CREATE FUNCTION pg_proctab_accounting_reset()
+RETURNS VOID
+AS 'MODULE_PATHNAME', 'pg_proctab_accounting_reset'
+LANGUAGE C VOLATILE;
+
+REVOKE ALL ON FUNCTION pg_proctab_accounting_reset() FROM PUBLIC;
+
+CREATE TYPE proctab_snapshot;
+
+CREATE FUNCTION proctab_snapshot_in(CSTRING)
+RETURNS proctab_snapshot
+AS 'MODULE_PATHNAME', 'proctab_snapshot_in'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION proctab_snapshot_out(proctab_snapshot)
+RETURNS CSTRING
+AS 'MODULE_PATHNAME', 'proctab_snapshot_out'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION proctab_snapshot_recv(INTERNAL)
+RETURNS proctab_snapshot
+AS 'MODULE_PATHNAME', 'proctab_snapshot_recv'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION proctab_snapshot_send(proctab_snapshot)
+RETURNS BYTEA
+AS 'MODULE_PATHNAME', 'proctab_snapshot_send'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE proctab_snapshot (
+	INPUT = proctab_snapshot_in,
+	OUTPUT = proctab_snapshot_out,
+	RECEIVE = proctab_snapshot_recv,
+	SEND = proctab_snapshot_send,
+	INTERNALLENGTH = VARIABLE,
+	ALIGNMENT = double,
+	STORAGE = extended
+);
+
+CREATE FUNCTION pg_proctab_snapshot()
+RETURNS proctab_snapshot
+AS 'MODULE_PATHNAME', 'pg_proctab_snapshot'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_proctab_snapshot_unpack(snapshot proctab_snapshot,
+		OUT pid INTEGER,
+		OUT comm VARCHAR,
+		OUT fullcomm VARCHAR,
+		OUT state CHAR,
+		OUT ppid INTEGER,
+		OUT pgrp INTEGER,
+		OUT session INTEGER,
+		OUT tty_nr INTEGER,
+		OUT tpgid INTEGER,
+		OUT flags INTEGER,
+		OUT minflt BIGINT,
+		OUT cminflt BIGINT,
+		OUT majflt BIGINT,
+		OUT cmajflt BIGINT,
+		OUT utime BIGINT,
+		OUT stime BIGINT,
+		OUT cutime BIGINT,
+		OUT cstime BIGINT,
+		OUT priority BIGINT,
+		OUT nice BIGINT,
+		OUT num_threads BIGINT,
+		OUT itrealvalue BIGINT,
+		OUT starttime BIGINT,
+		OUT vsize BIGINT,
+		OUT rss BIGINT,
+		OUT exit_signal INTEGER,
+		OUT processor INTEGER,
+		OUT rt_priority BIGINT,
+		OUT policy BIGINT,
+		OUT delayacct_blkio_ticks BIGINT,
+		OUT uid INTEGER,
+		OUT username VARCHAR,
+		OUT rchar BIGINT,
+		OUT wchar BIGINT,
+		OUT syscr BIGINT,
+		OUT syscw BIGINT,
+		OUT reads BIGINT,
+		OUT writes BIGINT,
+		OUT cwrites BIGINT,
+		OUT sampled TIMESTAMP WITH TIME ZONE,
+		OUT clock_ticks INTEGER)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab_snapshot_unpack'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION pg_proctab_quantiles(
+		metric_name TEXT,
+		percentiles FLOAT8[] DEFAULT '{50,90,99,99.9}',
+		OUT metric TEXT,
+		OUT object TEXT,
+		OUT samples BIGINT,
+		OUT mean FLOAT8,
+		OUT min FLOAT8,
+		OUT max FLOAT8,
+		OUT percentile FLOAT8,
+		OUT value FLOAT8,
+		OUT stats_reset TIMESTAMP WITH TIME ZONE)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_proctab_quantiles'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_proctab_quantiles_reset(metric_name TEXT DEFAULT NULL)
+RETURNS VOID
+AS 'MODULE_PATHNAME', 'pg_proctab_quantiles_reset'
+LANGUAGE C VOLATILE;
+
+REVOKE ALL ON FUNCTION pg_proctab_quantiles_reset(TEXT) FROM PUBLIC;
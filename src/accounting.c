@@ -0,0 +1,466 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/xact.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pg_proctab.h"
+
+/* What an exiting process is charged, in the order of the columns. */
+enum accounting_counter {a_utime, a_stime, a_minflt, a_majflt,
+		a_delayacct_blkio_ticks, a_rchar, a_wchar, a_syscr, a_syscw, a_reads,
+		a_writes, a_cwrites};
+
+#define ACCOUNTING_NCOUNTERS 12
+
+enum accounting {i_a_backend_type, i_a_datid, i_a_usesysid, i_a_exits,
+		i_a_counters, i_a_first_exit = i_a_counters + ACCOUNTING_NCOUNTERS,
+		i_a_last_exit, i_a_stats_reset};
+
+#define ACCOUNTING_NCOLS (i_a_stats_reset + 1)
+
+typedef struct
+{
+	char backend_type[NAMEDATALEN];
+	Oid datid;
+	Oid usesysid;
+} accounting_key;
+
+/* The totals of the processes of a backend_type, database and role. */
+typedef struct
+{
+	accounting_key key;		/* hash key */
+	int64 exits;
+	int64 counters[ACCOUNTING_NCOUNTERS];
+	TimestampTz first_exit;
+	TimestampTz last_exit;
+} accounting_entry;
+
+typedef struct
+{
+	LWLock *lock;
+	TimestampTz stats_reset;
+} accounting_shared;
+
+int accounting_max = 1000;
+
+static accounting_shared *accounting = NULL;
+static HTAB *accounting_hash = NULL;
+static bool accounting_registered = false;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+Datum pg_proctab_accounting(PG_FUNCTION_ARGS);
+Datum pg_proctab_accounting_reset(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_proctab_accounting);
+PG_FUNCTION_INFO_V1(pg_proctab_accounting_reset);
+
+static Size accounting_shmem_size(void);
+static void accounting_shmem_request(void);
+static void accounting_shmem_startup(void);
+static void accounting_xact_callback(XactEvent, void *);
+static void accounting_exit(int, Datum);
+static accounting_entry *accounting_enter(accounting_key *);
+#ifdef __linux__
+static bool accounting_read(const char *, char *, Size);
+static bool accounting_read_self(int64 *);
+#endif /* __linux__ */
+
+void
+accounting_init(void)
+{
+	DefineCustomIntVariable("pg_proctab.accounting_max",
+			"Most backend types, databases and roles whose exited "
+			"processes are accounted for separately.",
+			"The processes of any more are added to a row with a NULL "
+			"backend_type, datid and usesysid.",
+			&accounting_max,
+			1000,
+			100,
+			INT_MAX / 2,
+			PGC_POSTMASTER,
+			0,
+			NULL,
+			NULL,
+			NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = accounting_shmem_request;
+#else
+	accounting_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = accounting_shmem_startup;
+
+	/*
+	 * The exit callbacks of the postmaster are not inherited by the processes
+	 * it starts, but its transaction callbacks are, so every process that
+	 * runs a transaction, autovacuum workers included, registers its own.
+	 */
+	RegisterXactCallback(accounting_xact_callback, NULL);
+}
+
+static Size
+accounting_shmem_size(void)
+{
+	return add_size(MAXALIGN(sizeof(accounting_shared)),
+			hash_estimate_size(accounting_max, sizeof(accounting_entry)));
+}
+
+static void
+accounting_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(accounting_shmem_size());
+	RequestNamedLWLockTranche("pg_proctab accounting", 1);
+}
+
+static void
+accounting_shmem_startup(void)
+{
+	HASHCTL ctl;
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	accounting = ShmemInitStruct("pg_proctab accounting",
+			sizeof(accounting_shared), &found);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(accounting_key);
+	ctl.entrysize = sizeof(accounting_entry);
+	accounting_hash = ShmemInitHash("pg_proctab accounting hash",
+			accounting_max, accounting_max, &ctl, HASH_ELEM | HASH_BLOBS);
+
+	if (!found)
+	{
+		accounting->lock =
+				&(GetNamedLWLockTranche("pg_proctab accounting"))->lock;
+		accounting->stats_reset = GetCurrentTimestamp();
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/* Register the exit callback of this process on its first transaction. */
+static void
+accounting_xact_callback(XactEvent event, void *arg)
+{
+	if (accounting_registered || accounting == NULL || MyProc == NULL)
+		return;
+
+	before_shmem_exit(accounting_exit, (Datum) 0);
+	accounting_registered = true;
+}
+
+/*
+ * Return the entry of a key, or the one the keys that do not fit are charged
+ * to, for which a slot is always left.  The caller holds the lock
+ * exclusively.
+ */
+static accounting_entry *
+accounting_enter(accounting_key *key)
+{
+	accounting_entry *entry;
+	bool found;
+
+	entry = (accounting_entry *) hash_search(accounting_hash, key, HASH_FIND,
+			NULL);
+	if (entry != NULL)
+		return entry;
+
+	if (hash_get_num_entries(accounting_hash) >= accounting_max - 1)
+		memset(key, 0, sizeof(accounting_key));
+	entry = (accounting_entry *) hash_search(accounting_hash, key,
+			HASH_ENTER_NULL, &found);
+	if (entry != NULL && !found)
+	{
+		entry->exits = 0;
+		memset(entry->counters, 0, sizeof(entry->counters));
+		entry->first_exit = 0;
+		entry->last_exit = 0;
+	}
+
+	return entry;
+}
+
+#ifdef __linux__
+/*
+ * Read a small file without raising errors, since this runs while the process
+ * exits.
+ */
+static bool
+accounting_read(const char *path, char *buffer, Size size)
+{
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return false;
+	len = read(fd, buffer, size - 1);
+	close(fd);
+	if (len <= 0)
+		return false;
+	buffer[len] = '\0';
+
+	return true;
+}
+
+/*
+ * Read the counters of this process from its own files, those of the kernel
+ * it runs on whatever pg_proctab.procfs_root is.  The i/o counters are left
+ * at zero when /proc/self/io cannot be read.
+ */
+static bool
+accounting_read_self(int64 *counters)
+{
+	char buffer[PROCTAB_STAT_LEN];
+	char *p;
+	int field;
+
+	memset(counters, 0, sizeof(int64) * ACCOUNTING_NCOUNTERS);
+
+	/* The fields after the comm, which may have spaces, start at 3. */
+	if (!accounting_read("/proc/self/stat", buffer, sizeof(buffer)) ||
+			(p = strrchr(buffer, ')')) == NULL)
+		return false;
+	for (field = 3, p++; field <= 42 && *p != '\0'; field++)
+	{
+		int64 value;
+
+		while (*p == ' ')
+			p++;
+		value = strtoll(p, &p, 10);
+		if (field == 10)
+			counters[a_minflt] = value;
+		else if (field == 12)
+			counters[a_majflt] = value;
+		else if (field == 14)
+			counters[a_utime] = value;
+		else if (field == 15)
+			counters[a_stime] = value;
+		else if (field == 42)
+			counters[a_delayacct_blkio_ticks] = value;
+		while (*p != ' ' && *p != '\0')
+			p++;
+	}
+
+	if (accounting_read("/proc/self/io", buffer, sizeof(buffer)))
+	{
+		static const struct
+		{
+			const char *name;
+			int counter;
+		} io_fields[] = {
+			{"rchar:", a_rchar}, {"wchar:", a_wchar}, {"syscr:", a_syscr},
+			{"syscw:", a_syscw}, {"read_bytes:", a_reads},
+			{"write_bytes:", a_writes}, {"cancelled_write_bytes:", a_cwrites}
+		};
+		char *line = buffer;
+		int i;
+
+		while (line != NULL && *line != '\0')
+		{
+			for (i = 0; i < lengthof(io_fields); i++)
+				if (strncmp(line, io_fields[i].name,
+						strlen(io_fields[i].name)) == 0)
+					counters[io_fields[i].counter] =
+							strtoll(line + strlen(io_fields[i].name), NULL,
+									10);
+			if ((line = strchr(line, '\n')) != NULL)
+				line++;
+		}
+	}
+
+	return true;
+}
+#endif /* __linux__ */
+
+/*
+ * Add what this process used over its life to the totals of its backend_type,
+ * database and role, as pg_stat_activity shows them.
+ */
+static void
+accounting_exit(int code, Datum arg)
+{
+#ifdef __linux__
+	int64 counters[ACCOUNTING_NCOUNTERS];
+	accounting_key key;
+	accounting_entry *entry;
+	const char *backend_type;
+	TimestampTz now;
+	int i;
+
+	if (accounting == NULL || !accounting_read_self(counters))
+		return;
+
+	if (MyBackendType == B_BG_WORKER && MyBgworkerEntry != NULL)
+		backend_type = MyBgworkerEntry->bgw_type;
+	else
+		backend_type = GetBackendTypeDesc(MyBackendType);
+
+	memset(&key, 0, sizeof(key));
+	strlcpy(key.backend_type, backend_type, sizeof(key.backend_type));
+	key.datid = MyDatabaseId;
+	key.usesysid = MyProc->roleId;
+
+	now = GetCurrentTimestamp();
+
+	LWLockAcquire(accounting->lock, LW_EXCLUSIVE);
+	if ((entry = accounting_enter(&key)) != NULL)
+	{
+		entry->exits++;
+		for (i = 0; i < ACCOUNTING_NCOUNTERS; i++)
+			entry->counters[i] += counters[i];
+		if (entry->first_exit == 0)
+			entry->first_exit = now;
+		entry->last_exit = now;
+	}
+	LWLockRelease(accounting->lock);
+#endif /* __linux__ */
+}
+
+/*
+ * The totals of the processes that exited since the server started, or since
+ * pg_proctab_accounting_reset(), per backend_type, database and role.  There
+ * are none unless pg_proctab is in shared_preload_libraries.
+ */
+Datum pg_proctab_accounting(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+	HASH_SEQ_STATUS status;
+	accounting_entry *entries;
+	accounting_entry *entry;
+	TimestampTz stats_reset;
+	int nentries = 0;
+	int i;
+	int j;
+
+	elog(DEBUG5, "pg_proctab_accounting: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (accounting == NULL)
+		return (Datum) 0;
+
+	/* Copy the entries so the lock is not held while the rows are built. */
+	entries = (accounting_entry *) palloc(sizeof(accounting_entry) *
+			accounting_max);
+	LWLockAcquire(accounting->lock, LW_SHARED);
+	stats_reset = accounting->stats_reset;
+	hash_seq_init(&status, accounting_hash);
+	while ((entry = (accounting_entry *) hash_seq_search(&status)) != NULL)
+	{
+		if (nentries == accounting_max)
+		{
+			hash_seq_term(&status);
+			break;
+		}
+		entries[nentries++] = *entry;
+	}
+	LWLockRelease(accounting->lock);
+
+	for (i = 0; i < nentries; i++)
+	{
+		Datum values[ACCOUNTING_NCOLS];
+		bool nulls[ACCOUNTING_NCOLS];
+
+		entry = &entries[i];
+		memset(nulls, false, sizeof(nulls));
+		values[i_a_backend_type] =
+				CStringGetTextDatum(entry->key.backend_type);
+		nulls[i_a_backend_type] = entry->key.backend_type[0] == '\0';
+		values[i_a_datid] = ObjectIdGetDatum(entry->key.datid);
+		nulls[i_a_datid] = !OidIsValid(entry->key.datid);
+		values[i_a_usesysid] = ObjectIdGetDatum(entry->key.usesysid);
+		nulls[i_a_usesysid] = !OidIsValid(entry->key.usesysid);
+		values[i_a_exits] = Int64GetDatum(entry->exits);
+		for (j = 0; j < ACCOUNTING_NCOUNTERS; j++)
+			values[i_a_counters + j] = Int64GetDatum(entry->counters[j]);
+		values[i_a_first_exit] = TimestampTzGetDatum(entry->first_exit);
+		values[i_a_last_exit] = TimestampTzGetDatum(entry->last_exit);
+		values[i_a_stats_reset] = TimestampTzGetDatum(stats_reset);
+
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/* Forget the totals, which start again from now. */
+Datum pg_proctab_accounting_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS status;
+	accounting_entry *entry;
+
+	elog(DEBUG5, "pg_proctab_accounting_reset: Entering stored function.");
+
+	if (accounting == NULL)
+		PG_RETURN_VOID();
+
+	LWLockAcquire(accounting->lock, LW_EXCLUSIVE);
+	hash_seq_init(&status, accounting_hash);
+	while ((entry = (accounting_entry *) hash_seq_search(&status)) != NULL)
+		hash_search(accounting_hash, &entry->key, HASH_REMOVE, NULL);
+	accounting->stats_reset = GetCurrentTimestamp();
+	LWLockRelease(accounting->lock);
+
+	PG_RETURN_VOID();
+}
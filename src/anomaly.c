@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <math.h>
+#include <string.h>
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+#include <limits.h>
+#include <unistd.h>
+#include "pg_proctab.h"
+
+#define CHECK_ANOMALY \
+		"SELECT to_regprocedure('pg_proctab()') IS NOT NULL, " \
+		"to_regclass('ps_anomalies') IS NOT NULL"
+
+/*
+ * The host series, as a numerator and a denominator that are counters, the
+ * series being the ratio of their increases, or as a gauge with a NULL
+ * denominator.
+ */
+#define ANOMALY_HOST \
+		"SELECT v.metric, v.object, v.num, v.den " \
+		"FROM pg_cputime() c, " \
+		"     LATERAL (VALUES " \
+		"         ('cpu_busy', '', " \
+		"          100 * (c.\"user\" + c.nice + c.system)::float8, " \
+		"          (c.\"user\" + c.nice + c.system + c.idle + " \
+		"           c.iowait)::float8), " \
+		"         ('cpu_iowait', '', 100 * c.iowait::float8, " \
+		"          (c.\"user\" + c.nice + c.system + c.idle + " \
+		"           c.iowait)::float8)) v(metric, object, num, den) " \
+		"UNION ALL " \
+		"SELECT 'load1', '', l.load1::float8, NULL " \
+		"FROM pg_loadavg() l " \
+		"UNION ALL " \
+		"SELECT 'memfree', '', m.memfree::float8, NULL " \
+		"FROM pg_memusage() m " \
+		"UNION ALL " \
+		"SELECT 'await', d.devname, (d.readtime + d.writetime)::float8, " \
+		"    (d.reads_completed + d.writes_completed)::float8 " \
+		"FROM pg_diskusage() d"
+#define ANOMALY_BACKENDS \
+		"SELECT pid, (utime + stime)::float8, (reads + writes)::float8 " \
+		"FROM pg_proctab()"
+#define INSERT_ANOMALY \
+		"INSERT INTO ps_anomalies(time, metric, object, value, mean, " \
+		"    stddev, zscore, burst_until) " \
+		"VALUES ($1, $2, $3, $4, $5, $6, $7, $8)"
+
+#define ANOMALY_METRIC_LEN 32
+#define ANOMALY_OBJECT_LEN 64
+
+/* Samples a series needs before its deviations are trusted. */
+#define ANOMALY_WARMUP 30
+
+typedef struct
+{
+	char metric[ANOMALY_METRIC_LEN];
+	char object[ANOMALY_OBJECT_LEN];
+} anomaly_key;
+
+/* The baseline of a series, and its counters as of the previous sample. */
+typedef struct
+{
+	anomaly_key key;		/* hash key */
+	double mean;
+	double var;
+	int64 n;
+	double prev_num;
+	double prev_den;
+	bool have_prev;
+	bool seen;
+} anomaly_series;
+
+/* The counters of a backend as of the previous sample. */
+typedef struct
+{
+	int32 pid;				/* hash key */
+	double cpu;
+	double io;
+	TimestampTz time;
+	bool seen;
+} anomaly_backend;
+
+/* A deviation found in a sample. */
+typedef struct
+{
+	char metric[ANOMALY_METRIC_LEN];
+	char object[ANOMALY_OBJECT_LEN];
+	double value;
+	double mean;
+	double stddev;
+	double zscore;
+} anomaly_event;
+
+/*
+ * The smallest standard deviation of each series, so that a series that has
+ * been constant, such as iowait on an idle host, still has a baseline to
+ * deviate from.  cpu_busy and cpu_iowait are percentages of the host,
+ * memfree is in kB, await in milliseconds per I/O, backend_cpu the
+ * percentage of a processor of the busiest backend and backend_io the bytes
+ * per second of the backend doing the most I/O.
+ */
+static const struct
+{
+	const char *metric;
+	double min_stddev;
+} anomaly_metrics[] = {
+	{"cpu_busy", 1.0},
+	{"cpu_iowait", 1.0},
+	{"load1", 0.1},
+	{"memfree", 16384.0},
+	{"await", 1.0},
+	{"backend_cpu", 1.0},
+	{"backend_io", 1048576.0}
+};
+
+int anomaly_interval = 0;
+double anomaly_weight = 0.05;
+double anomaly_threshold = 4.0;
+int burst_interval = 1;
+int burst_duration = 60;
+
+static HTAB *anomaly_series_hash = NULL;
+static HTAB *anomaly_backends = NULL;
+
+static anomaly_series *anomaly_lookup(const char *, const char *);
+static void anomaly_update(anomaly_series *, double, const char *,
+		anomaly_event *, int *);
+static void anomaly_sample_host(anomaly_event *, int *);
+static void anomaly_sample_backends(TimestampTz, anomaly_event *, int *);
+
+void
+anomaly_init(void)
+{
+	DefineCustomIntVariable("pg_proctab.anomaly_interval",
+			"How often the pg_proctab worker compares the host and backend "
+			"statistics with their baselines.",
+			"Zero disables anomaly detection.",
+			&anomaly_interval,
+			0,
+			0,
+			INT_MAX / 1000,
+			PGC_SIGHUP,
+			GUC_UNIT_S,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomRealVariable("pg_proctab.anomaly_weight",
+			"Weight of the latest sample in the moving mean and variance of "
+			"a series.",
+			"The larger it is, the faster the baselines follow changes.",
+			&anomaly_weight,
+			0.05,
+			0.001,
+			1.0,
+			PGC_SIGHUP,
+			0,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomRealVariable("pg_proctab.anomaly_threshold",
+			"Standard deviations from its mean past which a sample is an "
+			"anomaly.",
+			NULL,
+			&anomaly_threshold,
+			4.0,
+			0.5,
+			100.0,
+			PGC_SIGHUP,
+			0,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.burst_interval",
+			"How often the pg_proctab worker takes a snapshot after an "
+			"anomaly.",
+			NULL,
+			&burst_interval,
+			1,
+			1,
+			INT_MAX / 1000,
+			PGC_SIGHUP,
+			GUC_UNIT_S,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.burst_duration",
+			"How long the pg_proctab worker keeps taking snapshots after an "
+			"anomaly.",
+			"Zero only records the anomaly.",
+			&burst_duration,
+			60,
+			0,
+			INT_MAX / 1000,
+			PGC_SIGHUP,
+			GUC_UNIT_S,
+			NULL,
+			NULL,
+			NULL);
+}
+
+/* Return the series of a metric and object, creating it if it is new. */
+static anomaly_series *
+anomaly_lookup(const char *metric, const char *object)
+{
+	anomaly_key key;
+	anomaly_series *series;
+	bool found;
+
+	memset(&key, 0, sizeof(key));
+	strlcpy(key.metric, metric, sizeof(key.metric));
+	strlcpy(key.object, object, sizeof(key.object));
+
+	series = (anomaly_series *) hash_search(anomaly_series_hash, &key,
+			HASH_ENTER, &found);
+	if (!found)
+	{
+		series->mean = 0;
+		series->var = 0;
+		series->n = 0;
+		series->have_prev = false;
+	}
+	series->seen = true;
+
+	return series;
+}
+
+/*
+ * Compare a sample with the exponentially weighted mean and variance of its
+ * series, adding an event if it is too far off, then fold it into them.  The
+ * object of the event may differ from that of the series, as for the
+ * busiest backend.
+ */
+static void
+anomaly_update(anomaly_series *series, double value, const char *object,
+		anomaly_event *events, int *nevents)
+{
+	double diff;
+	double incr;
+	int i;
+
+	if (series->n >= ANOMALY_WARMUP)
+	{
+		double stddev = sqrt(series->var);
+		double zscore;
+
+		for (i = 0; i < lengthof(anomaly_metrics); i++)
+			if (strcmp(anomaly_metrics[i].metric, series->key.metric) == 0)
+				stddev = Max(stddev, anomaly_metrics[i].min_stddev);
+		stddev = Max(stddev, 0.01 * fabs(series->mean));
+
+		zscore = (value - series->mean) / stddev;
+		if (fabs(zscore) > anomaly_threshold)
+		{
+			anomaly_event *event = &events[(*nevents)++];
+
+			strlcpy(event->metric, series->key.metric, sizeof(event->metric));
+			strlcpy(event->object, object, sizeof(event->object));
+			event->value = value;
+			event->mean = series->mean;
+			event->stddev = stddev;
+			event->zscore = zscore;
+		}
+	}
+
+	if (series->n == 0)
+	{
+		series->mean = value;
+		series->var = 0;
+	}
+	else
+	{
+		diff = value - series->mean;
+		incr = anomaly_weight * diff;
+		series->mean += incr;
+		series->var = (1 - anomaly_weight) * (series->var + diff * incr);
+	}
+	series->n++;
+}
+
+/*
+ * Sample the host series.  A series of counters has no value until their
+ * second sample, nor while the denominator does not increase, as the await
+ * of a device without I/O.
+ */
+static void
+anomaly_sample_host(anomaly_event *events, int *nevents)
+{
+	int ret;
+	uint64 i;
+
+	ret = SPI_execute(ANOMALY_HOST, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "pg_proctab worker: %s failed: %s", ANOMALY_HOST,
+				SPI_result_code_string(ret));
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple tuple = SPI_tuptable->vals[i];
+		TupleDesc tupdesc = SPI_tuptable->tupdesc;
+		anomaly_series *series;
+		char *object;
+		double num;
+		double den;
+		bool isnull;
+
+		object = SPI_getvalue(tuple, tupdesc, 2);
+		if (object == NULL)
+			object = "";
+		series = anomaly_lookup(SPI_getvalue(tuple, tupdesc, 1), object);
+
+		num = DatumGetFloat8(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+		if (isnull)
+			continue;
+		den = DatumGetFloat8(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+		if (isnull)
+		{
+			anomaly_update(series, num, object, events, nevents);
+			continue;
+		}
+
+		/* Counters going down were reset. */
+		if (series->have_prev && den > series->prev_den &&
+				num >= series->prev_num)
+			anomaly_update(series, (num - series->prev_num) /
+					(den - series->prev_den), object, events, nevents);
+		series->prev_num = num;
+		series->prev_den = den;
+		series->have_prev = true;
+	}
+}
+
+/*
+ * Sample the processor and I/O rates of every backend, the series being
+ * those of the busiest backend, whichever it is, so that the event names it.
+ */
+static void
+anomaly_sample_backends(TimestampTz now, anomaly_event *events,
+		int *nevents)
+{
+	HASH_SEQ_STATUS status;
+	anomaly_backend *backend;
+	double hz = (double) sysconf(_SC_CLK_TCK);
+	double max_cpu = -1;
+	double max_io = -1;
+	int32 max_cpu_pid = 0;
+	int32 max_io_pid = 0;
+	char pid[16];
+	int ret;
+	uint64 i;
+
+	hash_seq_init(&status, anomaly_backends);
+	while ((backend = (anomaly_backend *) hash_seq_search(&status)) != NULL)
+		backend->seen = false;
+
+	ret = SPI_execute(ANOMALY_BACKENDS, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "pg_proctab worker: %s failed: %s", ANOMALY_BACKENDS,
+				SPI_result_code_string(ret));
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple tuple = SPI_tuptable->vals[i];
+		TupleDesc tupdesc = SPI_tuptable->tupdesc;
+		bool found;
+		bool isnull;
+		bool cpu_null;
+		bool io_null;
+		double cpu;
+		double io;
+		double elapsed;
+		int32 key;
+
+		key = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+		cpu = DatumGetFloat8(SPI_getbinval(tuple, tupdesc, 2, &cpu_null));
+		io = DatumGetFloat8(SPI_getbinval(tuple, tupdesc, 3, &io_null));
+
+		backend = (anomaly_backend *) hash_search(anomaly_backends, &key,
+				HASH_ENTER, &found);
+		backend->seen = true;
+
+		elapsed = (double) (now - backend->time) / USECS_PER_SEC;
+		if (found && elapsed > 0)
+		{
+			if (!cpu_null && cpu >= backend->cpu &&
+					100 * (cpu - backend->cpu) / hz / elapsed > max_cpu)
+			{
+				max_cpu = 100 * (cpu - backend->cpu) / hz / elapsed;
+				max_cpu_pid = key;
+			}
+			if (!io_null && io >= backend->io &&
+					(io - backend->io) / elapsed > max_io)
+			{
+				max_io = (io - backend->io) / elapsed;
+				max_io_pid = key;
+			}
+		}
+
+		backend->cpu = cpu_null ? 0 : cpu;
+		backend->io = io_null ? 0 : io;
+		backend->time = now;
+	}
+
+	hash_seq_init(&status, anomaly_backends);
+	while ((backend = (anomaly_backend *) hash_seq_search(&status)) != NULL)
+		if (!backend->seen)
+			hash_search(anomaly_backends, &backend->pid, HASH_REMOVE, NULL);
+
+	if (max_cpu >= 0)
+	{
+		snprintf(pid, sizeof(pid), "%d", max_cpu_pid);
+		anomaly_update(anomaly_lookup("backend_cpu", ""), max_cpu, pid,
+				events, nevents);
+	}
+	if (max_io >= 0)
+	{
+		snprintf(pid, sizeof(pid), "%d", max_io_pid);
+		anomaly_update(anomaly_lookup("backend_io", ""), max_io, pid,
+				events, nevents);
+	}
+}
+
+/*
+ * Sample the series and compare them with their baselines.  Every anomaly is
+ * logged, and recorded in ps_anomalies where the table exists, and extends
+ * the burst of snapshots the worker takes to pg_proctab.burst_duration from
+ * now.  Returns true if that starts a burst.  Called by the pg_proctab
+ * worker every pg_proctab.anomaly_interval seconds.
+ */
+bool
+anomaly_check(TimestampTz *burst_until)
+{
+	static bool reported = false;
+	HASH_SEQ_STATUS status;
+	anomaly_series *series;
+	anomaly_event *events;
+	TimestampTz now = GetCurrentTimestamp();
+	TimestampTz until;
+	bool have_table;
+	bool started = false;
+	int nevents = 0;
+	int i;
+
+	if (anomaly_series_hash == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(anomaly_key);
+		ctl.entrysize = sizeof(anomaly_series);
+		anomaly_series_hash = hash_create("pg_proctab anomaly series", 64,
+				&ctl, HASH_ELEM | HASH_BLOBS);
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(int32);
+		ctl.entrysize = sizeof(anomaly_backend);
+		anomaly_backends = hash_create("pg_proctab anomaly backends", 128,
+				&ctl, HASH_ELEM | HASH_BLOBS);
+	}
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "checking for anomalies");
+
+	if (SPI_execute(CHECK_ANOMALY, true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "pg_proctab worker: %s failed", CHECK_ANOMALY);
+
+	if (strcmp(SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1),
+			"t") != 0)
+	{
+		if (!reported)
+			ereport(LOG,
+					(errmsg("pg_proctab worker: not checking for anomalies, "
+							"pg_proctab is missing in database \"%s\"",
+							worker_database)));
+		reported = true;
+
+		SPI_finish();
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+		return false;
+	}
+	reported = false;
+	have_table = strcmp(SPI_getvalue(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 2), "t") == 0;
+
+	hash_seq_init(&status, anomaly_series_hash);
+	while ((series = (anomaly_series *) hash_seq_search(&status)) != NULL)
+		series->seen = false;
+
+	/*
+	 * At most one event per series, and only a series with a baseline, so
+	 * one already in the hash, can deviate from it.
+	 */
+	events = (anomaly_event *) palloc(sizeof(anomaly_event) *
+			(hash_get_num_entries(anomaly_series_hash) + 1));
+
+	anomaly_sample_host(events, &nevents);
+	anomaly_sample_backends(now, events, &nevents);
+
+	/* Devices that are gone. */
+	hash_seq_init(&status, anomaly_series_hash);
+	while ((series = (anomaly_series *) hash_seq_search(&status)) != NULL)
+		if (!series->seen)
+			hash_search(anomaly_series_hash, &series->key, HASH_REMOVE, NULL);
+
+	if (nevents > 0)
+	{
+		until = TimestampTzPlusMilliseconds(now, burst_duration * 1000L);
+		started = *burst_until <= now && burst_duration > 0;
+		if (until > *burst_until)
+			*burst_until = until;
+	}
+
+	for (i = 0; i < nevents; i++)
+	{
+		ereport(LOG,
+				(errmsg("pg_proctab worker: %s%s%s is %g, %.1f standard "
+						"deviations from its mean of %g",
+						events[i].metric, events[i].object[0] ? " of " : "",
+						events[i].object, events[i].value, events[i].zscore,
+						events[i].mean)));
+
+		if (have_table)
+		{
+			Oid argtypes[8] = {TIMESTAMPTZOID, TEXTOID, TEXTOID, FLOAT8OID,
+					FLOAT8OID, FLOAT8OID, FLOAT8OID, TIMESTAMPTZOID};
+			Datum values[8];
+			char nulls[8] = {' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
+			int ret;
+
+			values[0] = TimestampTzGetDatum(now);
+			values[1] = CStringGetTextDatum(events[i].metric);
+			values[2] = CStringGetTextDatum(events[i].object);
+			nulls[2] = events[i].object[0] == '\0' ? 'n' : ' ';
+			values[3] = Float8GetDatum(events[i].value);
+			values[4] = Float8GetDatum(events[i].mean);
+			values[5] = Float8GetDatum(events[i].stddev);
+			values[6] = Float8GetDatum(events[i].zscore);
+			values[7] = TimestampTzGetDatum(*burst_until);
+			nulls[7] = burst_duration > 0 ? ' ' : 'n';
+
+			ret = SPI_execute_with_args(INSERT_ANOMALY, 8, argtypes, values,
+					nulls, false, 0);
+			if (ret != SPI_OK_INSERT)
+				elog(ERROR, "pg_proctab worker: %s failed: %s",
+						INSERT_ANOMALY, SPI_result_code_string(ret));
+		}
+	}
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_stat(false);
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	return started;
+}
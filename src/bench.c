@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/htup_details.h"
+#include "executor/executor.h"
+#include "portability/instr_time.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/regproc.h"
+#include "utils/tuplestore.h"
+#include "pg_proctab.h"
+
+enum proctab_bench {i_b_rows, i_b_seconds, i_b_rows_per_sec,
+		i_b_bytes_per_row};
+
+#define PROCTAB_BENCH_NCOLS 4
+
+Datum pg_proctab_bench(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_proctab_bench);
+
+static int64 bench_call(Oid, MemoryContext, Size *);
+
+/*
+ * Call a function without arguments the way a function scan does, in either
+ * SRF mode, and return the number of rows.  Nothing the function allocates
+ * is freed until it is done, so the most memory held by context during the
+ * calls, which is returned in bytes, is what the rows cost to produce.
+ */
+static int64
+bench_call(Oid fn, MemoryContext context, Size *bytes)
+{
+	LOCAL_FCINFO(fcinfo, 0);
+	FmgrInfo flinfo;
+	ReturnSetInfo rsinfo;
+	ExprContext *econtext;
+	MemoryContext oldcontext;
+	Size base;
+	int64 rows = 0;
+
+	oldcontext = MemoryContextSwitchTo(context);
+	base = MemoryContextMemAllocated(context, true);
+
+	econtext = CreateStandaloneExprContext();
+	fmgr_info(fn, &flinfo);
+
+	memset(&rsinfo, 0, sizeof(rsinfo));
+	rsinfo.type = T_ReturnSetInfo;
+	rsinfo.econtext = econtext;
+	rsinfo.allowedModes = (int) (SFRM_ValuePerCall | SFRM_Materialize);
+	rsinfo.returnMode = SFRM_ValuePerCall;
+
+	InitFunctionCallInfoData(*fcinfo, &flinfo, 0, InvalidOid, NULL,
+			(Node *) &rsinfo);
+
+	for (;;)
+	{
+		rsinfo.isDone = ExprSingleResult;
+		fcinfo->isnull = false;
+		(void) FunctionCallInvoke(fcinfo);
+
+		*bytes = Max(*bytes, MemoryContextMemAllocated(context, true) - base);
+
+		if (rsinfo.returnMode == SFRM_Materialize)
+		{
+			if (rsinfo.setResult != NULL)
+				rows += tuplestore_tuple_count(rsinfo.setResult);
+			break;
+		}
+		if (flinfo.fn_retset && rsinfo.isDone == ExprEndResult)
+			break;
+		rows++;
+		if (!flinfo.fn_retset)
+			break;
+	}
+
+	FreeExprContext(econtext, true);
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(context);
+
+	return rows;
+}
+
+/*
+ * Call a function loops times and report the rows it returns per call, the
+ * rows per second and the bytes allocated per row.
+ */
+Datum pg_proctab_bench(PG_FUNCTION_ARGS)
+{
+	Oid fn = PG_GETARG_OID(0);
+	int32 loops = PG_GETARG_INT32(1);
+	TupleDesc tupdesc;
+	Datum values[PROCTAB_BENCH_NCOLS];
+	bool nulls[PROCTAB_BENCH_NCOLS];
+	MemoryContext context;
+	instr_time start;
+	instr_time duration;
+	int64 rows = 0;
+	Size bytes = 0;
+	double seconds;
+	int32 i;
+
+	elog(DEBUG5, "pg_proctab_bench: Entering stored function.");
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to run pg_proctab_bench()")));
+	if (get_func_nargs(fn) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("function %s takes arguments", format_procedure(fn))));
+	if (loops < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("loops must be at least 1")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	context = AllocSetContextCreate(CurrentMemoryContext, "pg_proctab_bench",
+			ALLOCSET_DEFAULT_SIZES);
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (i = 0; i < loops; i++)
+	{
+		rows += bench_call(fn, context, &bytes);
+		CHECK_FOR_INTERRUPTS();
+	}
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	MemoryContextDelete(context);
+
+	seconds = INSTR_TIME_GET_DOUBLE(duration);
+
+	memset(nulls, false, sizeof(nulls));
+	values[i_b_rows] = Int64GetDatum(rows / loops);
+	values[i_b_seconds] = Float8GetDatum(seconds);
+	values[i_b_rows_per_sec] = Float8GetDatum(rows / seconds);
+	if (rows / loops > 0)
+		values[i_b_bytes_per_row] =
+				Float8GetDatum((double) bytes / (rows / loops));
+	else
+		nulls[i_b_bytes_per_row] = true;
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values,
+			nulls)));
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "utils/timestamp.h"
+#include <limits.h>
+#include "pg_proctab.h"
+
+/*
+ * The rows of the last scan, each stored as PROCTAB_NCOLS values in a row,
+ * every value a byte telling whether it is NULL followed by the value as a
+ * NUL terminated string when it is not.  The rows are only served to
+ * sessions reading the same pg_proctab.procfs_root.
+ */
+typedef struct
+{
+	LWLock *lock;
+	bool scanning;			/* a session is reading /proc for the cache */
+	ConditionVariable scanned;
+	TimestampTz sampled;	/* 0 while empty */
+	char root[MAXPGPATH];	/* procfs_root of the scan */
+	int nrows;
+	Size used;
+	char data[FLEXIBLE_ARRAY_MEMBER];
+} proctab_cache;
+
+int cache_max_age = 0;
+int cache_size = 1024;
+
+static proctab_cache *cache = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+static Size cache_shmem_size(void);
+static void cache_shmem_request(void);
+static void cache_shmem_startup(void);
+static bool cache_copy(char **, int *, Size *, TimestampTz *);
+static char ***cache_decode(char *, int);
+static void cache_store(char ***, int, TimestampTz);
+static void cache_scan_done(int, Datum);
+
+void
+cache_init(void)
+{
+	DefineCustomIntVariable("pg_proctab.cache_max_age",
+			"Oldest pg_proctab() rows served from the shared cache.",
+			"Zero reads /proc on every call.  The cache only exists "
+			"when pg_proctab is in shared_preload_libraries.",
+			&cache_max_age,
+			0,
+			0,
+			INT_MAX,
+			PGC_USERSET,
+			GUC_UNIT_MS,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.cache_size",
+			"Shared memory set aside for the pg_proctab() cache.",
+			NULL,
+			&cache_size,
+			1024,
+			64,
+			INT_MAX / 1024,
+			PGC_POSTMASTER,
+			GUC_UNIT_KB,
+			NULL,
+			NULL,
+			NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = cache_shmem_request;
+#else
+	cache_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = cache_shmem_startup;
+}
+
+static Size
+cache_shmem_size(void)
+{
+	return add_size(offsetof(proctab_cache, data),
+			mul_size(cache_size, 1024));
+}
+
+static void
+cache_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(cache_shmem_size());
+	RequestNamedLWLockTranche("pg_proctab", 1);
+}
+
+static void
+cache_shmem_startup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	cache = ShmemInitStruct("pg_proctab cache", cache_shmem_size(), &found);
+	if (!found)
+	{
+		cache->lock = &(GetNamedLWLockTranche("pg_proctab"))->lock;
+		cache->scanning = false;
+		ConditionVariableInit(&cache->scanned);
+		cache->sampled = 0;
+		cache->root[0] = '\0';
+		cache->nrows = 0;
+		cache->used = 0;
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Copy the cached rows if they were read from the same procfs_root and are
+ * younger than pg_proctab.cache_max_age.  The caller holds the lock, and
+ * decodes the copy after releasing it.
+ */
+static bool
+cache_copy(char **data, int *nrows, Size *used, TimestampTz *sampled)
+{
+	if (cache->sampled == 0 || strcmp(cache->root, PROCFS) != 0 ||
+			TimestampDifferenceExceeds(cache->sampled, GetCurrentTimestamp(),
+			cache_max_age))
+		return false;
+
+	*data = (char *) palloc(Max(cache->used, 1));
+	memcpy(*data, cache->data, cache->used);
+	*nrows = cache->nrows;
+	*used = cache->used;
+	*sampled = cache->sampled;
+
+	return true;
+}
+
+static char ***
+cache_decode(char *data, int nrows)
+{
+	char ***rows;
+	char *p = data;
+	int i;
+	int j;
+
+	rows = (char ***) palloc(sizeof(char **) * Max(nrows, 1));
+	for (i = 0; i < nrows; i++)
+	{
+		rows[i] = (char **) palloc(sizeof(char *) * (PROCTAB_NCOLS + 1));
+		for (j = 0; j < PROCTAB_NCOLS; j++)
+		{
+			if (*p++ == '\0')
+			{
+				rows[i][j] = NULL;
+				continue;
+			}
+			rows[i][j] = p;
+			p += strlen(p) + 1;
+		}
+	}
+
+	return rows;
+}
+
+/*
+ * Replace the cached rows.  The caller holds the lock exclusively.  Rows that
+ * do not fit in pg_proctab.cache_size leave the cache empty.
+ */
+static void
+cache_store(char ***rows, int nrows, TimestampTz sampled)
+{
+	Size capacity = mul_size(cache_size, 1024);
+	Size used = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < nrows; i++)
+		for (j = 0; j < PROCTAB_NCOLS; j++)
+			used += rows[i][j] == NULL ? 1 : strlen(rows[i][j]) + 2;
+
+	if (used > capacity)
+	{
+		cache->sampled = 0;
+		ereport(WARNING,
+				(errmsg("pg_proctab.cache_size is too small for %d processes",
+						nrows),
+				 errhint("%zu kB are needed.", (used + 1023) / 1024)));
+		return;
+	}
+
+	used = 0;
+	for (i = 0; i < nrows; i++)
+	{
+		for (j = 0; j < PROCTAB_NCOLS; j++)
+		{
+			Size len;
+
+			if (rows[i][j] == NULL)
+			{
+				cache->data[used++] = '\0';
+				continue;
+			}
+			cache->data[used++] = '\1';
+			len = strlen(rows[i][j]) + 1;
+			memcpy(cache->data + used, rows[i][j], len);
+			used += len;
+		}
+	}
+	cache->nrows = nrows;
+	cache->used = used;
+	cache->sampled = sampled;
+	strlcpy(cache->root, PROCFS, sizeof(cache->root));
+}
+
+/*
+ * Return the cached pg_proctab() rows and the time they were read if they are
+ * younger than pg_proctab.cache_max_age.  Only a shared lock is taken, so any
+ * number of sessions can read the cache at the same time.
+ */
+bool
+cache_read(char ****rows, int *nrows, TimestampTz *sampled)
+{
+	char *data;
+	Size used;
+	bool fresh;
+
+	if (cache == NULL || cache_max_age <= 0)
+		return false;
+
+	LWLockAcquire(cache->lock, LW_SHARED);
+	fresh = cache_copy(&data, nrows, &used, sampled);
+	LWLockRelease(cache->lock);
+
+	if (fresh)
+		*rows = cache_decode(data, *nrows);
+	return fresh;
+}
+
+/*
+ * Let the sessions waiting for a scan go, also when the scan failed.
+ */
+static void
+cache_scan_done(int code, Datum arg)
+{
+	LWLockAcquire(cache->lock, LW_EXCLUSIVE);
+	cache->scanning = false;
+	LWLockRelease(cache->lock);
+	ConditionVariableBroadcast(&cache->scanned);
+}
+
+/*
+ * Scan the processes and cache the rows.  Only one session scans at a time,
+ * without holding the lock so that the cache can still be read meanwhile,
+ * and the sessions that find the cache stale during the scan wait for its
+ * rows instead of each reading /proc.  If those rows could not be cached,
+ * the next session to wake up scans again.  Returns false when there is no
+ * cache, in which case nothing was scanned.
+ */
+bool
+cache_scan(int32 *pids, int npids, proctab_scan_fn scan, char ****rows,
+		int *nrows, TimestampTz *sampled)
+{
+	char *data;
+	Size used;
+
+	if (cache == NULL || cache_max_age <= 0)
+		return false;
+
+	for (;;)
+	{
+		LWLockAcquire(cache->lock, LW_EXCLUSIVE);
+		if (cache_copy(&data, nrows, &used, sampled))
+		{
+			LWLockRelease(cache->lock);
+			ConditionVariableCancelSleep();
+			*rows = cache_decode(data, *nrows);
+			return true;
+		}
+		if (!cache->scanning)
+		{
+			cache->scanning = true;
+			LWLockRelease(cache->lock);
+			break;
+		}
+		LWLockRelease(cache->lock);
+		ConditionVariableSleep(&cache->scanned, PG_WAIT_EXTENSION);
+	}
+	ConditionVariableCancelSleep();
+
+	PG_ENSURE_ERROR_CLEANUP(cache_scan_done, (Datum) 0);
+	{
+		*sampled = GetCurrentTimestamp();
+		*rows = scan(pids, npids, nrows);
+
+		LWLockAcquire(cache->lock, LW_EXCLUSIVE);
+		cache_store(*rows, *nrows, *sampled);
+		LWLockRelease(cache->lock);
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(cache_scan_done, (Datum) 0);
+	cache_scan_done(0, (Datum) 0);
+
+	return true;
+}
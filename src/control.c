@@ -0,0 +1,557 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "libpq/auth.h"
+#include "libpq/libpq-be.h"
+#include "storage/proc.h"
+#include "storage/procarray.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <sched.h>
+#include <limits.h>
+#include "pg_proctab.h"
+
+/*
+ * The kernel interface for I/O priorities has no glibc wrapper, see
+ * Documentation/block/ioprio.rst in the Linux source code.
+ */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_PRIO_VALUE(class, level) (((class) << IOPRIO_CLASS_SHIFT) | (level))
+
+enum ioprio_class {IOPRIO_CLASS_NONE, IOPRIO_CLASS_RT, IOPRIO_CLASS_BE,
+		IOPRIO_CLASS_IDLE};
+
+#define POLICY_UNSET INT_MIN
+#define POLICY_MAX_RULES 64
+
+/* What guc_malloc() returns is only freed with guc_free() from PG16 on. */
+#if PG_VERSION_NUM >= 160000
+#define policy_free(p) guc_free(p)
+#else
+#define policy_free(p) free(p)
+#endif
+
+/* One "selector: settings" rule of pg_proctab.process_policy. */
+typedef struct
+{
+	bool is_role;			/* match a role, otherwise a backend_type */
+	char name[NAMEDATALEN];
+	int nice;				/* POLICY_UNSET if not set */
+	int ioprio_class;		/* POLICY_UNSET if not set */
+	int ioprio_level;
+	bool has_affinity;
+#ifdef __linux__
+	cpu_set_t cpus;
+#endif /* __linux__ */
+} policy_rule;
+
+typedef struct
+{
+	int nrules;
+	policy_rule rules[FLEXIBLE_ARRAY_MEMBER];
+} process_policy;
+
+char *process_policy_string = NULL;
+static process_policy *current_policy = NULL;
+
+static ClientAuthentication_hook_type prev_ClientAuthentication = NULL;
+
+Datum pg_set_backend_affinity(PG_FUNCTION_ARGS);
+Datum pg_set_backend_nice(PG_FUNCTION_ARGS);
+Datum pg_set_backend_ioprio(PG_FUNCTION_ARGS);
+Datum pg_check_process_policy(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_set_backend_affinity);
+PG_FUNCTION_INFO_V1(pg_set_backend_nice);
+PG_FUNCTION_INFO_V1(pg_set_backend_ioprio);
+PG_FUNCTION_INFO_V1(pg_check_process_policy);
+
+static bool check_process_policy(char **, void **, GucSource);
+static void assign_process_policy(const char *, void *);
+static void policy_ClientAuthentication(Port *, int);
+static bool parse_ioprio_class(const char *, int *);
+static bool parse_cpu_list(const char *, void *);
+static bool check_target_pid(int32);
+
+void
+control_init(void)
+{
+	DefineCustomStringVariable("pg_proctab.process_policy",
+			"CPU affinity, nice and I/O priority applied to processes by role "
+			"or backend_type.",
+			"A semicolon separated list of rules of the form "
+			"\"role=NAME: settings\" or \"backend_type=TYPE: settings\", where "
+			"settings are space separated nice=N, ioprio=CLASS[/LEVEL] and "
+			"affinity=CPULIST.",
+			&process_policy_string,
+			"",
+			PGC_SIGHUP,
+			GUC_SUPERUSER_ONLY,
+			check_process_policy,
+			assign_process_policy,
+			NULL);
+
+	prev_ClientAuthentication = ClientAuthentication_hook;
+	ClientAuthentication_hook = policy_ClientAuthentication;
+}
+
+static bool
+parse_ioprio_class(const char *name, int *class)
+{
+	if (pg_strcasecmp(name, "realtime") == 0 ||
+			pg_strcasecmp(name, "rt") == 0)
+		*class = IOPRIO_CLASS_RT;
+	else if (pg_strcasecmp(name, "best-effort") == 0 ||
+			pg_strcasecmp(name, "be") == 0)
+		*class = IOPRIO_CLASS_BE;
+	else if (pg_strcasecmp(name, "idle") == 0)
+		*class = IOPRIO_CLASS_IDLE;
+	else
+		return false;
+	return true;
+}
+
+/*
+ * Parse a cpu list such as "0-3,8" into a cpu_set_t.
+ */
+static bool
+parse_cpu_list(const char *list, void *set)
+{
+#ifdef __linux__
+	cpu_set_t *cpus = (cpu_set_t *) set;
+	const char *p = list;
+
+	CPU_ZERO(cpus);
+	while (*p)
+	{
+		char *q;
+		long first;
+		long last;
+
+		first = strtol(p, &q, 10);
+		if (q == p || first < 0 || first >= CPU_SETSIZE)
+			return false;
+		last = first;
+		p = q;
+		if (*p == '-')
+		{
+			++p;
+			last = strtol(p, &q, 10);
+			if (q == p || last < first || last >= CPU_SETSIZE)
+				return false;
+			p = q;
+		}
+		for (; first <= last; first++)
+			CPU_SET(first, cpus);
+		if (*p == ',')
+			++p;
+		else if (*p != '\0')
+			return false;
+	}
+	return CPU_COUNT(cpus) > 0;
+#else
+	return false;
+#endif /* __linux__ */
+}
+
+static bool
+check_process_policy(char **newval, void **extra, GucSource source)
+{
+	process_policy *policy;
+	char *rawstring;
+	char *rule_str;
+	char *rule_save;
+
+	policy = (process_policy *) guc_malloc(LOG, offsetof(process_policy,
+			rules) + sizeof(policy_rule) * POLICY_MAX_RULES);
+	if (policy == NULL)
+		return false;
+	policy->nrules = 0;
+
+	rawstring = pstrdup(*newval);
+	for (rule_str = strtok_r(rawstring, ";", &rule_save); rule_str != NULL;
+			rule_str = strtok_r(NULL, ";", &rule_save))
+	{
+		policy_rule *rule;
+		char *colon;
+		char *selector;
+		char *setting;
+		char *setting_save;
+
+		while (isspace((unsigned char) *rule_str))
+			rule_str++;
+		if (*rule_str == '\0')
+			continue;
+
+		if (policy->nrules >= POLICY_MAX_RULES)
+		{
+			GUC_check_errdetail("At most %d rules are allowed.",
+					POLICY_MAX_RULES);
+			goto fail;
+		}
+		rule = &policy->rules[policy->nrules];
+		memset(rule, 0, sizeof(policy_rule));
+		rule->nice = POLICY_UNSET;
+		rule->ioprio_class = POLICY_UNSET;
+
+		colon = strchr(rule_str, ':');
+		if (colon == NULL)
+		{
+			GUC_check_errdetail("Rule \"%s\" has no ':'.", rule_str);
+			goto fail;
+		}
+		*colon = '\0';
+
+		selector = rule_str;
+		if (strncmp(selector, "role=", 5) == 0)
+		{
+			rule->is_role = true;
+			selector += 5;
+		}
+		else if (strncmp(selector, "backend_type=", 13) == 0)
+			selector += 13;
+		else
+		{
+			GUC_check_errdetail("Rule selector \"%s\" must start with role= "
+					"or backend_type=.", selector);
+			goto fail;
+		}
+		/* Backend types contain spaces, so only trim the ends. */
+		while (isspace((unsigned char) *selector))
+			selector++;
+		setting = selector + strlen(selector);
+		while (setting > selector && isspace((unsigned char) setting[-1]))
+			*--setting = '\0';
+		if (*selector == '\0' || strlen(selector) >= NAMEDATALEN)
+		{
+			GUC_check_errdetail("Invalid rule selector name \"%s\".", selector);
+			goto fail;
+		}
+		strlcpy(rule->name, selector, NAMEDATALEN);
+
+		for (setting = strtok_r(colon + 1, " \t", &setting_save);
+				setting != NULL; setting = strtok_r(NULL, " \t", &setting_save))
+		{
+			if (strncmp(setting, "nice=", 5) == 0)
+			{
+				char *end;
+				long nice;
+
+				nice = strtol(setting + 5, &end, 10);
+				if (end == setting + 5 || *end != '\0' || nice < -20 ||
+						nice > 19)
+				{
+					GUC_check_errdetail("nice must be between -20 and 19.");
+					goto fail;
+				}
+				rule->nice = (int) nice;
+			}
+			else if (strncmp(setting, "ioprio=", 7) == 0)
+			{
+				char *level = strchr(setting + 7, '/');
+				char *end;
+				long ioprio_level = 4;
+
+				if (level != NULL)
+					*level++ = '\0';
+				if (!parse_ioprio_class(setting + 7, &rule->ioprio_class))
+				{
+					GUC_check_errdetail("I/O priority class must be realtime, "
+							"best-effort or idle.");
+					goto fail;
+				}
+				if (level != NULL)
+				{
+					ioprio_level = strtol(level, &end, 10);
+					if (end == level || *end != '\0')
+						ioprio_level = -1;
+				}
+				if (ioprio_level < 0 || ioprio_level > 7)
+				{
+					GUC_check_errdetail("I/O priority level must be between "
+							"0 and 7.");
+					goto fail;
+				}
+				rule->ioprio_level = (int) ioprio_level;
+			}
+			else if (strncmp(setting, "affinity=", 9) == 0)
+			{
+#ifdef __linux__
+				if (!parse_cpu_list(setting + 9, &rule->cpus))
+				{
+					GUC_check_errdetail("Invalid CPU list \"%s\".",
+							setting + 9);
+					goto fail;
+				}
+				rule->has_affinity = true;
+#else
+				GUC_check_errdetail("CPU affinity is not supported on this "
+						"platform.");
+				goto fail;
+#endif /* __linux__ */
+			}
+			else
+			{
+				GUC_check_errdetail("Unrecognized setting \"%s\".", setting);
+				goto fail;
+			}
+		}
+
+		policy->nrules++;
+	}
+
+	pfree(rawstring);
+	*extra = policy;
+	return true;
+
+fail:
+	pfree(rawstring);
+	policy_free(policy);
+	return false;
+}
+
+static void
+assign_process_policy(const char *newval, void *extra)
+{
+	current_policy = (process_policy *) extra;
+}
+
+static void
+policy_ClientAuthentication(Port *port, int status)
+{
+	if (prev_ClientAuthentication)
+		prev_ClientAuthentication(port, status);
+
+	if (status == STATUS_OK)
+		apply_process_policy(MyProcPid, "client backend", port->user_name);
+}
+
+/*
+ * Apply every rule matching the process, backend_type rules first so that
+ * role rules can override them.  Failures are logged rather than raised,
+ * since this runs at connection start and in the worker.  Returns the
+ * number of rules that matched.
+ */
+int
+apply_process_policy(int32 pid, const char *backend_type, const char *role)
+{
+	int matched = 0;
+	int pass;
+	int i;
+
+	if (current_policy == NULL || current_policy->nrules == 0)
+		return 0;
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		for (i = 0; i < current_policy->nrules; i++)
+		{
+			policy_rule *rule = &current_policy->rules[i];
+			const char *name = pass == 0 ? backend_type : role;
+
+			if (rule->is_role != (pass == 1) || name == NULL ||
+					strcmp(rule->name, name) != 0)
+				continue;
+			matched++;
+
+#ifdef __linux__
+			if (rule->has_affinity &&
+					sched_setaffinity(pid, sizeof(cpu_set_t), &rule->cpus) < 0)
+				ereport(LOG,
+						(errmsg("pg_proctab: could not set CPU affinity of "
+								"process %d: %m", pid)));
+
+			if (rule->ioprio_class != POLICY_UNSET &&
+					syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid,
+							IOPRIO_PRIO_VALUE(rule->ioprio_class,
+									rule->ioprio_level)) < 0)
+				ereport(LOG,
+						(errmsg("pg_proctab: could not set I/O priority of "
+								"process %d: %m", pid)));
+#endif /* __linux__ */
+
+			if (rule->nice != POLICY_UNSET &&
+					setpriority(PRIO_PROCESS, pid, rule->nice) < 0)
+				ereport(LOG,
+						(errmsg("pg_proctab: could not set nice value of "
+								"process %d: %m", pid)));
+		}
+	}
+
+	return matched;
+}
+
+/*
+ * Only superusers may change scheduling, and only of PostgreSQL server
+ * processes.  Like pg_terminate_backend(), warn and return false for other
+ * pids.
+ */
+static bool
+check_target_pid(int32 pid)
+{
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to change process scheduling")));
+
+	if (BackendPidGetProc(pid) == NULL && AuxiliaryPidGetProc(pid) == NULL)
+	{
+		ereport(WARNING,
+				(errmsg("PID %d is not a PostgreSQL server process", pid)));
+		return false;
+	}
+
+	return true;
+}
+
+Datum pg_set_backend_affinity(PG_FUNCTION_ARGS)
+{
+	int32 pid = PG_GETARG_INT32(0);
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+#ifdef __linux__
+	cpu_set_t cpus;
+	Datum *elems;
+	bool *elem_nulls;
+	int nelems;
+	int i;
+#endif /* __linux__ */
+
+	if (!check_target_pid(pid))
+		PG_RETURN_BOOL(false);
+
+#ifdef __linux__
+	if (ARR_NDIM(array) > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("CPU list must be a one-dimensional array")));
+	deconstruct_array(array, INT4OID, sizeof(int32), true, 'i',
+			&elems, &elem_nulls, &nelems);
+
+	CPU_ZERO(&cpus);
+	for (i = 0; i < nelems; i++)
+	{
+		int32 cpu;
+
+		if (elem_nulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("CPU list must not contain nulls")));
+		cpu = DatumGetInt32(elems[i]);
+		if (cpu < 0 || cpu >= CPU_SETSIZE)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("CPU %d is out of range", cpu)));
+		CPU_SET(cpu, &cpus);
+	}
+	if (CPU_COUNT(&cpus) == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("CPU list must not be empty")));
+
+	if (sched_setaffinity(pid, sizeof(cpus), &cpus) < 0)
+		ereport(ERROR,
+				(errmsg("could not set CPU affinity of process %d: %m", pid)));
+
+	PG_RETURN_BOOL(true);
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("CPU affinity is not supported on this platform")));
+	PG_RETURN_BOOL(false);
+#endif /* __linux__ */
+}
+
+Datum pg_set_backend_nice(PG_FUNCTION_ARGS)
+{
+	int32 pid = PG_GETARG_INT32(0);
+	int32 nice = PG_GETARG_INT32(1);
+
+	if (!check_target_pid(pid))
+		PG_RETURN_BOOL(false);
+
+	if (nice < -20 || nice > 19)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("nice value must be between -20 and 19")));
+
+	if (setpriority(PRIO_PROCESS, pid, nice) < 0)
+		ereport(ERROR,
+				(errmsg("could not set nice value of process %d: %m", pid),
+				 errno == EACCES || errno == EPERM ?
+				 errhint("Lowering the nice value requires CAP_SYS_NICE or a "
+						 "raised RLIMIT_NICE for the server.") : 0));
+
+	PG_RETURN_BOOL(true);
+}
+
+Datum pg_set_backend_ioprio(PG_FUNCTION_ARGS)
+{
+	int32 pid = PG_GETARG_INT32(0);
+	char *class_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	int32 level = PG_GETARG_INT32(2);
+	int class;
+
+	if (!check_target_pid(pid))
+		PG_RETURN_BOOL(false);
+
+	if (!parse_ioprio_class(class_name, &class))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid I/O priority class \"%s\"", class_name),
+				 errhint("Valid classes are realtime, best-effort and idle.")));
+	if (level < 0 || level > 7)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("I/O priority level must be between 0 and 7")));
+
+#ifdef __linux__
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid,
+			IOPRIO_PRIO_VALUE(class, level)) < 0)
+		ereport(ERROR,
+				(errmsg("could not set I/O priority of process %d: %m", pid)));
+
+	PG_RETURN_BOOL(true);
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("I/O priorities are not supported on this platform")));
+	PG_RETURN_BOOL(false);
+#endif /* __linux__ */
+}
+
+/*
+ * Check a value for pg_proctab.process_policy with the same rules as setting
+ * it, without setting it, raising the error the setting would.
+ */
+Datum pg_check_process_policy(PG_FUNCTION_ARGS)
+{
+	char *policy = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	void *extra = NULL;
+
+	elog(DEBUG5, "pg_check_process_policy: Entering stored function.");
+
+	GUC_check_errdetail_string = NULL;
+	if (!check_process_policy(&policy, &extra, PGC_S_TEST))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid value for parameter \"%s\": \"%s\"",
+						"pg_proctab.process_policy", policy),
+				 GUC_check_errdetail_string ?
+				 errdetail_internal("%s", GUC_check_errdetail_string) : 0));
+	policy_free(extra);
+
+	PG_RETURN_VOID();
+}
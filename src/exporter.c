@@ -0,0 +1,765 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "access/xact.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "pg_proctab.h"
+
+#define CHECK_EXPORTER \
+		"SELECT to_regprocedure('pg_proctab()') IS NOT NULL " \
+		"AND to_regprocedure('pg_clock_ticks()') IS NOT NULL"
+
+/*
+ * Each query exports its columns after the first nlabels, which are the
+ * labels, as metric families named after the columns.  Columns ending in
+ * _total are counters and the others gauges.
+ */
+#define EXPORT_PROCESSES \
+		"SELECT p.pid, a.backend_type, a.datname, " \
+		"       p.utime::float8 / pg_clock_ticks() " \
+		"           AS process_user_cpu_seconds_total, " \
+		"       p.stime::float8 / pg_clock_ticks() " \
+		"           AS process_system_cpu_seconds_total, " \
+		"       p.rss * 1024 AS process_resident_memory_bytes, " \
+		"       p.vsize AS process_virtual_memory_bytes, " \
+		"       p.minflt AS process_minor_faults_total, " \
+		"       p.majflt AS process_major_faults_total, " \
+		"       p.reads AS process_read_bytes_total, " \
+		"       p.writes AS process_written_bytes_total " \
+		"FROM pg_proctab() p " \
+		"     JOIN pg_stat_activity a ON a.pid = p.pid " \
+		"ORDER BY p.pid"
+#define EXPORT_CPU \
+		"SELECT m.mode, m.ticks::float8 / pg_clock_ticks() " \
+		"           AS cpu_seconds_total " \
+		"FROM pg_cputime() c, " \
+		"     LATERAL (VALUES ('user', c.\"user\"), ('nice', c.nice), " \
+		"                     ('system', c.system), ('idle', c.idle), " \
+		"                     ('iowait', c.iowait)) m (mode, ticks)"
+#define EXPORT_LOAD \
+		"SELECT load1, load5, load15 " \
+		"FROM pg_loadavg()"
+#define EXPORT_MEMORY \
+		"SELECT m.type, m.kb * 1024 AS memory_bytes " \
+		"FROM pg_memusage() u, " \
+		"     LATERAL (VALUES ('used', u.memused), ('free', u.memfree), " \
+		"                     ('shared', u.memshared), " \
+		"                     ('buffers', u.membuffers), " \
+		"                     ('cached', u.memcached), " \
+		"                     ('swap_used', u.swapused), " \
+		"                     ('swap_free', u.swapfree), " \
+		"                     ('swap_cached', u.swapcached)) m (type, kb)"
+#define EXPORT_DISKS \
+		"SELECT devname AS device, " \
+		"       reads_completed AS disk_reads_completed_total, " \
+		"       writes_completed AS disk_writes_completed_total, " \
+		"       sectors_read * 512 AS disk_read_bytes_total, " \
+		"       sectors_written * 512 AS disk_written_bytes_total, " \
+		"       iotime / 1000.0 AS disk_io_time_seconds_total, " \
+		"       current_io AS disk_io_in_progress " \
+		"FROM pg_diskusage() " \
+		"ORDER BY devname"
+
+#define METRIC_PREFIX "pg_proctab_"
+#define CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/* Seconds a scraper has to send its request and take the response. */
+#define EXPORTER_IO_TIMEOUT 1
+
+typedef struct
+{
+	const char *query;
+	int nlabels;
+} exporter_source;
+
+static const exporter_source exporter_sources[] = {
+	{EXPORT_PROCESSES, 3},
+	{EXPORT_CPU, 1},
+	{EXPORT_LOAD, 0},
+	{EXPORT_MEMORY, 1},
+	{EXPORT_DISKS, 1}
+};
+
+static const struct
+{
+	const char *name;
+	const char *help;
+} exporter_help[] = {
+	{"process_user_cpu_seconds", "CPU time of the process in user mode."},
+	{"process_system_cpu_seconds", "CPU time of the process in kernel mode."},
+	{"process_resident_memory_bytes", "Resident set size of the process."},
+	{"process_virtual_memory_bytes", "Virtual memory size of the process."},
+	{"process_minor_faults", "Page faults of the process without i/o."},
+	{"process_major_faults", "Page faults of the process that read a page."},
+	{"process_read_bytes", "Bytes the process caused to be read from storage."},
+	{"process_written_bytes",
+			"Bytes the process caused to be written to storage."},
+	{"cpu_seconds", "CPU time of the system by mode."},
+	{"load1", "Load average over 1 minute."},
+	{"load5", "Load average over 5 minutes."},
+	{"load15", "Load average over 15 minutes."},
+	{"memory_bytes", "Memory of the system by type."},
+	{"disk_reads_completed", "Reads completed by the device."},
+	{"disk_writes_completed", "Writes completed by the device."},
+	{"disk_read_bytes", "Bytes read from the device."},
+	{"disk_written_bytes", "Bytes written to the device."},
+	{"disk_io_time_seconds", "Time the device spent doing i/o."},
+	{"disk_io_in_progress", "I/Os in progress on the device."}
+};
+
+/* The latest exposition, which scrapes are answered with. */
+typedef struct
+{
+	LWLock *lock;
+	TimestampTz sampled;	/* 0 before the first sample */
+	Size len;
+	char text[FLEXIBLE_ARRAY_MEMBER];
+} exporter_shared;
+
+char *exporter_listen = NULL;
+int exporter_interval = 15;
+int exporter_size = 1024;
+int exporter_socket_permissions = 0700;
+
+static exporter_shared *exporter = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+Datum pg_proctab_metrics(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_proctab_metrics);
+
+PGDLLEXPORT void pg_proctab_exporter_main(Datum);
+
+static Size exporter_shmem_size(void);
+static void exporter_shmem_request(void);
+static void exporter_shmem_startup(void);
+static void exporter_append_family(StringInfo, SPITupleTable *, int, int);
+static void exporter_sample(void);
+static const char *exporter_show_permissions(void);
+static pgsocket exporter_bind(void);
+static bool exporter_wait(pgsocket, int, TimestampTz);
+static void exporter_respond(pgsocket);
+static void exporter_unlink(int, Datum);
+
+void
+exporter_init(void)
+{
+	BackgroundWorker worker;
+
+	DefineCustomStringVariable("pg_proctab.exporter_listen",
+			"Address the pg_proctab exporter serves metrics on.",
+			"Either host:port, an empty host meaning localhost, or the "
+			"path of a Unix socket.  Empty disables the exporter.",
+			&exporter_listen,
+			"",
+			PGC_POSTMASTER,
+			0,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.exporter_interval",
+			"How often the pg_proctab exporter samples the metrics.",
+			NULL,
+			&exporter_interval,
+			15,
+			1,
+			INT_MAX / 1000,
+			PGC_SIGHUP,
+			GUC_UNIT_S,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.exporter_size",
+			"Shared memory set aside for the exported metrics.",
+			NULL,
+			&exporter_size,
+			1024,
+			64,
+			INT_MAX / 1024,
+			PGC_POSTMASTER,
+			GUC_UNIT_KB,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.exporter_socket_permissions",
+			"Access permissions of the pg_proctab exporter Unix socket.",
+			"Given in the numeric mode chmod accepts.",
+			&exporter_socket_permissions,
+			0700,
+			0000,
+			0777,
+			PGC_POSTMASTER,
+			0,
+			NULL,
+			NULL,
+			exporter_show_permissions);
+
+	if (!process_shared_preload_libraries_in_progress ||
+			exporter_listen[0] == '\0')
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = exporter_shmem_request;
+#else
+	exporter_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = exporter_shmem_startup;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 10;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_proctab");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN,
+			"pg_proctab_exporter_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_proctab exporter");
+	snprintf(worker.bgw_type, BGW_MAXLEN, "pg_proctab exporter");
+	worker.bgw_main_arg = (Datum) 0;
+	worker.bgw_notify_pid = 0;
+
+	RegisterBackgroundWorker(&worker);
+}
+
+static Size
+exporter_shmem_size(void)
+{
+	return add_size(offsetof(exporter_shared, text),
+			mul_size(exporter_size, 1024));
+}
+
+static void
+exporter_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(exporter_shmem_size());
+	RequestNamedLWLockTranche("pg_proctab exporter", 1);
+}
+
+static void
+exporter_shmem_startup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	exporter = ShmemInitStruct("pg_proctab exporter", exporter_shmem_size(),
+			&found);
+	if (!found)
+	{
+		exporter->lock = &(GetNamedLWLockTranche("pg_proctab exporter"))->lock;
+		exporter->sampled = 0;
+		exporter->len = 0;
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Append the family of column column of a source's rows, one sample per row
+ * labelled with the first nlabels columns.  NULL labels are left out, and
+ * rows without a value are skipped.
+ */
+static void
+exporter_append_family(StringInfo buf, SPITupleTable *tuptable, int nlabels,
+		int column)
+{
+	TupleDesc tupdesc = tuptable->tupdesc;
+	char *sample = SPI_fname(tupdesc, column);
+	char *family = pstrdup(sample);
+	size_t len = strlen(family);
+	bool counter = false;
+	uint64 i;
+	int j;
+
+	if (len > 6 && strcmp(family + len - 6, "_total") == 0)
+	{
+		family[len - 6] = '\0';
+		counter = true;
+	}
+
+	for (j = 0; j < lengthof(exporter_help); j++)
+		if (strcmp(exporter_help[j].name, family) == 0)
+			appendStringInfo(buf, "# HELP " METRIC_PREFIX "%s %s\n", family,
+					exporter_help[j].help);
+	appendStringInfo(buf, "# TYPE " METRIC_PREFIX "%s %s\n", family,
+			counter ? "counter" : "gauge");
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple tuple = tuptable->vals[i];
+		char *value = SPI_getvalue(tuple, tupdesc, column);
+		bool first = true;
+
+		if (value == NULL)
+			continue;
+
+		appendStringInfoString(buf, METRIC_PREFIX);
+		appendStringInfoString(buf, sample);
+		for (j = 1; j <= nlabels; j++)
+		{
+			char *label = SPI_getvalue(tuple, tupdesc, j);
+			char *c;
+
+			if (label == NULL)
+				continue;
+
+			appendStringInfo(buf, "%c%s=\"", first ? '{' : ',',
+					SPI_fname(tupdesc, j));
+			for (c = label; *c != '\0'; c++)
+			{
+				if (*c == '\\' || *c == '"')
+					appendStringInfoChar(buf, '\\');
+				if (*c == '\n')
+					appendStringInfoString(buf, "\\n");
+				else
+					appendStringInfoChar(buf, *c);
+			}
+			appendStringInfoChar(buf, '"');
+			first = false;
+		}
+		if (!first)
+			appendStringInfoChar(buf, '}');
+		appendStringInfo(buf, " %s\n", value);
+	}
+}
+
+/*
+ * Run the queries of every source in pg_proctab.database and replace the
+ * exposition in shared memory with their results.  While pg_proctab is
+ * missing there, the exposition is empty, which is reported once.
+ */
+static void
+exporter_sample(void)
+{
+	static bool reported = false;
+	StringInfoData buf;
+	int ret;
+	int i;
+	int j;
+
+	initStringInfo(&buf);
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "sampling metrics");
+
+	if (SPI_execute(CHECK_EXPORTER, true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "pg_proctab exporter: %s failed", CHECK_EXPORTER);
+
+	if (strcmp(SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1),
+			"t") == 0)
+	{
+		for (i = 0; i < lengthof(exporter_sources); i++)
+		{
+			ret = SPI_execute(exporter_sources[i].query, true, 0);
+			if (ret != SPI_OK_SELECT)
+				elog(ERROR, "pg_proctab exporter: %s failed: %s",
+						exporter_sources[i].query,
+						SPI_result_code_string(ret));
+
+			for (j = exporter_sources[i].nlabels + 1;
+					j <= SPI_tuptable->tupdesc->natts; j++)
+				exporter_append_family(&buf, SPI_tuptable,
+						exporter_sources[i].nlabels, j);
+		}
+		reported = false;
+	}
+	else if (!reported)
+	{
+		ereport(LOG,
+				(errmsg("pg_proctab exporter: not exporting metrics, "
+						"pg_proctab is missing in database \"%s\"",
+						worker_database)));
+		reported = true;
+	}
+	appendStringInfoString(&buf, "# EOF\n");
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_stat(false);
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	if (buf.len > mul_size(exporter_size, 1024))
+	{
+		ereport(WARNING,
+				(errmsg("pg_proctab exporter: pg_proctab.exporter_size is "
+						"too small for the metrics"),
+				 errhint("%d kB are needed.", (buf.len + 1023) / 1024)));
+		pfree(buf.data);
+		return;
+	}
+
+	LWLockAcquire(exporter->lock, LW_EXCLUSIVE);
+	memcpy(exporter->text, buf.data, buf.len);
+	exporter->len = buf.len;
+	exporter->sampled = GetCurrentTimestamp();
+	LWLockRelease(exporter->lock);
+
+	pfree(buf.data);
+}
+
+/*
+ * Show pg_proctab.exporter_socket_permissions in octal, as
+ * unix_socket_permissions is.
+ */
+static const char *
+exporter_show_permissions(void)
+{
+	static char buf[12];
+
+	snprintf(buf, sizeof(buf), "%04o", exporter_socket_permissions);
+	return buf;
+}
+
+/*
+ * Create the socket pg_proctab.exporter_listen names, either host:port, with
+ * an empty host meaning localhost, or the path of a Unix socket.  Anyone who
+ * can connect can scrape, so nothing listens on every address unless asked
+ * to, and the Unix socket gets pg_proctab.exporter_socket_permissions.
+ */
+static pgsocket
+exporter_bind(void)
+{
+	pgsocket sock = PGINVALID_SOCKET;
+	int one = 1;
+
+	if (exporter_listen[0] == '/')
+	{
+		struct sockaddr_un addr;
+
+		if (strlen(exporter_listen) >= sizeof(addr.sun_path))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("Unix socket path \"%s\" is too long",
+							exporter_listen)));
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, exporter_listen);
+		(void) unlink(exporter_listen);
+
+		if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == PGINVALID_SOCKET ||
+				bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+			ereport(ERROR,
+					(errcode_for_socket_access(),
+					 errmsg("could not bind Unix socket \"%s\": %m",
+							exporter_listen)));
+		on_proc_exit(exporter_unlink, (Datum) 0);
+
+		if (chmod(exporter_listen, exporter_socket_permissions) < 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not set permissions of file \"%s\": %m",
+							exporter_listen)));
+	}
+	else
+	{
+		struct addrinfo hints;
+		struct addrinfo *addrs;
+		struct addrinfo *addr;
+		char *host = pstrdup(exporter_listen);
+		char *port = strrchr(host, ':');
+		int ret;
+
+		if (port == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("pg_proctab.exporter_listen must be host:port "
+							"or an absolute path")));
+		*port++ = '\0';
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		ret = getaddrinfo(host[0] == '\0' ? "localhost" : host, port,
+				&hints, &addrs);
+		if (ret != 0)
+			ereport(ERROR,
+					(errmsg("could not resolve \"%s\": %s", exporter_listen,
+							gai_strerror(ret))));
+
+		for (addr = addrs; addr != NULL; addr = addr->ai_next)
+		{
+			sock = socket(addr->ai_family, addr->ai_socktype,
+					addr->ai_protocol);
+			if (sock == PGINVALID_SOCKET)
+				continue;
+			(void) setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one,
+					sizeof(one));
+			if (bind(sock, addr->ai_addr, addr->ai_addrlen) == 0)
+				break;
+			closesocket(sock);
+			sock = PGINVALID_SOCKET;
+		}
+		freeaddrinfo(addrs);
+
+		if (sock == PGINVALID_SOCKET)
+			ereport(ERROR,
+					(errcode_for_socket_access(),
+					 errmsg("could not bind \"%s\": %m", exporter_listen)));
+	}
+
+	if (listen(sock, 16) < 0 || !pg_set_noblock(sock))
+		ereport(ERROR,
+				(errcode_for_socket_access(),
+				 errmsg("could not listen on \"%s\": %m", exporter_listen)));
+
+	return sock;
+}
+
+static void
+exporter_unlink(int code, Datum arg)
+{
+	(void) unlink(exporter_listen);
+}
+
+/*
+ * Wait for the client to be ready for the events until the deadline.
+ */
+static bool
+exporter_wait(pgsocket sock, int events, TimestampTz deadline)
+{
+	long timeout;
+
+	timeout = TimestampDifferenceMilliseconds(GetCurrentTimestamp(),
+			deadline);
+	if (timeout <= 0)
+		return false;
+
+	return (WaitLatchOrSocket(NULL,
+			events | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+			sock, timeout, PG_WAIT_EXTENSION) & events) != 0;
+}
+
+/*
+ * Answer one scrape with the exposition.  Requests for anything but /metrics
+ * or / get a 404.  The socket is non-blocking and a client that has not sent
+ * its request and taken the response within EXPORTER_IO_TIMEOUT is dropped,
+ * so that it cannot hold up the sampling.
+ */
+static void
+exporter_respond(pgsocket sock)
+{
+	TimestampTz deadline;
+	char request[1024];
+	size_t len = 0;
+	StringInfoData buf;
+	char *p;
+	ssize_t ret;
+
+	if (!pg_set_noblock(sock))
+		return;
+	deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+			EXPORTER_IO_TIMEOUT * 1000);
+
+	/* Only the request line matters, but take the headers too. */
+	while (len < sizeof(request) - 1)
+	{
+		ret = recv(sock, request + len, sizeof(request) - 1 - len, 0);
+		if (ret < 0 &&
+				(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		{
+			if (!exporter_wait(sock, WL_SOCKET_READABLE, deadline))
+				return;
+			continue;
+		}
+		if (ret <= 0)
+			break;
+		len += ret;
+		request[len] = '\0';
+		if (strstr(request, "\r\n\r\n") != NULL ||
+				strstr(request, "\n\n") != NULL)
+			break;
+	}
+	request[len] = '\0';
+
+	initStringInfo(&buf);
+	if (strncmp(request, "GET /metrics ", 13) == 0 ||
+			strncmp(request, "GET / ", 6) == 0)
+	{
+		LWLockAcquire(exporter->lock, LW_SHARED);
+		appendStringInfo(&buf,
+				"HTTP/1.0 200 OK\r\n"
+				"Content-Type: " CONTENT_TYPE "\r\n"
+				"Content-Length: %zu\r\n"
+				"Connection: close\r\n"
+				"\r\n", exporter->len);
+		appendBinaryStringInfo(&buf, exporter->text, exporter->len);
+		LWLockRelease(exporter->lock);
+	}
+	else
+		appendStringInfoString(&buf,
+				"HTTP/1.0 404 Not Found\r\n"
+				"Content-Length: 0\r\n"
+				"Connection: close\r\n"
+				"\r\n");
+
+	p = buf.data;
+	while (p < buf.data + buf.len)
+	{
+#ifdef MSG_NOSIGNAL
+		ret = send(sock, p, buf.data + buf.len - p, MSG_NOSIGNAL);
+#else
+		ret = send(sock, p, buf.data + buf.len - p, 0);
+#endif
+		if (ret < 0 &&
+				(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		{
+			if (!exporter_wait(sock, WL_SOCKET_WRITEABLE, deadline))
+				break;
+			continue;
+		}
+		if (ret <= 0)
+			break;
+		p += ret;
+	}
+
+	pfree(buf.data);
+}
+
+void
+pg_proctab_exporter_main(Datum main_arg)
+{
+	TimestampTz last_sample = 0;
+	pgsocket listener;
+
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnection(worker_database, NULL, 0);
+
+	listener = exporter_bind();
+
+	elog(LOG, "pg_proctab exporter listening on \"%s\"", exporter_listen);
+
+	while (!ShutdownRequestPending)
+	{
+		TimestampTz now;
+		long timeout;
+		int rc;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		now = GetCurrentTimestamp();
+		timeout = TimestampDifferenceMilliseconds(now,
+				TimestampTzPlusMilliseconds(last_sample,
+				exporter_interval * 1000L));
+		if (timeout <= 0)
+		{
+			exporter_sample();
+			last_sample = now;
+			timeout = exporter_interval * 1000L;
+		}
+
+		rc = WaitLatchOrSocket(MyLatch,
+				WL_LATCH_SET | WL_TIMEOUT | WL_SOCKET_READABLE |
+				WL_EXIT_ON_PM_DEATH,
+				listener, timeout, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+
+		if (rc & WL_SOCKET_READABLE)
+		{
+			pgsocket client;
+
+			/* Leave the clients still queued once a sample is due. */
+			for (;;)
+			{
+				client = accept(listener, NULL, NULL);
+				if (client == PGINVALID_SOCKET)
+				{
+					if (errno != EAGAIN && errno != EWOULDBLOCK &&
+							errno != EINTR)
+						ereport(LOG,
+								(errcode_for_socket_access(),
+								 errmsg("pg_proctab exporter: could not "
+										"accept connection: %m")));
+					break;
+				}
+				exporter_respond(client);
+				closesocket(client);
+
+				if (TimestampDifferenceExceeds(last_sample,
+						GetCurrentTimestamp(), exporter_interval * 1000))
+					break;
+			}
+		}
+	}
+
+	closesocket(listener);
+
+	proc_exit(0);
+}
+
+/*
+ * Return the exposition the exporter serves, or NULL when it is not running.
+ */
+Datum pg_proctab_metrics(PG_FUNCTION_ARGS)
+{
+	text *result;
+
+	elog(DEBUG5, "pg_proctab_metrics: Entering stored function.");
+
+	if (exporter == NULL)
+		PG_RETURN_NULL();
+
+	LWLockAcquire(exporter->lock, LW_SHARED);
+	if (exporter->sampled == 0)
+	{
+		LWLockRelease(exporter->lock);
+		PG_RETURN_NULL();
+	}
+	result = cstring_to_text_with_len(exporter->text, exporter->len);
+	LWLockRelease(exporter->lock);
+
+	PG_RETURN_TEXT_P(result);
+}
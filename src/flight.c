@@ -0,0 +1,507 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "access/xact.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "port/pg_crc32c.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pg_proctab.h"
+
+/*
+ * The flight recorder file is a header followed by a ring of fixed size
+ * slots, record n of the samples taken since the file was created being in
+ * slot n % nslots.  Nothing but the pg_proctab worker writes it and the file
+ * is mapped shared, so what was written survives the server being killed,
+ * and it is synced after every sample to survive the host going down too.
+ * Every record has its own checksum, so records torn by a crash, or being
+ * written while they are read, are skipped.
+ */
+#define FLIGHT_MAGIC 0x50475046		/* "PGPF" */
+#define FLIGHT_VERSION 1
+#define FLIGHT_HEADER_SIZE 4096
+#define FLIGHT_SLOT_SIZE 256
+#define FLIGHT_NAME_LEN 32
+#define FLIGHT_MAX_VALUES 24
+
+typedef struct
+{
+	uint32 magic;
+	uint32 version;
+	uint32 slot_size;
+	uint32 nslots;
+	uint64 next;			/* the next record to write */
+} flight_header;
+
+typedef struct
+{
+	pg_crc32c crc;			/* of the rest of the slot */
+	uint16 kind;			/* FLIGHT_* below, 0 for an empty slot */
+	uint16 nvalues;
+	uint32 nulls;			/* bit i set if value i is NULL */
+	int32 pid;
+	uint64 seq;
+	TimestampTz sampled;
+	char name[FLIGHT_NAME_LEN];
+	int64 values[FLIGHT_MAX_VALUES];
+} flight_slot;
+
+StaticAssertDecl(sizeof(flight_slot) <= FLIGHT_SLOT_SIZE,
+		"flight_slot does not fit in a slot");
+
+enum flight_kind {FLIGHT_PROCTAB = 1, FLIGHT_CPUTIME, FLIGHT_MEMUSAGE,
+		FLIGHT_DISKUSAGE};
+
+/*
+ * What is recorded of each function.  Every row becomes a record with the
+ * pid and name columns, where given, and the metrics, in this order.
+ */
+static const struct
+{
+	const char *kind;
+	const char *function;
+	const char *pid;
+	const char *name;
+	const char *metrics[FLIGHT_MAX_VALUES];
+} flight_sources[] = {
+	{NULL},
+	{"proctab", "pg_proctab()", "pid", "comm",
+		{"ppid", "minflt", "majflt", "utime", "stime", "priority", "nice",
+		 "num_threads", "starttime", "vsize", "rss", "processor",
+		 "delayacct_blkio_ticks", "uid", "rchar", "wchar", "syscr", "syscw",
+		 "reads", "writes", "cwrites", NULL}},
+	{"cputime", "pg_cputime()", NULL, NULL,
+		{"user", "nice", "system", "idle", "iowait", NULL}},
+	{"memusage", "pg_memusage()", NULL, NULL,
+		{"memused", "memfree", "memshared", "membuffers", "memcached",
+		 "swapused", "swapfree", "swapcached", NULL}},
+	{"diskusage", "pg_diskusage()", NULL, "devname",
+		{"major", "minor", "reads_completed", "reads_merged",
+		 "sectors_read", "readtime", "writes_completed", "writes_merged",
+		 "sectors_written", "writetime", "current_io", "iotime",
+		 "totaliotime", "discards_completed", "discards_merged",
+		 "sectors_discarded", "discardtime", "flushes_completed",
+		 "flushtime", NULL}}
+};
+
+#define CHECK_FLIGHT \
+		"SELECT to_regprocedure('pg_proctab()') IS NOT NULL"
+
+enum flight_recorder {i_f_sampled, i_f_kind, i_f_pid, i_f_name, i_f_metric,
+		i_f_value};
+
+#define FLIGHT_NCOLS 6
+
+int flight_recorder_interval = 0;
+int flight_recorder_size = 64;
+char *flight_recorder_file = NULL;
+
+static char *flight_map = NULL;
+static Size flight_map_size = 0;
+
+Datum pg_proctab_flight_recorder(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_proctab_flight_recorder);
+
+static void flight_open(void);
+static void flight_append(flight_header *, flight_slot *);
+static pg_crc32c flight_crc(flight_slot *);
+static int flight_seq_cmp(const void *, const void *);
+
+void
+flight_init(void)
+{
+	DefineCustomIntVariable("pg_proctab.flight_recorder_interval",
+			"How often the pg_proctab worker records a sample in the flight "
+			"recorder.",
+			"Zero disables the flight recorder.",
+			&flight_recorder_interval,
+			0,
+			0,
+			INT_MAX / 1000,
+			PGC_SIGHUP,
+			GUC_UNIT_S,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.flight_recorder_size",
+			"Size of the flight recorder file.",
+			"Changing it discards what was recorded.",
+			&flight_recorder_size,
+			64,
+			1,
+			INT_MAX / 1024 / 1024,
+			PGC_POSTMASTER,
+			GUC_UNIT_MB,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomStringVariable("pg_proctab.flight_recorder_file",
+			"Flight recorder file, relative to the data directory.",
+			NULL,
+			&flight_recorder_file,
+			"pg_proctab.flight",
+			PGC_POSTMASTER,
+			0,
+			NULL,
+			NULL,
+			NULL);
+}
+
+static pg_crc32c
+flight_crc(flight_slot *record)
+{
+	pg_crc32c crc;
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, (char *) record + sizeof(pg_crc32c),
+			sizeof(flight_slot) - sizeof(pg_crc32c));
+	FIN_CRC32C(crc);
+
+	return crc;
+}
+
+/*
+ * Map the flight recorder file, creating it at its full size first.  A file
+ * of another layout is started over.
+ */
+static void
+flight_open(void)
+{
+	flight_header *header;
+	uint32 nslots;
+	int fd;
+
+	nslots = ((Size) flight_recorder_size * 1024 * 1024 - FLIGHT_HEADER_SIZE) /
+			FLIGHT_SLOT_SIZE;
+	flight_map_size = FLIGHT_HEADER_SIZE + (Size) nslots * FLIGHT_SLOT_SIZE;
+
+	fd = OpenTransientFile(flight_recorder_file, O_RDWR | O_CREAT | PG_BINARY);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m",
+						flight_recorder_file)));
+
+#ifdef HAVE_POSIX_FALLOCATE
+	if (posix_fallocate(fd, 0, flight_map_size) != 0)
+#else
+	if (ftruncate(fd, flight_map_size) < 0)
+#endif
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not allocate file \"%s\": %m",
+						flight_recorder_file)));
+
+	flight_map = mmap(NULL, flight_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	CloseTransientFile(fd);
+	if (flight_map == MAP_FAILED)
+	{
+		flight_map = NULL;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not map file \"%s\": %m",
+						flight_recorder_file)));
+	}
+
+	header = (flight_header *) flight_map;
+	if (header->magic != FLIGHT_MAGIC || header->version != FLIGHT_VERSION ||
+			header->slot_size != FLIGHT_SLOT_SIZE ||
+			header->nslots != nslots)
+	{
+		memset(flight_map, 0, flight_map_size);
+		header->magic = FLIGHT_MAGIC;
+		header->version = FLIGHT_VERSION;
+		header->slot_size = FLIGHT_SLOT_SIZE;
+		header->nslots = nslots;
+		header->next = 0;
+	}
+}
+
+static void
+flight_append(flight_header *header, flight_slot *record)
+{
+	record->seq = header->next++;
+	record->crc = flight_crc(record);
+	memcpy(flight_map + FLIGHT_HEADER_SIZE +
+			(record->seq % header->nslots) * FLIGHT_SLOT_SIZE,
+			record, sizeof(flight_slot));
+}
+
+/*
+ * Record a sample of every source in the flight recorder.  Called by the
+ * pg_proctab worker every pg_proctab.flight_recorder_interval seconds.
+ */
+void
+flight_record(void)
+{
+	static bool reported = false;
+	flight_header *header;
+	TimestampTz now = GetCurrentTimestamp();
+	StringInfoData query;
+	int kind;
+	int i;
+	uint64 row;
+
+	if (flight_map == NULL)
+		flight_open();
+	header = (flight_header *) flight_map;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "recording flight recorder sample");
+
+	if (SPI_execute(CHECK_FLIGHT, true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "pg_proctab worker: %s failed", CHECK_FLIGHT);
+
+	if (strcmp(SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1),
+			"t") != 0)
+	{
+		if (!reported)
+			ereport(LOG,
+					(errmsg("pg_proctab worker: not recording, pg_proctab "
+							"is missing in database \"%s\"",
+							worker_database)));
+		reported = true;
+		kind = lengthof(flight_sources);
+	}
+	else
+	{
+		reported = false;
+		kind = FLIGHT_PROCTAB;
+	}
+
+	initStringInfo(&query);
+	for (; kind < lengthof(flight_sources); kind++)
+	{
+		int ret;
+
+		resetStringInfo(&query);
+		appendStringInfo(&query, "SELECT %s, %s",
+				flight_sources[kind].pid ? flight_sources[kind].pid : "NULL",
+				flight_sources[kind].name ? flight_sources[kind].name : "NULL");
+		for (i = 0; flight_sources[kind].metrics[i] != NULL; i++)
+			appendStringInfo(&query, ", %s::bigint",
+					quote_identifier(flight_sources[kind].metrics[i]));
+		appendStringInfo(&query, " FROM %s", flight_sources[kind].function);
+
+		ret = SPI_execute(query.data, true, 0);
+		if (ret != SPI_OK_SELECT)
+			elog(ERROR, "pg_proctab worker: %s failed: %s", query.data,
+					SPI_result_code_string(ret));
+
+		for (row = 0; row < SPI_processed; row++)
+		{
+			HeapTuple tuple = SPI_tuptable->vals[row];
+			TupleDesc tupdesc = SPI_tuptable->tupdesc;
+			flight_slot record;
+			char *pid;
+			char *name;
+			bool isnull;
+
+			memset(&record, 0, sizeof(record));
+			record.kind = kind;
+			record.sampled = now;
+			pid = SPI_getvalue(tuple, tupdesc, 1);
+			if (pid != NULL)
+				record.pid = atoi(pid);
+			name = SPI_getvalue(tuple, tupdesc, 2);
+			if (name != NULL)
+				strlcpy(record.name, name, FLIGHT_NAME_LEN);
+			record.nvalues = tupdesc->natts - 2;
+			for (i = 0; i < record.nvalues; i++)
+			{
+				Datum value = SPI_getbinval(tuple, tupdesc, i + 3, &isnull);
+
+				if (isnull)
+					record.nulls |= 1 << i;
+				else
+					record.values[i] = DatumGetInt64(value);
+			}
+
+			flight_append(header, &record);
+		}
+	}
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_stat(false);
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	if (msync(flight_map, flight_map_size, MS_SYNC) < 0)
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not sync file \"%s\": %m",
+						flight_recorder_file)));
+}
+
+static int
+flight_seq_cmp(const void *a, const void *b)
+{
+	uint64 sa = (*(flight_slot *const *) a)->seq;
+	uint64 sb = (*(flight_slot *const *) b)->seq;
+
+	return sa < sb ? -1 : sa > sb;
+}
+
+/*
+ * Decode the records of the flight recorder sampled between from and to, a
+ * NULL bound being open, one row per metric, oldest first.  This reads the
+ * file itself, so it works after a crash, and while the recorder is off.
+ */
+Datum pg_proctab_flight_recorder(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+	Datum values[FLIGHT_NCOLS];
+	bool nulls[FLIGHT_NCOLS];
+	flight_header header;
+	flight_slot **records;
+	char *map;
+	struct stat st;
+	int nrecords = 0;
+	uint32 slot;
+	int fd;
+	int i;
+	int j;
+
+	elog(DEBUG5, "pg_proctab_flight_recorder: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	fd = OpenTransientFile(flight_recorder_file, O_RDONLY | PG_BINARY);
+	if (fd < 0)
+	{
+		if (errno == ENOENT)
+			return (Datum) 0;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m",
+						flight_recorder_file)));
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < FLIGHT_HEADER_SIZE)
+	{
+		CloseTransientFile(fd);
+		return (Datum) 0;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	CloseTransientFile(fd);
+	if (map == MAP_FAILED)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not map file \"%s\": %m",
+						flight_recorder_file)));
+
+	memcpy(&header, map, sizeof(header));
+	if (header.magic != FLIGHT_MAGIC || header.version != FLIGHT_VERSION ||
+			header.slot_size != FLIGHT_SLOT_SIZE ||
+			FLIGHT_HEADER_SIZE + (Size) header.nslots * FLIGHT_SLOT_SIZE >
+			st.st_size)
+	{
+		munmap(map, st.st_size);
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("\"%s\" is not a flight recorder file",
+						flight_recorder_file)));
+	}
+
+	/* Copy the records in range out, as the worker may be overwriting them. */
+	records = (flight_slot **) palloc(sizeof(flight_slot *) *
+			Max(header.nslots, 1));
+	for (slot = 0; slot < header.nslots; slot++)
+	{
+		flight_slot *record = (flight_slot *) palloc(sizeof(flight_slot));
+
+		memcpy(record, map + FLIGHT_HEADER_SIZE + (Size) slot *
+				FLIGHT_SLOT_SIZE, sizeof(flight_slot));
+		if (record->kind == 0 || record->kind >= lengthof(flight_sources) ||
+				record->nvalues > FLIGHT_MAX_VALUES ||
+				record->crc != flight_crc(record) ||
+				(!PG_ARGISNULL(0) &&
+				 record->sampled < PG_GETARG_TIMESTAMPTZ(0)) ||
+				(!PG_ARGISNULL(1) &&
+				 record->sampled > PG_GETARG_TIMESTAMPTZ(1)))
+		{
+			pfree(record);
+			continue;
+		}
+		records[nrecords++] = record;
+	}
+	munmap(map, st.st_size);
+
+	qsort(records, nrecords, sizeof(flight_slot *), flight_seq_cmp);
+
+	for (i = 0; i < nrecords; i++)
+	{
+		flight_slot *record = records[i];
+
+		memset(nulls, false, sizeof(nulls));
+		values[i_f_sampled] = TimestampTzGetDatum(record->sampled);
+		values[i_f_kind] =
+				CStringGetTextDatum(flight_sources[record->kind].kind);
+		values[i_f_pid] = Int32GetDatum(record->pid);
+		nulls[i_f_pid] = flight_sources[record->kind].pid == NULL;
+		record->name[FLIGHT_NAME_LEN - 1] = '\0';
+		values[i_f_name] = CStringGetTextDatum(record->name);
+		nulls[i_f_name] = flight_sources[record->kind].name == NULL;
+
+		for (j = 0; j < record->nvalues &&
+				flight_sources[record->kind].metrics[j] != NULL; j++)
+		{
+			values[i_f_metric] = CStringGetTextDatum(
+					flight_sources[record->kind].metrics[j]);
+			values[i_f_value] = Int64GetDatum(record->values[j]);
+			nulls[i_f_value] = (record->nulls & (1 << j)) != 0;
+			tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+		}
+	}
+
+	return (Datum) 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "commands/tablespace.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+#include <stdlib.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include "pg_proctab.h"
+
+enum fsusage {i_fs_name, i_fs_path, i_fs_mount_point, i_fs_fs_type,
+		i_fs_device, i_fs_bytes_total, i_fs_bytes_free, i_fs_bytes_reserved,
+		i_fs_bytes_available, i_fs_inodes_total, i_fs_inodes_free,
+		i_fs_inodes_reserved, i_fs_inodes_available};
+
+#define FSUSAGE_NCOLS 13
+
+/* A line of /proc/self/mountinfo. */
+typedef struct
+{
+	char *mount_point;
+	char *fs_type;
+	char *device;
+} mount_entry;
+
+Datum pg_fsusage(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_fsusage);
+
+#ifdef __linux__
+static void unescape_mount(char *);
+static mount_entry *read_mounts(int *);
+static mount_entry *find_mount(mount_entry *, int, const char *);
+static void put_fsusage(Tuplestorestate *, TupleDesc, mount_entry *, int,
+		const char *, const char *);
+
+/* Undo the octal escapes of spaces, tabs and newlines in mountinfo. */
+static void
+unescape_mount(char *s)
+{
+	char *p = s;
+
+	while (*s != '\0')
+	{
+		if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' &&
+				s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7')
+		{
+			*p++ = (char) ((s[1] - '0') * 64 + (s[2] - '0') * 8 +
+					(s[3] - '0'));
+			s += 4;
+		}
+		else
+			*p++ = *s++;
+	}
+	*p = '\0';
+}
+
+/*
+ * Read the mount points, file system types and devices of /proc/self/mountinfo,
+ * in the order they were mounted.
+ */
+static mount_entry *
+read_mounts(int *nmounts)
+{
+	char path[MAXPGPATH];
+	char line[MAXPGPATH * 2];
+	mount_entry *mounts;
+	int size = 32;
+	FILE *fp;
+
+	*nmounts = 0;
+	mounts = (mount_entry *) palloc(sizeof(mount_entry) * size);
+
+	snprintf(path, sizeof(path), "%s/self/mountinfo", PROCFS);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		return mounts;
+
+	/*
+	 * Lines such as "36 35 98:0 / /mnt rw,noatime shared:1 - ext4 /dev/sda1
+	 * rw", with any number of optional fields before the "-".
+	 */
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char *fields[5];
+		char *separator;
+		char *fs_type;
+		char *device;
+		char *p = line;
+		int i;
+
+		line[strcspn(line, "\n")] = '\0';
+		for (i = 0; i < 5 && p != NULL; i++)
+		{
+			fields[i] = p;
+			if ((p = strchr(p, ' ')) != NULL)
+				*p++ = '\0';
+		}
+		if (i < 5 || p == NULL || (separator = strstr(p, " - ")) == NULL)
+			continue;
+
+		fs_type = separator + 3;
+		if ((device = strchr(fs_type, ' ')) == NULL)
+			continue;
+		*device++ = '\0';
+		device[strcspn(device, " ")] = '\0';
+
+		if (*nmounts == size)
+		{
+			size *= 2;
+			mounts = (mount_entry *) repalloc(mounts,
+					sizeof(mount_entry) * size);
+		}
+		unescape_mount(fields[4]);
+		unescape_mount(device);
+		mounts[*nmounts].mount_point = pstrdup(fields[4]);
+		mounts[*nmounts].fs_type = pstrdup(fs_type);
+		mounts[*nmounts].device = pstrdup(device);
+		(*nmounts)++;
+	}
+	FreeFile(fp);
+
+	return mounts;
+}
+
+/*
+ * Return the mount a resolved path is on, the one with the longest mount point
+ * the path is under, the last mounted one of those mounted over each other.
+ */
+static mount_entry *
+find_mount(mount_entry *mounts, int nmounts, const char *path)
+{
+	mount_entry *found = NULL;
+	size_t found_len = 0;
+	int i;
+
+	for (i = 0; i < nmounts; i++)
+	{
+		size_t len = strlen(mounts[i].mount_point);
+
+		/* "/" is the prefix of every path. */
+		if (len == 1)
+			len = 0;
+		if (strncmp(path, mounts[i].mount_point, len) != 0 ||
+				(path[len] != '/' && path[len] != '\0'))
+			continue;
+		if (found == NULL || len >= found_len)
+		{
+			found = &mounts[i];
+			found_len = len;
+		}
+	}
+
+	return found;
+}
+
+/* Add the row of the file system a directory is on. */
+static void
+put_fsusage(Tuplestorestate *tupleStore, TupleDesc tupleDesc,
+		mount_entry *mounts, int nmounts, const char *name, const char *path)
+{
+	Datum values[FSUSAGE_NCOLS];
+	bool nulls[FSUSAGE_NCOLS];
+	struct statvfs st;
+	mount_entry *mount;
+	char *resolved;
+	int64 frsize;
+
+	/* pg_wal and tablespaces are usually links to other file systems. */
+	if ((resolved = realpath(path, NULL)) == NULL)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not resolve \"%s\": %m", path)));
+		return;
+	}
+	if (statvfs(resolved, &st) != 0)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not stat file system of \"%s\": %m",
+						resolved)));
+		free(resolved);
+		return;
+	}
+
+	memset(nulls, false, sizeof(nulls));
+	values[i_fs_name] = CStringGetTextDatum(name);
+	values[i_fs_path] = CStringGetTextDatum(resolved);
+
+	mount = find_mount(mounts, nmounts, resolved);
+	free(resolved);
+	if (mount != NULL)
+	{
+		values[i_fs_mount_point] = CStringGetTextDatum(mount->mount_point);
+		values[i_fs_fs_type] = CStringGetTextDatum(mount->fs_type);
+		values[i_fs_device] = CStringGetTextDatum(mount->device);
+	}
+	else
+	{
+		nulls[i_fs_mount_point] = true;
+		nulls[i_fs_fs_type] = true;
+		nulls[i_fs_device] = true;
+	}
+
+	/*
+	 * The blocks free include those reserved for the superuser, which the
+	 * server, not running as root, cannot use.
+	 */
+	frsize = st.f_frsize != 0 ? st.f_frsize : st.f_bsize;
+	values[i_fs_bytes_total] = Int64GetDatum(frsize * st.f_blocks);
+	values[i_fs_bytes_free] = Int64GetDatum(frsize * st.f_bfree);
+	values[i_fs_bytes_reserved] =
+			Int64GetDatum(frsize * (st.f_bfree - st.f_bavail));
+	values[i_fs_bytes_available] = Int64GetDatum(frsize * st.f_bavail);
+
+	/* File systems without a fixed number of inodes report 0. */
+	values[i_fs_inodes_total] = Int64GetDatum(st.f_files);
+	values[i_fs_inodes_free] = Int64GetDatum(st.f_ffree);
+	values[i_fs_inodes_reserved] = Int64GetDatum(st.f_ffree - st.f_favail);
+	values[i_fs_inodes_available] = Int64GetDatum(st.f_favail);
+
+	tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+}
+#endif /* __linux__ */
+
+/*
+ * The capacity of the file systems the data directory, pg_wal and every
+ * tablespace are on.  The data directory is named after pg_default, which is
+ * where pg_global lives too.
+ */
+Datum pg_fsusage(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	char path[MAXPGPATH];
+	mount_entry *mounts;
+	int nmounts;
+	DIR *dir;
+	struct dirent *de;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_fsusage: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	mounts = read_mounts(&nmounts);
+
+	put_fsusage(tupleStore, tupleDesc, mounts, nmounts, "pg_default",
+			DataDir);
+	snprintf(path, sizeof(path), "%s/pg_wal", DataDir);
+	put_fsusage(tupleStore, tupleDesc, mounts, nmounts, "pg_wal", path);
+
+	/* Every tablespace has a link, or a directory, named after its oid. */
+	snprintf(path, sizeof(path), "%s/pg_tblspc", DataDir);
+	dir = AllocateDir(path);
+	while ((de = ReadDir(dir, path)) != NULL)
+	{
+		char location[MAXPGPATH];
+		char *name;
+		Oid spcoid;
+
+		if (strspn(de->d_name, "0123456789") != strlen(de->d_name))
+			continue;
+
+		spcoid = (Oid) strtoul(de->d_name, NULL, 10);
+		if ((name = get_tablespace_name(spcoid)) == NULL)
+			continue;
+
+		snprintf(location, sizeof(location), "%s/%s", path, de->d_name);
+		put_fsusage(tupleStore, tupleDesc, mounts, nmounts, name, location);
+	}
+	FreeDir(dir);
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
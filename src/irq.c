@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "lib/stringinfo.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include "pg_proctab.h"
+
+enum irqs {i_irq_source, i_irq_cpu, i_irq_count, i_irq_description};
+enum irqs_delta {i_irqd_source, i_irqd_cpu, i_irqd_elapsed, i_irqd_count,
+		i_irqd_per_sec, i_irqd_description};
+
+#define IRQ_SOURCE_LEN 32
+
+/* The two files, which share their layout. */
+enum irq_file {IRQ_INTERRUPTS, IRQ_SOFTIRQS};
+
+/* The count of an interrupt on a processor as of the previous call. */
+typedef struct
+{
+	char source[IRQ_SOURCE_LEN];	/* hash key, with cpu */
+	int32 cpu;
+	int64 prev;
+	TimestampTz prev_time;
+} irq_entry;
+
+Datum pg_interrupts(PG_FUNCTION_ARGS);
+Datum pg_interrupts_delta(PG_FUNCTION_ARGS);
+Datum pg_softirqs(PG_FUNCTION_ARGS);
+Datum pg_softirqs_delta(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_interrupts);
+PG_FUNCTION_INFO_V1(pg_interrupts_delta);
+PG_FUNCTION_INFO_V1(pg_softirqs);
+PG_FUNCTION_INFO_V1(pg_softirqs_delta);
+
+static Datum irq_counts(FunctionCallInfo, enum irq_file, bool);
+
+#ifdef __linux__
+static const char *irq_files[] = {"interrupts", "softirqs"};
+
+static HTAB *irq_hash[2] = {NULL, NULL};
+
+static bool read_line(FILE *, StringInfo);
+static void collapse_spaces(char *);
+static void put_irq(Tuplestorestate *, TupleDesc, enum irq_file, bool,
+		TimestampTz, const char *, int32, int64, const char *);
+
+/* Read a whole line, however many processors make it long. */
+static bool
+read_line(FILE *fp, StringInfo line)
+{
+	char buffer[4096];
+
+	resetStringInfo(line);
+	while (fgets(buffer, sizeof(buffer), fp) != NULL)
+	{
+		appendStringInfoString(line, buffer);
+		if (line->len > 0 && line->data[line->len - 1] == '\n')
+			break;
+	}
+
+	return line->len > 0;
+}
+
+/* Trim a description and squeeze the runs of spaces aligning its columns. */
+static void
+collapse_spaces(char *s)
+{
+	char *p = s;
+	char *q = s;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	while (*p != '\0' && *p != '\n')
+	{
+		if (*p == ' ' || *p == '\t')
+		{
+			while (*p == ' ' || *p == '\t')
+				p++;
+			if (*p != '\0' && *p != '\n')
+				*q++ = ' ';
+			continue;
+		}
+		*q++ = *p++;
+	}
+	*q = '\0';
+}
+
+/*
+ * Add the row of an interrupt on a processor, a cpu of -1 standing for a
+ * count that is not per processor.
+ */
+static void
+put_irq(Tuplestorestate *tupleStore, TupleDesc tupleDesc,
+		enum irq_file file, bool delta, TimestampTz now, const char *source,
+		int32 cpu, int64 count, const char *description)
+{
+	Datum values[i_irqd_description + 1];
+	bool nulls[i_irqd_description + 1];
+	int i_description;
+
+	memset(nulls, false, sizeof(nulls));
+	values[i_irq_source] = CStringGetTextDatum(source);
+	values[i_irq_cpu] = Int32GetDatum(cpu);
+	nulls[i_irq_cpu] = cpu < 0;
+
+	if (!delta)
+	{
+		values[i_irq_count] = Int64GetDatum(count);
+		i_description = i_irq_description;
+	}
+	else
+	{
+		struct
+		{
+			char source[IRQ_SOURCE_LEN];
+			int32 cpu;
+		} key;
+		irq_entry *entry;
+		bool found;
+
+		memset(&key, 0, sizeof(key));
+		strlcpy(key.source, source, sizeof(key.source));
+		key.cpu = cpu;
+		entry = (irq_entry *) hash_search(irq_hash[file], &key, HASH_ENTER,
+				&found);
+
+		/* Counts that went down were reset, as by a processor going offline. */
+		if (found)
+		{
+			double elapsed = (double) (now - entry->prev_time) / 1000000.0;
+			int64 increase = count >= entry->prev ? count - entry->prev :
+					count;
+
+			values[i_irqd_elapsed] = Float8GetDatum(elapsed);
+			values[i_irqd_count] = Int64GetDatum(increase);
+			values[i_irqd_per_sec] = Float8GetDatum(elapsed > 0 ?
+					increase / elapsed : 0);
+			nulls[i_irqd_per_sec] = elapsed <= 0;
+		}
+		else
+		{
+			nulls[i_irqd_elapsed] = true;
+			nulls[i_irqd_count] = true;
+			nulls[i_irqd_per_sec] = true;
+		}
+		entry->prev = count;
+		entry->prev_time = now;
+		i_description = i_irqd_description;
+	}
+
+	if (file == IRQ_INTERRUPTS)
+	{
+		values[i_description] = CStringGetTextDatum(description);
+		nulls[i_description] = description[0] == '\0';
+	}
+
+	tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+}
+#endif /* __linux__ */
+
+/*
+ * Return a row per interrupt, or softirq, and processor, with the count since
+ * boot, or with its increase since the previous call in this session when
+ * delta is true.  The header of the files names the processors, only those
+ * online, and counts that are not per processor, as ERR and MIS, have a NULL
+ * cpu.
+ */
+static Datum
+irq_counts(FunctionCallInfo fcinfo, enum irq_file file, bool delta)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	char path[MAXPGPATH];
+	StringInfoData line;
+	TimestampTz now;
+	int32 *cpus;
+	int64 *counts;
+	int ncpus = 0;
+	FILE *fp;
+	char *p;
+	char *q;
+#endif /* __linux__ */
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	check_procfs();
+
+	if (delta && irq_hash[file] == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = IRQ_SOURCE_LEN + sizeof(int32);
+		ctl.entrysize = sizeof(irq_entry);
+		ctl.hcxt = TopMemoryContext;
+		irq_hash[file] = hash_create("pg_proctab interrupts", 256, &ctl,
+				HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", PROCFS, irq_files[file]);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+
+	/* The header, such as "           CPU0       CPU1       CPU3". */
+	initStringInfo(&line);
+	if (read_line(fp, &line))
+	{
+		cpus = (int32 *) palloc(sizeof(int32) * (line.len / 4 + 1));
+		for (p = line.data; (p = strstr(p, "CPU")) != NULL; p += 3)
+			cpus[ncpus++] = atoi(p + 3);
+	}
+	if (ncpus == 0)
+	{
+		FreeFile(fp);
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("unexpected contents of \"%s\"", path)));
+	}
+
+	now = GetCurrentTimestamp();
+
+	/*
+	 * Lines such as "  24:     104587          0   PCI-MSI 327680-edge
+	 * xhci_hcd", "NMI:          0          0   Non-maskable interrupts" and
+	 * "ERR:          0", or "      NET_RX:     219781        348" in
+	 * softirqs.
+	 */
+	counts = (int64 *) palloc(sizeof(int64) * ncpus);
+	while (read_line(fp, &line))
+	{
+		char *colon;
+		int ncounts;
+		int i;
+
+		if ((colon = strchr(line.data, ':')) == NULL)
+			continue;
+		*colon = '\0';
+		p = line.data;
+		while (*p == ' ')
+			p++;
+
+		for (ncounts = 0, q = colon + 1; ncounts < ncpus; ncounts++)
+		{
+			char *end;
+
+			counts[ncounts] = strtoll(q, &end, 10);
+			if (end == q)
+				break;
+			q = end;
+		}
+		collapse_spaces(q);
+
+		if (ncounts == 1 && ncpus > 1)
+			put_irq(tupleStore, tupleDesc, file, delta, now, p, -1,
+					counts[0], q);
+		else
+			for (i = 0; i < ncounts; i++)
+				put_irq(tupleStore, tupleDesc, file, delta, now, p, cpus[i],
+						counts[i], q);
+	}
+	FreeFile(fp);
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
+
+Datum pg_interrupts(PG_FUNCTION_ARGS)
+{
+	elog(DEBUG5, "pg_interrupts: Entering stored function.");
+
+	return irq_counts(fcinfo, IRQ_INTERRUPTS, false);
+}
+
+Datum pg_interrupts_delta(PG_FUNCTION_ARGS)
+{
+	elog(DEBUG5, "pg_interrupts_delta: Entering stored function.");
+
+	return irq_counts(fcinfo, IRQ_INTERRUPTS, true);
+}
+
+Datum pg_softirqs(PG_FUNCTION_ARGS)
+{
+	elog(DEBUG5, "pg_softirqs: Entering stored function.");
+
+	return irq_counts(fcinfo, IRQ_SOFTIRQS, false);
+}
+
+Datum pg_softirqs_delta(PG_FUNCTION_ARGS)
+{
+	elog(DEBUG5, "pg_softirqs_delta: Entering stored function.");
+
+	return irq_counts(fcinfo, IRQ_SOFTIRQS, true);
+}
@@ -0,0 +1,636 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "pg_proctab.h"
+
+enum sockets {i_so_pid, i_so_fd, i_so_protocol, i_so_state,
+		i_so_local_address, i_so_remote_address, i_so_tx_queue,
+		i_so_rx_queue, i_so_retransmits, i_so_inode};
+enum netdev {i_nd_interface, i_nd_counters};
+enum netdev_delta {i_ndd_interface, i_ndd_elapsed, i_ndd_counters,
+		i_ndd_rx_bytes_per_sec = i_ndd_counters + 16, i_ndd_tx_bytes_per_sec};
+
+#define NETDEV_NCOUNTERS 16
+#define NETDEV_NAME_LEN 32
+
+#define SOCKETS_NCOLS 10
+#define NETDEV_NCOLS (i_nd_counters + NETDEV_NCOUNTERS)
+#define NETDEV_DELTA_NCOLS (i_ndd_tx_bytes_per_sec + 1)
+
+/* Counters of /proc/net/dev of interest for rates. */
+#define NETDEV_RX_BYTES 0
+#define NETDEV_TX_BYTES 8
+
+/* A socket of /proc/net/tcp, tcp6 or unix. */
+typedef struct
+{
+	uint64 inode;
+	const char *protocol;
+	const char *state;
+	char *local_address;
+	char *remote_address;
+	bool has_queues;		/* unix sockets do not show their queues */
+	int64 tx_queue;
+	int64 rx_queue;
+	int64 retransmits;
+} socket_entry;
+
+/* Counters of an interface as of the previous pg_netdev_delta() call. */
+typedef struct
+{
+	char name[NETDEV_NAME_LEN];	/* hash key */
+	int64 prev[NETDEV_NCOUNTERS];
+	TimestampTz prev_time;
+} netdev_entry;
+
+Datum pg_proctab_sockets(PG_FUNCTION_ARGS);
+Datum pg_netdev(PG_FUNCTION_ARGS);
+Datum pg_netdev_delta(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_proctab_sockets);
+PG_FUNCTION_INFO_V1(pg_netdev);
+PG_FUNCTION_INFO_V1(pg_netdev_delta);
+
+#ifdef __linux__
+/* Names of the TCP states, indexed by the st column of /proc/net/tcp. */
+static const char *tcp_states[] = {NULL, "ESTABLISHED", "SYN_SENT",
+		"SYN_RECV", "FIN_WAIT1", "FIN_WAIT2", "TIME_WAIT", "CLOSE",
+		"CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING", "NEW_SYN_RECV"};
+
+/* Names of the unix socket states, by the St column of /proc/net/unix. */
+static const char *unix_states[] = {"FREE", "UNCONNECTED", "CONNECTING",
+		"CONNECTED", "DISCONNECTING"};
+
+static HTAB *netdev_hash = NULL;
+
+static char *format_address(const char *, unsigned int, bool);
+static void read_tcp_sockets(const char *, const char *, bool,
+		socket_entry **, int *, int *);
+static void read_unix_sockets(socket_entry **, int *, int *);
+static int socket_cmp(const void *, const void *);
+static bool read_netdev_line(FILE *, char *, int64 *);
+static FILE *open_netdev(void);
+
+/*
+ * Format an address of /proc/net/tcp, the bytes of the address in network
+ * order printed as 32 bit words of the host, followed by the port.
+ */
+static char *
+format_address(const char *hex, unsigned int port, bool ipv6)
+{
+	unsigned char addr[16];
+	char text[INET6_ADDRSTRLEN];
+	uint32 word;
+	int i;
+
+	for (i = 0; i < (ipv6 ? 4 : 1); i++)
+	{
+		char part[9];
+
+		strlcpy(part, hex + i * 8, sizeof(part));
+		word = (uint32) strtoul(part, NULL, 16);
+		memcpy(addr + i * 4, &word, 4);
+	}
+
+	if (inet_ntop(ipv6 ? AF_INET6 : AF_INET, addr, text, sizeof(text)) == NULL)
+		return NULL;
+
+	return ipv6 ? psprintf("[%s]:%u", text, port) :
+			psprintf("%s:%u", text, port);
+}
+
+/* Add the sockets of /proc/net/tcp or /proc/net/tcp6 to the array. */
+static void
+read_tcp_sockets(const char *file, const char *protocol, bool ipv6,
+		socket_entry **sockets, int *nsockets, int *size)
+{
+	char path[MAXPGPATH];
+	char line[512];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/net/%s", PROCFS, file);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		return;
+
+	/* Skip the header. */
+	if (fgets(line, sizeof(line), fp) == NULL)
+	{
+		FreeFile(fp);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char local[33];
+		char remote[33];
+		unsigned int local_port;
+		unsigned int remote_port;
+		unsigned int state;
+		unsigned int tx_queue;
+		unsigned int rx_queue;
+		unsigned int retransmits;
+		unsigned long long inode;
+		socket_entry *entry;
+
+		if (sscanf(line, "%*d: %32[0-9A-Fa-f]:%X %32[0-9A-Fa-f]:%X %X %X:%X "
+				"%*X:%*X %X %*u %*d %llu", local, &local_port, remote,
+				&remote_port, &state, &tx_queue, &rx_queue, &retransmits,
+				&inode) != 9)
+			continue;
+
+		if (*nsockets == *size)
+		{
+			*size *= 2;
+			*sockets = (socket_entry *) repalloc(*sockets,
+					sizeof(socket_entry) * *size);
+		}
+		entry = &(*sockets)[(*nsockets)++];
+		entry->inode = inode;
+		entry->protocol = protocol;
+		entry->state = state < lengthof(tcp_states) ? tcp_states[state] :
+				NULL;
+		entry->local_address = format_address(local, local_port, ipv6);
+		entry->remote_address = format_address(remote, remote_port, ipv6);
+		entry->has_queues = true;
+		entry->tx_queue = tx_queue;
+		entry->rx_queue = rx_queue;
+		entry->retransmits = retransmits;
+	}
+	FreeFile(fp);
+}
+
+/*
+ * Add the sockets of /proc/net/unix to the array.  Their address is their
+ * path, if any, and the kernel does not show their queues there.
+ */
+static void
+read_unix_sockets(socket_entry **sockets, int *nsockets, int *size)
+{
+	char path[MAXPGPATH];
+	char line[MAXPGPATH + 128];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/net/unix", PROCFS);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		return;
+
+	if (fgets(line, sizeof(line), fp) == NULL)
+	{
+		FreeFile(fp);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		unsigned int flags;
+		unsigned int state;
+		unsigned long long inode;
+		int offset = 0;
+		socket_entry *entry;
+
+		if (sscanf(line, "%*x: %*x %*x %X %*x %X %llu%n", &flags, &state,
+				&inode, &offset) != 3)
+			continue;
+
+		if (*nsockets == *size)
+		{
+			*size *= 2;
+			*sockets = (socket_entry *) repalloc(*sockets,
+					sizeof(socket_entry) * *size);
+		}
+		entry = &(*sockets)[(*nsockets)++];
+		entry->inode = inode;
+		entry->protocol = "unix";
+		/* __SO_ACCEPTCON marks a listening socket. */
+		if ((flags & 0x10000) != 0)
+			entry->state = "LISTEN";
+		else
+			entry->state = state < lengthof(unix_states) ?
+					unix_states[state] : NULL;
+		entry->local_address = NULL;
+		entry->remote_address = NULL;
+		entry->has_queues = false;
+		entry->tx_queue = 0;
+		entry->rx_queue = 0;
+		entry->retransmits = 0;
+
+		while (line[offset] == ' ')
+			offset++;
+		line[strcspn(line, "\n")] = '\0';
+		if (line[offset] != '\0')
+			entry->local_address = pstrdup(line + offset);
+	}
+	FreeFile(fp);
+}
+
+static int
+socket_cmp(const void *a, const void *b)
+{
+	uint64 ia = ((const socket_entry *) a)->inode;
+	uint64 ib = ((const socket_entry *) b)->inode;
+
+	return ia < ib ? -1 : ia > ib;
+}
+
+/*
+ * Open /proc/net/dev past its two header lines.
+ */
+static FILE *
+open_netdev(void)
+{
+	char path[MAXPGPATH];
+	char line[512];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/net/dev", PROCFS);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+
+	if (fgets(line, sizeof(line), fp) == NULL ||
+			fgets(line, sizeof(line), fp) == NULL)
+	{
+		FreeFile(fp);
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("unexpected contents of \"%s\"", path)));
+	}
+
+	return fp;
+}
+
+/*
+ * Read the name and the 16 counters of the next interface of /proc/net/dev,
+ * received bytes, packets, errors, drops, fifo errors, frame errors,
+ * compressed and multicast packets, and then transmitted bytes, packets,
+ * errors, drops, fifo errors, collisions, carrier errors and compressed
+ * packets.
+ */
+static bool
+read_netdev_line(FILE *fp, char *name, int64 *counters)
+{
+	char line[512];
+	char *p;
+	char *colon;
+	int i;
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		/* The counters may follow the colon without a space. */
+		if ((colon = strchr(line, ':')) == NULL)
+			continue;
+		*colon = '\0';
+
+		p = line;
+		while (*p == ' ')
+			p++;
+		strlcpy(name, p, NETDEV_NAME_LEN);
+
+		p = colon + 1;
+		for (i = 0; i < NETDEV_NCOUNTERS; i++)
+		{
+			char *end;
+
+			counters[i] = strtoll(p, &end, 10);
+			if (end == p)
+				break;
+			p = end;
+		}
+		if (i == NETDEV_NCOUNTERS)
+			return true;
+	}
+
+	return false;
+}
+#endif /* __linux__ */
+
+/*
+ * The TCP and unix sockets open by every backend, found by the inodes the
+ * links in /proc/PID/fd point to, with the queues and retransmits from
+ * /proc/net/tcp and /proc/net/tcp6.  tx_queue is what the client has not
+ * acknowledged yet, rx_queue what the backend has not read yet.
+ */
+Datum pg_proctab_sockets(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	Datum values[SOCKETS_NCOLS];
+	bool nulls[SOCKETS_NCOLS];
+	socket_entry *sockets;
+	int nsockets = 0;
+	int size = 64;
+	int32 *pids;
+	int npids;
+	int i;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_proctab_sockets: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	check_procfs();
+
+	sockets = (socket_entry *) palloc(sizeof(socket_entry) * size);
+	read_tcp_sockets("tcp", "tcp", false, &sockets, &nsockets, &size);
+	read_tcp_sockets("tcp6", "tcp6", true, &sockets, &nsockets, &size);
+	read_unix_sockets(&sockets, &nsockets, &size);
+	qsort(sockets, nsockets, sizeof(socket_entry), socket_cmp);
+
+	pids = get_backend_pids(&npids);
+	for (i = 0; i < npids; i++)
+	{
+		char path[MAXPGPATH];
+		DIR *dir;
+		struct dirent *de;
+
+		snprintf(path, sizeof(path), "%s/%d/fd", PROCFS, pids[i]);
+		if ((dir = AllocateDir(path)) == NULL)
+			continue;
+
+		while ((de = ReadDirExtended(dir, path, LOG)) != NULL)
+		{
+			char link[MAXPGPATH];
+			char target[64];
+			socket_entry key;
+			socket_entry *entry;
+			int len;
+
+			if (strspn(de->d_name, "0123456789") != strlen(de->d_name))
+				continue;
+
+			/* Sockets link to "socket:[inode]". */
+			snprintf(link, sizeof(link), "%s/%s", path, de->d_name);
+			len = readlink(link, target, sizeof(target) - 1);
+			if (len <= 0)
+				continue;
+			target[len] = '\0';
+			if (strncmp(target, "socket:[", 8) != 0)
+				continue;
+
+			key.inode = strtoull(target + 8, NULL, 10);
+			entry = (socket_entry *) bsearch(&key, sockets, nsockets,
+					sizeof(socket_entry), socket_cmp);
+			if (entry == NULL)
+				continue;
+
+			memset(nulls, false, sizeof(nulls));
+			values[i_so_pid] = Int32GetDatum(pids[i]);
+			values[i_so_fd] = Int32GetDatum(atoi(de->d_name));
+			values[i_so_protocol] = CStringGetTextDatum(entry->protocol);
+			nulls[i_so_state] = entry->state == NULL;
+			if (entry->state != NULL)
+				values[i_so_state] = CStringGetTextDatum(entry->state);
+			nulls[i_so_local_address] = entry->local_address == NULL;
+			if (entry->local_address != NULL)
+				values[i_so_local_address] =
+						CStringGetTextDatum(entry->local_address);
+			nulls[i_so_remote_address] = entry->remote_address == NULL;
+			if (entry->remote_address != NULL)
+				values[i_so_remote_address] =
+						CStringGetTextDatum(entry->remote_address);
+			values[i_so_tx_queue] = Int64GetDatum(entry->tx_queue);
+			values[i_so_rx_queue] = Int64GetDatum(entry->rx_queue);
+			values[i_so_retransmits] = Int64GetDatum(entry->retransmits);
+			nulls[i_so_tx_queue] = !entry->has_queues;
+			nulls[i_so_rx_queue] = !entry->has_queues;
+			nulls[i_so_retransmits] = !entry->has_queues;
+			values[i_so_inode] = Int64GetDatum((int64) entry->inode);
+			tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+		}
+		FreeDir(dir);
+	}
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
+
+/*
+ * The totals of every network interface from /proc/net/dev.
+ */
+Datum pg_netdev(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	Datum values[NETDEV_NCOLS];
+	bool nulls[NETDEV_NCOLS];
+	char name[NETDEV_NAME_LEN];
+	int64 counters[NETDEV_NCOUNTERS];
+	FILE *fp;
+	int i;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_netdev: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	check_procfs();
+
+	fp = open_netdev();
+	while (read_netdev_line(fp, name, counters))
+	{
+		memset(nulls, false, sizeof(nulls));
+		values[i_nd_interface] = CStringGetTextDatum(name);
+		for (i = 0; i < NETDEV_NCOUNTERS; i++)
+			values[i_nd_counters + i] = Int64GetDatum(counters[i]);
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+	FreeFile(fp);
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
+
+/*
+ * Same as pg_netdev(), but the counters are the change since the previous
+ * call in this session, along with the elapsed time and the received and
+ * transmitted bytes per second.  On the first call, and for an interface
+ * that was not there on the previous call, they are NULL.
+ */
+Datum pg_netdev_delta(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	Datum values[NETDEV_DELTA_NCOLS];
+	bool nulls[NETDEV_DELTA_NCOLS];
+	char name[NETDEV_NAME_LEN];
+	int64 counters[NETDEV_NCOUNTERS];
+	TimestampTz now;
+	FILE *fp;
+	int i;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_netdev_delta: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	check_procfs();
+
+	if (netdev_hash == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = NETDEV_NAME_LEN;
+		ctl.entrysize = sizeof(netdev_entry);
+		ctl.hcxt = TopMemoryContext;
+		netdev_hash = hash_create("pg_proctab network interfaces", 16, &ctl,
+				HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	fp = open_netdev();
+	now = GetCurrentTimestamp();
+	while (read_netdev_line(fp, name, counters))
+	{
+		char key[NETDEV_NAME_LEN];
+		netdev_entry *entry;
+		bool found;
+
+		memset(key, 0, sizeof(key));
+		strlcpy(key, name, sizeof(key));
+		entry = (netdev_entry *) hash_search(netdev_hash, key, HASH_ENTER,
+				&found);
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, true, sizeof(nulls));
+		values[i_ndd_interface] = CStringGetTextDatum(name);
+		nulls[i_ndd_interface] = false;
+
+		if (found)
+		{
+			double elapsed = (double) (now - entry->prev_time) / 1000000.0;
+
+			values[i_ndd_elapsed] = Float8GetDatum(elapsed);
+			nulls[i_ndd_elapsed] = false;
+
+			/* A counter that went down was reset, as by a driver reload. */
+			for (i = 0; i < NETDEV_NCOUNTERS; i++)
+			{
+				values[i_ndd_counters + i] = Int64GetDatum(
+						counters[i] >= entry->prev[i] ?
+						counters[i] - entry->prev[i] : counters[i]);
+				nulls[i_ndd_counters + i] = false;
+			}
+
+			if (elapsed > 0)
+			{
+				values[i_ndd_rx_bytes_per_sec] = Float8GetDatum(
+						DatumGetInt64(values[i_ndd_counters +
+						NETDEV_RX_BYTES]) / elapsed);
+				nulls[i_ndd_rx_bytes_per_sec] = false;
+				values[i_ndd_tx_bytes_per_sec] = Float8GetDatum(
+						DatumGetInt64(values[i_ndd_counters +
+						NETDEV_TX_BYTES]) / elapsed);
+				nulls[i_ndd_tx_bytes_per_sec] = false;
+			}
+		}
+
+		memcpy(entry->prev, counters, sizeof(counters));
+		entry->prev_time = now;
+
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+	FreeFile(fp);
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
@@ -0,0 +1,662 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <ctype.h>
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "pg_proctab.h"
+
+enum numa_maps {i_nm_pid, i_nm_segment, i_nm_node, i_nm_pages, i_nm_bytes,
+		i_nm_local};
+enum numa_nodes {i_nn_node, i_nn_cpus, i_nn_memtotal, i_nn_memfree,
+		i_nn_memused, i_nn_filepages, i_nn_anonpages, i_nn_shmem,
+		i_nn_hugepages_total, i_nn_hugepages_free};
+
+#define NUMA_MAPS_NCOLS 6
+#define NUMA_NODES_NCOLS 10
+
+#define MAX_NUMA_NODES 1024
+
+/* Pages queried per move_pages() call. */
+#define MOVE_PAGES_BATCH 1024
+
+/* Most pages of shared memory looked up, and so mapped, per call. */
+#define SHARED_PAGES_SAMPLE 65536
+
+#define SEGMENT_SHARED "shared_memory"
+#define SEGMENT_PRIVATE "private"
+
+Datum pg_numa_maps(PG_FUNCTION_ARGS);
+Datum pg_numa_nodes(PG_FUNCTION_ARGS);
+Datum pg_cpu_numa_node(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_numa_maps);
+PG_FUNCTION_INFO_V1(pg_numa_nodes);
+PG_FUNCTION_INFO_V1(pg_cpu_numa_node);
+
+#ifdef __linux__
+/*
+ * Node of every cpu, built on first use and again under another sysfs_root;
+ * -1 for unknown cpus.
+ */
+static int *cpu_node = NULL;
+static int cpu_node_count = 0;
+static char cpu_node_root[MAXPGPATH];
+
+static void load_cpu_nodes(void);
+static int get_processor(int32);
+static void read_numa_maps(int32, int64 *, int64 *, int64);
+static Size huge_page_size(void);
+static bool shared_segment(void **, Size *, Size *);
+static Size query_shared_pages(int64 *);
+static void put_node_rows(Tuplestorestate *, TupleDesc, int32, const char *,
+		int64 *, int64 *, int);
+
+/*
+ * Build the cpu to node map from /sys/devices/system/node/node<N>/cpulist.
+ * Kernels without NUMA support have no such directory and every cpu maps to
+ * node 0.
+ */
+static void
+load_cpu_nodes(void)
+{
+	char path[MAXPGPATH];
+	DIR *dir;
+	struct dirent *de;
+	int ncpus;
+	int i;
+
+	if (cpu_node != NULL && strcmp(cpu_node_root, SYSFS) == 0)
+		return;
+	if (cpu_node != NULL)
+		pfree(cpu_node);
+	cpu_node = NULL;
+
+	ncpus = sysfs_cpu_count();
+	strlcpy(cpu_node_root, SYSFS, sizeof(cpu_node_root));
+
+	if (ncpus < 1)
+		ncpus = 1;
+	cpu_node = (int *) MemoryContextAlloc(TopMemoryContext,
+			sizeof(int) * ncpus);
+	cpu_node_count = ncpus;
+
+	snprintf(path, sizeof(path), "%s/devices/system/node", SYSFS);
+	dir = AllocateDir(path);
+	if (dir == NULL)
+	{
+		for (i = 0; i < ncpus; i++)
+			cpu_node[i] = 0;
+		return;
+	}
+
+	for (i = 0; i < ncpus; i++)
+		cpu_node[i] = -1;
+
+	while ((de = ReadDirExtended(dir, path, LOG)) != NULL)
+	{
+		FILE *fp;
+		char buffer[4096];
+		char *p;
+		int node;
+
+		if (strncmp(de->d_name, "node", 4) != 0 ||
+				!isdigit((unsigned char) de->d_name[4]))
+			continue;
+		node = atoi(de->d_name + 4);
+
+		snprintf(buffer, sizeof(buffer), "%s/%s/cpulist", path, de->d_name);
+		if ((fp = AllocateFile(buffer, PG_BINARY_R)) == NULL)
+			continue;
+		if (fgets(buffer, sizeof(buffer), fp) == NULL)
+			buffer[0] = '\0';
+		FreeFile(fp);
+
+		/* A list of ranges such as "0-7,16-23". */
+		p = buffer;
+		while (isdigit((unsigned char) *p))
+		{
+			int first = strtol(p, &p, 10);
+			int last = first;
+
+			if (*p == '-')
+				last = strtol(p + 1, &p, 10);
+			for (; first <= last; first++)
+				if (first < ncpus)
+					cpu_node[first] = node;
+			if (*p == ',')
+				++p;
+		}
+	}
+	FreeDir(dir);
+}
+
+/*
+ * The processor field of /proc/PID/stat, or -1 if the process is gone.
+ */
+static int
+get_processor(int32 pid)
+{
+	char buffer[4096];
+	char *p;
+	int fd;
+	int len;
+	int i;
+
+	snprintf(buffer, sizeof(buffer) - 1, "%s/%d/stat", PROCFS, pid);
+	fd = open(buffer, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	len = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+	buffer[len] = '\0';
+
+	/* comm may contain anything, so start counting after its ')'. */
+	if ((p = strrchr(buffer, ')')) == NULL)
+		return -1;
+	++p;
+
+	/* processor is the 39th field, the 36th after comm. */
+	for (i = 0; i < 36; i++)
+	{
+		SKIP_TOKEN(p);
+	}
+
+	return isdigit((unsigned char) *p) ? atoi(p) : -1;
+}
+
+/*
+ * Add up the pages per node of the private (anonymous, heap and stack)
+ * mappings in /proc/PID/numa_maps.  Huge pages are counted in base pages.
+ */
+static void
+read_numa_maps(int32 pid, int64 *pages, int64 *bytes, int64 page_size)
+{
+	char path[MAXPGPATH];
+	char line[4096];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%d/numa_maps", PROCFS, pid);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		int64 counts[64];
+		int nodes[64];
+		int n = 0;
+		int64 kb = 4;
+		bool private = true;
+		char *token;
+		char *save;
+		int i;
+
+		for (token = strtok_r(line, " \n", &save); token != NULL;
+				token = strtok_r(NULL, " \n", &save))
+		{
+			if (strncmp(token, "file=", 5) == 0)
+				private = false;
+			else if (strncmp(token, "kernelpagesize_kB=", 18) == 0)
+				kb = atoll(token + 18);
+			else if (token[0] == 'N' && isdigit((unsigned char) token[1]) &&
+					n < 64)
+			{
+				char *eq = strchr(token, '=');
+
+				if (eq == NULL)
+					continue;
+				nodes[n] = atoi(token + 1);
+				counts[n] = atoll(eq + 1);
+				n++;
+			}
+		}
+
+		if (!private)
+			continue;
+
+		for (i = 0; i < n; i++)
+		{
+			if (nodes[i] < 0 || nodes[i] >= MAX_NUMA_NODES)
+				continue;
+			pages[nodes[i]] += counts[i] * (kb * 1024 / page_size);
+			bytes[nodes[i]] += counts[i] * kb * 1024;
+		}
+	}
+	FreeFile(fp);
+}
+
+/*
+ * Hugepagesize from /proc/meminfo, in bytes.
+ */
+static Size
+huge_page_size(void)
+{
+	char path[MAXPGPATH];
+	char line[256];
+	FILE *fp;
+	Size size = 2 * 1024 * 1024;
+
+	snprintf(path, sizeof(path), "%s/meminfo", PROCFS);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		return size;
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (strncmp(line, "Hugepagesize:", 13) == 0)
+		{
+			size = (Size) atoll(line + 13) * 1024;
+			break;
+		}
+	FreeFile(fp);
+
+	return size;
+}
+
+/*
+ * Find the main shared memory segment in our own address space.  It is the
+ * largest shared mapping of /dev/zero (mmap), a SysV segment, or anonymous
+ * huge pages.
+ */
+static bool
+shared_segment(void **start, Size *size, Size *page_size)
+{
+	char path[MAXPGPATH];
+	char line[4096];
+	FILE *fp;
+	bool found = false;
+
+	*size = 0;
+	snprintf(path, sizeof(path), "%s/self/maps", PROCFS);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		return false;
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		unsigned long lo;
+		unsigned long hi;
+		char perms[8];
+		char *name;
+
+		if (sscanf(line, "%lx-%lx %7s", &lo, &hi, perms) != 3 ||
+				perms[3] != 's')
+			continue;
+		if ((name = strchr(line, '/')) == NULL)
+			continue;
+		if (strncmp(name, "/dev/zero", 9) != 0 &&
+				strncmp(name, "/SYSV", 5) != 0 &&
+				strncmp(name, "/anon_hugepage", 14) != 0)
+			continue;
+		if (hi - lo <= *size)
+			continue;
+
+		*start = (void *) lo;
+		*size = hi - lo;
+		*page_size = strncmp(name, "/anon_hugepage", 14) == 0 ?
+				huge_page_size() : sysconf(_SC_PAGESIZE);
+		found = true;
+	}
+	FreeFile(fp);
+
+	return found;
+}
+
+/*
+ * Count the pages of the shared memory segment per node.  numa_maps only
+ * sees the pages a process has mapped itself, which for the postmaster is
+ * hardly any of shared_buffers, so ask the kernel directly: mincore() finds
+ * the pages that exist without faulting them in, reading one byte maps such
+ * a page into our page tables, and move_pages() without target nodes
+ * reports where it lives.  Pages nobody has touched yet are not allocated
+ * and not counted.  Mapping every page of a large shared_buffers would cost
+ * the caller page tables in proportion, so at most SHARED_PAGES_SAMPLE pages
+ * evenly spread over the segment are looked up, each counting for the pages
+ * up to the next.  Returns the page size of the segment, or 0 if it was not
+ * found.
+ */
+static Size
+query_shared_pages(int64 *pages)
+{
+	char *start;
+	Size size;
+	Size page_size;
+	Size npages;
+	Size stride;
+	Size base;
+	unsigned char *resident;
+	void **batch;
+	int *status;
+
+	if (!shared_segment((void **) &start, &size, &page_size))
+		return 0;
+
+	npages = size / page_size;
+	stride = (npages + SHARED_PAGES_SAMPLE - 1) / SHARED_PAGES_SAMPLE;
+	stride = Max(stride, 1);
+	resident = (unsigned char *) palloc(size / sysconf(_SC_PAGESIZE) + 1);
+	if (mincore(start, size, resident) < 0)
+	{
+		elog(DEBUG1, "pg_numa_maps: mincore failed: %m");
+		pfree(resident);
+		return 0;
+	}
+
+	batch = (void **) palloc(sizeof(void *) * MOVE_PAGES_BATCH);
+	status = (int *) palloc(sizeof(int) * MOVE_PAGES_BATCH);
+
+	for (base = 0; base < npages; base += MOVE_PAGES_BATCH * stride)
+	{
+		int n = 0;
+		int i;
+		Size page;
+
+		for (page = base; page < npages &&
+				page < base + MOVE_PAGES_BATCH * stride; page += stride)
+		{
+			char *addr = start + page * page_size;
+
+			if (!(resident[(page * page_size) / sysconf(_SC_PAGESIZE)] & 1))
+				continue;
+			(void) *(volatile char *) addr;
+			batch[n++] = addr;
+		}
+
+		if (n == 0)
+			continue;
+
+		if (syscall(SYS_move_pages, 0, (unsigned long) n, batch, NULL,
+				status, 0) < 0)
+		{
+			elog(DEBUG1, "pg_numa_maps: move_pages failed: %m");
+			break;
+		}
+
+		for (i = 0; i < n; i++)
+			if (status[i] >= 0 && status[i] < MAX_NUMA_NODES)
+				pages[status[i]] += stride;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	pfree(batch);
+	pfree(status);
+	pfree(resident);
+
+	return page_size;
+}
+
+static void
+put_node_rows(Tuplestorestate *tupleStore, TupleDesc tupleDesc, int32 pid,
+		const char *segment, int64 *pages, int64 *bytes, int local_node)
+{
+	Datum values[NUMA_MAPS_NCOLS];
+	bool nulls[NUMA_MAPS_NCOLS];
+	int node;
+
+	for (node = 0; node < MAX_NUMA_NODES; node++)
+	{
+		if (pages[node] == 0)
+			continue;
+
+		memset(nulls, false, sizeof(nulls));
+		values[i_nm_pid] = Int32GetDatum(pid);
+		values[i_nm_segment] = CStringGetTextDatum(segment);
+		values[i_nm_node] = Int32GetDatum(node);
+		values[i_nm_pages] = Int64GetDatumFast(pages[node]);
+		values[i_nm_bytes] = Int64GetDatumFast(bytes[node]);
+		if (local_node < 0)
+			nulls[i_nm_local] = true;
+		else
+			values[i_nm_local] = BoolGetDatum(node == local_node);
+
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+}
+#endif /* __linux__ */
+
+Datum pg_numa_maps(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	int32 *pids;
+	int npids;
+	int64 *pages;
+	int64 *bytes;
+	int64 page_size;
+	Size shared_page_size;
+	int i;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_numa_maps: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/*
+	 * Build a tuple descriptor for our result type
+	 */
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	load_cpu_nodes();
+
+	pages = (int64 *) palloc(sizeof(int64) * MAX_NUMA_NODES);
+	bytes = (int64 *) palloc(sizeof(int64) * MAX_NUMA_NODES);
+	page_size = sysconf(_SC_PAGESIZE);
+
+	/* The main shared memory segment, accounted to the postmaster. */
+	memset(pages, 0, sizeof(int64) * MAX_NUMA_NODES);
+	shared_page_size = query_shared_pages(pages);
+	for (i = 0; i < MAX_NUMA_NODES; i++)
+		bytes[i] = pages[i] * shared_page_size;
+	put_node_rows(tupleStore, tupleDesc, PostmasterPid, SEGMENT_SHARED, pages,
+			bytes, -1);
+
+	/* The private memory of the postmaster and every backend. */
+	pids = get_backend_pids(&npids);
+	for (i = -1; i < npids; i++)
+	{
+		int32 pid = i < 0 ? PostmasterPid : pids[i];
+		int processor;
+		int local_node = -1;
+
+		processor = get_processor(pid);
+		if (processor >= 0 && processor < cpu_node_count)
+			local_node = cpu_node[processor];
+
+		memset(pages, 0, sizeof(int64) * MAX_NUMA_NODES);
+		memset(bytes, 0, sizeof(int64) * MAX_NUMA_NODES);
+		read_numa_maps(pid, pages, bytes, page_size);
+
+		put_node_rows(tupleStore, tupleDesc, pid, SEGMENT_PRIVATE, pages,
+				bytes, local_node);
+	}
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
+
+Datum pg_numa_nodes(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	char path[MAXPGPATH];
+	DIR *dir;
+	struct dirent *de;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_numa_nodes: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/*
+	 * Build a tuple descriptor for our result type
+	 */
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	snprintf(path, sizeof(path), "%s/devices/system/node", SYSFS);
+	dir = AllocateDir(path);
+	if (dir == NULL)
+	{
+		elog(NOTICE, "kernel has no NUMA support");
+		return (Datum) 0;
+	}
+
+	while ((de = ReadDirExtended(dir, path, LOG)) != NULL)
+	{
+		Datum values[NUMA_NODES_NCOLS];
+		bool nulls[NUMA_NODES_NCOLS];
+		char buffer[4096];
+		char *p;
+		FILE *fp;
+
+		if (strncmp(de->d_name, "node", 4) != 0 ||
+				!isdigit((unsigned char) de->d_name[4]))
+			continue;
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, true, sizeof(nulls));
+		values[i_nn_node] = Int32GetDatum(atoi(de->d_name + 4));
+		nulls[i_nn_node] = false;
+
+		snprintf(buffer, sizeof(buffer), "%s/%s/cpulist", path, de->d_name);
+		if ((fp = AllocateFile(buffer, PG_BINARY_R)) != NULL)
+		{
+			if (fgets(buffer, sizeof(buffer), fp) != NULL)
+			{
+				buffer[strcspn(buffer, "\n")] = '\0';
+				values[i_nn_cpus] = CStringGetTextDatum(buffer);
+				nulls[i_nn_cpus] = false;
+			}
+			FreeFile(fp);
+		}
+
+		/* Lines look like "Node 0 MemTotal:       16343452 kB". */
+		snprintf(buffer, sizeof(buffer), "%s/%s/meminfo", path, de->d_name);
+		if ((fp = AllocateFile(buffer, PG_BINARY_R)) == NULL)
+			continue;
+		while (fgets(buffer, sizeof(buffer), fp) != NULL)
+		{
+			int column;
+
+			p = buffer;
+			SKIP_TOKEN(p);		/* skip Node */
+			SKIP_TOKEN(p);		/* skip the node number */
+
+			if (strncmp(p, "MemTotal:", 9) == 0)
+				column = i_nn_memtotal;
+			else if (strncmp(p, "MemFree:", 8) == 0)
+				column = i_nn_memfree;
+			else if (strncmp(p, "MemUsed:", 8) == 0)
+				column = i_nn_memused;
+			else if (strncmp(p, "FilePages:", 10) == 0)
+				column = i_nn_filepages;
+			else if (strncmp(p, "AnonPages:", 10) == 0)
+				column = i_nn_anonpages;
+			else if (strncmp(p, "Shmem:", 6) == 0)
+				column = i_nn_shmem;
+			else if (strncmp(p, "HugePages_Total:", 16) == 0)
+				column = i_nn_hugepages_total;
+			else if (strncmp(p, "HugePages_Free:", 15) == 0)
+				column = i_nn_hugepages_free;
+			else
+				continue;
+
+			SKIP_TOKEN(p);		/* skip the label */
+			values[column] = Int64GetDatum(strtoll(p, NULL, 10));
+			nulls[column] = false;
+		}
+		FreeFile(fp);
+
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+	FreeDir(dir);
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
+
+/*
+ * The NUMA node of a cpu, or -1 if it is not known.
+ */
+int
+cpu_numa_node(int cpu)
+{
+#ifdef __linux__
+	load_cpu_nodes();
+	if (cpu >= 0 && cpu < cpu_node_count)
+		return cpu_node[cpu];
+#endif /* __linux__ */
+
+	return -1;
+}
+
+Datum pg_cpu_numa_node(PG_FUNCTION_ARGS)
+{
+	int node = cpu_numa_node(PG_GETARG_INT32(0));
+
+	if (node < 0)
+		PG_RETURN_NULL();
+	PG_RETURN_INT32(node);
+}
@@ -0,0 +1,791 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <limits.h>
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include "pg_proctab.h"
+
+/*
+ * A packed snapshot holds the ps_procstat rows of one snapshot in a single
+ * bytea.  Every frame lists the pids present, sorted and delta encoded, and a
+ * bitmap of the processes that changed since the previous frame.  Only the
+ * changed processes are stored, column by column so that similar values sit
+ * together for the compression of the bytea by TOAST:
+ *
+ *   numbers and times: 0 for NULL, else 1 + zigzag(value - previous value)
+ *   text:              0 for NULL, 1 for unchanged, else 2 + length, bytes
+ *
+ * A keyframe is encoded against an empty previous frame, so it stores every
+ * process in full.  Decoding a frame starts from the keyframe of its chain.
+ * Every UTC day starts with a keyframe, so that ps_maintain() can drop the
+ * daily partitions of ps_procstat_packed without breaking a chain.
+ */
+#define PACK_VERSION 1
+
+#define LOCK_PACKED \
+		"LOCK TABLE ps_procstat_packed IN SHARE ROW EXCLUSIVE MODE"
+#define GET_LAST_PACKED \
+		"SELECT snap FROM ps_procstat_packed ORDER BY snap DESC LIMIT 1"
+#define PUT_PACKED \
+		"INSERT INTO ps_procstat_packed(snap, time, base, prev, nprocs, " \
+		"    data) " \
+		"VALUES ($1, $2, $3, $4, $5, $6)"
+#define GET_PACKED_RANGE \
+		"SELECT snap, prev, data " \
+		"FROM ps_procstat_packed " \
+		"WHERE snap <= $2 " \
+		"  AND snap >= coalesce((SELECT base " \
+		"                        FROM ps_procstat_packed " \
+		"                        WHERE snap >= $1 " \
+		"                        ORDER BY snap LIMIT 1), $1) " \
+		"ORDER BY snap"
+
+typedef enum
+{
+	PACK_INT,
+	PACK_TIME,
+	PACK_BOOL,
+	PACK_TEXT
+} pack_type;
+
+/* The ps_procstat columns after snap and pid, in table order. */
+static const struct
+{
+	const char *expr;
+	pack_type type;
+} pack_columns[] = {
+	{"p.comm::text", PACK_TEXT},
+	{"p.fullcomm::text", PACK_TEXT},
+	{"p.state::text", PACK_TEXT},
+	{"p.ppid::int8", PACK_INT},
+	{"p.pgrp::int8", PACK_INT},
+	{"p.session::int8", PACK_INT},
+	{"p.tty_nr::int8", PACK_INT},
+	{"p.tpgid::int8", PACK_INT},
+	{"p.flags::int8", PACK_INT},
+	{"p.minflt", PACK_INT},
+	{"p.cminflt", PACK_INT},
+	{"p.majflt", PACK_INT},
+	{"p.cmajflt", PACK_INT},
+	{"p.utime", PACK_INT},
+	{"p.stime", PACK_INT},
+	{"p.cutime", PACK_INT},
+	{"p.cstime", PACK_INT},
+	{"p.priority", PACK_INT},
+	{"p.nice", PACK_INT},
+	{"p.num_threads", PACK_INT},
+	{"p.itrealvalue", PACK_INT},
+	{"p.starttime", PACK_INT},
+	{"p.vsize", PACK_INT},
+	{"p.rss", PACK_INT},
+	{"p.exit_signal::int8", PACK_INT},
+	{"p.processor::int8", PACK_INT},
+	{"p.rt_priority", PACK_INT},
+	{"p.policy", PACK_INT},
+	{"p.delayacct_blkio_ticks", PACK_INT},
+	{"p.uid::int8", PACK_INT},
+	{"p.username::text", PACK_TEXT},
+	{"p.rchar", PACK_INT},
+	{"p.wchar", PACK_INT},
+	{"p.syscr", PACK_INT},
+	{"p.syscw", PACK_INT},
+	{"p.reads", PACK_INT},
+	{"p.writes", PACK_INT},
+	{"p.cwrites", PACK_INT},
+	{"a.datid::int8", PACK_INT},
+	{"a.datname::text", PACK_TEXT},
+	{"a.usesysid::int8", PACK_INT},
+	{"a.usename::text", PACK_TEXT},
+	{"a.query", PACK_TEXT},
+	{"(a.wait_event_type IS NOT DISTINCT FROM 'Lock')::int::int8", PACK_BOOL},
+	{"a.query_start", PACK_TIME},
+	{"a.backend_start", PACK_TIME},
+	{"a.client_addr::text", PACK_TEXT},
+	{"a.client_port::int8", PACK_INT}
+};
+
+#define PACK_NCOLS lengthof(pack_columns)
+
+/* snap, pid, then the packed columns */
+#define PROCSTAT_NCOLS (2 + PACK_NCOLS)
+
+/* The columns of the rows of pack_source() before the packed ones. */
+#define SOURCE_PID 3
+
+typedef struct
+{
+	int32 pid;
+	bool isnull[PACK_NCOLS];
+	int64 num[PACK_NCOLS];
+	char *text[PACK_NCOLS];
+} pack_proc;
+
+typedef struct
+{
+	int64 snap;				/* 0 for an empty frame */
+	TimestampTz time;
+	int64 base;				/* snap of the keyframe of the chain */
+	int nframes;			/* frames since the keyframe */
+	int nprocs;
+	pack_proc *procs;		/* sorted by pid */
+	MemoryContext context;
+} pack_state;
+
+static const struct config_enum_entry snap_storage_options[] = {
+	{"rows", SNAP_STORAGE_ROWS, false},
+	{"packed", SNAP_STORAGE_PACKED, false},
+	{NULL, 0, false}
+};
+
+int snap_storage = SNAP_STORAGE_ROWS;
+int snap_keyframe_interval = 60;
+
+/* What the last frame written by this backend decodes to. */
+static pack_state writer_state[2];
+static int writer_current = 0;
+static char *source_query = NULL;
+
+Datum ps_procstat_unpack(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(ps_procstat_unpack);
+
+static void pack_uint(StringInfo, uint64);
+static uint64 unpack_uint(const char **, const char *);
+static void pack_reset(pack_state *, const char *);
+static int *pack_match(pack_state *, pack_state *);
+static bool pack_same(pack_proc *, pack_proc *, int);
+static void pack_encode(pack_state *, pack_state *, StringInfo);
+static void pack_decode(pack_state *, pack_state *, const char *, int);
+static void pack_collect(pack_state *, SPITupleTable *, uint64);
+
+void
+pack_init(void)
+{
+	DefineCustomEnumVariable("pg_proctab.snap_storage",
+			"How ps_snap_stats() stores process statistics.",
+			"rows stores one ps_procstat row per process, packed stores one "
+			"delta encoded ps_procstat_packed row per snapshot.",
+			&snap_storage,
+			SNAP_STORAGE_ROWS,
+			snap_storage_options,
+			PGC_USERSET,
+			0,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.snap_keyframe_interval",
+			"Number of packed snapshots between full snapshots.",
+			NULL,
+			&snap_keyframe_interval,
+			60,
+			1,
+			INT_MAX,
+			PGC_USERSET,
+			0,
+			NULL,
+			NULL,
+			NULL);
+}
+
+static void
+pack_uint(StringInfo buf, uint64 value)
+{
+	while (value >= 0x80)
+	{
+		appendStringInfoChar(buf, (char) ((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	appendStringInfoChar(buf, (char) value);
+}
+
+static uint64
+unpack_uint(const char **p, const char *end)
+{
+	uint64 value = 0;
+	int shift = 0;
+
+	for (;;)
+	{
+		unsigned char c;
+
+		if (*p >= end || shift > 63)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("corrupt packed snapshot")));
+		c = (unsigned char) *(*p)++;
+		value |= (uint64) (c & 0x7F) << shift;
+		if (!(c & 0x80))
+			return value;
+		shift += 7;
+	}
+}
+
+/* Map signed deltas to unsigned so that small negative ones stay short. */
+static inline uint64
+zigzag(int64 value)
+{
+	return ((uint64) value << 1) ^ (uint64) (value >> 63);
+}
+
+static inline int64
+unzigzag(uint64 value)
+{
+	return (int64) (value >> 1) ^ -((int64) (value & 1));
+}
+
+/*
+ * Empty a frame, keeping its memory context.
+ */
+static void
+pack_reset(pack_state *state, const char *name)
+{
+	if (state->context == NULL)
+		state->context = AllocSetContextCreate(TopMemoryContext, name,
+				ALLOCSET_DEFAULT_SIZES);
+	else
+		MemoryContextReset(state->context);
+	state->snap = 0;
+	state->time = 0;
+	state->base = 0;
+	state->nframes = 0;
+	state->nprocs = 0;
+	state->procs = NULL;
+}
+
+/*
+ * For every process of next, the index of the same pid in prev or -1.
+ */
+static int *
+pack_match(pack_state *prev, pack_state *next)
+{
+	int *match = (int *) palloc(sizeof(int) * (next->nprocs + 1));
+	int i;
+	int j = 0;
+
+	for (i = 0; i < next->nprocs; i++)
+	{
+		while (j < prev->nprocs && prev->procs[j].pid < next->procs[i].pid)
+			j++;
+		match[i] = j < prev->nprocs &&
+				prev->procs[j].pid == next->procs[i].pid ? j : -1;
+	}
+
+	return match;
+}
+
+static bool
+pack_same(pack_proc *a, pack_proc *b, int col)
+{
+	if (a->isnull[col] || b->isnull[col])
+		return a->isnull[col] == b->isnull[col];
+	if (pack_columns[col].type == PACK_TEXT)
+		return strcmp(a->text[col], b->text[col]) == 0;
+	return a->num[col] == b->num[col];
+}
+
+static void
+pack_encode(pack_state *prev, pack_state *next, StringInfo buf)
+{
+	int *match = pack_match(prev, next);
+	bool *changed = (bool *) palloc0(sizeof(bool) * (next->nprocs + 1));
+	int32 last = 0;
+	int i;
+	int col;
+
+	pack_uint(buf, PACK_VERSION);
+	pack_uint(buf, next->nprocs);
+	for (i = 0; i < next->nprocs; i++)
+	{
+		pack_uint(buf, zigzag((int64) next->procs[i].pid - last));
+		last = next->procs[i].pid;
+	}
+
+	/* Idle processes whose counters did not move are not stored again. */
+	for (i = 0; i < next->nprocs; i++)
+	{
+		if (match[i] < 0)
+			changed[i] = true;
+		else
+			for (col = 0; col < PACK_NCOLS && !changed[i]; col++)
+				changed[i] = !pack_same(&next->procs[i],
+						&prev->procs[match[i]], col);
+	}
+	for (i = 0; i < next->nprocs; i += 8)
+	{
+		int bits = 0;
+		int k;
+
+		for (k = 0; k < 8 && i + k < next->nprocs; k++)
+			if (changed[i + k])
+				bits |= 1 << k;
+		appendStringInfoChar(buf, (char) bits);
+	}
+
+	for (col = 0; col < PACK_NCOLS; col++)
+	{
+		for (i = 0; i < next->nprocs; i++)
+		{
+			pack_proc *cur = &next->procs[i];
+			pack_proc *old = match[i] < 0 ? NULL : &prev->procs[match[i]];
+
+			if (!changed[i])
+				continue;
+
+			if (cur->isnull[col])
+				pack_uint(buf, 0);
+			else if (pack_columns[col].type == PACK_TEXT)
+			{
+				if (old != NULL && pack_same(cur, old, col))
+					pack_uint(buf, 1);
+				else
+				{
+					int len = strlen(cur->text[col]);
+
+					pack_uint(buf, 2 + len);
+					appendBinaryStringInfo(buf, cur->text[col], len);
+				}
+			}
+			else
+			{
+				int64 base = old == NULL || old->isnull[col] ? 0 :
+						old->num[col];
+
+				pack_uint(buf, 1 + zigzag(cur->num[col] - base));
+			}
+		}
+	}
+
+	pfree(match);
+	pfree(changed);
+}
+
+/*
+ * Decode a frame into next, which must be reset, against prev.
+ */
+static void
+pack_decode(pack_state *prev, pack_state *next, const char *data, int len)
+{
+	const char *p = data;
+	const char *end = data + len;
+	MemoryContext oldcontext;
+	const unsigned char *bitmap;
+	int32 last = 0;
+	int *match;
+	int i;
+	int col;
+
+	if (unpack_uint(&p, end) != PACK_VERSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("unsupported packed snapshot version")));
+
+	oldcontext = MemoryContextSwitchTo(next->context);
+
+	next->nprocs = (int) unpack_uint(&p, end);
+	if (next->nprocs < 0 || next->nprocs > len)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("corrupt packed snapshot")));
+	next->procs = (pack_proc *) palloc0(sizeof(pack_proc) *
+			(next->nprocs + 1));
+	for (i = 0; i < next->nprocs; i++)
+	{
+		last += (int32) unzigzag(unpack_uint(&p, end));
+		next->procs[i].pid = last;
+	}
+
+	bitmap = (const unsigned char *) p;
+	p += (next->nprocs + 7) / 8;
+	if (p > end)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("corrupt packed snapshot")));
+
+	match = pack_match(prev, next);
+
+	for (col = 0; col < PACK_NCOLS; col++)
+	{
+		for (i = 0; i < next->nprocs; i++)
+		{
+			pack_proc *cur = &next->procs[i];
+			pack_proc *old = match[i] < 0 ? NULL : &prev->procs[match[i]];
+			uint64 tag;
+
+			if (!(bitmap[i / 8] & (1 << (i % 8))))
+			{
+				/* Unchanged, so it must have been in the previous frame. */
+				if (old == NULL)
+					ereport(ERROR,
+							(errcode(ERRCODE_DATA_CORRUPTED),
+							 errmsg("corrupt packed snapshot")));
+				cur->isnull[col] = old->isnull[col];
+				cur->num[col] = old->num[col];
+				if (pack_columns[col].type == PACK_TEXT && !old->isnull[col])
+					cur->text[col] = pstrdup(old->text[col]);
+				continue;
+			}
+
+			tag = unpack_uint(&p, end);
+			cur->isnull[col] = tag == 0;
+			if (tag == 0)
+				continue;
+
+			if (pack_columns[col].type != PACK_TEXT)
+				cur->num[col] = unzigzag(tag - 1) +
+						(old == NULL || old->isnull[col] ? 0 : old->num[col]);
+			else if (tag == 1)
+			{
+				if (old == NULL || old->isnull[col])
+					ereport(ERROR,
+							(errcode(ERRCODE_DATA_CORRUPTED),
+							 errmsg("corrupt packed snapshot")));
+				cur->text[col] = pstrdup(old->text[col]);
+			}
+			else
+			{
+				if (tag - 2 > (uint64) (end - p))
+					ereport(ERROR,
+							(errcode(ERRCODE_DATA_CORRUPTED),
+							 errmsg("corrupt packed snapshot")));
+				cur->text[col] = pnstrdup(p, tag - 2);
+				p += tag - 2;
+			}
+		}
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+	pfree(match);
+}
+
+/*
+ * Return the end of the snapshot statement for packed storage: a CTE reading
+ * the process statistics and a result of a row per process, each with the
+ * snap and time of the snapshot, ordered by pid.  An empty snapshot has a
+ * single row with a NULL pid.  The processes are so read by the same
+ * statement as every other source, once.
+ */
+const char *
+pack_source(void)
+{
+	MemoryContext oldcontext;
+	StringInfoData buf;
+	int col;
+
+	if (source_query != NULL)
+		return source_query;
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	initStringInfo(&buf);
+	appendStringInfoString(&buf, ", proc AS (SELECT p.pid");
+	for (col = 0; col < PACK_NCOLS; col++)
+		appendStringInfo(&buf, ", %s AS c%d", pack_columns[col].expr, col);
+	appendStringInfoString(&buf,
+			" FROM pg_proctab() p"
+			" JOIN pg_catalog.pg_stat_activity a ON a.pid = p.pid) "
+			"SELECT s.snap, s.time, proc.* "
+			"FROM s LEFT JOIN proc ON true "
+			"ORDER BY proc.pid");
+	source_query = buf.data;
+	MemoryContextSwitchTo(oldcontext);
+
+	return source_query;
+}
+
+/*
+ * Read the process statistics of the rows of pack_source() into state,
+ * which must be reset.
+ */
+static void
+pack_collect(pack_state *state, SPITupleTable *tuptable, uint64 nrows)
+{
+	MemoryContext oldcontext;
+	uint64 i;
+	int col;
+
+	oldcontext = MemoryContextSwitchTo(state->context);
+	state->procs = (pack_proc *) palloc0(sizeof(pack_proc) * (nrows + 1));
+	for (i = 0; i < nrows; i++)
+	{
+		HeapTuple tuple = tuptable->vals[i];
+		TupleDesc tupdesc = tuptable->tupdesc;
+		pack_proc *proc = &state->procs[state->nprocs];
+		bool isnull;
+
+		proc->pid = DatumGetInt32(SPI_getbinval(tuple, tupdesc, SOURCE_PID,
+				&isnull));
+		if (isnull)
+			continue;
+		/* pg_stat_activity can list the same pid twice while it changes. */
+		if (state->nprocs > 0 && proc[-1].pid == proc->pid)
+			continue;
+
+		for (col = 0; col < PACK_NCOLS; col++)
+		{
+			Datum value = SPI_getbinval(tuple, tupdesc, SOURCE_PID + 1 + col,
+					&proc->isnull[col]);
+
+			if (proc->isnull[col])
+				continue;
+			if (pack_columns[col].type == PACK_TEXT)
+				proc->text[col] = TextDatumGetCString(value);
+			else if (pack_columns[col].type == PACK_TIME)
+				proc->num[col] = DatumGetTimestampTz(value);
+			else
+				proc->num[col] = DatumGetInt64(value);
+		}
+		state->nprocs++;
+	}
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Lock ps_procstat_packed against other writers until the end of the
+ * transaction.  Taken before the snapshot, so that snapshots are numbered in
+ * the order their frames are written and every frame is encoded against the
+ * one written last.
+ */
+void
+pack_lock(void)
+{
+	int ret;
+
+	SPI_connect();
+	ret = SPI_execute(LOCK_PACKED, false, 0);
+	if (ret != SPI_OK_UTILITY)
+		elog(ERROR, "ps_snap_stats: %s failed: %s", LOCK_PACKED,
+				SPI_result_code_string(ret));
+	SPI_finish();
+}
+
+/*
+ * Store the process statistics of a snapshot, the rows of pack_source(), as
+ * one ps_procstat_packed row, delta encoded against the last frame this
+ * backend wrote if that is still the last one in the table.  The caller
+ * holds pack_lock().
+ */
+void
+pack_procstat(int64 snap, TimestampTz time, SPITupleTable *tuptable,
+		uint64 nrows)
+{
+	pack_state *prev = &writer_state[writer_current];
+	pack_state *next = &writer_state[1 - writer_current];
+	StringInfoData buf;
+	Oid argtypes[6] = {INT8OID, TIMESTAMPTZOID, INT8OID, INT8OID, INT4OID,
+			BYTEAOID};
+	Datum values[6];
+	char nulls[6] = {' ', ' ', ' ', ' ', ' ', ' '};
+	bytea *data;
+	bool isnull;
+	int ret;
+
+	SPI_connect();
+
+	if (prev->context == NULL)
+		pack_reset(prev, "pg_proctab packed snapshot");
+
+	ret = SPI_execute(GET_LAST_PACKED, true, 1);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "ps_snap_stats: %s failed: %s", GET_LAST_PACKED,
+				SPI_result_code_string(ret));
+	if (SPI_processed == 0 || prev->snap == 0 ||
+			DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+					SPI_tuptable->tupdesc, 1, &isnull)) != prev->snap ||
+			prev->nframes + 1 >= snap_keyframe_interval ||
+			prev->time / USECS_PER_DAY != time / USECS_PER_DAY)
+		pack_reset(prev, "pg_proctab packed snapshot");
+
+	pack_reset(next, "pg_proctab packed snapshot");
+	pack_collect(next, tuptable, nrows);
+	next->snap = snap;
+	next->time = time;
+	next->base = prev->snap == 0 ? snap : prev->base;
+	next->nframes = prev->snap == 0 ? 0 : prev->nframes + 1;
+
+	initStringInfo(&buf);
+	pack_encode(prev, next, &buf);
+
+	data = (bytea *) palloc(VARHDRSZ + buf.len);
+	SET_VARSIZE(data, VARHDRSZ + buf.len);
+	memcpy(VARDATA(data), buf.data, buf.len);
+
+	values[0] = Int64GetDatum(snap);
+	values[1] = TimestampTzGetDatum(time);
+	values[2] = Int64GetDatum(next->base);
+	values[3] = Int64GetDatum(prev->snap);
+	nulls[3] = prev->snap == 0 ? 'n' : ' ';
+	values[4] = Int32GetDatum(next->nprocs);
+	values[5] = PointerGetDatum(data);
+
+	ret = SPI_execute_with_args(PUT_PACKED, 6, argtypes, values, nulls,
+			false, 0);
+	if (ret != SPI_OK_INSERT)
+		elog(ERROR, "ps_snap_stats: %s failed: %s", PUT_PACKED,
+				SPI_result_code_string(ret));
+
+	SPI_finish();
+
+	writer_current = 1 - writer_current;
+
+	elog(DEBUG1, "ps_snap_stats: packed %d processes of snapshot "
+			INT64_FORMAT " into %d bytes", next->nprocs, snap, buf.len);
+}
+
+/*
+ * Expand the packed snapshots from first to last back into ps_procstat rows.
+ */
+Datum ps_procstat_unpack(PG_FUNCTION_ARGS)
+{
+	int64 first = PG_GETARG_INT64(0);
+	int64 last = PG_GETARG_INT64(1);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+	AttInMetadata *attinmeta;
+	pack_state state[2];
+	int current = 0;
+	MemoryContext rowcontext;
+	Oid argtypes[2] = {INT8OID, INT8OID};
+	Datum args[2];
+	int ret;
+	uint64 row;
+
+	elog(DEBUG5, "ps_procstat_unpack: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/*
+	 * Build a tuple descriptor for our result type
+	 */
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	attinmeta = TupleDescGetAttInMetadata(tupleDesc);
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	memset(state, 0, sizeof(state));
+	state[0].context = AllocSetContextCreate(CurrentMemoryContext,
+			"ps_procstat_unpack", ALLOCSET_DEFAULT_SIZES);
+	state[1].context = AllocSetContextCreate(CurrentMemoryContext,
+			"ps_procstat_unpack", ALLOCSET_DEFAULT_SIZES);
+	rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+			"ps_procstat_unpack rows", ALLOCSET_DEFAULT_SIZES);
+
+	SPI_connect();
+
+	args[0] = Int64GetDatum(first);
+	args[1] = Int64GetDatum(last);
+	ret = SPI_execute_with_args(GET_PACKED_RANGE, 2, argtypes, args, NULL,
+			true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "ps_procstat_unpack: %s failed: %s", GET_PACKED_RANGE,
+				SPI_result_code_string(ret));
+
+	for (row = 0; row < SPI_processed; row++)
+	{
+		HeapTuple tuple = SPI_tuptable->vals[row];
+		TupleDesc tupdesc = SPI_tuptable->tupdesc;
+		pack_state *prev = &state[current];
+		pack_state *next = &state[1 - current];
+		int64 snap;
+		bool isnull;
+		bytea *data;
+		int i;
+
+		snap = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+		(void) SPI_getbinval(tuple, tupdesc, 2, &isnull);
+		if (isnull)
+			/* A keyframe. */
+			pack_reset(prev, NULL);
+		else if (prev->snap != DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2,
+				&isnull)))
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("packed snapshot " INT64_FORMAT " follows a "
+							"missing snapshot", snap)));
+
+		data = DatumGetByteaPP(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+		pack_reset(next, NULL);
+		pack_decode(prev, next, VARDATA_ANY(data), VARSIZE_ANY_EXHDR(data));
+		next->snap = snap;
+		current = 1 - current;
+
+		if (snap < first)
+			continue;
+
+		MemoryContextReset(rowcontext);
+		oldcontext = MemoryContextSwitchTo(rowcontext);
+		for (i = 0; i < next->nprocs; i++)
+		{
+			pack_proc *proc = &next->procs[i];
+			char *values[PROCSTAT_NCOLS];
+			int col;
+
+			values[0] = psprintf(INT64_FORMAT, snap);
+			values[1] = psprintf("%d", proc->pid);
+			for (col = 0; col < PACK_NCOLS; col++)
+			{
+				char **value = &values[col + 2];
+
+				if (proc->isnull[col])
+					*value = NULL;
+				else if (pack_columns[col].type == PACK_TEXT)
+					*value = proc->text[col];
+				else if (pack_columns[col].type == PACK_BOOL)
+					*value = proc->num[col] ? "t" : "f";
+				else if (pack_columns[col].type == PACK_TIME)
+					*value = DatumGetCString(DirectFunctionCall1(
+							timestamptz_out,
+							TimestampTzGetDatum(proc->num[col])));
+				else
+					*value = psprintf(INT64_FORMAT, proc->num[col]);
+			}
+
+			tuplestore_puttuple(tupleStore,
+					BuildTupleFromCStrings(attinmeta, values));
+		}
+		MemoryContextSwitchTo(oldcontext);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	SPI_finish();
+
+	MemoryContextDelete(state[0].context);
+	MemoryContextDelete(state[1].context);
+	MemoryContextDelete(rowcontext);
+
+	return (Datum) 0;
+}
@@ -0,0 +1,547 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif /* __linux__ */
+#include "pg_proctab.h"
+
+enum perf_counter {i_cycles, i_instructions, i_cache_references,
+		i_cache_misses, i_task_clock, i_context_switches, i_cpu_migrations,
+		i_page_faults};
+
+#define PERF_NCOUNTERS 8
+#define PERF_FIRST_SOFTWARE i_task_clock
+
+enum perf {i_perf_pid, i_perf_hardware, i_perf_counters};
+enum perf_delta {i_pd_pid, i_pd_hardware, i_pd_elapsed, i_pd_counters,
+		i_pd_ipc = i_pd_counters + PERF_NCOUNTERS, i_pd_cache_miss_ratio};
+
+#define PERF_NCOLS (i_perf_counters + PERF_NCOUNTERS)
+#define PERF_DELTA_NCOLS (i_pd_cache_miss_ratio + 1)
+
+/* Counters of one process, kept open across calls. */
+typedef struct
+{
+	int32 pid;				/* hash key */
+	bool hardware;			/* true if the hardware counters are open */
+	bool seen;				/* still in pg_stat_activity */
+	int fd[PERF_NCOUNTERS];
+	uint64 prev[PERF_NCOUNTERS];
+	TimestampTz prev_time;
+} perf_entry;
+
+bool perf_counters = false;
+
+Datum pg_proctab_perf(PG_FUNCTION_ARGS);
+Datum pg_proctab_perf_delta(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_proctab_perf);
+PG_FUNCTION_INFO_V1(pg_proctab_perf_delta);
+
+#ifdef __linux__
+static const struct
+{
+	uint32 type;
+	uint64 config;
+} perf_events[PERF_NCOUNTERS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}
+};
+
+static HTAB *perf_hash = NULL;
+
+/* Set once the PMU has refused us, e.g. in a VM without a virtual PMU. */
+static bool perf_no_hardware = false;
+/* Set once we ran out of file descriptors, to warn only once. */
+static bool perf_fd_warned = false;
+
+static perf_entry *perf_attach(int32);
+static void perf_detach(perf_entry *);
+static bool perf_read(perf_entry *, uint64 *);
+static void perf_sweep(int32 *, int);
+static int perf_open(int32, int, bool);
+#endif /* __linux__ */
+
+void
+perf_init(void)
+{
+	DefineCustomBoolVariable("pg_proctab.perf_counters",
+			"Count hardware and software events of backends with perf_event_open.",
+			NULL,
+			&perf_counters,
+			false,
+			PGC_SUSET,
+			0,
+			NULL,
+			NULL,
+			NULL);
+}
+
+#ifdef __linux__
+static int
+perf_open(int32 pid, int counter, bool exclude_kernel)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+#if PG_VERSION_NUM >= 130000
+	if (!AcquireExternalFD())
+	{
+		if (!perf_fd_warned)
+			ereport(WARNING,
+					(errmsg("not enough file descriptors to count events "
+							"of every backend"),
+					 errhint("Raise max_files_per_process.")));
+		perf_fd_warned = true;
+		errno = EMFILE;
+		return -1;
+	}
+#endif
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = perf_events[counter].type;
+	attr.config = perf_events[counter].config;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_kernel = exclude_kernel ? 1 : 0;
+	attr.exclude_hv = 1;
+
+	/* Our own counters are opened on ourselves, which pid 0 stands for. */
+	fd = syscall(SYS_perf_event_open, &attr, pid == MyProcPid ? 0 : pid, -1,
+			-1, PERF_FLAG_FD_CLOEXEC);
+#if PG_VERSION_NUM >= 130000
+	if (fd < 0)
+		ReleaseExternalFD();
+#endif
+
+	return fd;
+}
+
+/*
+ * Open the counters for one process.  The hardware events are tried first
+ * and dropped as a whole if the PMU is unavailable, leaving the software
+ * events, which every kernel with perf support provides.
+ */
+static perf_entry *
+perf_attach(int32 pid)
+{
+	perf_entry *entry;
+	bool found;
+	bool exclude_kernel;
+	int paranoid = 2;
+	char path[MAXPGPATH];
+	char buffer[32];
+	int fd;
+	int len;
+	int i;
+
+	if (perf_hash == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(int32);
+		ctl.entrysize = sizeof(perf_entry);
+		ctl.hcxt = TopMemoryContext;
+		perf_hash = hash_create("pg_proctab perf counters", 64, &ctl,
+				HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	entry = (perf_entry *) hash_search(perf_hash, &pid, HASH_ENTER, &found);
+	if (found)
+		return entry;
+
+	entry->hardware = false;
+	entry->prev_time = GetCurrentTimestamp();
+	for (i = 0; i < PERF_NCOUNTERS; i++)
+	{
+		entry->fd[i] = -1;
+		entry->prev[i] = 0;
+	}
+
+	/* Unprivileged users may only count user space above level 1. */
+	snprintf(path, sizeof(path), "%s/sys/kernel/perf_event_paranoid", PROCFS);
+	fd = open(path, O_RDONLY);
+	if (fd != -1)
+	{
+		len = read(fd, buffer, sizeof(buffer) - 1);
+		close(fd);
+		if (len > 0)
+		{
+			buffer[len] = '\0';
+			paranoid = atoi(buffer);
+		}
+	}
+	exclude_kernel = paranoid > 1;
+
+	if (!perf_no_hardware)
+	{
+		entry->hardware = true;
+		for (i = 0; i < PERF_FIRST_SOFTWARE; i++)
+		{
+			entry->fd[i] = perf_open(pid, i, exclude_kernel);
+			if (entry->fd[i] < 0)
+			{
+				if (errno == ENOENT || errno == EOPNOTSUPP || errno == ENODEV)
+				{
+					elog(DEBUG1, "pg_proctab_perf: no hardware counters, "
+							"falling back to software events");
+					perf_no_hardware = true;
+				}
+				entry->hardware = false;
+				break;
+			}
+		}
+		if (!entry->hardware)
+		{
+			for (i = 0; i < PERF_FIRST_SOFTWARE; i++)
+			{
+				if (entry->fd[i] >= 0)
+				{
+					close(entry->fd[i]);
+#if PG_VERSION_NUM >= 130000
+					ReleaseExternalFD();
+#endif
+				}
+				entry->fd[i] = -1;
+			}
+		}
+	}
+
+	for (i = PERF_FIRST_SOFTWARE; i < PERF_NCOUNTERS; i++)
+	{
+		entry->fd[i] = perf_open(pid, i, exclude_kernel);
+		if (entry->fd[i] < 0)
+			elog(DEBUG1, "pg_proctab_perf: cannot count event %d of pid %d: %m",
+					i, pid);
+	}
+
+	return entry;
+}
+
+static void
+perf_detach(perf_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < PERF_NCOUNTERS; i++)
+	{
+		if (entry->fd[i] >= 0)
+		{
+			close(entry->fd[i]);
+#if PG_VERSION_NUM >= 130000
+			ReleaseExternalFD();
+#endif
+		}
+		entry->fd[i] = -1;
+	}
+	hash_search(perf_hash, &entry->pid, HASH_REMOVE, NULL);
+}
+
+/*
+ * Read the current counts, scaled up for the time the kernel had to
+ * multiplex a counter off the PMU.  Returns false if no counter is open.
+ */
+static bool
+perf_read(perf_entry *entry, uint64 *counts)
+{
+	struct
+	{
+		uint64 value;
+		uint64 time_enabled;
+		uint64 time_running;
+	} data;
+	bool any = false;
+	int i;
+
+	for (i = 0; i < PERF_NCOUNTERS; i++)
+	{
+		counts[i] = 0;
+		if (entry->fd[i] < 0)
+			continue;
+		if (read(entry->fd[i], &data, sizeof(data)) != sizeof(data))
+			continue;
+		if (data.time_running > 0 && data.time_running < data.time_enabled)
+			counts[i] = (uint64) ((double) data.value *
+					data.time_enabled / data.time_running);
+		else
+			counts[i] = data.value;
+		any = true;
+	}
+
+	return any;
+}
+
+/*
+ * Attach to every process in the list and drop the counters of those that
+ * are gone.
+ */
+static void
+perf_sweep(int32 *pids, int npids)
+{
+	HASH_SEQ_STATUS status;
+	perf_entry *entry;
+	int i;
+
+	if (perf_hash != NULL)
+	{
+		hash_seq_init(&status, perf_hash);
+		while ((entry = (perf_entry *) hash_seq_search(&status)) != NULL)
+			entry->seen = false;
+	}
+
+	for (i = 0; i < npids; i++)
+		perf_attach(pids[i])->seen = true;
+
+	if (perf_hash == NULL)
+		return;
+
+	hash_seq_init(&status, perf_hash);
+	while ((entry = (perf_entry *) hash_seq_search(&status)) != NULL)
+		if (!entry->seen)
+			perf_detach(entry);
+}
+#endif /* __linux__ */
+
+static void
+perf_check_enabled(void)
+{
+	if (!perf_counters)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("perf event counting is not enabled"),
+				 errhint("Set pg_proctab.perf_counters to on.")));
+}
+
+Datum pg_proctab_perf(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+	Datum values[PERF_NCOLS];
+	bool nulls[PERF_NCOLS];
+
+#ifdef __linux__
+	int32 *pids;
+	int npids;
+	int i;
+	int j;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_proctab_perf: Entering stored function.");
+
+	perf_check_enabled();
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/*
+	 * Build a tuple descriptor for our result type
+	 */
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	pids = get_backend_pids(&npids);
+	perf_sweep(pids, npids);
+
+	for (i = 0; i < npids; i++)
+	{
+		perf_entry *entry;
+		uint64 counts[PERF_NCOUNTERS];
+
+		entry = (perf_entry *) hash_search(perf_hash, &pids[i], HASH_FIND,
+				NULL);
+		if (entry == NULL)
+			continue;
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, true, sizeof(nulls));
+
+		values[i_perf_pid] = Int32GetDatum(pids[i]);
+		nulls[i_perf_pid] = false;
+		values[i_perf_hardware] = BoolGetDatum(entry->hardware);
+		nulls[i_perf_hardware] = false;
+
+		if (perf_read(entry, counts))
+		{
+			for (j = 0; j < PERF_NCOUNTERS; j++)
+			{
+				if (entry->fd[j] < 0)
+					continue;
+				values[i_perf_counters + j] = Int64GetDatum((int64) counts[j]);
+				nulls[i_perf_counters + j] = false;
+			}
+		}
+
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
+
+/*
+ * Same as pg_proctab_perf(), but the counters are the change since the
+ * previous call in this session (or since the counters were attached), along
+ * with the elapsed time and the derived ratios.
+ */
+Datum pg_proctab_perf_delta(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+	Datum values[PERF_DELTA_NCOLS];
+	bool nulls[PERF_DELTA_NCOLS];
+
+#ifdef __linux__
+	int32 *pids;
+	int npids;
+	int i;
+	int j;
+	TimestampTz now;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_proctab_perf_delta: Entering stored function.");
+
+	perf_check_enabled();
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/*
+	 * Build a tuple descriptor for our result type
+	 */
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	pids = get_backend_pids(&npids);
+	perf_sweep(pids, npids);
+	now = GetCurrentTimestamp();
+
+	for (i = 0; i < npids; i++)
+	{
+		perf_entry *entry;
+		uint64 counts[PERF_NCOUNTERS];
+		uint64 delta[PERF_NCOUNTERS];
+
+		entry = (perf_entry *) hash_search(perf_hash, &pids[i], HASH_FIND,
+				NULL);
+		if (entry == NULL)
+			continue;
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, true, sizeof(nulls));
+		memset(delta, 0, sizeof(delta));
+
+		values[i_pd_pid] = Int32GetDatum(pids[i]);
+		nulls[i_pd_pid] = false;
+		values[i_pd_hardware] = BoolGetDatum(entry->hardware);
+		nulls[i_pd_hardware] = false;
+		values[i_pd_elapsed] =
+				Float8GetDatum((double) (now - entry->prev_time) / 1000000.0);
+		nulls[i_pd_elapsed] = false;
+
+		if (perf_read(entry, counts))
+		{
+			for (j = 0; j < PERF_NCOUNTERS; j++)
+			{
+				if (entry->fd[j] < 0)
+					continue;
+				delta[j] = counts[j] >= entry->prev[j] ?
+						counts[j] - entry->prev[j] : 0;
+				entry->prev[j] = counts[j];
+				values[i_pd_counters + j] = Int64GetDatum((int64) delta[j]);
+				nulls[i_pd_counters + j] = false;
+			}
+
+			if (entry->hardware && delta[i_cycles] > 0)
+			{
+				values[i_pd_ipc] = Float8GetDatum((double) delta[i_instructions] /
+						delta[i_cycles]);
+				nulls[i_pd_ipc] = false;
+			}
+			if (entry->hardware && delta[i_cache_references] > 0)
+			{
+				values[i_pd_cache_miss_ratio] = Float8GetDatum(
+						(double) delta[i_cache_misses] /
+						delta[i_cache_references]);
+				nulls[i_pd_cache_miss_ratio] = false;
+			}
+		}
+		entry->prev_time = now;
+
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
@@ -8,9 +8,16 @@
 #include "funcapi.h"
 #include "miscadmin.h"
 #include "access/htup_details.h"
+#include "catalog/pg_type.h"
 #include "utils/tuplestore.h"
 #include "storage/fd.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
 #include <sys/types.h>
 #include <pwd.h>
 #ifndef __FreeBSD__
@@ -25,7 +32,7 @@
 #include <executor/spi.h>
 #include "pg_proctab.h"
 
-#define FULLCOMM_LEN 1024
+PG_MODULE_MAGIC;
 
 #if PG_VERSION_NUM < 90200
 #define GET_PIDS \
@@ -37,6 +44,17 @@
 		"FROM pg_stat_activity"
 #endif /* PG_VERSION_NUM */
 
+#if PG_VERSION_NUM >= 100000
+#define GET_FILTERED_PIDS \
+		"SELECT pid " \
+		"FROM pg_stat_activity " \
+		"WHERE ($1 IS NULL OR pid = ANY ($1)) " \
+		"  AND ($2 IS NULL OR backend_type = ANY ($2)) " \
+		"  AND ($3 IS NULL OR datname = ANY ($3)) " \
+		"  AND ($4 IS NULL OR usename = ANY ($4)) " \
+		"  AND (NOT $5 OR state = 'active')"
+#endif /* PG_VERSION_NUM */
+
 #ifdef __linux__
 #define GET_VALUE(value) \
 		p = strchr(p, ':'); \
@@ -53,6 +71,9 @@
 		value[len] = '\0';
 #endif /* __linux__ */
 
+/* Seconds a uid's name is remembered before it is looked up again. */
+#define USERNAME_TTL 60
+
 #define pagetok(x)	((x) * sysconf(_SC_PAGESIZE) >> 10)
 
 enum proctab {i_pid, i_comm, i_fullcomm, i_state, i_ppid, i_pgrp, i_session,
@@ -61,7 +82,7 @@ enum proctab {i_pid, i_comm, i_fullcomm, i_state, i_ppid, i_pgrp, i_session,
 		i_num_threads, i_itrealvalue, i_starttime, i_vsize, i_rss,
 		i_exit_signal, i_processor, i_rt_priority, i_policy,
 		i_delayacct_blkio_ticks, i_uid, i_username, i_rchar, i_wchar, i_syscr,
-		i_syscw, i_reads, i_writes, i_cwrites};
+		i_syscw, i_reads, i_writes, i_cwrites, i_sample_age};
 enum cputime {i_user, i_nice_c, i_system, i_idle, i_iowait};
 enum loadavg {i_load1, i_load5, i_load15, i_last_pid};
 enum memusage {i_memused, i_memfree, i_memshared, i_membuffers, i_memcached,
@@ -73,7 +94,45 @@ enum diskusage {i_major, i_minor, i_devname,
 		i_discards_completed, i_discards_merged, i_sectors_discarded, i_discardtime,
 		i_flushes_completed, i_flushtime};
 
-int get_proctab(FuncCallContext *, char **);
+/*
+ * Names of the columns of pg_proctab(), in the order of enum proctab, and
+ * what has to be read for each beyond /proc/PID/stat.
+ */
+static const struct
+{
+	const char *name;
+	int reads;
+} proctab_columns[] = {
+	{"pid", 0}, {"comm", 0}, {"fullcomm", PROCTAB_CMDLINE}, {"state", 0},
+	{"ppid", 0}, {"pgrp", 0}, {"session", 0}, {"tty_nr", 0}, {"tpgid", 0},
+	{"flags", 0}, {"minflt", 0}, {"cminflt", 0}, {"majflt", 0},
+	{"cmajflt", 0}, {"utime", 0}, {"stime", 0}, {"cutime", 0},
+	{"cstime", 0}, {"priority", 0}, {"nice", 0}, {"num_threads", 0},
+	{"itrealvalue", 0}, {"starttime", 0}, {"vsize", 0}, {"rss", 0},
+	{"exit_signal", 0}, {"processor", 0}, {"rt_priority", 0},
+	{"policy", 0}, {"delayacct_blkio_ticks", 0}, {"uid", 0},
+	{"username", PROCTAB_USERNAME}, {"rchar", PROCTAB_IO},
+	{"wchar", PROCTAB_IO}, {"syscr", PROCTAB_IO}, {"syscw", PROCTAB_IO},
+	{"reads", PROCTAB_IO}, {"writes", PROCTAB_IO}, {"cwrites", PROCTAB_IO},
+	{"sample_age", 0}
+};
+
+/* Name of a uid, NULL if it has none, as of when it was looked up. */
+typedef struct
+{
+	uid_t uid;				/* hash key */
+	TimestampTz looked_up;
+	char *name;
+} username_entry;
+
+/* State of pg_proctab() across calls. */
+typedef struct
+{
+	char ***rows;			/* all rows, read on the first call */
+	char *sample_age;
+} proctab_fctx;
+
+int get_proctab(int32, proctab_files *, char **, int);
 int get_cputime(char **);
 int get_loadavg(char **);
 int get_memusage(char **);
@@ -83,12 +142,217 @@ Datum pg_cputime(PG_FUNCTION_ARGS);
 Datum pg_loadavg(PG_FUNCTION_ARGS);
 Datum pg_memusage(PG_FUNCTION_ARGS);
 Datum pg_diskusage(PG_FUNCTION_ARGS);
+Datum pg_clock_ticks(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(pg_proctab);
 PG_FUNCTION_INFO_V1(pg_cputime);
 PG_FUNCTION_INFO_V1(pg_loadavg);
 PG_FUNCTION_INFO_V1(pg_memusage);
 PG_FUNCTION_INFO_V1(pg_diskusage);
+PG_FUNCTION_INFO_V1(pg_clock_ticks);
+
+void _PG_init(void);
+
+static char **alloc_proctab_values(void);
+static char ***read_proctab(int32 *, int, int, int *);
+static char ***scan_proctab(int32 *, int, int *);
+static void read_proctab_files(int32, int, proctab_files *);
+static char *get_username(uid_t);
+static int32 *get_filtered_pids(FunctionCallInfo, int *);
+static int get_proctab_reads(ArrayType *);
+
+/* Roots of the proc and sys filesystems every function reads. */
+char *procfs_root = "/proc";
+char *sysfs_root = "/sys";
+
+static HTAB *usernames = NULL;
+
+void
+_PG_init(void)
+{
+	DefineCustomStringVariable("pg_proctab.procfs_root",
+			"Directory read in place of /proc.",
+			"Any other directory is not checked to be a proc filesystem "
+			"and its numeric subdirectories are taken as the backends, "
+			"so recorded or generated trees can be read.",
+			&procfs_root,
+			"/proc",
+			PGC_SUSET,
+			0,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomStringVariable("pg_proctab.sysfs_root",
+			"Directory read in place of /sys.",
+			NULL,
+			&sysfs_root,
+			"/sys",
+			PGC_SUSET,
+			0,
+			NULL,
+			NULL,
+			NULL);
+
+	cache_init();
+	perf_init();
+	control_init();
+	worker_init();
+	exporter_init();
+	pack_init();
+	flight_init();
+	uring_init();
+	anomaly_init();
+	accounting_init();
+	quantile_init();
+}
+
+/*
+ * Allocate the values of a pg_proctab() row, except the fullcomm and username
+ * that get_proctab() allocates and the sample_age filled in on output.
+ */
+static char **
+alloc_proctab_values(void)
+{
+	char **values;
+
+	values = (char **) palloc((PROCTAB_NCOLS + 1) * sizeof(char *));
+	values[i_pid] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_comm] = (char *) palloc(1024 * sizeof(char));
+	values[i_state] = (char *) palloc(2 * sizeof(char));
+	values[i_ppid] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_pgrp] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_session] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_tty_nr] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_tpgid] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_flags] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_minflt] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_cminflt] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_majflt] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_cmajflt] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+
+	/* FIXME: Need to figure out correct length to hold a C double type. */
+	values[i_utime] = (char *) palloc(32 * sizeof(char));
+	values[i_stime] = (char *) palloc(32 * sizeof(char));
+
+	values[i_cutime] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_cstime] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_priority] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_nice] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_num_threads] =
+			(char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_itrealvalue] =
+			(char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_starttime] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_vsize] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_rss] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_exit_signal] =
+			(char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_processor] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_rt_priority] =
+			(char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_policy] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_delayacct_blkio_ticks] =
+			(char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_uid] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
+	values[i_rchar] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_wchar] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_syscr] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_syscw] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_reads] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_writes] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+	values[i_cwrites] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
+
+	return values;
+}
+
+/*
+ * Read the rows of the pids, PROCTAB_BATCH pids at a time, whose files are
+ * all read with io_uring where it is available before any of them is parsed.
+ * A pid whose stat file could not be opened has exited since it was listed
+ * and is left out.  This stops at the first pid that cannot be parsed.
+ */
+static char ***
+read_proctab(int32 *pids, int npids, int reads, int *nrows)
+{
+	proctab_files *files;
+	char ***rows;
+	int batch;
+	int n;
+	int i;
+
+	check_procfs();
+
+	rows = (char ***) palloc(sizeof(char **) * Max(npids, 1));
+	files = (proctab_files *) palloc(sizeof(proctab_files) * PROCTAB_BATCH);
+	*nrows = 0;
+	for (batch = 0; batch < npids; batch += PROCTAB_BATCH)
+	{
+		n = Min(npids - batch, PROCTAB_BATCH);
+		if (!uring_read_proctab(pids + batch, n, reads, files))
+			for (i = 0; i < n; i++)
+				read_proctab_files(pids[batch + i], reads, &files[i]);
+
+		for (i = 0; i < n; i++)
+		{
+			if (files[i].stat == NULL)
+			{
+				if (files[i].cmdline != NULL)
+					pfree(files[i].cmdline);
+				if (files[i].io != NULL)
+					pfree(files[i].io);
+				continue;
+			}
+
+			rows[*nrows] = alloc_proctab_values();
+			if (get_proctab(pids[batch + i], &files[i], rows[*nrows],
+					reads) == 0)
+				return rows;
+			(*nrows)++;
+
+			/* The command line is kept as fullcomm. */
+			if (files[i].stat != NULL)
+				pfree(files[i].stat);
+			if (files[i].io != NULL)
+				pfree(files[i].io);
+		}
+	}
+	pfree(files);
+
+	return rows;
+}
+
+/* Read the rows of all pids, for the cache. */
+static char ***
+scan_proctab(int32 *pids, int npids, int *nrows)
+{
+	return read_proctab(pids, npids, PROCTAB_ALL, nrows);
+}
+
+/*
+ * Return the rows of all client connections and the time they were read,
+ * from the shared cache when it is fresh enough, otherwise read now and
+ * cached when there is a cache.
+ */
+char ***
+get_proctab_rows(int *nrows, TimestampTz *sampled)
+{
+	char ***rows;
+	int32 *pids;
+	int npids;
+
+	if (cache_read(&rows, nrows, sampled))
+		return rows;
+
+	pids = get_backend_pids(&npids);
+	if (!cache_scan(pids, npids, scan_proctab, &rows, nrows, sampled))
+	{
+		*sampled = GetCurrentTimestamp();
+		rows = scan_proctab(pids, npids, nrows);
+	}
+
+	return rows;
+}
 
 Datum pg_proctab(PG_FUNCTION_ARGS)
 {
@@ -97,6 +361,7 @@ Datum pg_proctab(PG_FUNCTION_ARGS)
 	int max_calls;
 	TupleDesc tupdesc;
 	AttInMetadata *attinmeta;
+	proctab_fctx *fctx;
 
 	elog(DEBUG5, "pg_proctab: Entering stored function.");
 
@@ -104,8 +369,10 @@ Datum pg_proctab(PG_FUNCTION_ARGS)
 	if (SRF_IS_FIRSTCALL())
 	{
 		MemoryContext oldcontext;
-
-		int ret;
+		TimestampTz sampled;
+		int32 *pids;
+		int npids;
+		int reads = PROCTAB_ALL;
 
 		/* create a function context for cross-call persistence */
 		funcctx = SRF_FIRSTCALL_INIT();
@@ -127,53 +394,33 @@ Datum pg_proctab(PG_FUNCTION_ARGS)
 		attinmeta = TupleDescGetAttInMetadata(tupdesc);
 		funcctx->attinmeta = attinmeta;
 
-		/* Get pid of all client connections. */
-
-		SPI_connect();
-		elog(DEBUG5, "pg_proctab: SPI connected.");
+		fctx = (proctab_fctx *) palloc0(sizeof(proctab_fctx));
 
-		ret = SPI_exec(GET_PIDS, 0);
-		if (ret == SPI_OK_SELECT)
+		/*
+		 * The overloads taking filters pick the processes, and the columns
+		 * to read, before any file is opened.  They always read /proc.
+		 * Otherwise take the rows from the shared cache when it is fresh
+		 * enough, or get pid of all client connections and either refresh
+		 * the cache with them or read them.  Either way all rows are read
+		 * now, so that the files of many processes can be read at once.
+		 */
+		if (PG_NARGS() > 0)
 		{
-			int32 *ppid;
-
-			int i;
-			TupleDesc tupdesc2;
-			SPITupleTable *tuptable;
-			HeapTuple tuple;
-
-			/* total number of tuples to be returned */
-			funcctx->max_calls = SPI_processed;
-
-#if (PG_VERSION_NUM >= 90600)
-			elog(DEBUG5, "pg_proctab: %lu process(es) in pg_stat_activity.",
-					funcctx->max_calls);
-#else
-			elog(DEBUG5, "pg_proctab: %d process(es) in pg_stat_activity.",
-					funcctx->max_calls);
-#endif
-			funcctx->user_fctx = MemoryContextAlloc(
-					funcctx->multi_call_memory_ctx, sizeof(int32) *
-					funcctx->max_calls);
-			ppid = (int32 *) funcctx->user_fctx;
-
-			tupdesc2 = SPI_tuptable->tupdesc;
-			tuptable = SPI_tuptable;
-
-			for (i = 0; i < funcctx->max_calls; i++)
-			{
-				tuple = tuptable->vals[i];
-				ppid[i] = atoi(SPI_getvalue(tuple, tupdesc2, 1));
-			}
+			if (!PG_ARGISNULL(PG_NARGS() - 1))
+				reads = get_proctab_reads(
+						PG_GETARG_ARRAYTYPE_P(PG_NARGS() - 1));
+			pids = get_filtered_pids(fcinfo, &npids);
+			sampled = GetCurrentTimestamp();
+			fctx->rows = read_proctab(pids, npids, reads, &max_calls);
 		}
 		else
-		{
-			/* total number of tuples to be returned */
-			funcctx->max_calls = 0;
-			elog(WARNING, "unable to get procpids from pg_stat_activity");
-		}
+			fctx->rows = get_proctab_rows(&max_calls, &sampled);
+		fctx->sample_age = psprintf(INT64_FORMAT " microseconds",
+				(int64) (GetCurrentTimestamp() - sampled));
+		funcctx->user_fctx = fctx;
 
-		SPI_finish();
+		/* total number of tuples to be returned */
+		funcctx->max_calls = max_calls;
 
 		MemoryContextSwitchTo(oldcontext);
 	}
@@ -184,63 +431,16 @@ Datum pg_proctab(PG_FUNCTION_ARGS)
 	call_cntr = funcctx->call_cntr;
 	max_calls = funcctx->max_calls;
 	attinmeta = funcctx->attinmeta;
+	fctx = (proctab_fctx *) funcctx->user_fctx;
 
 	if (call_cntr < max_calls) /* do when there is more left to send */
 	{
 		HeapTuple tuple;
 		Datum result;
 
-		char **values = NULL;
+		char **values = fctx->rows[call_cntr];
 
-		values = (char **) palloc(39 * sizeof(char *));
-		values[i_pid] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_comm] = (char *) palloc(1024 * sizeof(char));
-		values[i_state] = (char *) palloc(2 * sizeof(char));
-		values[i_ppid] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_pgrp] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_session] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_tty_nr] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_tpgid] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_flags] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_minflt] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_cminflt] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_majflt] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_cmajflt] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-
-		/* FIXME: Need to figure out correct length to hold a C double type. */
-		values[i_utime] = (char *) palloc(32 * sizeof(char));
-		values[i_stime] = (char *) palloc(32 * sizeof(char));
-
-		values[i_cutime] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_cstime] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_priority] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_nice] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_num_threads] =
-				(char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_itrealvalue] =
-				(char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_starttime] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_vsize] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_rss] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_exit_signal] =
-				(char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_processor] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_rt_priority] =
-				(char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_policy] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_delayacct_blkio_ticks] =
-				(char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_uid] = (char *) palloc((INTEGER_LEN + 1) * sizeof(char));
-		values[i_rchar] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_wchar] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_syscr] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_syscw] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_reads] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_writes] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-		values[i_cwrites] = (char *) palloc((BIGINT_LEN + 1) * sizeof(char));
-
-		if (get_proctab(funcctx, values) == 0)
-			SRF_RETURN_DONE(funcctx);
+		values[i_sample_age] = fctx->sample_age;
 
 		/* build a tuple */
 		tuple = BuildTupleFromCStrings(attinmeta, values);
@@ -256,111 +456,439 @@ Datum pg_proctab(PG_FUNCTION_ARGS)
 	}
 }
 
-int
-get_proctab(FuncCallContext *funcctx, char **values)
+/*
+ * Raise an error unless PROCFS is a mounted proc filesystem.  A root other
+ * than /proc is a fixture tree and is not checked.
+ */
+void
+check_procfs(void)
 {
 #ifdef __linux__
-	/*
- 	* For details on the Linux process table, see the description of
- 	* /proc/PID/stat in Documentation/filesystems/proc.txt in the Linux source
- 	* code.
- 	*/
+	struct statfs sb;
 
-	int32 *ppid;
-	int32 pid;
-	int length;
+	if (strcmp(PROCFS, "/proc") != 0)
+		return;
 
-	struct stat stat_struct;
+	if (statfs(PROCFS, &sb) < 0 || sb.f_type != PROC_SUPER_MAGIC)
+		elog(ERROR, "proc filesystem not mounted on %s", PROCFS);
+#endif /* __linux__ */
+}
 
-	struct statfs sb;
-	int fd;
-	int len;
-	char buffer[4096];
-	char *p;
-	char *q;
+static int
+pid_cmp(const void *a, const void *b)
+{
+	int32 pa = *(const int32 *) a;
+	int32 pb = *(const int32 *) b;
 
-	/* Check if /proc is mounted. */
-	if (statfs(PROCFS, &sb) < 0 || sb.f_type != PROC_SUPER_MAGIC)
+	return pa < pb ? -1 : pa > pb;
+}
+
+/*
+ * Return the pids of the numeric directories of an overridden PROCFS, in
+ * ascending order, standing in for the backends of a fixture tree.
+ */
+static int32 *
+get_procfs_pids(int *npids)
+{
+	DIR *dir;
+	struct dirent *de;
+	int32 *pids;
+	int size = 64;
+
+	*npids = 0;
+	pids = (int32 *) palloc(sizeof(int32) * size);
+
+	if ((dir = AllocateDir(PROCFS)) == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open directory \"%s\": %m", PROCFS)));
+	while ((de = ReadDir(dir, PROCFS)) != NULL)
 	{
-		elog(ERROR, "proc filesystem not mounted on " PROCFS "\n");
-		return 0;
+		if (strspn(de->d_name, "0123456789") != strlen(de->d_name))
+			continue;
+
+		if (*npids == size)
+		{
+			size *= 2;
+			pids = (int32 *) repalloc(pids, sizeof(int32) * size);
+		}
+		pids[(*npids)++] = atoi(de->d_name);
 	}
+	FreeDir(dir);
 
-	/* Read the stat info for the pid. */
+	qsort(pids, *npids, sizeof(int32), pid_cmp);
 
-	ppid = (int32 *) funcctx->user_fctx;
-	pid = ppid[funcctx->call_cntr];
-#if (PG_VERSION_NUM >= 90600)
-	elog(DEBUG5, "pg_proctab: accessing process table for pid[%lu] %d.",
-				funcctx->call_cntr, pid);
-#else
-	elog(DEBUG5, "pg_proctab: accessing process table for pid[%d] %d.",
-				funcctx->call_cntr, pid);
-#endif
+	return pids;
+}
 
-	/* Get the full command line information. */
-	snprintf(buffer, sizeof(buffer) - 1, "%s/%d/cmdline", PROCFS, pid);
-	fd = open(buffer, O_RDONLY);
-	if (fd == -1)
+/*
+ * Return the pids of all processes listed in pg_stat_activity.  The array is
+ * allocated in the memory context that is current when called.
+ */
+int32 *
+get_backend_pids(int *npids)
+{
+	int32 *pids = NULL;
+	int ret;
+
+	if (strcmp(PROCFS, "/proc") != 0)
+		return get_procfs_pids(npids);
+
+	SPI_connect();
+	elog(DEBUG5, "get_backend_pids: SPI connected.");
+
+	ret = SPI_exec(GET_PIDS, 0);
+	if (ret == SPI_OK_SELECT)
 	{
-		elog(WARNING, "'%s' no longer exists", buffer);
-		values[i_fullcomm] = NULL;
+		int i;
+		TupleDesc tupdesc;
+		SPITupleTable *tuptable;
+		HeapTuple tuple;
+
+		*npids = (int) SPI_processed;
+		elog(DEBUG5, "get_backend_pids: %d process(es) in pg_stat_activity.",
+				*npids);
+
+		pids = (int32 *) SPI_palloc(sizeof(int32) * (*npids + 1));
+
+		tupdesc = SPI_tuptable->tupdesc;
+		tuptable = SPI_tuptable;
+
+		for (i = 0; i < *npids; i++)
+		{
+			tuple = tuptable->vals[i];
+			pids[i] = atoi(SPI_getvalue(tuple, tupdesc, 1));
+		}
 	}
 	else
 	{
-		values[i_fullcomm] =
-				(char *) palloc((FULLCOMM_LEN + 1) * sizeof(char));
-		len = read(fd, values[i_fullcomm], FULLCOMM_LEN);
-		close(fd);
-		values[i_fullcomm][len] = '\0';
+		*npids = 0;
+		elog(WARNING, "unable to get procpids from pg_stat_activity");
 	}
-	elog(DEBUG5, "pg_proctab: %s %s", buffer, values[i_fullcomm]);
 
-	/* Get the uid and username of the pid's owner. */
-	snprintf(buffer, sizeof(buffer) - 1, "%s/%d", PROCFS, pid);
-	if (stat(buffer, &stat_struct) < 0)
+	SPI_finish();
+
+	return pids;
+}
+
+/*
+ * Return the pids the filter arguments of pg_proctab() select, a NULL
+ * argument selecting any.  pg_proctab(pids, columns) only has the first, and
+ * pg_proctab(backend_types, datnames, usenames, only_active, columns) all
+ * but the first.  For an overridden PROCFS only the pids can be applied.
+ */
+static int32 *
+get_filtered_pids(FunctionCallInfo fcinfo, int *npids)
+{
+	Oid argtypes[5];
+	Datum args[5];
+	char nulls[5];
+	int32 *pids = NULL;
+	int ret;
+	int i;
+
+	memset(nulls, 'n', sizeof(nulls));
+	args[4] = BoolGetDatum(false);
+	nulls[4] = ' ';
+	if (PG_NARGS() == 2)
 	{
-		elog(ERROR, "'%s' not found", buffer);
-		strncpy(values[i_uid], "-1", INTEGER_LEN);
-		values[i_username] = NULL;
+		if (!PG_ARGISNULL(0))
+		{
+			args[0] = PG_GETARG_DATUM(0);
+			nulls[0] = ' ';
+		}
 	}
 	else
 	{
-		struct passwd *pwd;
+		for (i = 0; i < 3; i++)
+		{
+			if (PG_ARGISNULL(i))
+				continue;
+			args[i + 1] = PG_GETARG_DATUM(i);
+			nulls[i + 1] = ' ';
+		}
+		if (!PG_ARGISNULL(3))
+			args[4] = PG_GETARG_DATUM(3);
+	}
 
-		snprintf(values[i_uid], INTEGER_LEN, "%d", stat_struct.st_uid);
-		pwd = getpwuid(stat_struct.st_uid);
-		if (pwd == NULL)
-			values[i_username] = NULL;
-		else
+	if (strcmp(PROCFS, "/proc") != 0)
+	{
+		ArrayType *array;
+		int32 *wanted;
+		int nwanted;
+		int j;
+		int n = 0;
+
+		/* The processes of another tree are not in pg_stat_activity. */
+		if (nulls[1] == ' ' || nulls[2] == ' ' || nulls[3] == ' ' ||
+				DatumGetBool(args[4]))
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("backend_types, datnames, usenames and "
+							"only_active cannot be applied under another "
+							"pg_proctab.procfs_root"),
+					 errhint("Only pids can select the processes of "
+							 "another procfs_root.")));
+
+		pids = get_procfs_pids(npids);
+		if (nulls[0] == 'n')
+			return pids;
+
+		array = DatumGetArrayTypeP(args[0]);
+		wanted = (int32 *) ARR_DATA_PTR(array);
+		nwanted = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+		if (ARR_HASNULL(array))
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("pids must not contain nulls")));
+
+		for (i = 0; i < *npids; i++)
+			for (j = 0; j < nwanted; j++)
+				if (pids[i] == wanted[j])
+				{
+					pids[n++] = pids[i];
+					break;
+				}
+		*npids = n;
+
+		return pids;
+	}
+
+#if PG_VERSION_NUM >= 100000
+	argtypes[0] = INT4ARRAYOID;
+	argtypes[1] = TEXTARRAYOID;
+	argtypes[2] = get_array_type(NAMEOID);
+	argtypes[3] = get_array_type(NAMEOID);
+	argtypes[4] = BOOLOID;
+
+	SPI_connect();
+
+	ret = SPI_execute_with_args(GET_FILTERED_PIDS, 5, argtypes, args, nulls,
+			true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "unable to get pids from pg_stat_activity");
+
+	*npids = (int) SPI_processed;
+	pids = (int32 *) SPI_palloc(sizeof(int32) * (*npids + 1));
+	for (i = 0; i < *npids; i++)
+		pids[i] = atoi(SPI_getvalue(SPI_tuptable->vals[i],
+				SPI_tuptable->tupdesc, 1));
+
+	SPI_finish();
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("filtering pg_proctab() requires PostgreSQL 10 or later")));
+#endif /* PG_VERSION_NUM */
+
+	return pids;
+}
+
+/*
+ * Return the PROCTAB_* flags of the files the named columns need read.  The
+ * columns of /proc/PID/stat are always returned.
+ */
+static int
+get_proctab_reads(ArrayType *columns)
+{
+	Datum *names;
+	bool *nulls;
+	int nnames;
+	int reads = 0;
+	int i;
+	int j;
+
+	deconstruct_array(columns, TEXTOID, -1, false, 'i', &names, &nulls,
+			&nnames);
+	for (i = 0; i < nnames; i++)
+	{
+		char *name;
+
+		if (nulls[i])
+			continue;
+		name = TextDatumGetCString(names[i]);
+		for (j = 0; j < lengthof(proctab_columns); j++)
+			if (strcmp(name, proctab_columns[j].name) == 0)
+				break;
+		if (j == lengthof(proctab_columns))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("pg_proctab() has no column \"%s\"", name)));
+		reads |= proctab_columns[j].reads;
+	}
+
+	return reads;
+}
+
+/*
+ * Return the name of a uid, or NULL if it has none.  Where the passwd database
+ * is a network service, a lookup per process would dominate the time
+ * pg_proctab() takes, and the processes almost always share one uid, so the
+ * names are remembered for USERNAME_TTL seconds by each backend.
+ */
+static char *
+get_username(uid_t uid)
+{
+	username_entry *entry;
+	struct passwd *pwd;
+	TimestampTz now = GetCurrentTimestamp();
+	bool found;
+
+	if (usernames == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(uid_t);
+		ctl.entrysize = sizeof(username_entry);
+		ctl.hcxt = TopMemoryContext;
+		usernames = hash_create("pg_proctab usernames", 16, &ctl,
+				HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	entry = (username_entry *) hash_search(usernames, &uid, HASH_ENTER,
+			&found);
+	if (found && !TimestampDifferenceExceeds(entry->looked_up, now,
+			USERNAME_TTL * 1000))
+		return entry->name;
+
+	if (found && entry->name != NULL)
+		pfree(entry->name);
+	entry->name = NULL;
+	entry->looked_up = now;
+
+	pwd = getpwuid(uid);
+	entry->name = pwd == NULL ? NULL :
+			MemoryContextStrdup(TopMemoryContext, pwd->pw_name);
+
+	return entry->name;
+}
+
+/*
+ * Read the files of a pid that get_proctab() parses, one after the other.
+ */
+static void
+read_proctab_files(int32 pid, int reads, proctab_files *files)
+{
+#ifdef __linux__
+	struct stat stat_struct;
+	char path[MAXPGPATH];
+	int fd;
+	int len;
+#endif /* __linux__ */
+
+	memset(files, 0, sizeof(proctab_files));
+
+#ifdef __linux__
+	snprintf(path, sizeof(path), "%s/%d/cmdline", PROCFS, pid);
+	if ((reads & PROCTAB_CMDLINE) != 0 &&
+			(fd = open(path, O_RDONLY)) != -1)
+	{
+		files->cmdline =
+				(char *) palloc((FULLCOMM_LEN + 1) * sizeof(char));
+		len = read(fd, files->cmdline, FULLCOMM_LEN);
+		close(fd);
+		files->cmdline[len < 0 ? 0 : len] = '\0';
+	}
+
+	/*
+	 * The uid is also on the Uid: line of /proc/PID/status, but that file is
+	 * not otherwise read, and opening and reading it would take more system
+	 * calls than one fstat() on the stat file, whose owner is the owner of
+	 * the process.
+	 */
+	snprintf(path, sizeof(path), "%s/%d/stat", PROCFS, pid);
+	if ((fd = open(path, O_RDONLY)) != -1)
+	{
+		if (fstat(fd, &stat_struct) == 0)
 		{
-			values[i_username] = (char *) palloc((strlen(pwd->pw_name) +
-					1) * sizeof(char));
-			strcpy(values[i_username], pwd->pw_name);
+			files->have_uid = true;
+			files->uid = stat_struct.st_uid;
 		}
+		files->stat = (char *) palloc(PROCTAB_STAT_LEN * sizeof(char));
+		len = read(fd, files->stat, PROCTAB_STAT_LEN - 1);
+		close(fd);
+		files->stat[len < 0 ? 0 : len] = '\0';
 	}
 
-	/* Get the process table information for the pid. */
+	snprintf(path, sizeof(path), "%s/%d/io", PROCFS, pid);
+	if ((reads & PROCTAB_IO) != 0 && (fd = open(path, O_RDONLY)) != -1)
+	{
+		files->io = (char *) palloc(PROCTAB_IO_LEN * sizeof(char));
+		len = read(fd, files->io, PROCTAB_IO_LEN - 1);
+		close(fd);
+		files->io[len < 0 ? 0 : len] = '\0';
+	}
+#endif /* __linux__ */
+}
+
+/*
+ * Parse the files of a pid, read by read_proctab_files() or
+ * uring_read_proctab(), into the values of its row.
+ */
+int
+get_proctab(int32 pid, proctab_files *files, char **values, int reads)
+{
+#ifdef __linux__
+	/*
+ 	* For details on the Linux process table, see the description of
+ 	* /proc/PID/stat in Documentation/filesystems/proc.txt in the Linux source
+ 	* code.
+ 	*/
+
+	int length;
+
+	int len;
+	char buffer[MAXPGPATH];
+	char *p;
+	char *q;
+
+	/* Parse the stat info for the pid. */
+
+	elog(DEBUG5, "pg_proctab: accessing process table for pid %d.", pid);
+
+	/* Get the full command line information. */
+	snprintf(buffer, sizeof(buffer) - 1, "%s/%d/cmdline", PROCFS, pid);
+	if ((reads & PROCTAB_CMDLINE) != 0 && files->cmdline == NULL)
+		elog(WARNING, "'%s' no longer exists", buffer);
+	values[i_fullcomm] = files->cmdline;
+	elog(DEBUG5, "pg_proctab: %s %s", buffer, values[i_fullcomm]);
+
+	/*
+	 * Get the process table information for the pid, and the uid and
+	 * username of its owner, who owns the file.
+	 */
 	snprintf(buffer, sizeof(buffer) - 1, "%s/%d/stat", PROCFS, pid);
-	fd = open(buffer, O_RDONLY);
-	if (fd == -1)
+	if (files->stat == NULL)
 	{
 		elog(ERROR, "%d/stat not found", pid);
 		return 0;
 	}
-	len = read(fd, buffer, sizeof(buffer) - 1);
-	close(fd);
-	buffer[len] = '\0';
-	elog(DEBUG5, "pg_proctab: %s", buffer);
+	if (!files->have_uid)
+	{
+		elog(ERROR, "'%s' not found", buffer);
+		return 0;
+	}
+	snprintf(values[i_uid], INTEGER_LEN, "%d", files->uid);
+	values[i_username] = NULL;
+	if ((reads & PROCTAB_USERNAME) != 0)
+		values[i_username] = get_username(files->uid);
+	if (values[i_username] != NULL)
+		values[i_username] = pstrdup(values[i_username]);
 
-	p = buffer;
+	elog(DEBUG5, "pg_proctab: %s", files->stat);
+
+	p = files->stat;
 
 	/* pid */
 	GET_NEXT_VALUE(p, q, values[i_pid], length, "pid not found", ' ');
 
-	/* comm */
+	/*
+	 * comm, which may itself contain spaces and parentheses, so it ends at
+	 * the last parenthesis.
+	 */
 	++p;
-	if ((q = strchr(p, ')')) == NULL)
+	if ((q = strrchr(p, ')')) == NULL)
 	{
 		elog(ERROR, "pg_proctab: comm not found");
 		return 0;
@@ -441,8 +969,8 @@ get_proctab(FuncCallContext *funcctx, char **values)
 	/* rss */
 	GET_NEXT_VALUE(p, q, values[i_rss], length, "rss not found", ' ');
 	/* Convert rss into bytes. */
-	snprintf(values[i_rss], sizeof(values[i_rss]) -1, "%lld",
-			pagetok(atoll(values[i_rss])));
+	snprintf(values[i_rss], BIGINT_LEN, "%lld",
+			(long long) pagetok(atoll(values[i_rss])));
 
 	SKIP_TOKEN(p);			/* skip rlim */
 	SKIP_TOKEN(p);			/* skip startcode */
@@ -493,9 +1021,17 @@ get_proctab(FuncCallContext *funcctx, char **values)
 
 	/* Get i/o stats per process. */
 
-	snprintf(buffer, sizeof(buffer) - 1, "%s/%d/io", PROCFS, pid);
-	fd = open(buffer, O_RDONLY);
-	if (fd == -1)
+	if ((reads & PROCTAB_IO) == 0)
+	{
+		values[i_rchar] = NULL;
+		values[i_wchar] = NULL;
+		values[i_syscr] = NULL;
+		values[i_syscw] = NULL;
+		values[i_reads] = NULL;
+		values[i_writes] = NULL;
+		values[i_cwrites] = NULL;
+	}
+	else if (files->io == NULL)
 	{
 		/* If the i/o stats are not available, set the values to zero. */
 		elog(NOTICE, "i/o stats collection for Linux not enabled");
@@ -509,10 +1045,7 @@ get_proctab(FuncCallContext *funcctx, char **values)
 	}
 	else
 	{
-		len = read(fd, buffer, sizeof(buffer) - 1);
-		close(fd);
-		buffer[len] = '\0';
-		p = buffer;
+		p = files->io;
 		GET_VALUE(values[i_rchar]);
 		GET_VALUE(values[i_wchar]);
 		GET_VALUE(values[i_syscr]);
@@ -681,7 +1214,6 @@ int
 get_cputime(char **values)
 {
 #ifdef __linux__
-	struct statfs sb;
 	int fd;
 	int len;
 	char buffer[4096];
@@ -690,12 +1222,7 @@ get_cputime(char **values)
 
 	int length;
 
-	/* Check if /proc is mounted. */
-	if (statfs(PROCFS, &sb) < 0 || sb.f_type != PROC_SUPER_MAGIC)
-	{
-		elog(ERROR, "proc filesystem not mounted on " PROCFS "\n");
-		return 0;
-	}
+	check_procfs();
 
 	snprintf(buffer, sizeof(buffer) - 1, "%s/stat", PROCFS);
 	fd = open(buffer, O_RDONLY);
@@ -823,19 +1350,13 @@ get_loadavg(char **values)
 #ifdef __linux__
 	int length;
 
-	struct statfs sb;
 	int fd;
 	int len;
 	char buffer[4096];
 	char *p;
 	char *q;
 
-	/* Check if /proc is mounted. */
-	if (statfs(PROCFS, &sb) < 0 || sb.f_type != PROC_SUPER_MAGIC)
-	{
-		elog(ERROR, "proc filesystem not mounted on " PROCFS "\n");
-		return 0;
-	}
+	check_procfs();
 
 	snprintf(buffer, sizeof(buffer) - 1, "%s/loadavg", PROCFS);
 	fd = open(buffer, O_RDONLY);
@@ -987,19 +1508,13 @@ get_memusage(char **values)
 	unsigned long swapfree = 0;
 	unsigned long swaptotal = 0;
 
-	struct statfs sb;
 	int fd;
 	int len;
 	char buffer[4096];
 	char *p;
 	char *q;
 
-	/* Check if /proc is mounted. */
-	if (statfs(PROCFS, &sb) < 0 || sb.f_type != PROC_SUPER_MAGIC)
-	{
-		elog(ERROR, "proc filesystem not mounted on " PROCFS "\n");
-		return 0;
-	}
+	check_procfs();
 
 	snprintf(buffer, sizeof(buffer) - 1, "%s/meminfo", PROCFS);
 	fd = open(buffer, O_RDONLY);
@@ -1106,9 +1621,9 @@ Datum pg_diskusage(PG_FUNCTION_ARGS)
 	bool nulls[20];
 
 	char device_name[4096];
-	struct statfs sb;
 	FILE *fd;
 	int ret;
+	int i;
 
 	int major = 0;
 	int minor = 0;
@@ -1168,14 +1683,12 @@ Datum pg_diskusage(PG_FUNCTION_ARGS)
 	memset(values, 0, sizeof(values));
 
 #ifdef __linux__
-	if (statfs("/proc", &sb) < 0 || sb.f_type != PROC_SUPER_MAGIC)
-	{
-		elog(ERROR, "proc filesystem not mounted on /proc\n");
-		return (Datum) 0;
-	}
-	if ((fd = AllocateFile("/proc/diskstats", PG_BINARY_R)) == NULL)
+	check_procfs();
+
+	snprintf(device_name, sizeof(device_name), "%s/diskstats", PROCFS);
+	if ((fd = AllocateFile(device_name, PG_BINARY_R)) == NULL)
 	{
-		elog(ERROR, "File not found: '/proc/diskstats'");
+		elog(ERROR, "File not found: '%s'", device_name);
 		return (Datum) 0;
 	}
 
@@ -1198,6 +1711,29 @@ Datum pg_diskusage(PG_FUNCTION_ARGS)
 				   &flushes_completed, &flushtime
 				)) > 0)
 	{
+		/*
+		 * Kernels before 4.18 have no discard columns and before 5.5 no
+		 * flush columns.  Columns the line does not have are NULL.
+		 */
+		for (i = 0; i < 20; i++)
+			nulls[i] = i >= ret;
+
+		/*
+		 * Kernels before 2.6.25 list partitions with only reads, sectors
+		 * read, writes and sectors written.
+		 */
+		if (ret == 7)
+		{
+			sectors_written = readtime;
+			writes_completed = sectors_read;
+			sectors_read = reads_merged;
+
+			nulls[i_reads_merged] = true;
+			nulls[i_readtime] = true;
+			nulls[i_writes_completed] = false;
+			nulls[i_sectors_written] = false;
+		}
+
 		/*
 		 * Consume additional data on the line, so it isn't
 		 * interpreted as part of the next (newline-delimited)
@@ -1223,13 +1759,13 @@ Datum pg_diskusage(PG_FUNCTION_ARGS)
 		values[i_iotime] = Int64GetDatumFast(iotime);
 		values[i_totaliotime] = Int64GetDatumFast(totaliotime);
 
-		values[i_discards_completed] = discards_completed;
-		values[i_discards_merged] = discards_merged;
-		values[i_sectors_discarded] = sectors_discarded;
-		values[i_discardtime] = discardtime;
+		values[i_discards_completed] = Int64GetDatumFast(discards_completed);
+		values[i_discards_merged] = Int64GetDatumFast(discards_merged);
+		values[i_sectors_discarded] = Int64GetDatumFast(sectors_discarded);
+		values[i_discardtime] = Int64GetDatumFast(discardtime);
 
-		values[i_flushes_completed] = flushes_completed;
-		values[i_flushtime] = flushtime;
+		values[i_flushes_completed] = Int64GetDatumFast(flushes_completed);
+		values[i_flushtime] = Int64GetDatumFast(flushtime);
 
 		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
 	}
@@ -1238,3 +1774,14 @@ Datum pg_diskusage(PG_FUNCTION_ARGS)
 
 	return (Datum) 0;
 }
+
+/*
+ * The unit of the utime and stime columns of pg_proctab() and of every
+ * column of pg_cputime().
+ */
+Datum pg_clock_ticks(PG_FUNCTION_ARGS)
+{
+	elog(DEBUG5, "pg_clock_ticks: Entering stored function.");
+
+	PG_RETURN_INT32((int32) sysconf(_SC_CLK_TCK));
+}
@@ -5,19 +5,115 @@
 #ifndef _PG_PROCTAB_H_
 #define _PG_PROCTAB_H_
 
-#ifdef PG_MODULE_MAGIC
-PG_MODULE_MAGIC;
-#endif
+#include "datatype/timestamp.h"
 
 #define BIGINT_LEN 20
 #define FLOAT_LEN 20
 #define INTEGER_LEN 10
 
+extern int32 *get_backend_pids(int *);
+
+extern void perf_init(void);
+extern void control_init(void);
+extern void worker_init(void);
+extern void exporter_init(void);
+
+extern char *worker_database;
+
+extern int apply_process_policy(int32, const char *, const char *);
+
+extern int cpu_numa_node(int);
+extern int sysfs_cpu_count(void);
+
+extern int64 snap_stats(const char *);
+
+#define SNAP_STORAGE_ROWS 0
+#define SNAP_STORAGE_PACKED 1
+
+extern int snap_storage;
+
+struct SPITupleTable;
+
+extern void pack_init(void);
+extern const char *pack_source(void);
+extern void pack_lock(void);
+extern void pack_procstat(int64, TimestampTz, struct SPITupleTable *, uint64);
+
+extern char *procfs_root;
+extern char *sysfs_root;
+
+extern void check_procfs(void);
+
+/* Columns of pg_proctab() read from /proc, which leaves out sample_age. */
+#define PROCTAB_NCOLS 39
+
+typedef char ***(*proctab_scan_fn)(int32 *, int, int *);
+
+/* What get_proctab() reads besides /proc/PID/stat. */
+#define PROCTAB_CMDLINE 0x01
+#define PROCTAB_IO 0x02
+#define PROCTAB_USERNAME 0x04
+#define PROCTAB_ALL (PROCTAB_CMDLINE | PROCTAB_IO | PROCTAB_USERNAME)
+
+/* Sizes of the buffers the files of a pid are read into. */
+#define FULLCOMM_LEN 1024
+#define PROCTAB_STAT_LEN 4096
+#define PROCTAB_IO_LEN 1024
+
+/* Pids whose files are read at once. */
+#define PROCTAB_BATCH 256
+
+/*
+ * The files of a pid that get_proctab() parses, each NULL where it was not
+ * read, and the owner of /proc/PID/stat.
+ */
+typedef struct
+{
+	char *stat;
+	char *cmdline;
+	char *io;
+	bool have_uid;
+	uid_t uid;
+} proctab_files;
+
+extern int cache_max_age;
+
+extern void cache_init(void);
+extern bool cache_read(char ****, int *, TimestampTz *);
+extern bool cache_scan(int32 *, int, proctab_scan_fn, char ****, int *,
+		TimestampTz *);
+
+extern char ***get_proctab_rows(int *, TimestampTz *);
+
+extern int flight_recorder_interval;
+
+extern void flight_init(void);
+extern void flight_record(void);
+
+extern bool proctab_io_uring;
+
+extern void uring_init(void);
+extern bool uring_read_proctab(int32 *, int, int, proctab_files *);
+
+extern int anomaly_interval;
+extern int burst_interval;
+
+extern void anomaly_init(void);
+extern bool anomaly_check(TimestampTz *);
+
+extern void accounting_init(void);
+
+extern int quantile_interval;
+
+extern void quantile_init(void);
+extern void quantile_sample(void);
+
 #ifdef __linux__
 #include <ctype.h>
 #include <linux/magic.h>
 
-#define PROCFS "/proc"
+#define PROCFS procfs_root
+#define SYSFS sysfs_root
 
 #define GET_NEXT_VALUE(p, q, value, length, msg, delim) \
         if ((q = strchr(p, delim)) == NULL) \
@@ -0,0 +1,748 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <math.h>
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include <limits.h>
+#include "pg_proctab.h"
+
+#define GET_QUANTILE_BACKENDS \
+		"SELECT pid, backend_type " \
+		"FROM pg_stat_activity " \
+		"WHERE pid <> pg_backend_pid() AND backend_type IS NOT NULL"
+
+/*
+ * The series, each in its own unit: the percentage of a processor a backend
+ * used over a sample, the milliseconds it waited in the run queue per time
+ * it was scheduled in, and the milliseconds a request to a device took.
+ */
+enum quantile_metric {QUANTILE_CPU, QUANTILE_RUNQ_DELAY, QUANTILE_AWAIT};
+
+#define QUANTILE_NMETRICS 3
+
+static const char *quantile_metrics[] = {"cpu", "runq_delay", "await"};
+
+enum quantiles {i_q_metric, i_q_object, i_q_samples, i_q_mean, i_q_min,
+		i_q_max, i_q_percentile, i_q_value, i_q_stats_reset};
+
+#define QUANTILES_NCOLS 9
+
+/*
+ * Values are recorded in thousandths of their unit, in buckets as wide as
+ * one in 2^QUANTILE_SUB_BITS of the values they hold, so a quantile is off
+ * by at most 1.6% of itself whatever its magnitude.  Values below
+ * 2^(QUANTILE_SUB_BITS + 1) have a bucket each and those from
+ * 2^QUANTILE_MAX_BITS, some 12 days in milliseconds, share the last.
+ */
+#define QUANTILE_SCALE 1000.0
+#define QUANTILE_SUB_BITS 5
+#define QUANTILE_SUB_COUNT (1 << QUANTILE_SUB_BITS)
+#define QUANTILE_MAX_BITS 40
+#define QUANTILE_BUCKETS \
+		((QUANTILE_MAX_BITS - QUANTILE_SUB_BITS + 1) * QUANTILE_SUB_COUNT)
+
+typedef struct
+{
+	int32 metric;
+	char object[NAMEDATALEN];
+} quantile_key;
+
+/* The histogram of a metric of a backend_type or device. */
+typedef struct
+{
+	quantile_key key;		/* hash key */
+	int64 samples;
+	double sum;
+	uint64 min;
+	uint64 max;
+	int64 counts[QUANTILE_BUCKETS];
+} quantile_entry;
+
+typedef struct
+{
+	LWLock *lock;
+	TimestampTz stats_reset[QUANTILE_NMETRICS];
+} quantile_shared;
+
+/* The counters of a backend as of the previous sample. */
+typedef struct
+{
+	int32 pid;				/* hash key */
+	int64 cpu_ns;
+	int64 delay_ns;
+	int64 slices;
+	TimestampTz time;
+	bool seen;
+} quantile_backend;
+
+/* The counters of a device as of the previous sample. */
+typedef struct
+{
+	char devname[NAMEDATALEN];	/* hash key */
+	int64 ios;
+	int64 ticks;
+	bool seen;
+} quantile_device;
+
+/* A value of a sample, waiting to be added to its histogram. */
+typedef struct
+{
+	quantile_key key;
+	double value;
+} quantile_value;
+
+int quantile_interval = 0;
+int quantile_max = 128;
+
+static quantile_shared *quantile = NULL;
+static HTAB *quantile_hash = NULL;
+
+static HTAB *quantile_backends = NULL;
+static HTAB *quantile_devices = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+Datum pg_proctab_quantiles(PG_FUNCTION_ARGS);
+Datum pg_proctab_quantiles_reset(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_proctab_quantiles);
+PG_FUNCTION_INFO_V1(pg_proctab_quantiles_reset);
+
+static Size quantile_shmem_size(void);
+static void quantile_shmem_request(void);
+static void quantile_shmem_startup(void);
+static int quantile_bucket(uint64);
+static uint64 quantile_bucket_value(int);
+static double quantile_at(quantile_entry *, double);
+static int quantile_lookup_metric(text *);
+static void quantile_add(quantile_value *, int32, const char *, double);
+#ifdef __linux__
+static int quantile_sample_backends(TimestampTz, quantile_value *);
+static int quantile_sample_devices(quantile_value *, int);
+#endif /* __linux__ */
+
+void
+quantile_init(void)
+{
+	DefineCustomIntVariable("pg_proctab.quantile_interval",
+			"How often the pg_proctab worker adds a sample to the quantile "
+			"histograms.",
+			"Zero disables the histograms.",
+			&quantile_interval,
+			0,
+			0,
+			INT_MAX / 1000,
+			PGC_SIGHUP,
+			GUC_UNIT_S,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.quantile_max",
+			"Most histograms, one per metric and backend type or device, "
+			"kept in shared memory.",
+			"Samples of any more are not recorded.",
+			&quantile_max,
+			128,
+			16,
+			INT_MAX / 2,
+			PGC_POSTMASTER,
+			0,
+			NULL,
+			NULL,
+			NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = quantile_shmem_request;
+#else
+	quantile_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = quantile_shmem_startup;
+}
+
+static Size
+quantile_shmem_size(void)
+{
+	return add_size(MAXALIGN(sizeof(quantile_shared)),
+			hash_estimate_size(quantile_max, sizeof(quantile_entry)));
+}
+
+static void
+quantile_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(quantile_shmem_size());
+	RequestNamedLWLockTranche("pg_proctab quantiles", 1);
+}
+
+static void
+quantile_shmem_startup(void)
+{
+	HASHCTL ctl;
+	bool found;
+	int i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	quantile = ShmemInitStruct("pg_proctab quantiles",
+			sizeof(quantile_shared), &found);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(quantile_key);
+	ctl.entrysize = sizeof(quantile_entry);
+	quantile_hash = ShmemInitHash("pg_proctab quantiles hash",
+			quantile_max, quantile_max, &ctl, HASH_ELEM | HASH_BLOBS);
+
+	if (!found)
+	{
+		quantile->lock =
+				&(GetNamedLWLockTranche("pg_proctab quantiles"))->lock;
+		for (i = 0; i < QUANTILE_NMETRICS; i++)
+			quantile->stats_reset[i] = GetCurrentTimestamp();
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/* Return the bucket of a value in thousandths. */
+static int
+quantile_bucket(uint64 v)
+{
+	int shift = 0;
+
+	if (v >= (UINT64CONST(1) << QUANTILE_MAX_BITS))
+		return QUANTILE_BUCKETS - 1;
+
+	while ((v >> shift) >= 2 * QUANTILE_SUB_COUNT)
+		shift++;
+
+	return shift * QUANTILE_SUB_COUNT + (int) (v >> shift);
+}
+
+/* Return the middle of the values a bucket holds. */
+static uint64
+quantile_bucket_value(int bucket)
+{
+	int shift;
+	uint64 low;
+
+	if (bucket < 2 * QUANTILE_SUB_COUNT)
+		return bucket;
+
+	shift = bucket / QUANTILE_SUB_COUNT - 1;
+	low = (uint64) (bucket - shift * QUANTILE_SUB_COUNT) << shift;
+
+	return low + ((UINT64CONST(1) << shift) - 1) / 2;
+}
+
+/*
+ * Return the value below which a percentage of the samples of a histogram
+ * fall, within the smallest and the largest sample.
+ */
+static double
+quantile_at(quantile_entry *entry, double percentile)
+{
+	int64 rank;
+	int64 seen = 0;
+	uint64 value = entry->max;
+	int i;
+
+	rank = (int64) ceil(percentile / 100.0 * entry->samples);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < QUANTILE_BUCKETS; i++)
+	{
+		seen += entry->counts[i];
+		if (seen >= rank)
+		{
+			value = quantile_bucket_value(i);
+			break;
+		}
+	}
+
+	value = Max(value, entry->min);
+	value = Min(value, entry->max);
+
+	return value / QUANTILE_SCALE;
+}
+
+/* Return the metric a name stands for, or -1 for NULL, all of them. */
+static int
+quantile_lookup_metric(text *name)
+{
+	char *metric;
+	int i;
+
+	if (name == NULL)
+		return -1;
+
+	metric = text_to_cstring(name);
+	for (i = 0; i < QUANTILE_NMETRICS; i++)
+		if (strcmp(metric, quantile_metrics[i]) == 0)
+			return i;
+
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("unrecognized metric \"%s\"", metric),
+			 errhint("Valid metrics are \"cpu\", \"runq_delay\" and "
+					 "\"await\".")));
+	return -1;
+}
+
+static void
+quantile_add(quantile_value *value, int32 metric, const char *object,
+		double v)
+{
+	memset(&value->key, 0, sizeof(value->key));
+	value->key.metric = metric;
+	strlcpy(value->key.object, object, sizeof(value->key.object));
+	value->value = v;
+}
+
+#ifdef __linux__
+/*
+ * Sample the processor time and run queue delay of every backend from
+ * /proc/PID/schedstat, a backend that is new having no values until its
+ * second sample.  Returns how many values are added to values, which has
+ * room for two per backend.
+ */
+static int
+quantile_sample_backends(TimestampTz now, quantile_value *values)
+{
+	HASH_SEQ_STATUS status;
+	quantile_backend *backend;
+	int nvalues = 0;
+	int ret;
+	uint64 i;
+
+	hash_seq_init(&status, quantile_backends);
+	while ((backend = (quantile_backend *) hash_seq_search(&status)) != NULL)
+		backend->seen = false;
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple tuple = SPI_tuptable->vals[i];
+		TupleDesc tupdesc = SPI_tuptable->tupdesc;
+		char path[MAXPGPATH];
+		char *backend_type;
+		int64 cpu_ns;
+		int64 delay_ns;
+		int64 slices;
+		double elapsed;
+		bool found;
+		FILE *fp;
+		int32 pid;
+
+		pid = atoi(SPI_getvalue(tuple, tupdesc, 1));
+		backend_type = SPI_getvalue(tuple, tupdesc, 2);
+
+		/* The backend may have exited since pg_stat_activity was read. */
+		snprintf(path, sizeof(path), "%s/%d/schedstat", PROCFS, pid);
+		if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+			continue;
+		ret = fscanf(fp, INT64_FORMAT " " INT64_FORMAT " " INT64_FORMAT,
+				&cpu_ns, &delay_ns, &slices);
+		FreeFile(fp);
+		if (ret != 3)
+			continue;
+
+		backend = (quantile_backend *) hash_search(quantile_backends, &pid,
+				HASH_ENTER, &found);
+		backend->seen = true;
+
+		/* Counters that went down belong to a new process with the pid. */
+		elapsed = (double) (now - backend->time) * 1000.0;
+		if (found && elapsed > 0 && cpu_ns >= backend->cpu_ns &&
+				delay_ns >= backend->delay_ns && slices >= backend->slices)
+		{
+			quantile_add(&values[nvalues++], QUANTILE_CPU, backend_type,
+					100.0 * (cpu_ns - backend->cpu_ns) / elapsed);
+			if (slices > backend->slices)
+				quantile_add(&values[nvalues++], QUANTILE_RUNQ_DELAY,
+						backend_type, (delay_ns - backend->delay_ns) /
+						1000000.0 / (slices - backend->slices));
+		}
+
+		backend->cpu_ns = cpu_ns;
+		backend->delay_ns = delay_ns;
+		backend->slices = slices;
+		backend->time = now;
+	}
+
+	hash_seq_init(&status, quantile_backends);
+	while ((backend = (quantile_backend *) hash_seq_search(&status)) != NULL)
+		if (!backend->seen)
+			hash_search(quantile_backends, &backend->pid, HASH_REMOVE, NULL);
+
+	return nvalues;
+}
+
+/*
+ * Sample the await of every device that completed requests since the
+ * previous sample, from the milliseconds spent reading and writing in
+ * /proc/diskstats.  Returns how many values are added to values, which has
+ * room for max.
+ */
+static int
+quantile_sample_devices(quantile_value *values, int max)
+{
+	HASH_SEQ_STATUS status;
+	quantile_device *device;
+	char path[MAXPGPATH];
+	char line[1024];
+	int nvalues = 0;
+	FILE *fp;
+
+	hash_seq_init(&status, quantile_devices);
+	while ((device = (quantile_device *) hash_seq_search(&status)) != NULL)
+		device->seen = false;
+
+	snprintf(path, sizeof(path), "%s/diskstats", PROCFS);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char devname[NAMEDATALEN];
+		int64 reads;
+		int64 readtime;
+		int64 writes;
+		int64 writetime;
+		bool found;
+
+		/*
+		 * "   8       0 sda 25317 6143 1725210 17893 51736 ...", the lines
+		 * of the partitions of kernels before 2.6.25 having no times.
+		 */
+		memset(devname, 0, sizeof(devname));
+		if (sscanf(line, "%*d %*d %63s " INT64_FORMAT " %*d %*d "
+				INT64_FORMAT " " INT64_FORMAT " %*d %*d " INT64_FORMAT,
+				devname, &reads, &readtime, &writes, &writetime) != 5)
+			continue;
+
+		device = (quantile_device *) hash_search(quantile_devices, devname,
+				HASH_ENTER, &found);
+		device->seen = true;
+
+		if (found && nvalues < max && reads + writes > device->ios &&
+				readtime + writetime >= device->ticks)
+			quantile_add(&values[nvalues++], QUANTILE_AWAIT, devname,
+					(double) (readtime + writetime - device->ticks) /
+					(reads + writes - device->ios));
+
+		device->ios = reads + writes;
+		device->ticks = readtime + writetime;
+	}
+	FreeFile(fp);
+
+	hash_seq_init(&status, quantile_devices);
+	while ((device = (quantile_device *) hash_seq_search(&status)) != NULL)
+		if (!device->seen)
+			hash_search(quantile_devices, device->devname, HASH_REMOVE, NULL);
+
+	return nvalues;
+}
+#endif /* __linux__ */
+
+/*
+ * Add a sample of every backend and device to the histograms of their
+ * backend_type and device.  Called by the pg_proctab worker every
+ * pg_proctab.quantile_interval seconds.
+ */
+void
+quantile_sample(void)
+{
+#ifdef __linux__
+	quantile_value *values;
+	TimestampTz now;
+	int nvalues;
+	int ret;
+	int i;
+
+	if (quantile == NULL)
+		return;
+
+	if (quantile_backends == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(int32);
+		ctl.entrysize = sizeof(quantile_backend);
+		quantile_backends = hash_create("pg_proctab quantile backends", 128,
+				&ctl, HASH_ELEM | HASH_BLOBS);
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = NAMEDATALEN;
+		ctl.entrysize = sizeof(quantile_device);
+		quantile_devices = hash_create("pg_proctab quantile devices", 32,
+				&ctl, HASH_ELEM | HASH_BLOBS);
+	}
+
+	check_procfs();
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "sampling quantiles");
+
+	ret = SPI_execute(GET_QUANTILE_BACKENDS, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "pg_proctab worker: %s failed: %s",
+				GET_QUANTILE_BACKENDS, SPI_result_code_string(ret));
+
+	now = GetCurrentTimestamp();
+
+	/* Two values per backend, and as many devices as there are keys. */
+	values = (quantile_value *) palloc(sizeof(quantile_value) *
+			(2 * SPI_processed + quantile_max));
+	nvalues = quantile_sample_backends(now, values);
+	nvalues += quantile_sample_devices(values + nvalues, quantile_max);
+
+	LWLockAcquire(quantile->lock, LW_EXCLUSIVE);
+	for (i = 0; i < nvalues; i++)
+	{
+		quantile_entry *entry;
+		uint64 v;
+		bool found;
+
+		entry = (quantile_entry *) hash_search(quantile_hash,
+				&values[i].key, HASH_FIND, NULL);
+		if (entry == NULL && hash_get_num_entries(quantile_hash) <
+				quantile_max)
+		{
+			entry = (quantile_entry *) hash_search(quantile_hash,
+					&values[i].key, HASH_ENTER_NULL, &found);
+			if (entry != NULL && !found)
+			{
+				entry->samples = 0;
+				entry->sum = 0;
+				entry->min = 0;
+				entry->max = 0;
+				memset(entry->counts, 0, sizeof(entry->counts));
+			}
+		}
+		if (entry == NULL)
+			continue;
+
+		v = (uint64) rint(Max(values[i].value, 0) * QUANTILE_SCALE);
+		if (entry->samples == 0 || v < entry->min)
+			entry->min = v;
+		if (v > entry->max)
+			entry->max = v;
+		entry->samples++;
+		entry->sum += values[i].value;
+		entry->counts[quantile_bucket(v)]++;
+	}
+	LWLockRelease(quantile->lock);
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+#endif /* __linux__ */
+}
+
+/*
+ * Return the percentiles of a metric, or of every metric for a NULL one, per
+ * backend_type or device, a row per percentile.  There are none unless
+ * pg_proctab is in shared_preload_libraries and
+ * pg_proctab.quantile_interval is set.
+ */
+Datum pg_proctab_quantiles(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+	HASH_SEQ_STATUS status;
+	quantile_entry *entries;
+	quantile_entry *entry;
+	TimestampTz stats_reset[QUANTILE_NMETRICS];
+	ArrayType *array;
+	Datum *elems;
+	bool *elem_nulls;
+	int nelems;
+	int nentries = 0;
+	int metric;
+	int i;
+	int j;
+
+	elog(DEBUG5, "pg_proctab_quantiles: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	metric = quantile_lookup_metric(PG_ARGISNULL(0) ? NULL :
+			PG_GETARG_TEXT_PP(0));
+
+	if (PG_ARGISNULL(1))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("percentiles must not be null")));
+	array = PG_GETARG_ARRAYTYPE_P(1);
+	if (ARR_NDIM(array) > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("percentiles must be a one-dimensional array")));
+	deconstruct_array(array, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL,
+			'd', &elems, &elem_nulls, &nelems);
+	for (i = 0; i < nelems; i++)
+	{
+		double percentile;
+
+		if (elem_nulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("percentiles must not contain nulls")));
+		percentile = DatumGetFloat8(elems[i]);
+		if (isnan(percentile) || percentile < 0 || percentile > 100)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("percentile %g is not between 0 and 100",
+							percentile)));
+	}
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (quantile == NULL)
+		return (Datum) 0;
+
+	/* Copy the histograms so the lock is not held while the rows are built. */
+	entries = (quantile_entry *) palloc(sizeof(quantile_entry) *
+			quantile_max);
+	LWLockAcquire(quantile->lock, LW_SHARED);
+	memcpy(stats_reset, quantile->stats_reset, sizeof(stats_reset));
+	hash_seq_init(&status, quantile_hash);
+	while ((entry = (quantile_entry *) hash_seq_search(&status)) != NULL)
+	{
+		if (nentries == quantile_max)
+		{
+			hash_seq_term(&status);
+			break;
+		}
+		if ((metric < 0 || entry->key.metric == metric) &&
+				entry->samples > 0)
+			entries[nentries++] = *entry;
+	}
+	LWLockRelease(quantile->lock);
+
+	for (i = 0; i < nentries; i++)
+	{
+		entry = &entries[i];
+
+		for (j = 0; j < nelems; j++)
+		{
+			Datum values[QUANTILES_NCOLS];
+			bool nulls[QUANTILES_NCOLS];
+			double percentile = DatumGetFloat8(elems[j]);
+
+			memset(nulls, false, sizeof(nulls));
+			values[i_q_metric] =
+					CStringGetTextDatum(quantile_metrics[entry->key.metric]);
+			values[i_q_object] = CStringGetTextDatum(entry->key.object);
+			values[i_q_samples] = Int64GetDatum(entry->samples);
+			values[i_q_mean] = Float8GetDatum(entry->sum / entry->samples);
+			values[i_q_min] = Float8GetDatum(entry->min / QUANTILE_SCALE);
+			values[i_q_max] = Float8GetDatum(entry->max / QUANTILE_SCALE);
+			values[i_q_percentile] = Float8GetDatum(percentile);
+			values[i_q_value] = Float8GetDatum(quantile_at(entry,
+					percentile));
+			values[i_q_stats_reset] =
+					TimestampTzGetDatum(stats_reset[entry->key.metric]);
+
+			tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+		}
+	}
+
+	return (Datum) 0;
+}
+
+/* Empty the histograms of a metric, or of every metric for a NULL one. */
+Datum pg_proctab_quantiles_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS status;
+	quantile_entry *entry;
+	TimestampTz now;
+	int metric;
+	int i;
+
+	elog(DEBUG5, "pg_proctab_quantiles_reset: Entering stored function.");
+
+	metric = quantile_lookup_metric(PG_ARGISNULL(0) ? NULL :
+			PG_GETARG_TEXT_PP(0));
+
+	if (quantile == NULL)
+		PG_RETURN_VOID();
+
+	now = GetCurrentTimestamp();
+
+	LWLockAcquire(quantile->lock, LW_EXCLUSIVE);
+	hash_seq_init(&status, quantile_hash);
+	while ((entry = (quantile_entry *) hash_seq_search(&status)) != NULL)
+		if (metric < 0 || entry->key.metric == metric)
+			hash_search(quantile_hash, &entry->key, HASH_REMOVE, NULL);
+	for (i = 0; i < QUANTILE_NMETRICS; i++)
+		if (metric < 0 || i == metric)
+			quantile->stats_reset[i] = now;
+	LWLockRelease(quantile->lock);
+
+	PG_RETURN_VOID();
+}
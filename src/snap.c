@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "pg_proctab.h"
+
+/*
+ * Take a snapshot of every source in one statement.  The data-modifying
+ * CTEs all run against the same snapshot and see the same now(), which is
+ * also the time recorded in ps_snaps, and each source is read exactly once.
+ * With packed storage the statement ends with pack_source() instead of
+ * SNAP_PROCSTAT and SNAP_RESULT, returning the process statistics that
+ * pack_procstat() then stores.
+ */
+#define SNAP_SYSTEM \
+		"WITH s AS (" \
+		"  INSERT INTO ps_snaps(note) VALUES ($1) RETURNING snap, time), " \
+		"cpu AS (" \
+		"  INSERT INTO ps_cpustat(snap, time, cpu_user, cpu_nice, " \
+		"      cpu_system, cpu_idle, cpu_iowait) " \
+		"  SELECT s.snap, s.time, c.\"user\", c.nice, c.system, c.idle, " \
+		"      c.iowait " \
+		"  FROM s, pg_cputime() c), " \
+		"mem AS (" \
+		"  INSERT INTO ps_memstat(snap, time, memused, memfree, memshared, " \
+		"      membuffers, memcached, swapused, swapfree, swapcached) " \
+		"  SELECT s.snap, s.time, m.memused, m.memfree, m.memshared, " \
+		"      m.membuffers, m.memcached, m.swapused, m.swapfree, " \
+		"      m.swapcached " \
+		"  FROM s, pg_memusage() m), " \
+		"load AS (" \
+		"  INSERT INTO ps_loadstat(snap, time, load1, load5, load15, " \
+		"      last_pid) " \
+		"  SELECT s.snap, s.time, l.load1, l.load5, l.load15, l.last_pid " \
+		"  FROM s, pg_loadavg() l), " \
+		"disk AS (" \
+		"  INSERT INTO ps_diskstat(snap, time, major, minor, devname, " \
+		"      reads_completed, reads_merged, sectors_read, readtime, " \
+		"      writes_completed, writes_merged, sectors_written, writetime, " \
+		"      current_io, iotime, totaliotime) " \
+		"  SELECT s.snap, s.time, d.major, d.minor, d.devname, " \
+		"      d.reads_completed, d.reads_merged, d.sectors_read, " \
+		"      d.readtime, d.writes_completed, d.writes_merged, " \
+		"      d.sectors_written, d.writetime, d.current_io, d.iotime, " \
+		"      d.totaliotime " \
+		"  FROM s, pg_diskusage() d), " \
+		"fs AS (" \
+		"  INSERT INTO ps_fsstat(snap, time, name, path, mount_point, " \
+		"      bytes_total, bytes_available, inodes_total, " \
+		"      inodes_available) " \
+		"  SELECT s.snap, s.time, f.name, f.path, f.mount_point, " \
+		"      f.bytes_total, f.bytes_available, f.inodes_total, " \
+		"      f.inodes_available " \
+		"  FROM s, pg_fsusage() f), " \
+		"db AS (" \
+		"  INSERT INTO ps_dbstat(snap, time, datid, datname, numbackends, " \
+		"      xact_commit, xact_rollback, blks_read, blks_hit) " \
+		"  SELECT s.snap, s.time, d.datid, d.datname, d.numbackends, " \
+		"      d.xact_commit, d.xact_rollback, d.blks_read, d.blks_hit " \
+		"  FROM s, pg_catalog.pg_stat_database d " \
+		"  WHERE d.datid <> 0), " \
+		"tab AS (" \
+		"  INSERT INTO ps_tablestat(snap, time, relid, schemaname, relname, " \
+		"      seq_scan, seq_tup_read, idx_scan, idx_tup_fetch, n_tup_ins, " \
+		"      n_tup_upd, n_tup_del, last_vacuum, last_autovacuum, " \
+		"      last_analyze, last_autoanalyze) " \
+		"  SELECT s.snap, s.time, t.relid, t.schemaname, t.relname, " \
+		"      t.seq_scan, t.seq_tup_read, t.idx_scan, t.idx_tup_fetch, " \
+		"      t.n_tup_ins, t.n_tup_upd, t.n_tup_del, t.last_vacuum, " \
+		"      t.last_autovacuum, t.last_analyze, t.last_autoanalyze " \
+		"  FROM s, pg_catalog.pg_stat_all_tables t), " \
+		"idx AS (" \
+		"  INSERT INTO ps_indexstat(snap, time, relid, indexrelid, " \
+		"      schemaname, relname, indexrelname, idx_scan, idx_tup_read, " \
+		"      idx_tup_fetch) " \
+		"  SELECT s.snap, s.time, i.relid, i.indexrelid, i.schemaname, " \
+		"      i.relname, i.indexrelname, i.idx_scan, i.idx_tup_read, " \
+		"      i.idx_tup_fetch " \
+		"  FROM s, pg_catalog.pg_stat_all_indexes i) "
+/*
+ * waiting keeps the meaning of the column of pg_stat_activity before 9.6,
+ * blocked on a lock, rather than any wait event, which idle backends always
+ * have.
+ */
+#define SNAP_PROCSTAT \
+		", proc AS (" \
+		"  INSERT INTO ps_procstat(snap, time, pid, comm, fullcomm, state, " \
+		"      ppid, pgrp, session, tty_nr, tpgid, flags, minflt, cminflt, " \
+		"      majflt, cmajflt, utime, stime, cutime, cstime, priority, " \
+		"      nice, num_threads, itrealvalue, starttime, vsize, rss, " \
+		"      exit_signal, processor, rt_priority, policy, " \
+		"      delayacct_blkio_ticks, uid, username, rchar, wchar, syscr, " \
+		"      syscw, reads, writes, cwrites, datid, datname, usesysid, " \
+		"      usename, current_query, waiting, query_start, " \
+		"      backend_start, client_addr, client_port) " \
+		"  SELECT s.snap, s.time, p.pid, p.comm, p.fullcomm, p.state, " \
+		"      p.ppid, p.pgrp, p.session, p.tty_nr, p.tpgid, p.flags, " \
+		"      p.minflt, p.cminflt, p.majflt, p.cmajflt, p.utime, p.stime, " \
+		"      p.cutime, p.cstime, p.priority, p.nice, p.num_threads, " \
+		"      p.itrealvalue, p.starttime, p.vsize, p.rss, p.exit_signal, " \
+		"      p.processor, p.rt_priority, p.policy, " \
+		"      p.delayacct_blkio_ticks, p.uid, p.username, p.rchar, " \
+		"      p.wchar, p.syscr, p.syscw, p.reads, p.writes, p.cwrites, " \
+		"      a.datid, a.datname, a.usesysid, a.usename, a.query, " \
+		"      a.wait_event_type IS NOT DISTINCT FROM 'Lock', " \
+		"      a.query_start, a.backend_start, " \
+		"      a.client_addr, a.client_port " \
+		"  FROM s, pg_proctab() p " \
+		"       JOIN pg_catalog.pg_stat_activity a ON a.pid = p.pid) "
+#define SNAP_RESULT \
+		"SELECT snap, time FROM s"
+
+Datum ps_snap_stats(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(ps_snap_stats);
+
+/* One plan for every pg_proctab.snap_storage. */
+static SPIPlanPtr snap_plan[2] = {NULL, NULL};
+
+/*
+ * Take a snapshot into the ps_* tables and return its id.  The caller must
+ * be in a transaction; the plan is prepared once per backend.
+ */
+int64
+snap_stats(const char *note)
+{
+	Datum values[1];
+	char nulls[1];
+	bool isnull;
+	int64 snap;
+	TimestampTz time;
+	int ret;
+
+	SPI_connect();
+
+	if (snap_plan[snap_storage] == NULL)
+	{
+		Oid argtypes[1] = {TEXTOID};
+		SPIPlanPtr plan;
+
+		if (SPI_execute("SELECT to_regclass('ps_snaps') IS NOT NULL", true,
+				1) != SPI_OK_SELECT ||
+				!DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+						SPI_tuptable->tupdesc, 1, &isnull)))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_TABLE),
+					 errmsg("snapshot tables do not exist"),
+					 errhint("Create them with create-ps_procstat-tables.sql.")));
+
+		plan = SPI_prepare(snap_storage == SNAP_STORAGE_PACKED ?
+				psprintf("%s%s", SNAP_SYSTEM, pack_source()) :
+				SNAP_SYSTEM SNAP_PROCSTAT SNAP_RESULT, 1, argtypes);
+		if (plan == NULL)
+			elog(ERROR, "ps_snap_stats: SPI_prepare failed: %s",
+					SPI_result_code_string(SPI_result));
+		SPI_keepplan(plan);
+		snap_plan[snap_storage] = plan;
+	}
+
+	values[0] = note == NULL ? (Datum) 0 : CStringGetTextDatum(note);
+	nulls[0] = note == NULL ? 'n' : ' ';
+
+	if (snap_storage == SNAP_STORAGE_PACKED)
+		pack_lock();
+
+	ret = SPI_execute_plan(snap_plan[snap_storage], values, nulls, false,
+			snap_storage == SNAP_STORAGE_PACKED ? 0 : 1);
+	if (ret != SPI_OK_SELECT || SPI_processed < 1)
+		elog(ERROR, "ps_snap_stats: snapshot failed: %s",
+				SPI_result_code_string(ret));
+
+	snap = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 1, &isnull));
+	time = DatumGetTimestampTz(SPI_getbinval(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 2, &isnull));
+
+	if (snap_storage == SNAP_STORAGE_PACKED)
+		pack_procstat(snap, time, SPI_tuptable, SPI_processed);
+
+	SPI_finish();
+
+	elog(DEBUG1, "ps_snap_stats: created snapshot " INT64_FORMAT, snap);
+
+	return snap;
+}
+
+Datum ps_snap_stats(PG_FUNCTION_ARGS)
+{
+	elog(DEBUG5, "ps_snap_stats: Entering stored function.");
+
+	PG_RETURN_INT64(snap_stats(PG_ARGISNULL(0) ? NULL :
+			text_to_cstring(PG_GETARG_TEXT_PP(0))));
+}
@@ -0,0 +1,560 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "mb/pg_wchar.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include "pg_proctab.h"
+
+/*
+ * A proctab_snapshot holds the pg_proctab() rows of one sample in a single
+ * value.  Every column is stored as an array of fixed width values, one per
+ * row, after a bitmap of the rows where it is NULL.  Text values are indexes
+ * into a dictionary of the distinct strings, since most processes share their
+ * comm, state and username:
+ *
+ *   header | values[ncols][nrows] | offsets[nstrings + 1] |
+ *       nulls[ncols][(nrows + 7) / 8] | strings
+ *
+ * The binary form sent to clients is the header, the strings, each with its
+ * length, then the bitmap and values of every column, in network byte order.
+ * The text form is that in hex, so that either form of COPY works.
+ */
+#define SNAPSHOT_VERSION 1
+
+typedef struct
+{
+	int32 vl_len_;			/* varlena header, do not touch directly */
+	int16 version;
+	int16 ncols;
+	int32 nrows;
+	int32 nstrings;
+	int32 clock_ticks;
+	TimestampTz sampled;
+	char data[FLEXIBLE_ARRAY_MEMBER];
+} proctab_snapshot;
+
+#define SNAPSHOT_NULL_BYTES(nrows) (((nrows) + 7) / 8)
+#define SNAPSHOT_VALUES(s) ((int64 *) (s)->data)
+#define SNAPSHOT_OFFSETS(s) \
+		((int32 *) (SNAPSHOT_VALUES(s) + (Size) (s)->ncols * (s)->nrows))
+#define SNAPSHOT_NULLS(s) \
+		((bits8 *) (SNAPSHOT_OFFSETS(s) + (s)->nstrings + 1))
+#define SNAPSHOT_STRINGS(s) \
+		((char *) (SNAPSHOT_NULLS(s) + \
+				(Size) (s)->ncols * SNAPSHOT_NULL_BYTES((s)->nrows)))
+
+typedef enum
+{
+	SNAPSHOT_INT4,
+	SNAPSHOT_INT8,
+	SNAPSHOT_TEXT
+} snapshot_type;
+
+/* The columns of pg_proctab() read from /proc, in order. */
+static const struct
+{
+	const char *name;
+	snapshot_type type;
+} snapshot_columns[PROCTAB_NCOLS] = {
+	{"pid", SNAPSHOT_INT4}, {"comm", SNAPSHOT_TEXT},
+	{"fullcomm", SNAPSHOT_TEXT}, {"state", SNAPSHOT_TEXT},
+	{"ppid", SNAPSHOT_INT4}, {"pgrp", SNAPSHOT_INT4},
+	{"session", SNAPSHOT_INT4}, {"tty_nr", SNAPSHOT_INT4},
+	{"tpgid", SNAPSHOT_INT4}, {"flags", SNAPSHOT_INT4},
+	{"minflt", SNAPSHOT_INT8}, {"cminflt", SNAPSHOT_INT8},
+	{"majflt", SNAPSHOT_INT8}, {"cmajflt", SNAPSHOT_INT8},
+	{"utime", SNAPSHOT_INT8}, {"stime", SNAPSHOT_INT8},
+	{"cutime", SNAPSHOT_INT8}, {"cstime", SNAPSHOT_INT8},
+	{"priority", SNAPSHOT_INT8}, {"nice", SNAPSHOT_INT8},
+	{"num_threads", SNAPSHOT_INT8}, {"itrealvalue", SNAPSHOT_INT8},
+	{"starttime", SNAPSHOT_INT8}, {"vsize", SNAPSHOT_INT8},
+	{"rss", SNAPSHOT_INT8}, {"exit_signal", SNAPSHOT_INT4},
+	{"processor", SNAPSHOT_INT4}, {"rt_priority", SNAPSHOT_INT8},
+	{"policy", SNAPSHOT_INT8}, {"delayacct_blkio_ticks", SNAPSHOT_INT8},
+	{"uid", SNAPSHOT_INT4}, {"username", SNAPSHOT_TEXT},
+	{"rchar", SNAPSHOT_INT8}, {"wchar", SNAPSHOT_INT8},
+	{"syscr", SNAPSHOT_INT8}, {"syscw", SNAPSHOT_INT8},
+	{"reads", SNAPSHOT_INT8}, {"writes", SNAPSHOT_INT8},
+	{"cwrites", SNAPSHOT_INT8}
+};
+
+/* The columns of pg_proctab_snapshot_unpack() after those of the rows. */
+enum snapshot_unpack {i_su_sampled = PROCTAB_NCOLS, i_su_clock_ticks};
+
+#define SNAPSHOT_UNPACK_NCOLS (PROCTAB_NCOLS + 2)
+
+/* A text value of the rows, while the dictionary is built. */
+typedef struct
+{
+	const char *value;
+	int row;
+	int col;
+} snapshot_string;
+
+Datum proctab_snapshot_in(PG_FUNCTION_ARGS);
+Datum proctab_snapshot_out(PG_FUNCTION_ARGS);
+Datum proctab_snapshot_recv(PG_FUNCTION_ARGS);
+Datum proctab_snapshot_send(PG_FUNCTION_ARGS);
+Datum pg_proctab_snapshot(PG_FUNCTION_ARGS);
+Datum pg_proctab_snapshot_unpack(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(proctab_snapshot_in);
+PG_FUNCTION_INFO_V1(proctab_snapshot_out);
+PG_FUNCTION_INFO_V1(proctab_snapshot_recv);
+PG_FUNCTION_INFO_V1(proctab_snapshot_send);
+PG_FUNCTION_INFO_V1(pg_proctab_snapshot);
+PG_FUNCTION_INFO_V1(pg_proctab_snapshot_unpack);
+
+static proctab_snapshot *snapshot_alloc(int, int, Size);
+static int snapshot_string_cmp(const void *, const void *);
+static proctab_snapshot *snapshot_build(char ***, int, TimestampTz);
+static void snapshot_write(proctab_snapshot *, StringInfo);
+static proctab_snapshot *snapshot_read(StringInfo);
+
+/*
+ * Allocate a snapshot of PROCTAB_NCOLS columns, its header filled in but for
+ * the sample time.
+ */
+static proctab_snapshot *
+snapshot_alloc(int nrows, int nstrings, Size strings_len)
+{
+	proctab_snapshot *snapshot;
+	Size size;
+
+	size = offsetof(proctab_snapshot, data);
+	size = add_size(size, mul_size(sizeof(int64),
+			mul_size(PROCTAB_NCOLS, nrows)));
+	size = add_size(size, mul_size(sizeof(int32), (Size) nstrings + 1));
+	size = add_size(size, mul_size(PROCTAB_NCOLS,
+			SNAPSHOT_NULL_BYTES(nrows)));
+	size = add_size(size, strings_len);
+	if (!AllocSizeIsValid(size))
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("proctab_snapshot of %d rows is too large", nrows)));
+
+	snapshot = (proctab_snapshot *) palloc0(size);
+	SET_VARSIZE(snapshot, size);
+	snapshot->version = SNAPSHOT_VERSION;
+	snapshot->ncols = PROCTAB_NCOLS;
+	snapshot->nrows = nrows;
+	snapshot->nstrings = nstrings;
+	snapshot->clock_ticks = (int32) sysconf(_SC_CLK_TCK);
+
+	return snapshot;
+}
+
+static int
+snapshot_string_cmp(const void *a, const void *b)
+{
+	return strcmp(((const snapshot_string *) a)->value,
+			((const snapshot_string *) b)->value);
+}
+
+/*
+ * Encode rows of pg_proctab() values, numbers as their strings and NULL as a
+ * NULL pointer.  The text values are sorted to find the distinct ones, which
+ * become the dictionary in that order.
+ */
+static proctab_snapshot *
+snapshot_build(char ***rows, int nrows, TimestampTz sampled)
+{
+	proctab_snapshot *snapshot;
+	snapshot_string *strings;
+	int64 *values;
+	int32 *offsets;
+	bits8 *nulls;
+	char *pool;
+	Size strings_len = 0;
+	int nvalues = 0;
+	int nstrings = 0;
+	int row;
+	int col;
+	int i;
+
+	strings = (snapshot_string *) palloc(sizeof(snapshot_string) *
+			(Size) (nrows * PROCTAB_NCOLS + 1));
+	for (row = 0; row < nrows; row++)
+		for (col = 0; col < PROCTAB_NCOLS; col++)
+			if (snapshot_columns[col].type == SNAPSHOT_TEXT &&
+					rows[row][col] != NULL)
+			{
+				strings[nvalues].value = rows[row][col];
+				strings[nvalues].row = row;
+				strings[nvalues].col = col;
+				nvalues++;
+			}
+	qsort(strings, nvalues, sizeof(snapshot_string), snapshot_string_cmp);
+	for (i = 0; i < nvalues; i++)
+		if (i == 0 || strcmp(strings[i].value, strings[i - 1].value) != 0)
+		{
+			nstrings++;
+			strings_len += strlen(strings[i].value) + 1;
+		}
+
+	snapshot = snapshot_alloc(nrows, nstrings, strings_len);
+	snapshot->sampled = sampled;
+	values = SNAPSHOT_VALUES(snapshot);
+	offsets = SNAPSHOT_OFFSETS(snapshot);
+	nulls = SNAPSHOT_NULLS(snapshot);
+	pool = SNAPSHOT_STRINGS(snapshot);
+
+	/* The dictionary, and the index into it of every text value. */
+	nstrings = 0;
+	offsets[0] = 0;
+	for (i = 0; i < nvalues; i++)
+	{
+		if (i == 0 || strcmp(strings[i].value, strings[i - 1].value) != 0)
+		{
+			int len = strlen(strings[i].value) + 1;
+
+			memcpy(pool + offsets[nstrings], strings[i].value, len);
+			offsets[nstrings + 1] = offsets[nstrings] + len;
+			nstrings++;
+		}
+		values[(Size) strings[i].col * nrows + strings[i].row] = nstrings - 1;
+	}
+
+	for (col = 0; col < PROCTAB_NCOLS; col++)
+	{
+		int64 *column = values + (Size) col * nrows;
+		bits8 *column_nulls = nulls + (Size) col * SNAPSHOT_NULL_BYTES(nrows);
+
+		for (row = 0; row < nrows; row++)
+		{
+			const char *value = rows[row][col];
+
+			if (value == NULL)
+				column_nulls[row / 8] |= 1 << (row % 8);
+			else if (snapshot_columns[col].type != SNAPSHOT_TEXT)
+				column[row] = strtoll(value, NULL, 10);
+		}
+	}
+	pfree(strings);
+
+	return snapshot;
+}
+
+/* Append the binary form of a snapshot. */
+static void
+snapshot_write(proctab_snapshot *snapshot, StringInfo buf)
+{
+	int64 *values = SNAPSHOT_VALUES(snapshot);
+	int32 *offsets = SNAPSHOT_OFFSETS(snapshot);
+	bits8 *nulls = SNAPSHOT_NULLS(snapshot);
+	char *pool = SNAPSHOT_STRINGS(snapshot);
+	int nrows = snapshot->nrows;
+	int row;
+	int col;
+	int i;
+
+	pq_sendint16(buf, snapshot->version);
+	pq_sendint16(buf, snapshot->ncols);
+	pq_sendint32(buf, nrows);
+	pq_sendint32(buf, snapshot->nstrings);
+	pq_sendint32(buf, snapshot->clock_ticks);
+	pq_sendint64(buf, snapshot->sampled);
+
+	for (i = 0; i < snapshot->nstrings; i++)
+	{
+		int len = offsets[i + 1] - offsets[i] - 1;
+
+		pq_sendint32(buf, len);
+		pq_sendbytes(buf, pool + offsets[i], len);
+	}
+
+	for (col = 0; col < snapshot->ncols; col++)
+	{
+		pq_sendbytes(buf, (char *) nulls + (Size) col *
+				SNAPSHOT_NULL_BYTES(nrows), SNAPSHOT_NULL_BYTES(nrows));
+		for (row = 0; row < nrows; row++)
+			pq_sendint64(buf, values[(Size) col * nrows + row]);
+	}
+}
+
+/*
+ * Decode the binary form of a snapshot, checking everything it could get
+ * wrong: the counts against what is left of the message, that the strings
+ * are valid in the database encoding, and that every text value refers to one
+ * of them.
+ */
+static proctab_snapshot *
+snapshot_read(StringInfo msg)
+{
+	proctab_snapshot *snapshot;
+	StringInfoData strings;
+	int32 *lengths;
+	int64 *values;
+	int32 *offsets;
+	bits8 *nulls;
+	int version;
+	int ncols;
+	int nrows;
+	int nstrings;
+	int clock_ticks;
+	TimestampTz sampled;
+	int row;
+	int col;
+	int i;
+
+	version = pq_getmsgint(msg, 2);
+	ncols = pq_getmsgint(msg, 2);
+	nrows = (int32) pq_getmsgint(msg, 4);
+	nstrings = (int32) pq_getmsgint(msg, 4);
+	clock_ticks = (int32) pq_getmsgint(msg, 4);
+	sampled = pq_getmsgint64(msg);
+
+	if (version != SNAPSHOT_VERSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("unsupported proctab_snapshot version %d", version)));
+	if (ncols != PROCTAB_NCOLS)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("proctab_snapshot has %d columns instead of %d",
+						ncols, PROCTAB_NCOLS)));
+	if (nrows < 0 || nstrings < 0 ||
+			(Size) nstrings * 4 > (Size) (msg->len - msg->cursor) ||
+			(Size) nrows * ncols * 8 > (Size) (msg->len - msg->cursor))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid proctab_snapshot counts")));
+
+	initStringInfo(&strings);
+	lengths = (int32 *) palloc(sizeof(int32) * ((Size) nstrings + 1));
+	for (i = 0; i < nstrings; i++)
+	{
+		const char *value;
+
+		lengths[i] = (int32) pq_getmsgint(msg, 4);
+		if (lengths[i] < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid proctab_snapshot string length")));
+		value = pq_getmsgbytes(msg, lengths[i]);
+		if (memchr(value, '\0', lengths[i]) != NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("proctab_snapshot string contains a null "
+							"character")));
+		pg_verifymbstr(value, lengths[i], false);
+		appendBinaryStringInfo(&strings, value, lengths[i]);
+		appendStringInfoChar(&strings, '\0');
+	}
+
+	snapshot = snapshot_alloc(nrows, nstrings, strings.len);
+	snapshot->clock_ticks = clock_ticks;
+	snapshot->sampled = sampled;
+	values = SNAPSHOT_VALUES(snapshot);
+	offsets = SNAPSHOT_OFFSETS(snapshot);
+	nulls = SNAPSHOT_NULLS(snapshot);
+
+	offsets[0] = 0;
+	for (i = 0; i < nstrings; i++)
+		offsets[i + 1] = offsets[i] + lengths[i] + 1;
+	memcpy(SNAPSHOT_STRINGS(snapshot), strings.data, strings.len);
+	pfree(strings.data);
+	pfree(lengths);
+
+	for (col = 0; col < ncols; col++)
+	{
+		int64 *column = values + (Size) col * nrows;
+		bits8 *column_nulls = nulls + (Size) col * SNAPSHOT_NULL_BYTES(nrows);
+
+		pq_copymsgbytes(msg, (char *) column_nulls,
+				SNAPSHOT_NULL_BYTES(nrows));
+		for (row = 0; row < nrows; row++)
+		{
+			column[row] = pq_getmsgint64(msg);
+			if (snapshot_columns[col].type == SNAPSHOT_TEXT &&
+					!(column_nulls[row / 8] & (1 << (row % 8))) &&
+					(column[row] < 0 || column[row] >= nstrings))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+						 errmsg("invalid proctab_snapshot string index "
+								INT64_FORMAT, column[row])));
+		}
+	}
+
+	return snapshot;
+}
+
+/* The text form is the binary form in hex, as bytea prints it. */
+Datum proctab_snapshot_in(PG_FUNCTION_ARGS)
+{
+	char *input = PG_GETARG_CSTRING(0);
+	StringInfoData buf;
+	proctab_snapshot *snapshot;
+	int len;
+
+	if (input[0] != '\\' || input[1] != 'x')
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type %s: \"%s\"",
+						"proctab_snapshot", input)));
+
+	len = strlen(input + 2);
+	initStringInfo(&buf);
+	enlargeStringInfo(&buf, len / 2 + 1);
+	buf.len = hex_decode(input + 2, len, buf.data);
+	buf.data[buf.len] = '\0';
+
+	snapshot = snapshot_read(&buf);
+	pq_getmsgend(&buf);
+	pfree(buf.data);
+
+	PG_RETURN_POINTER(snapshot);
+}
+
+Datum proctab_snapshot_out(PG_FUNCTION_ARGS)
+{
+	proctab_snapshot *snapshot =
+			(proctab_snapshot *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	StringInfoData buf;
+	char *result;
+	int len;
+
+	initStringInfo(&buf);
+	snapshot_write(snapshot, &buf);
+
+	result = (char *) palloc((Size) buf.len * 2 + 3);
+	result[0] = '\\';
+	result[1] = 'x';
+	len = hex_encode(buf.data, buf.len, result + 2);
+	result[len + 2] = '\0';
+	pfree(buf.data);
+
+	PG_RETURN_CSTRING(result);
+}
+
+Datum proctab_snapshot_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+
+	PG_RETURN_POINTER(snapshot_read(buf));
+}
+
+Datum proctab_snapshot_send(PG_FUNCTION_ARGS)
+{
+	proctab_snapshot *snapshot =
+			(proctab_snapshot *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	StringInfoData buf;
+
+	pq_begintypsend(&buf);
+	snapshot_write(snapshot, &buf);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * The rows pg_proctab() would return, as one proctab_snapshot.
+ */
+Datum pg_proctab_snapshot(PG_FUNCTION_ARGS)
+{
+	TimestampTz sampled;
+	char ***rows;
+	int nrows;
+
+	elog(DEBUG5, "pg_proctab_snapshot: Entering stored function.");
+
+	rows = get_proctab_rows(&nrows, &sampled);
+
+	PG_RETURN_POINTER(snapshot_build(rows, nrows, sampled));
+}
+
+/*
+ * The rows of a proctab_snapshot, as pg_proctab() returned them but with the
+ * time they were read and the clock ticks per second of their host in place
+ * of sample_age.
+ */
+Datum pg_proctab_snapshot_unpack(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+	proctab_snapshot *snapshot;
+	int64 *values;
+	int32 *offsets;
+	bits8 *nulls;
+	char *pool;
+	int nrows;
+	int row;
+	int col;
+
+	elog(DEBUG5, "pg_proctab_snapshot_unpack: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	snapshot = (proctab_snapshot *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	values = SNAPSHOT_VALUES(snapshot);
+	offsets = SNAPSHOT_OFFSETS(snapshot);
+	nulls = SNAPSHOT_NULLS(snapshot);
+	pool = SNAPSHOT_STRINGS(snapshot);
+	nrows = snapshot->nrows;
+
+	for (row = 0; row < nrows; row++)
+	{
+		Datum rowvalues[SNAPSHOT_UNPACK_NCOLS];
+		bool rownulls[SNAPSHOT_UNPACK_NCOLS];
+
+		for (col = 0; col < PROCTAB_NCOLS; col++)
+		{
+			int64 value = values[(Size) col * nrows + row];
+
+			rownulls[col] = (nulls[(Size) col * SNAPSHOT_NULL_BYTES(nrows) +
+					row / 8] & (1 << (row % 8))) != 0;
+			if (rownulls[col])
+				rowvalues[col] = (Datum) 0;
+			else if (snapshot_columns[col].type == SNAPSHOT_TEXT)
+				rowvalues[col] = CStringGetTextDatum(pool + offsets[value]);
+			else if (snapshot_columns[col].type == SNAPSHOT_INT4)
+				rowvalues[col] = Int32GetDatum((int32) value);
+			else
+				rowvalues[col] = Int64GetDatum(value);
+		}
+		rowvalues[i_su_sampled] = TimestampTzGetDatum(snapshot->sampled);
+		rownulls[i_su_sampled] = false;
+		rowvalues[i_su_clock_ticks] = Int32GetDatum(snapshot->clock_ticks);
+		rownulls[i_su_clock_ticks] = false;
+
+		tuplestore_putvalues(tupleStore, tupleDesc, rowvalues, rownulls);
+	}
+
+	return (Datum) 0;
+}
@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <ctype.h>
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include "pg_proctab.h"
+
+#define GET_LONG_ACTIVE_PIDS \
+		"SELECT pid " \
+		"FROM pg_stat_activity " \
+		"WHERE state = 'active' " \
+		"  AND state_change < now() - $1"
+
+enum stalls {i_st_state, i_st_wchan, i_st_stack, i_st_backends, i_st_pids};
+
+#define STALLS_NCOLS 5
+
+/* A stuck process and where in the kernel it is. */
+typedef struct
+{
+	int32 pid;
+	char state;
+	char *wchan;			/* NULL when not waiting or unknown */
+	char *stack;			/* NULL when not readable */
+} stall_entry;
+
+/* The processes sharing a state, wait channel and stack. */
+typedef struct
+{
+	stall_entry *first;
+	int count;
+} stall_group;
+
+Datum pg_proctab_stalls(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_proctab_stalls);
+
+#ifdef __linux__
+static char get_state(int32);
+static char *read_wchan(int32);
+static char *read_stack(int32);
+static int32 *get_long_active_pids(Datum, int *);
+static int nullable_strcmp(const char *, const char *);
+static int stall_cmp(const void *, const void *);
+static int stall_group_cmp(const void *, const void *);
+
+/* Return the state of a process from /proc/PID/stat, '\0' if it is gone. */
+static char
+get_state(int32 pid)
+{
+	char buffer[4096];
+	char *p;
+	int fd;
+	int len;
+
+	snprintf(buffer, sizeof(buffer) - 1, "%s/%d/stat", PROCFS, pid);
+	fd = open(buffer, O_RDONLY);
+	if (fd == -1)
+		return '\0';
+	len = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (len <= 0)
+		return '\0';
+	buffer[len] = '\0';
+
+	/* comm may contain anything, so the state follows its last ')'. */
+	if ((p = strrchr(buffer, ')')) == NULL || p[1] != ' ')
+		return '\0';
+
+	return p[2];
+}
+
+/*
+ * Return the kernel function a process sleeps in from /proc/PID/wchan, or
+ * NULL for a running process, whose wchan is 0.
+ */
+static char *
+read_wchan(int32 pid)
+{
+	char buffer[MAXPGPATH];
+	int fd;
+	int len;
+
+	snprintf(buffer, sizeof(buffer) - 1, "%s/%d/wchan", PROCFS, pid);
+	fd = open(buffer, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	len = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (len <= 0)
+		return NULL;
+	buffer[len] = '\0';
+	buffer[strcspn(buffer, "\n")] = '\0';
+
+	if (buffer[0] == '\0' || strcmp(buffer, "0") == 0)
+		return NULL;
+	return pstrdup(buffer);
+}
+
+/*
+ * Return the kernel stack of a process from /proc/PID/stack, a function per
+ * line, innermost first.  The addresses and offsets the kernel prints are
+ * left out so that processes stuck on the same path share a stack.  Only
+ * processes with CAP_SYS_ADMIN may read the file, so it is NULL otherwise.
+ */
+static char *
+read_stack(int32 pid)
+{
+	char buffer[8192];
+	StringInfoData stack;
+	char *line;
+	char *next;
+	char *p;
+	int fd;
+	int len;
+
+	snprintf(buffer, sizeof(buffer) - 1, "%s/%d/stack", PROCFS, pid);
+	fd = open(buffer, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	len = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (len <= 0)
+		return NULL;
+	buffer[len] = '\0';
+
+	/* Lines such as "[<0>] jbd2_log_wait_commit+0xac/0x120". */
+	initStringInfo(&stack);
+	for (line = buffer; *line != '\0'; line = next)
+	{
+		next = line + strcspn(line, "\n");
+		if (*next != '\0')
+			*next++ = '\0';
+
+		if (*line == '[')
+		{
+			if ((p = strchr(line, ']')) == NULL)
+				continue;
+			line = p + 1;
+		}
+		while (isspace((unsigned char) *line))
+			line++;
+		line[strcspn(line, "+ ")] = '\0';
+		if (*line == '\0')
+			continue;
+
+		if (stack.len > 0)
+			appendStringInfoChar(&stack, '\n');
+		appendStringInfoString(&stack, line);
+	}
+
+	if (stack.len == 0)
+	{
+		pfree(stack.data);
+		return NULL;
+	}
+	return stack.data;
+}
+
+/*
+ * Return the pids of the backends that have been running a query for longer
+ * than the interval.  For an overridden PROCFS there are none.
+ */
+static int32 *
+get_long_active_pids(Datum interval, int *npids)
+{
+	Oid argtypes[1] = {INTERVALOID};
+	Datum args[1];
+	int32 *pids;
+	int ret;
+	int i;
+
+	*npids = 0;
+	if (strcmp(PROCFS, "/proc") != 0)
+		return NULL;
+
+	args[0] = interval;
+
+	SPI_connect();
+
+	ret = SPI_execute_with_args(GET_LONG_ACTIVE_PIDS, 1, argtypes, args,
+			NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "unable to get pids from pg_stat_activity");
+
+	*npids = (int) SPI_processed;
+	pids = (int32 *) SPI_palloc(sizeof(int32) * (*npids + 1));
+	for (i = 0; i < *npids; i++)
+		pids[i] = atoi(SPI_getvalue(SPI_tuptable->vals[i],
+				SPI_tuptable->tupdesc, 1));
+
+	SPI_finish();
+
+	return pids;
+}
+
+static int
+nullable_strcmp(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return (a != NULL) - (b != NULL);
+	return strcmp(a, b);
+}
+
+/* Order the stuck processes so that those to aggregate are adjacent. */
+static int
+stall_cmp(const void *a, const void *b)
+{
+	const stall_entry *sa = (const stall_entry *) a;
+	const stall_entry *sb = (const stall_entry *) b;
+	int cmp;
+
+	if (sa->state != sb->state)
+		return sa->state < sb->state ? -1 : 1;
+	if ((cmp = nullable_strcmp(sa->wchan, sb->wchan)) != 0)
+		return cmp;
+	if ((cmp = nullable_strcmp(sa->stack, sb->stack)) != 0)
+		return cmp;
+	return sa->pid < sb->pid ? -1 : sa->pid > sb->pid;
+}
+
+/* The largest groups first, ties in the order of stall_cmp(). */
+static int
+stall_group_cmp(const void *a, const void *b)
+{
+	const stall_group *ga = (const stall_group *) a;
+	const stall_group *gb = (const stall_group *) b;
+
+	if (ga->count != gb->count)
+		return ga->count > gb->count ? -1 : 1;
+	return stall_cmp(ga->first, gb->first);
+}
+#endif /* __linux__ */
+
+/*
+ * Aggregate the backends in uninterruptible sleep, and those running (R) a
+ * query for longer than the given interval, by state, kernel wait channel
+ * and kernel stack, so that the cause of an I/O stall, be it fsync, reclaim,
+ * NFS or the journal, shows as the stack most backends are stuck on.
+ */
+Datum pg_proctab_stalls(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	Datum values[STALLS_NCOLS];
+	bool nulls[STALLS_NCOLS];
+	stall_entry *entries;
+	stall_group *groups;
+	int32 *pids;
+	int32 *long_active;
+	int npids;
+	int nlong_active;
+	int nentries = 0;
+	int ngroups = 0;
+	int i;
+	int j;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_proctab_stalls: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	check_procfs();
+
+	pids = get_backend_pids(&npids);
+	long_active = get_long_active_pids(PG_GETARG_DATUM(0), &nlong_active);
+
+	entries = (stall_entry *) palloc(sizeof(stall_entry) * Max(npids, 1));
+	for (i = 0; i < npids; i++)
+	{
+		char state = get_state(pids[i]);
+
+		if (state == 'R')
+		{
+			for (j = 0; j < nlong_active; j++)
+				if (long_active[j] == pids[i])
+					break;
+			if (j == nlong_active)
+				continue;
+		}
+		else if (state != 'D')
+			continue;
+
+		entries[nentries].pid = pids[i];
+		entries[nentries].state = state;
+		entries[nentries].wchan = read_wchan(pids[i]);
+		entries[nentries].stack = read_stack(pids[i]);
+		nentries++;
+	}
+
+	qsort(entries, nentries, sizeof(stall_entry), stall_cmp);
+
+	groups = (stall_group *) palloc(sizeof(stall_group) * Max(nentries, 1));
+	for (i = 0; i < nentries; i++)
+	{
+		if (ngroups > 0 &&
+				entries[i].state == groups[ngroups - 1].first->state &&
+				nullable_strcmp(entries[i].wchan,
+						groups[ngroups - 1].first->wchan) == 0 &&
+				nullable_strcmp(entries[i].stack,
+						groups[ngroups - 1].first->stack) == 0)
+		{
+			groups[ngroups - 1].count++;
+			continue;
+		}
+		groups[ngroups].first = &entries[i];
+		groups[ngroups].count = 1;
+		ngroups++;
+	}
+
+	qsort(groups, ngroups, sizeof(stall_group), stall_group_cmp);
+
+	for (i = 0; i < ngroups; i++)
+	{
+		Datum *group_pids;
+		char state[2];
+
+		state[0] = groups[i].first->state;
+		state[1] = '\0';
+
+		group_pids = (Datum *) palloc(sizeof(Datum) * groups[i].count);
+		for (j = 0; j < groups[i].count; j++)
+			group_pids[j] = Int32GetDatum(groups[i].first[j].pid);
+
+		memset(nulls, false, sizeof(nulls));
+		values[i_st_state] = CStringGetTextDatum(state);
+		values[i_st_wchan] = groups[i].first->wchan == NULL ? (Datum) 0 :
+				CStringGetTextDatum(groups[i].first->wchan);
+		nulls[i_st_wchan] = groups[i].first->wchan == NULL;
+		values[i_st_stack] = groups[i].first->stack == NULL ? (Datum) 0 :
+				CStringGetTextDatum(groups[i].first->stack);
+		nulls[i_st_stack] = groups[i].first->stack == NULL;
+		values[i_st_backends] = Int32GetDatum(groups[i].count);
+		values[i_st_pids] = PointerGetDatum(construct_array(group_pids,
+				groups[i].count, INT4OID, sizeof(int32), true,
+				'i'));
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
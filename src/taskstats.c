@@ -0,0 +1,466 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/tuplestore.h"
+#include "storage/fd.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#endif /* __linux__ */
+#include "pg_proctab.h"
+
+enum delayacct {i_ts_pid, i_cpu_count, i_cpu_delay_total, i_blkio_count,
+		i_blkio_delay_total, i_swapin_count, i_swapin_delay_total,
+		i_reclaim_count, i_reclaim_delay_total, i_thrashing_count,
+		i_thrashing_delay_total};
+
+#define TASKSTATS_NCOLS 11
+
+Datum pg_taskstats(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_taskstats);
+
+#ifdef __linux__
+/*
+ * Everything needed to talk to the taskstats generic netlink family.  A
+ * reply carrying a struct taskstats is well under 1kB, so a few pages are
+ * plenty for both directions.
+ */
+#define TASKSTATS_MSG_SIZE 4096
+
+typedef struct
+{
+	struct nlmsghdr n;
+	struct genlmsghdr g;
+	char buf[TASKSTATS_MSG_SIZE];
+} taskstats_msg;
+
+#define GENLMSG_DATA(msg) ((char *) NLMSG_DATA(&(msg)->n) + GENL_HDRLEN)
+#define GENLMSG_PAYLOAD(msg) (NLMSG_PAYLOAD(&(msg)->n, 0) - GENL_HDRLEN)
+#define NLA_DATA(na) ((char *) (na) + NLA_HDRLEN)
+#define NLA_PAYLOAD(na) ((int) (na)->nla_len - NLA_HDRLEN)
+
+/*
+ * The socket is opened on first use and then kept for the lifetime of the
+ * process, so that sampling the same backends over and over does not pay
+ * for the socket setup and family lookup every time.
+ */
+static int taskstats_sock = -1;
+static uint16 taskstats_family = 0;
+static uint32 taskstats_seq = 0;
+
+/*
+ * The kernel only answers TASKSTATS_CMD_GET for processes with CAP_NET_ADMIN,
+ * which the server does not normally have.  Once it has said no it is not
+ * asked again in this session.
+ */
+static bool taskstats_denied = false;
+
+static bool taskstats_open(void);
+static void taskstats_close(void);
+static int taskstats_send(uint16, uint8, uint16, const void *, int);
+static int taskstats_recv(taskstats_msg *);
+static int taskstats_get(int32, struct taskstats *);
+static bool delayacct_enabled(void);
+
+static void
+taskstats_close(void)
+{
+	if (taskstats_sock >= 0)
+		close(taskstats_sock);
+	taskstats_sock = -1;
+	taskstats_family = 0;
+}
+
+static bool
+taskstats_open(void)
+{
+	struct sockaddr_nl local;
+	struct timeval timeout;
+	taskstats_msg msg;
+	struct nlattr *na;
+	int len;
+
+	if (taskstats_sock >= 0 && taskstats_family != 0)
+		return true;
+
+	taskstats_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+			NETLINK_GENERIC);
+	if (taskstats_sock < 0)
+	{
+		elog(DEBUG1, "pg_taskstats: could not create netlink socket: %m");
+		return false;
+	}
+
+	/* Never let a misbehaving kernel hang the backend. */
+	timeout.tv_sec = 1;
+	timeout.tv_usec = 0;
+	setsockopt(taskstats_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+			sizeof(timeout));
+
+	memset(&local, 0, sizeof(local));
+	local.nl_family = AF_NETLINK;
+	if (bind(taskstats_sock, (struct sockaddr *) &local, sizeof(local)) < 0)
+	{
+		elog(DEBUG1, "pg_taskstats: could not bind netlink socket: %m");
+		taskstats_close();
+		return false;
+	}
+
+	/* Look up the id of the TASKSTATS family. */
+	if (taskstats_send(GENL_ID_CTRL, CTRL_CMD_GETFAMILY,
+			CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME,
+			strlen(TASKSTATS_GENL_NAME) + 1) < 0 ||
+			taskstats_recv(&msg) < 0)
+	{
+		elog(DEBUG1, "pg_taskstats: taskstats family not available");
+		taskstats_close();
+		return false;
+	}
+
+	len = GENLMSG_PAYLOAD(&msg);
+	na = (struct nlattr *) GENLMSG_DATA(&msg);
+	while (len >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN &&
+			na->nla_len <= len)
+	{
+		if (na->nla_type == CTRL_ATTR_FAMILY_ID)
+		{
+			memcpy(&taskstats_family, NLA_DATA(na), sizeof(uint16));
+			break;
+		}
+		len -= NLA_ALIGN(na->nla_len);
+		na = (struct nlattr *) ((char *) na + NLA_ALIGN(na->nla_len));
+	}
+
+	if (taskstats_family == 0)
+	{
+		elog(DEBUG1, "pg_taskstats: taskstats family id not found");
+		taskstats_close();
+		return false;
+	}
+
+	elog(DEBUG5, "pg_taskstats: taskstats family id %d", taskstats_family);
+	return true;
+}
+
+/*
+ * Send a generic netlink request carrying a single attribute.
+ */
+static int
+taskstats_send(uint16 type, uint8 cmd, uint16 attr, const void *data,
+		int length)
+{
+	taskstats_msg msg;
+	struct nlattr *na;
+	struct sockaddr_nl kernel;
+	char *p;
+	int remaining;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	msg.n.nlmsg_type = type;
+	msg.n.nlmsg_flags = NLM_F_REQUEST;
+	msg.n.nlmsg_seq = ++taskstats_seq;
+	msg.n.nlmsg_pid = 0;
+	msg.g.cmd = cmd;
+	msg.g.version = TASKSTATS_GENL_VERSION;
+
+	na = (struct nlattr *) GENLMSG_DATA(&msg);
+	na->nla_type = attr;
+	na->nla_len = NLA_HDRLEN + length;
+	memcpy(NLA_DATA(na), data, length);
+	msg.n.nlmsg_len += NLA_ALIGN(na->nla_len);
+
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.nl_family = AF_NETLINK;
+
+	p = (char *) &msg;
+	remaining = msg.n.nlmsg_len;
+	while (remaining > 0)
+	{
+		int r = sendto(taskstats_sock, p, remaining, 0,
+				(struct sockaddr *) &kernel, sizeof(kernel));
+
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		remaining -= r;
+	}
+
+	return 0;
+}
+
+/*
+ * Receive one reply.  Returns the negative errno carried by an NLMSG_ERROR
+ * reply, or -1 if nothing sensible came back.
+ */
+static int
+taskstats_recv(taskstats_msg *msg)
+{
+	int len;
+
+	do
+	{
+		len = recv(taskstats_sock, msg, sizeof(taskstats_msg), 0);
+	} while (len < 0 && errno == EINTR);
+
+	if (len < 0 || !NLMSG_OK(&msg->n, (unsigned int) len))
+		return -1;
+
+	if (msg->n.nlmsg_type == NLMSG_ERROR)
+	{
+		struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(&msg->n);
+
+		return err->error < 0 ? err->error : -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Fetch the taskstats of a single pid.  Returns 0 on success, or a negative
+ * errno, -ESRCH meaning that the process is gone.
+ */
+static int
+taskstats_get(int32 pid, struct taskstats *ts)
+{
+	taskstats_msg msg;
+	struct nlattr *na;
+	int len;
+	int ret;
+	uint32 seq;
+
+	if (taskstats_send(taskstats_family, TASKSTATS_CMD_GET,
+			TASKSTATS_CMD_ATTR_PID, &pid, sizeof(pid)) < 0)
+		return -1;
+	seq = taskstats_seq;
+
+	/* Skip over any stale reply left behind by an earlier error. */
+	do
+	{
+		ret = taskstats_recv(&msg);
+		if (ret < 0)
+			return ret;
+	} while (msg.n.nlmsg_seq != seq);
+
+	len = GENLMSG_PAYLOAD(&msg);
+	na = (struct nlattr *) GENLMSG_DATA(&msg);
+	while (len >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN &&
+			na->nla_len <= len)
+	{
+		if (na->nla_type == TASKSTATS_TYPE_AGGR_PID)
+		{
+			/* Nested: the pid followed by the stats themselves. */
+			int nested_len = NLA_PAYLOAD(na);
+			struct nlattr *nested = (struct nlattr *) NLA_DATA(na);
+
+			while (nested_len >= NLA_HDRLEN &&
+					nested->nla_len >= NLA_HDRLEN &&
+					nested->nla_len <= nested_len)
+			{
+				if (nested->nla_type == TASKSTATS_TYPE_STATS)
+				{
+					/*
+					 * The kernel may be older or newer than the headers we
+					 * were built with, so copy only what both know about.
+					 */
+					memset(ts, 0, sizeof(struct taskstats));
+					memcpy(ts, NLA_DATA(nested),
+							Min(NLA_PAYLOAD(nested),
+									(int) sizeof(struct taskstats)));
+					return 0;
+				}
+				nested_len -= NLA_ALIGN(nested->nla_len);
+				nested = (struct nlattr *) ((char *) nested +
+						NLA_ALIGN(nested->nla_len));
+			}
+		}
+		len -= NLA_ALIGN(na->nla_len);
+		na = (struct nlattr *) ((char *) na + NLA_ALIGN(na->nla_len));
+	}
+
+	return -1;
+}
+
+/*
+ * Delay accounting is compiled in but switched off by default since Linux
+ * 5.14, in which case the kernel happily returns zeroes.  Kernels that
+ * predate the sysctl have it on unless booted with nodelayacct.
+ */
+static bool
+delayacct_enabled(void)
+{
+	char path[MAXPGPATH];
+	char buffer[32];
+	int fd;
+	int len;
+
+	snprintf(path, sizeof(path), "%s/sys/kernel/task_delayacct", PROCFS);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return true;
+	len = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (len <= 0)
+		return true;
+	buffer[len] = '\0';
+
+	return atoi(buffer) != 0;
+}
+#endif /* __linux__ */
+
+Datum pg_taskstats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+	Datum values[TASKSTATS_NCOLS];
+	bool nulls[TASKSTATS_NCOLS];
+
+#ifdef __linux__
+	int32 *pids;
+	int npids;
+	int i;
+	bool have_socket;
+	bool have_delays;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_taskstats: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/*
+	 * Build a tuple descriptor for our result type
+	 */
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	pids = get_backend_pids(&npids);
+
+	/*
+	 * Without the netlink family, or with delay accounting switched off,
+	 * still return a row per backend with the delay columns left NULL.
+	 */
+	have_socket = !taskstats_denied && taskstats_open();
+	have_delays = have_socket && delayacct_enabled();
+
+	for (i = 0; i < npids; i++)
+	{
+		struct taskstats ts;
+		int ret = -1;
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, true, sizeof(nulls));
+
+		values[i_ts_pid] = Int32GetDatum(pids[i]);
+		nulls[i_ts_pid] = false;
+
+		if (have_delays)
+		{
+			ret = taskstats_get(pids[i], &ts);
+			if (ret == -ESRCH)
+			{
+				elog(DEBUG5, "pg_taskstats: pid %d no longer exists", pids[i]);
+				continue;
+			}
+			if (ret == -EPERM)
+			{
+				taskstats_denied = true;
+				have_delays = false;
+			}
+			else if (ret == -1)
+			{
+				/* The socket is in an unknown state, start over next time. */
+				elog(DEBUG1, "pg_taskstats: lost the taskstats socket");
+				taskstats_close();
+				have_delays = false;
+			}
+			else if (ret < 0)
+				elog(DEBUG1, "pg_taskstats: no taskstats for pid %d: %s",
+						pids[i], strerror(-ret));
+		}
+
+		if (ret == 0)
+		{
+			values[i_cpu_count] = Int64GetDatum((int64) ts.cpu_count);
+			values[i_cpu_delay_total] =
+					Int64GetDatum((int64) ts.cpu_delay_total);
+			values[i_blkio_count] = Int64GetDatum((int64) ts.blkio_count);
+			values[i_blkio_delay_total] =
+					Int64GetDatum((int64) ts.blkio_delay_total);
+			values[i_swapin_count] =
+					Int64GetDatum((int64) ts.swapin_count);
+			values[i_swapin_delay_total] =
+					Int64GetDatum((int64) ts.swapin_delay_total);
+			values[i_reclaim_count] =
+					Int64GetDatum((int64) ts.freepages_count);
+			values[i_reclaim_delay_total] =
+					Int64GetDatum((int64) ts.freepages_delay_total);
+			memset(nulls + i_cpu_count, false,
+					sizeof(bool) * (i_reclaim_delay_total - i_cpu_count + 1));
+
+#if TASKSTATS_VERSION >= 9
+			/* Thrashing delays appeared in version 9 of the struct. */
+			if (ts.version >= 9)
+			{
+				values[i_thrashing_count] =
+						Int64GetDatum((int64) ts.thrashing_count);
+				values[i_thrashing_delay_total] =
+						Int64GetDatum((int64) ts.thrashing_delay_total);
+				nulls[i_thrashing_count] = false;
+				nulls[i_thrashing_delay_total] = false;
+			}
+#endif
+		}
+
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+
+	if (taskstats_denied)
+		ereport(NOTICE,
+				(errmsg("delay accounting for Linux not permitted"),
+				 errhint("The server needs the CAP_NET_ADMIN capability to "
+						 "read the taskstats of other processes.")));
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
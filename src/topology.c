@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <ctype.h>
+#include <string.h>
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+#include <unistd.h>
+#include "pg_proctab.h"
+
+enum cpu_topology {i_ct_cpu, i_ct_online, i_ct_package, i_ct_die, i_ct_core,
+		i_ct_siblings, i_ct_node, i_ct_l1d, i_ct_l1i, i_ct_l2, i_ct_l3,
+		i_ct_l3_cpus, i_ct_cur_freq, i_ct_max_freq, i_ct_core_throttle,
+		i_ct_package_throttle};
+enum cputime_percpu {i_cp_cpu, i_cp_user, i_cp_nice, i_cp_system, i_cp_idle,
+		i_cp_iowait, i_cp_irq, i_cp_softirq, i_cp_steal};
+
+#define CPU_TOPOLOGY_NCOLS 16
+#define CPUTIME_PERCPU_NCOLS 9
+
+Datum pg_cpu_topology(PG_FUNCTION_ARGS);
+Datum pg_cputime_percpu(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_cpu_topology);
+PG_FUNCTION_INFO_V1(pg_cputime_percpu);
+
+#ifdef __linux__
+/*
+ * The number of cpus the kernel may bring up, one more than the highest
+ * cpu<N> under the devices/system/cpu directory of pg_proctab.sysfs_root, so
+ * that a fixture tree is described by its own cpus.  Falls back to sysconf()
+ * when the directory cannot be read.
+ */
+int
+sysfs_cpu_count(void)
+{
+	char path[MAXPGPATH];
+	DIR *dir;
+	struct dirent *de;
+	int ncpus = 0;
+
+	snprintf(path, sizeof(path), "%s/devices/system/cpu", SYSFS);
+	if ((dir = AllocateDir(path)) == NULL)
+		return (int) sysconf(_SC_NPROCESSORS_CONF);
+	while ((de = ReadDirExtended(dir, path, LOG)) != NULL)
+	{
+		const char *digits = de->d_name + 3;
+
+		if (strncmp(de->d_name, "cpu", 3) == 0 && *digits != '\0' &&
+				strspn(digits, "0123456789") == strlen(digits))
+			ncpus = Max(ncpus, atoi(digits) + 1);
+	}
+	FreeDir(dir);
+
+	return ncpus > 0 ? ncpus : (int) sysconf(_SC_NPROCESSORS_CONF);
+}
+
+static bool read_sysfs_line(const char *, char *, int);
+static bool read_sysfs_int64(const char *, int64 *);
+static void get_cpu_caches(int, Datum *, bool *);
+
+/*
+ * Read the first line of a sysfs attribute without its newline.  Returns
+ * false if the attribute does not exist or cannot be read, which is normal
+ * for offline cpus and for hardware or drivers that do not provide it.
+ */
+static bool
+read_sysfs_line(const char *path, char *buffer, int size)
+{
+	FILE *fp;
+	bool found;
+
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		return false;
+	found = fgets(buffer, size, fp) != NULL;
+	FreeFile(fp);
+
+	if (found)
+		buffer[strcspn(buffer, "\n")] = '\0';
+	return found;
+}
+
+static bool
+read_sysfs_int64(const char *path, int64 *value)
+{
+	char buffer[64];
+
+	if (!read_sysfs_line(path, buffer, sizeof(buffer)) ||
+			!isdigit((unsigned char) buffer[0]))
+		return false;
+	*value = atoll(buffer);
+	return true;
+}
+
+/*
+ * Fill in the cache sizes, in kB, from cache/index<N>.  Every index names
+ * its level and type (Data, Instruction or Unified).
+ */
+static void
+get_cpu_caches(int cpu, Datum *values, bool *nulls)
+{
+	char path[MAXPGPATH];
+	char buffer[256];
+	int index;
+
+	for (index = 0;; index++)
+	{
+		int64 level;
+		int column;
+
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/cache/index%d/level", SYSFS, cpu,
+				index);
+		if (!read_sysfs_int64(path, &level))
+			break;
+
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/cache/index%d/type", SYSFS, cpu,
+				index);
+		if (!read_sysfs_line(path, buffer, sizeof(buffer)))
+			continue;
+
+		if (level == 1 && strcmp(buffer, "Data") == 0)
+			column = i_ct_l1d;
+		else if (level == 1 && strcmp(buffer, "Instruction") == 0)
+			column = i_ct_l1i;
+		else if (level == 2)
+			column = i_ct_l2;
+		else if (level == 3)
+			column = i_ct_l3;
+		else
+			continue;
+
+		/* Sizes look like "32K". */
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/cache/index%d/size", SYSFS, cpu,
+				index);
+		if (!read_sysfs_line(path, buffer, sizeof(buffer)) ||
+				!isdigit((unsigned char) buffer[0]))
+			continue;
+		values[column] = Int64GetDatum(atoll(buffer) *
+				(strchr(buffer, 'M') != NULL ? 1024 : 1));
+		nulls[column] = false;
+
+		/* The cpus sharing the last level cache. */
+		if (level == 3)
+		{
+			snprintf(path, sizeof(path),
+					"%s/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+					SYSFS, cpu, index);
+			if (read_sysfs_line(path, buffer, sizeof(buffer)))
+			{
+				values[i_ct_l3_cpus] = CStringGetTextDatum(buffer);
+				nulls[i_ct_l3_cpus] = false;
+			}
+		}
+	}
+}
+#endif /* __linux__ */
+
+Datum pg_cpu_topology(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	int ncpus;
+	int cpu;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_cpu_topology: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/*
+	 * Build a tuple descriptor for our result type
+	 */
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	ncpus = sysfs_cpu_count();
+	for (cpu = 0; cpu < ncpus; cpu++)
+	{
+		Datum values[CPU_TOPOLOGY_NCOLS];
+		bool nulls[CPU_TOPOLOGY_NCOLS];
+		char path[MAXPGPATH];
+		char buffer[4096];
+		int64 value;
+		int node;
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, true, sizeof(nulls));
+
+		values[i_ct_cpu] = Int32GetDatum(cpu);
+		nulls[i_ct_cpu] = false;
+
+		/* cpu0 usually cannot be taken offline and has no online file. */
+		snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/online",
+				SYSFS, cpu);
+		values[i_ct_online] = BoolGetDatum(!read_sysfs_int64(path, &value) ||
+				value != 0);
+		nulls[i_ct_online] = false;
+
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/topology/physical_package_id",
+				SYSFS, cpu);
+		if (read_sysfs_int64(path, &value))
+		{
+			values[i_ct_package] = Int32GetDatum((int32) value);
+			nulls[i_ct_package] = false;
+		}
+
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/topology/die_id", SYSFS, cpu);
+		if (read_sysfs_int64(path, &value))
+		{
+			values[i_ct_die] = Int32GetDatum((int32) value);
+			nulls[i_ct_die] = false;
+		}
+
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/topology/core_id", SYSFS, cpu);
+		if (read_sysfs_int64(path, &value))
+		{
+			values[i_ct_core] = Int32GetDatum((int32) value);
+			nulls[i_ct_core] = false;
+		}
+
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+				SYSFS, cpu);
+		if (read_sysfs_line(path, buffer, sizeof(buffer)))
+		{
+			values[i_ct_siblings] = CStringGetTextDatum(buffer);
+			nulls[i_ct_siblings] = false;
+		}
+
+		if ((node = cpu_numa_node(cpu)) >= 0)
+		{
+			values[i_ct_node] = Int32GetDatum(node);
+			nulls[i_ct_node] = false;
+		}
+
+		get_cpu_caches(cpu, values, nulls);
+
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", SYSFS,
+				cpu);
+		if (read_sysfs_int64(path, &value))
+		{
+			values[i_ct_cur_freq] = Int64GetDatum(value);
+			nulls[i_ct_cur_freq] = false;
+		}
+
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", SYSFS,
+				cpu);
+		if (read_sysfs_int64(path, &value))
+		{
+			values[i_ct_max_freq] = Int64GetDatum(value);
+			nulls[i_ct_max_freq] = false;
+		}
+
+		/* Only on x86 with the therm_throt driver. */
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/thermal_throttle/core_throttle_count",
+				SYSFS, cpu);
+		if (read_sysfs_int64(path, &value))
+		{
+			values[i_ct_core_throttle] = Int64GetDatum(value);
+			nulls[i_ct_core_throttle] = false;
+		}
+
+		snprintf(path, sizeof(path),
+				"%s/devices/system/cpu/cpu%d/thermal_throttle/package_throttle_count",
+				SYSFS, cpu);
+		if (read_sysfs_int64(path, &value))
+		{
+			values[i_ct_package_throttle] = Int64GetDatum(value);
+			nulls[i_ct_package_throttle] = false;
+		}
+
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
+
+Datum pg_cputime_percpu(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc tupleDesc;
+	Tuplestorestate *tupleStore;
+
+#ifdef __linux__
+	char path[MAXPGPATH];
+	char buffer[4096];
+	FILE *fp;
+	bool line_start = true;
+#endif /* __linux__ */
+
+	elog(DEBUG5, "pg_cputime_percpu: Entering stored function.");
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg
+				 ("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/*
+	 * Build a tuple descriptor for our result type
+	 */
+	if (get_call_result_type(fcinfo, NULL, &tupleDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef __linux__
+	snprintf(path, sizeof(path), "%s/stat", PROCFS);
+	if ((fp = AllocateFile(path, PG_BINARY_R)) == NULL)
+		elog(ERROR, "'%s' not found", path);
+
+	/*
+	 * Lines look like "cpu3 1523 0 734 89321 102 0 11 0 0 0".  The summary
+	 * line has no number and is what pg_cputime() returns.  The intr line
+	 * can be longer than the buffer, so only look at the start of lines.
+	 */
+	while (fgets(buffer, sizeof(buffer), fp) != NULL)
+	{
+		Datum values[CPUTIME_PERCPU_NCOLS];
+		bool nulls[CPUTIME_PERCPU_NCOLS];
+		bool at_start = line_start;
+		char *p;
+		int i;
+
+		line_start = strchr(buffer, '\n') != NULL;
+		if (!at_start || strncmp(buffer, "cpu", 3) != 0 ||
+				!isdigit((unsigned char) buffer[3]))
+			continue;
+
+		memset(nulls, true, sizeof(nulls));
+		values[i_cp_cpu] = Int32GetDatum(atoi(buffer + 3));
+		nulls[i_cp_cpu] = false;
+
+		p = buffer;
+		SKIP_TOKEN(p);			/* skip cpuN */
+		for (i = i_cp_user;
+				i < CPUTIME_PERCPU_NCOLS && isdigit((unsigned char) *p); i++)
+		{
+			values[i] = Int64GetDatum(strtoll(p, &p, 10));
+			nulls[i] = false;
+			while (*p == ' ')
+				p++;
+		}
+
+		tuplestore_putvalues(tupleStore, tupleDesc, values, nulls);
+	}
+	FreeFile(fp);
+#endif /* __linux__ */
+
+	return (Datum) 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "storage/fd.h"
+#include "utils/guc.h"
+#include "pg_proctab.h"
+#if defined(__linux__) && defined(WITH_LIBURING)
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool proctab_io_uring = true;
+
+void
+uring_init(void)
+{
+	DefineCustomBoolVariable("pg_proctab.io_uring",
+			"Read the files of many processes at once with io_uring.",
+			"Only has an effect when pg_proctab was built with "
+			"WITH_LIBURING=1 and the kernel supports io_uring.",
+			&proctab_io_uring,
+			true,
+			PGC_USERSET,
+			0,
+			NULL,
+			NULL,
+			NULL);
+}
+
+#if defined(__linux__) && defined(WITH_LIBURING)
+/*
+ * The files of a pid, in the order they are opened, and the look up of the
+ * owner of its stat file, which rides along in the same submission instead
+ * of reading the Uid: line of the status file.  Every operation on a pid's
+ * files carries the index of the pid in the batch and the file as its user
+ * data.
+ */
+enum uring_file {URING_STAT, URING_CMDLINE, URING_IO, URING_STATX};
+
+#define URING_FILES 4
+#define URING_DATA(i, file) ((uint64) (i) * URING_FILES + (file))
+
+/* Each round takes at most URING_FILES operations per pid of a batch. */
+#define URING_ENTRIES (PROCTAB_BATCH * URING_FILES)
+
+static const char *uring_names[] = {"stat", "cmdline", "io"};
+static const int uring_sizes[] = {PROCTAB_STAT_LEN - 1, FULLCOMM_LEN,
+		PROCTAB_IO_LEN - 1};
+
+/* The ring of the backend, set up on first use. */
+static struct io_uring ring;
+static int ring_state = 0;		/* 1 when set up, -1 when unavailable */
+
+static bool uring_ready(void);
+static void uring_wait(int, int *);
+static int uring_reserve(int, int);
+static void uring_release(int);
+static void uring_read_batch(int32 *, int, int, proctab_files *, int *);
+
+/*
+ * Set up the ring unless it was already, or was found to be unavailable:
+ * where the kernel has no io_uring, where it is disabled or where it lacks
+ * one of the operations used, the files are read one after the other.
+ */
+static bool
+uring_ready(void)
+{
+	struct io_uring_probe *probe;
+	int ret;
+
+	if (ring_state != 0)
+		return ring_state > 0;
+
+	ring_state = -1;
+	ret = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+	if (ret < 0)
+	{
+		elog(DEBUG1, "pg_proctab: io_uring is not available: %s",
+				strerror(-ret));
+		return false;
+	}
+
+	probe = io_uring_get_probe_ring(&ring);
+	if (probe == NULL ||
+			!io_uring_opcode_supported(probe, IORING_OP_OPENAT) ||
+			!io_uring_opcode_supported(probe, IORING_OP_READ) ||
+			!io_uring_opcode_supported(probe, IORING_OP_CLOSE) ||
+			!io_uring_opcode_supported(probe, IORING_OP_STATX))
+	{
+		elog(DEBUG1, "pg_proctab: io_uring lacks the operations needed");
+		if (probe != NULL)
+			io_uring_free_probe(probe);
+		io_uring_queue_exit(&ring);
+		return false;
+	}
+	io_uring_free_probe(probe);
+
+	ring_state = 1;
+	return true;
+}
+
+/*
+ * Submit the queued operations and reap all n of them, storing the result of
+ * each under its user data.  The ring cannot be trusted after a failure, so
+ * it is torn down and not used again by the backend.
+ */
+static void
+uring_wait(int n, int *results)
+{
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	ret = io_uring_submit(&ring);
+	while (ret >= 0 && n > 0)
+	{
+		ret = io_uring_wait_cqe(&ring, &cqe);
+		if (ret == -EINTR)
+		{
+			ret = 0;
+			continue;
+		}
+		if (ret < 0)
+			break;
+
+		if (results != NULL)
+			results[io_uring_cqe_get_data64(cqe)] = cqe->res;
+		io_uring_cqe_seen(&ring, cqe);
+		n--;
+	}
+
+	if (ret < 0)
+	{
+		io_uring_queue_exit(&ring);
+		ring_state = -1;
+		elog(ERROR, "pg_proctab: io_uring failed: %s", strerror(-ret));
+	}
+}
+
+/*
+ * Reserve the descriptors of as many of npids pids as fd.c grants, each pid
+ * taking per_pid, and return how many pids that is.
+ */
+static int
+uring_reserve(int per_pid, int npids)
+{
+#if PG_VERSION_NUM >= 130000
+	int n;
+	int i;
+
+	for (n = 0; n < npids; n++)
+		for (i = 0; i < per_pid; i++)
+			if (!AcquireExternalFD())
+			{
+				uring_release(i);
+				return n;
+			}
+#endif
+
+	return npids;
+}
+
+static void
+uring_release(int nfds)
+{
+#if PG_VERSION_NUM >= 130000
+	while (nfds-- > 0)
+		ReleaseExternalFD();
+#endif
+}
+
+/*
+ * Read the files of a batch of pids, in three rounds of one submission each:
+ * all files are opened and the owners looked up, then all of them are read,
+ * then closed.  That takes a handful of system calls per batch instead of
+ * several per pid.  The descriptors opened are kept in fds until they are
+ * closed, so that they can be closed on error.  A file that cannot be opened
+ * is left NULL, as its process has exited.
+ */
+static void
+uring_read_batch(int32 *pids, int npids, int reads, proctab_files *files,
+		int *fds)
+{
+	struct io_uring_sqe *sqe;
+	struct statx *stx;
+	char **paths;
+	char **buffers;
+	int *lens;
+	int n;
+	int i;
+	int file;
+
+	paths = (char **) palloc0(sizeof(char *) * npids * URING_FILES);
+	buffers = (char **) palloc0(sizeof(char *) * npids * URING_FILES);
+	lens = (int *) palloc(sizeof(int) * npids * URING_FILES);
+	stx = (struct statx *) palloc(sizeof(struct statx) * npids);
+
+	/* Open the files and look up the owner of every pid. */
+	n = 0;
+	for (i = 0; i < npids; i++)
+	{
+		for (file = URING_STAT; file <= URING_IO; file++)
+		{
+			fds[URING_DATA(i, file)] = -1;
+			if ((file == URING_CMDLINE && (reads & PROCTAB_CMDLINE) == 0) ||
+					(file == URING_IO && (reads & PROCTAB_IO) == 0))
+				continue;
+
+			paths[URING_DATA(i, file)] = psprintf("%s/%d/%s", PROCFS,
+					pids[i], uring_names[file]);
+			buffers[URING_DATA(i, file)] =
+					(char *) palloc(uring_sizes[file] + 1);
+
+			sqe = io_uring_get_sqe(&ring);
+			io_uring_prep_openat(sqe, AT_FDCWD, paths[URING_DATA(i, file)],
+					O_RDONLY, 0);
+			io_uring_sqe_set_data64(sqe, URING_DATA(i, file));
+			n++;
+		}
+
+		sqe = io_uring_get_sqe(&ring);
+		io_uring_prep_statx(sqe, AT_FDCWD, paths[URING_DATA(i, URING_STAT)],
+				0, STATX_UID, &stx[i]);
+		io_uring_sqe_set_data64(sqe, URING_DATA(i, URING_STATX));
+		n++;
+	}
+	uring_wait(n, fds);
+
+	/* Read every file that could be opened. */
+	n = 0;
+	for (i = 0; i < npids; i++)
+	{
+		for (file = URING_STAT; file <= URING_IO; file++)
+		{
+			if (fds[URING_DATA(i, file)] < 0)
+				continue;
+
+			sqe = io_uring_get_sqe(&ring);
+			io_uring_prep_read(sqe, fds[URING_DATA(i, file)],
+					buffers[URING_DATA(i, file)], uring_sizes[file], 0);
+			io_uring_sqe_set_data64(sqe, URING_DATA(i, file));
+			n++;
+		}
+	}
+	uring_wait(n, lens);
+
+	for (i = 0; i < npids; i++)
+	{
+		char *contents[URING_FILES - 1];
+
+		for (file = URING_STAT; file <= URING_IO; file++)
+		{
+			int len = lens[URING_DATA(i, file)];
+
+			contents[file] = NULL;
+			if (fds[URING_DATA(i, file)] < 0)
+			{
+				if (buffers[URING_DATA(i, file)] != NULL)
+					pfree(buffers[URING_DATA(i, file)]);
+				continue;
+			}
+			contents[file] = buffers[URING_DATA(i, file)];
+			contents[file][len < 0 ? 0 : len] = '\0';
+		}
+
+		files[i].stat = contents[URING_STAT];
+		files[i].cmdline = contents[URING_CMDLINE];
+		files[i].io = contents[URING_IO];
+		files[i].have_uid = fds[URING_DATA(i, URING_STATX)] == 0;
+		files[i].uid = stx[i].stx_uid;
+	}
+
+	/* Close them. */
+	n = 0;
+	for (i = 0; i < npids; i++)
+	{
+		for (file = URING_STAT; file <= URING_IO; file++)
+		{
+			if (fds[URING_DATA(i, file)] < 0)
+				continue;
+
+			sqe = io_uring_get_sqe(&ring);
+			io_uring_prep_close(sqe, fds[URING_DATA(i, file)]);
+			io_uring_sqe_set_data64(sqe, URING_DATA(i, file));
+			n++;
+		}
+	}
+	uring_wait(n, NULL);
+	for (i = 0; i < npids * URING_FILES; i++)
+		fds[i] = -1;
+
+	for (i = 0; i < npids * URING_FILES; i++)
+		if (paths[i] != NULL)
+			pfree(paths[i]);
+	pfree(paths);
+	pfree(buffers);
+	pfree(lens);
+	pfree(stx);
+}
+
+/*
+ * Read the files of at most PROCTAB_BATCH pids, in batches of as many pids as
+ * there are descriptors for.  Returns false, having read nothing, when
+ * io_uring cannot be used or no descriptor is left.
+ */
+bool
+uring_read_proctab(int32 *pids, int npids, int reads, proctab_files *files)
+{
+	int per_pid;
+	int batch;
+	int *fds;
+	int i;
+	int j;
+
+	if (!proctab_io_uring || !uring_ready())
+		return false;
+
+	per_pid = 1 + ((reads & PROCTAB_CMDLINE) != 0) +
+			((reads & PROCTAB_IO) != 0);
+	batch = uring_reserve(per_pid, npids);
+	if (batch == 0)
+		return false;
+
+	fds = (int *) palloc(sizeof(int) * batch * URING_FILES);
+	for (j = 0; j < batch * URING_FILES; j++)
+		fds[j] = -1;
+
+	PG_TRY();
+	{
+		for (i = 0; i < npids; i += batch)
+			uring_read_batch(pids + i, Min(npids - i, batch), reads,
+					files + i, fds);
+	}
+	PG_CATCH();
+	{
+		for (j = 0; j < batch * URING_FILES; j++)
+			if (j % URING_FILES != URING_STATX && fds[j] >= 0)
+				close(fds[j]);
+		uring_release(batch * per_pid);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	uring_release(batch * per_pid);
+	pfree(fds);
+
+	return true;
+}
+#else
+bool
+uring_read_proctab(int32 *pids, int npids, int reads, proctab_files *files)
+{
+	return false;
+}
+#endif /* __linux__ && WITH_LIBURING */
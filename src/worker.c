@@ -0,0 +1,522 @@
+/*
+ * Copyright (C) 2008 Mark Wong
+ */
+
+#include "postgres.h"
+#include <string.h>
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+#include <limits.h>
+#include "pg_proctab.h"
+
+#define GET_POLICY_TARGETS \
+		"SELECT pid, backend_type, usename " \
+		"FROM pg_stat_activity " \
+		"WHERE pid <> pg_backend_pid()"
+#define CHECK_SNAP_TABLES \
+		"SELECT to_regclass('ps_snaps') IS NOT NULL " \
+		"AND to_regprocedure('pg_proctab()') IS NOT NULL"
+#define CHECK_MAINTENANCE \
+		"SELECT to_regclass('ps_rollup_hour') IS NOT NULL " \
+		"AND to_regprocedure('ps_maintain(interval, interval, interval)') " \
+		"    IS NOT NULL"
+#define MAINTAIN \
+		"SELECT ps_maintain($1, $2, $3)"
+
+/* The duties of the worker, each run on its own schedule. */
+typedef enum
+{
+	WORKER_POLICY,
+	WORKER_MAINTAIN,
+	WORKER_SNAP,
+	WORKER_FLIGHT,
+	WORKER_ANOMALY,
+	WORKER_BURST,
+	WORKER_QUANTILE
+} worker_duty;
+
+static const char *worker_duties[] = {"policy", "maintenance", "snapshot",
+		"flight recorder", "anomaly check", "anomaly burst snapshot",
+		"quantile sample"};
+
+/* Processes the policy has been applied to, and under which generation. */
+typedef struct
+{
+	int32 pid;				/* hash key */
+	uint32 generation;
+	bool seen;
+} policy_target;
+
+char *worker_database = NULL;
+int policy_interval = 10;
+int snap_interval = 0;
+int maintenance_interval = 300;
+int raw_retention = 7 * 24 * 60;
+int rollup_minute_retention = 90 * 24 * 60;
+int rollup_hour_retention = 730 * 24 * 60;
+
+static HTAB *policy_targets = NULL;
+static uint32 policy_generation = 0;
+
+PGDLLEXPORT void pg_proctab_worker_main(Datum);
+
+static bool worker_due(TimestampTz *, int, TimestampTz, long *);
+static bool worker_run(worker_duty, TimestampTz *);
+static void worker_apply_policy(void);
+static void worker_snap_stats(const char *);
+static void worker_maintain(void);
+
+void
+worker_init(void)
+{
+	BackgroundWorker worker;
+
+	DefineCustomStringVariable("pg_proctab.database",
+			"Database the pg_proctab background worker connects to.",
+			NULL,
+			&worker_database,
+			"postgres",
+			PGC_POSTMASTER,
+			0,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.policy_interval",
+			"How often the background worker applies pg_proctab.process_policy "
+			"to new processes.",
+			"Zero disables applying the policy from the worker; client "
+			"backends still apply it when they connect.",
+			&policy_interval,
+			10,
+			0,
+			INT_MAX / 1000,
+			PGC_SIGHUP,
+			GUC_UNIT_S,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.snap_interval",
+			"How often the background worker takes a ps_snap_stats() "
+			"snapshot.",
+			"Zero disables snapshots.",
+			&snap_interval,
+			0,
+			0,
+			INT_MAX / 1000,
+			PGC_SIGHUP,
+			GUC_UNIT_S,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.maintenance_interval",
+			"How often the background worker runs ps_maintain().",
+			"Zero disables maintenance from the worker.",
+			&maintenance_interval,
+			300,
+			0,
+			INT_MAX / 1000,
+			PGC_SIGHUP,
+			GUC_UNIT_S,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.raw_retention",
+			"How long ps_maintain() keeps raw snapshots.",
+			"Zero keeps them forever.",
+			&raw_retention,
+			7 * 24 * 60,
+			0,
+			INT_MAX,
+			PGC_SIGHUP,
+			GUC_UNIT_MIN,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.rollup_minute_retention",
+			"How long ps_maintain() keeps 1-minute rollups.",
+			"Zero keeps them forever.",
+			&rollup_minute_retention,
+			90 * 24 * 60,
+			0,
+			INT_MAX,
+			PGC_SIGHUP,
+			GUC_UNIT_MIN,
+			NULL,
+			NULL,
+			NULL);
+
+	DefineCustomIntVariable("pg_proctab.rollup_hour_retention",
+			"How long ps_maintain() keeps 1-hour rollups.",
+			"Zero keeps them forever.",
+			&rollup_hour_retention,
+			730 * 24 * 60,
+			0,
+			INT_MAX,
+			PGC_SIGHUP,
+			GUC_UNIT_MIN,
+			NULL,
+			NULL,
+			NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 10;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_proctab");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "pg_proctab_worker_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_proctab worker");
+	snprintf(worker.bgw_type, BGW_MAXLEN, "pg_proctab worker");
+	worker.bgw_main_arg = (Datum) 0;
+	worker.bgw_notify_pid = 0;
+
+	RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Return true if a duty run every interval seconds is due, and shorten the
+ * timeout until the next wakeup accordingly.
+ */
+static bool
+worker_due(TimestampTz *last, int interval, TimestampTz now, long *timeout)
+{
+	long remaining;
+
+	if (interval <= 0)
+		return false;
+
+	remaining = TimestampDifferenceMilliseconds(now,
+			TimestampTzPlusMilliseconds(*last, interval * 1000L));
+	if (remaining <= 0)
+	{
+		*last = now;
+		remaining = interval * 1000L;
+		*timeout = Min(*timeout, remaining);
+		return true;
+	}
+
+	*timeout = Min(*timeout, remaining);
+	return false;
+}
+
+/*
+ * Run one duty.  An error in it is logged and its transaction aborted, so
+ * that the worker carries on instead of being restarted, which would throw
+ * away the state of the other duties such as the anomaly baselines and the
+ * samples behind the quantiles.  Returns what anomaly_check() returns for
+ * WORKER_ANOMALY and false otherwise.
+ */
+static bool
+worker_run(worker_duty duty, TimestampTz *burst_until)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	volatile bool result = false;
+
+	PG_TRY();
+	{
+		switch (duty)
+		{
+			case WORKER_POLICY:
+				worker_apply_policy();
+				break;
+			case WORKER_MAINTAIN:
+				worker_maintain();
+				break;
+			case WORKER_SNAP:
+				worker_snap_stats(NULL);
+				break;
+			case WORKER_FLIGHT:
+				flight_record();
+				break;
+			case WORKER_ANOMALY:
+				result = anomaly_check(burst_until);
+				break;
+			case WORKER_BURST:
+				worker_snap_stats("anomaly burst");
+				break;
+			case WORKER_QUANTILE:
+				quantile_sample();
+				break;
+		}
+	}
+	PG_CATCH();
+	{
+		ErrorData *edata;
+
+		HOLD_INTERRUPTS();
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+		LWLockReleaseAll();
+		RESUME_INTERRUPTS();
+
+		ereport(LOG,
+				(errmsg("pg_proctab worker: %s failed: %s",
+						worker_duties[duty], edata->message)));
+		FreeErrorData(edata);
+		pgstat_report_activity(STATE_IDLE, NULL);
+		result = false;
+	}
+	PG_END_TRY();
+
+	return result;
+}
+
+/*
+ * Apply pg_proctab.process_policy to every process it has not been applied
+ * to yet.  This is what covers the auxiliary processes, autovacuum workers
+ * and background workers, which never pass through client authentication.
+ */
+static void
+worker_apply_policy(void)
+{
+	HASH_SEQ_STATUS status;
+	policy_target *target;
+	int ret;
+	uint64 i;
+
+	if (policy_targets == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(int32);
+		ctl.entrysize = sizeof(policy_target);
+		policy_targets = hash_create("pg_proctab policy targets", 128, &ctl,
+				HASH_ELEM | HASH_BLOBS);
+	}
+
+	hash_seq_init(&status, policy_targets);
+	while ((target = (policy_target *) hash_seq_search(&status)) != NULL)
+		target->seen = false;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "applying process policy");
+
+	ret = SPI_execute(GET_POLICY_TARGETS, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "pg_proctab worker: %s failed: %s", GET_POLICY_TARGETS,
+				SPI_result_code_string(ret));
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple tuple = SPI_tuptable->vals[i];
+		TupleDesc tupdesc = SPI_tuptable->tupdesc;
+		int32 pid;
+		bool found;
+
+		pid = atoi(SPI_getvalue(tuple, tupdesc, 1));
+		target = (policy_target *) hash_search(policy_targets, &pid,
+				HASH_ENTER, &found);
+		target->seen = true;
+		if (found && target->generation == policy_generation)
+			continue;
+		target->generation = policy_generation;
+
+		if (apply_process_policy(pid, SPI_getvalue(tuple, tupdesc, 2),
+				SPI_getvalue(tuple, tupdesc, 3)) > 0)
+			elog(DEBUG1, "pg_proctab worker: applied process policy to %d",
+					pid);
+	}
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	hash_seq_init(&status, policy_targets);
+	while ((target = (policy_target *) hash_seq_search(&status)) != NULL)
+		if (!target->seen)
+			hash_search(policy_targets, &target->pid, HASH_REMOVE, NULL);
+}
+
+/*
+ * Take a snapshot into the ps_* tables of pg_proctab.database.  Missing
+ * tables are reported once rather than on every interval.
+ */
+static void
+worker_snap_stats(const char *note)
+{
+	static bool reported = false;
+	bool ready;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "taking snapshot");
+
+	if (SPI_execute(CHECK_SNAP_TABLES, true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "pg_proctab worker: %s failed", CHECK_SNAP_TABLES);
+	ready = strcmp(SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+			1), "t") == 0;
+
+	if (ready)
+	{
+		snap_stats(note);
+		reported = false;
+	}
+	else if (!reported)
+	{
+		ereport(LOG,
+				(errmsg("pg_proctab worker: not taking snapshots, pg_proctab "
+						"or the snapshot tables are missing in database "
+						"\"%s\"", worker_database)));
+		reported = true;
+	}
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_stat(false);
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+/*
+ * Create the coming partitions of the ps_* tables, roll up and drop expired
+ * partitions.
+ */
+static void
+worker_maintain(void)
+{
+	Oid argtypes[3] = {INTERVALOID, INTERVALOID, INTERVALOID};
+	int retention[3] = {raw_retention, rollup_minute_retention,
+			rollup_hour_retention};
+	Datum values[3];
+	char nulls[3];
+	int ret;
+	int i;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "maintaining snapshots");
+
+	if (SPI_execute(CHECK_MAINTENANCE, true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "pg_proctab worker: %s failed", CHECK_MAINTENANCE);
+
+	if (strcmp(SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1),
+			"t") == 0)
+	{
+		for (i = 0; i < 3; i++)
+		{
+			Interval *interval = (Interval *) palloc0(sizeof(Interval));
+
+			interval->time = (int64) retention[i] * USECS_PER_MINUTE;
+			values[i] = IntervalPGetDatum(interval);
+			nulls[i] = retention[i] == 0 ? 'n' : ' ';
+		}
+
+		ret = SPI_execute_with_args(MAINTAIN, 3, argtypes, values, nulls,
+				false, 0);
+		if (ret != SPI_OK_SELECT)
+			elog(ERROR, "pg_proctab worker: %s failed: %s", MAINTAIN,
+					SPI_result_code_string(ret));
+	}
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_stat(false);
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+void
+pg_proctab_worker_main(Datum main_arg)
+{
+	TimestampTz last_policy = 0;
+	TimestampTz last_snap = 0;
+	TimestampTz last_maintenance = 0;
+	TimestampTz last_flight = 0;
+	TimestampTz last_anomaly = 0;
+	TimestampTz last_burst = 0;
+	TimestampTz last_quantile = 0;
+	TimestampTz burst_until = 0;
+
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnection(worker_database, NULL, 0);
+
+	elog(LOG, "pg_proctab worker started");
+
+	while (!ShutdownRequestPending)
+	{
+		TimestampTz now;
+		long timeout = 60 * 1000L;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+			/* Re-apply a possibly changed policy to everybody. */
+			policy_generation++;
+			last_policy = 0;
+		}
+
+		now = GetCurrentTimestamp();
+
+		if (worker_due(&last_policy, policy_interval, now, &timeout))
+			worker_run(WORKER_POLICY, NULL);
+
+		/* Before the snapshot, which may need a new partition. */
+		if (worker_due(&last_maintenance, maintenance_interval, now,
+				&timeout))
+			worker_run(WORKER_MAINTAIN, NULL);
+
+		if (worker_due(&last_snap, snap_interval, now, &timeout))
+			worker_run(WORKER_SNAP, NULL);
+
+		if (worker_due(&last_flight, flight_recorder_interval, now, &timeout))
+			worker_run(WORKER_FLIGHT, NULL);
+
+		/* An anomaly starts a burst of snapshots, the first one right away. */
+		if (worker_due(&last_anomaly, anomaly_interval, now, &timeout) &&
+				worker_run(WORKER_ANOMALY, &burst_until))
+			last_burst = 0;
+
+		if (burst_until > now &&
+				worker_due(&last_burst, burst_interval, now, &timeout))
+			worker_run(WORKER_BURST, NULL);
+
+		if (worker_due(&last_quantile, quantile_interval, now, &timeout))
+			worker_run(WORKER_QUANTILE, NULL);
+
+		(void) WaitLatch(MyLatch,
+				WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+				timeout, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+	}
+
+	proc_exit(0);
+}
@@ -0,0 +1,58 @@
+-- Rows per second and bytes allocated per row of the pg_proctab functions,
+-- first against the fixture trees of 10, 1000 and 10000 backends and then
+-- against the running system.  Run with make bench, which sets fixtures and
+-- loops.
+\set ON_ERROR_STOP 1
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS pg_proctab;
+
+\set query 'SELECT f AS function, b.rows, round(b.rows_per_sec) AS rows_per_sec, round(b.bytes_per_row) AS bytes_per_row FROM unnest(ARRAY[''pg_proctab()'', ''pg_cputime()'', ''pg_cputime_percpu()'', ''pg_loadavg()'', ''pg_memusage()'', ''pg_diskusage()'', ''pg_cpu_topology()'', ''pg_numa_nodes()'', ''pg_clock_ticks()'']::REGPROCEDURE[]) f, LATERAL pg_proctab_bench(f, ' :loops ') b'
+
+\echo 10 backends
+\set root :fixtures '/10'
+\set proc :root '/proc'
+\set sys :root '/sys'
+SET pg_proctab.procfs_root = :'proc';
+SET pg_proctab.sysfs_root = :'sys';
+:query;
+
+\echo 1000 backends
+\set root :fixtures '/1000'
+\set proc :root '/proc'
+\set sys :root '/sys'
+SET pg_proctab.procfs_root = :'proc';
+SET pg_proctab.sysfs_root = :'sys';
+:query;
+
+\echo 10000 backends
+\set root :fixtures '/10000'
+\set proc :root '/proc'
+\set sys :root '/sys'
+SET pg_proctab.procfs_root = :'proc';
+SET pg_proctab.sysfs_root = :'sys';
+:query;
+
+-- pg_proctab() reading the files of one process after the other, as it does
+-- anyway unless built with WITH_LIBURING=1.
+\echo 10000 backends without io_uring
+SET pg_proctab.io_uring = off;
+SELECT b.rows, round(b.rows_per_sec) AS rows_per_sec,
+       round(b.bytes_per_row) AS bytes_per_row
+FROM pg_proctab_bench('pg_proctab()', :loops) b;
+RESET pg_proctab.io_uring;
+
+-- The functions that only read, including those that need no fixture.
+-- Those that need a setting, such as pg_proctab_perf(), or that reset
+-- counters are left out.
+\echo running system
+RESET pg_proctab.procfs_root;
+RESET pg_proctab.sysfs_root;
+SELECT f AS function, b.rows, round(b.rows_per_sec) AS rows_per_sec,
+       round(b.bytes_per_row) AS bytes_per_row
+FROM unnest(ARRAY['pg_proctab()', 'pg_cputime()', 'pg_cputime_percpu()',
+                  'pg_loadavg()', 'pg_memusage()', 'pg_diskusage()',
+                  'pg_cpu_topology()', 'pg_numa_nodes()', 'pg_clock_ticks()',
+                  'pg_taskstats()', 'pg_proctab_sockets()', 'pg_netdev()',
+                  'pg_fsusage()', 'pg_interrupts()', 'pg_softirqs()',
+                  'pg_proctab_snapshot()']::REGPROCEDURE[]) f,
+     LATERAL pg_proctab_bench(f, :loops) b;
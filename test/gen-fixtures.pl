@@ -0,0 +1,353 @@
+#!/usr/bin/env perl
+
+# Generate proc and sys trees that pg_proctab.procfs_root and
+# pg_proctab.sysfs_root can point at.  Every tree simulates a number of
+# backends and includes the awkward cases: comm values with spaces and
+# parentheses, /proc/PID/stat of kernels without the fields after
+# delayacct_blkio_ticks, processes without an io file and /proc/diskstats
+# lines of kernels without the discard and flush columns.  The contents only
+# depend on the number of backends, so the regression tests can expect exact
+# values.
+
+use strict;
+use warnings;
+
+use File::Path qw(make_path remove_tree);
+
+if (scalar @ARGV < 1) {
+	print "Usage: $0 <directory> [backends ...]\n";
+	exit(1);
+}
+
+my $dir = shift @ARGV;
+my @sizes = @ARGV ? @ARGV : (10, 1000, 10000);
+
+my @comms = ("postgres", "postgres: walwriter", "(sd-pam)", "a) b (c",
+		"x)", "idle (in) txn");
+my @states = ("S", "R", "S", "D", "S", "I");
+my $ncpus = 4;
+
+# Wait channels and kernel stacks of processes in uninterruptible sleep.
+my @stacks = (
+	["jbd2_log_wait_commit",
+		["jbd2_log_wait_commit+0xac/0x120",
+		 "jbd2_complete_transaction+0x5c/0x90",
+		 "ext4_fc_commit+0x1a0/0x7c0",
+		 "ext4_sync_file+0x1c1/0x3c0",
+		 "__x64_sys_fdatasync+0x4b/0x90",
+		 "do_syscall_64+0x5c/0x90"]],
+	["folio_wait_bit_common",
+		["folio_wait_bit_common+0x136/0x330",
+		 "filemap_read+0x3b4/0x670",
+		 "vfs_read+0x1f3/0x300",
+		 "__x64_sys_pread64+0x98/0xd0",
+		 "do_syscall_64+0x5c/0x90"]]);
+
+sub write_file {
+	my ($path, $content) = @_;
+
+	open(my $fh, '>', $path) or die "Unable to write $path: $!";
+	print $fh $content;
+	close $fh;
+}
+
+# /proc/PID/stat, cmdline and io of backend $i.
+sub write_process {
+	my ($proc, $i) = @_;
+
+	my $pid = 1000 + $i;
+	my $comm = $comms[$i % scalar @comms];
+	my $state = $states[$i % scalar @states];
+
+	make_path("$proc/$pid");
+
+	my @stat = ($pid, "($comm)", $state,
+			999,				# ppid
+			999,				# pgrp
+			999,				# session
+			0,					# tty_nr
+			-1,					# tpgid
+			4194560,			# flags
+			1000 + $i * 3,		# minflt
+			0,					# cminflt
+			$i % 5,				# majflt
+			0,					# cmajflt
+			100 + $i * 7,		# utime
+			50 + $i * 3,		# stime
+			0,					# cutime
+			0,					# cstime
+			20,					# priority
+			0,					# nice
+			1,					# num_threads
+			0,					# itrealvalue
+			5000 + $i,			# starttime
+			230000000 + $i * 4096,	# vsize
+			2000 + $i,			# rss
+			"18446744073709551615",	# rlim
+			1, 1, 0, 0, 0,		# startcode to kstkeip
+			0, 0, 4096, 536890880,	# signal to sigcatch
+			0, 0, 0,			# wchan, nswap, cnswap
+			17,					# exit_signal
+			$i % $ncpus,		# processor
+			0,					# rt_priority
+			0,					# policy
+			$i % 11);			# delayacct_blkio_ticks
+
+	# Kernels before 2.6.24 end the line at delayacct_blkio_ticks.
+	push @stat, (0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0) if ($i % 4 != 2);
+
+	write_file("$proc/$pid/stat", join(' ', @stat) . "\n");
+	write_file("$proc/$pid/cmdline",
+			"postgres: user$i db$i [local] idle\0");
+
+	# Where in the kernel the process waits, for pg_proctab_stalls().  The
+	# processes in D state alternate between two stacks, and the stack of
+	# every third one is not readable.
+	my $stack = $stacks[int($i / scalar @states) % scalar @stacks];
+	write_file("$proc/$pid/wchan", $state eq "D" ? $stack->[0] : "0");
+	if ($state eq "D" && $i % 9 != 3) {
+		write_file("$proc/$pid/stack",
+				join('', map { "[<0>] $_\n" } @{$stack->[1]}));
+	}
+
+	# Standard input and the connection to the client, which is TCP, TCP over
+	# IPv6 or a unix socket in turn.
+	make_path("$proc/$pid/fd");
+	symlink("/dev/null", "$proc/$pid/fd/0");
+	symlink("socket:[" . (20000 + $i) . "]", "$proc/$pid/fd/3");
+
+	# Kernels without CONFIG_TASK_IO_ACCOUNTING have no io file.
+	return if ($i % 7 == 3);
+
+	write_file("$proc/$pid/io",
+			"rchar: " . (10000 + $i * 100) . "\n" .
+			"wchar: " . (20000 + $i * 200) . "\n" .
+			"syscr: " . (30 + $i) . "\n" .
+			"syscw: " . (40 + $i) . "\n" .
+			"read_bytes: " . ($i * 4096) . "\n" .
+			"write_bytes: " . ($i * 8192) . "\n" .
+			"cancelled_write_bytes: " . ($i % 3 * 4096) . "\n");
+}
+
+# /proc/net/tcp, tcp6 and unix with the sockets the postmaster listens on and
+# one client connection per backend, and /proc/net/dev.
+sub write_net {
+	my ($proc, $backends) = @_;
+
+	my $tcp_header = "  sl  local_address rem_address   st tx_queue rx_queue " .
+			"tr tm->when retrnsmt   uid  timeout inode\n";
+	my $tcp = $tcp_header .
+			sprintf("%4d: %s:%04X %s:%04X %02X %08X:%08X 00:00000000 " .
+					"%08X %5d %8d %d 1 0000000000000000 100 0 0 10 0\n",
+					0, "00000000", 5432, "00000000", 0, 10, 0, 0, 0, 26,
+					0, 10001);
+	my $tcp6 = $tcp_header .
+			sprintf("%4d: %s:%04X %s:%04X %02X %08X:%08X 00:00000000 " .
+					"%08X %5d %8d %d 1 0000000000000000 100 0 0 10 0\n",
+					0, "0" x 32, 5432, "0" x 32, 0, 10, 0, 0, 0, 26, 0,
+					10002);
+	my $unix = "Num       RefCount Protocol Flags    Type St Inode Path\n" .
+			"0000000000000000: 00000002 00000000 00010000 0001 01 10003 " .
+			"/tmp/.s.PGSQL.5432\n";
+
+	for (my $i = 0; $i < $backends; $i++) {
+		my $inode = 20000 + $i;
+		# Some connections are closed by the client and the rest have data
+		# in flight, part of it being retransmitted.
+		my $state = $i % 10 == 7 ? 8 : 1;
+		my $tx_queue = ($i % 4) * 1448;
+		my $rx_queue = ($i % 5) * 100;
+		my $retransmits = $i % 4 == 3 ? 2 : 0;
+
+		if ($i % 3 == 0) {
+			$tcp .= sprintf("%4d: %s:%04X %s:%04X %02X %08X:%08X " .
+					"00:00000000 %08X %5d %8d %d 1 0000000000000000 20 4 30 " .
+					"10 -1\n", $i + 1, "0100007F", 5432, "0100007F",
+					40000 + $i, $state, $tx_queue, $rx_queue, $retransmits,
+					26, 0, $inode);
+		} elsif ($i % 3 == 1) {
+			$tcp6 .= sprintf("%4d: %s:%04X %s:%04X %02X %08X:%08X " .
+					"00:00000000 %08X %5d %8d %d 1 0000000000000000 20 4 30 " .
+					"10 -1\n", $i + 1, "00000000000000000000000001000000",
+					5432, sprintf("0000000000000000FFFF0000%02X00000A", $i % 10),
+					40000 + $i, $state, $tx_queue, $rx_queue, $retransmits,
+					26, 0, $inode);
+		} else {
+			$unix .= sprintf("%016x: 00000002 00000000 00000000 0001 03 " .
+					"%d /tmp/.s.PGSQL.5432\n", $i + 1, $inode);
+		}
+	}
+
+	make_path("$proc/net");
+	write_file("$proc/net/tcp", $tcp);
+	write_file("$proc/net/tcp6", $tcp6);
+	write_file("$proc/net/unix", $unix);
+
+	# Old kernels print the counters right after the colon.
+	write_file("$proc/net/dev",
+			"Inter-|   Receive                                                |  Transmit\n" .
+			" face |bytes    packets errs drop fifo frame compressed multicast|" .
+			"bytes    packets errs drop fifo colls carrier compressed\n" .
+			"    lo:  " . join(' ', 123456 * $backends, 1234 * $backends,
+					0, 0, 0, 0, 0, 0, 123456 * $backends, 1234 * $backends,
+					0, 0, 0, 0, 0, 0) . "\n" .
+			"  eth0:" . join(' ', 9876543210 + $backends, 7654321, 3, 12,
+					0, 1, 0, 4321, 1234567890, 2345678, 0, 5, 0, 0, 2, 0) .
+					"\n");
+}
+
+sub write_proc {
+	my ($proc, $backends) = @_;
+
+	make_path($proc);
+
+	for (my $i = 0; $i < $backends; $i++) {
+		write_process($proc, $i);
+	}
+
+	# The summary cpu line is the sum of the per cpu lines.
+	my @total = (0) x 10;
+	my $cpus = '';
+	for (my $cpu = 0; $cpu < $ncpus; $cpu++) {
+		my @c = (1000 * ($cpu + 1) + $backends, 10 * $cpu, 500 + $cpu,
+				90000 + $cpu, 20 * $cpu, 0, 3 * $cpu, $cpu, 0, 0);
+		$total[$_] += $c[$_] for (0 .. 9);
+		$cpus .= "cpu$cpu " . join(' ', @c) . "\n";
+	}
+	write_file("$proc/stat",
+			"cpu  " . join(' ', @total) . "\n" . $cpus .
+			"intr 1462898 9 0 0 0 0 0 0 0 1 0 0 0 0 0 0 0\n" .
+			"ctxt 8227356\n" .
+			"btime 1700000000\n" .
+			"processes " . (1000 + $backends) . "\n" .
+			"procs_running 2\n" .
+			"procs_blocked 0\n" .
+			"softirq 1234567 0 1 2 3 4 5 6 7 8 9\n");
+
+	write_file("$proc/loadavg",
+			"0.52 0.58 0.59 3/" . ($backends + 200) . " " .
+			(999 + $backends) . "\n");
+
+	write_file("$proc/meminfo",
+			"MemTotal:       16314736 kB\n" .
+			"MemFree:         1862512 kB\n" .
+			"MemAvailable:   10923344 kB\n" .
+			"Buffers:          563428 kB\n" .
+			"Cached:          8410880 kB\n" .
+			"SwapCached:         1024 kB\n" .
+			"Active:          7654321 kB\n" .
+			"Inactive:        5432100 kB\n" .
+			"SwapTotal:       2097148 kB\n" .
+			"SwapFree:        2080508 kB\n" .
+			"Dirty:               148 kB\n" .
+			"Shmem:            482312 kB\n" .
+			"HugePages_Total:       0\n" .
+			"Hugepagesize:       2048 kB\n");
+
+	# Kernel 5.5 and later, 4.18, before 4.18 and a 2.6.24 partition.
+	write_file("$proc/diskstats",
+			" 259       0 nvme0n1 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17\n" .
+			"   8       0 sda 101 102 103 104 105 106 107 108 109 110 111 112 113 114 115\n" .
+			" 253       0 dm-0 201 202 203 204 205 206 207 208 209 210 211\n" .
+			"   3       1 hda1 301 302 303 304\n");
+
+	write_net($proc, $backends);
+
+	# Interrupts with the network queue and NET_RX pinned to the first
+	# processor, and counts that are not per processor.
+	my $cpu_header = (' ' x 11) .
+			join('', map { sprintf("%-11s", "CPU$_") } (0 .. $ncpus - 1));
+	$cpu_header =~ s/ +$//;
+	my @irqs = (
+		["0", [44, 0, 0, 0], "IO-APIC   2-edge      timer"],
+		["24", [$backends * 1000, 0, 0, 0],
+				"PCI-MSI 1572864-edge      eth0-TxRx-0"],
+		["25", [3, 1200, 1100, 1300], "PCI-MSI 327680-edge      nvme0q1"],
+		["NMI", [0, 0, 0, 0], "Non-maskable interrupts"],
+		["LOC", [9000, 8000, 8500, 8700], "Local timer interrupts"],
+		["ERR", [0], ""]);
+	write_file("$proc/interrupts", "$cpu_header\n" .
+			join('', map {
+				my $line = sprintf("%4s:", $_->[0]) .
+						join('', map { sprintf("%11d", $_) } @{$_->[1]});
+				$line .= "   $_->[2]" if ($_->[2] ne "");
+				"$line\n";
+			} @irqs));
+
+	my @softirqs = (
+		["HI", [1, 0, 0, 0]],
+		["TIMER", [5000, 4800, 4900, 4700]],
+		["NET_TX", [$backends * 10, 2, 1, 3]],
+		["NET_RX", [$backends * 2000, 12, 9, 15]],
+		["BLOCK", [300, 280, 310, 290]],
+		["RCU", [7000, 6900, 7100, 6800]]);
+	write_file("$proc/softirqs", "    $cpu_header\n" .
+			join('', map {
+				sprintf("%12s:", $_->[0]) .
+						join('', map { sprintf("%11d", $_) } @{$_->[1]}) .
+						"\n";
+			} @softirqs));
+
+	# The mounts pg_fsusage() looks up the file systems in, with a mount
+	# point with a space, escaped, and one mounted over another.
+	make_path("$proc/self");
+	write_file("$proc/self/mountinfo",
+			"22 1 259:2 / / rw,relatime shared:1 - ext4 /dev/nvme0n1p2 " .
+			"rw,errors=remount-ro\n" .
+			"23 22 0:21 / /proc rw,nosuid,nodev,noexec,relatime shared:12 - " .
+			"proc proc rw\n" .
+			"24 22 0:23 / /dev/shm rw,nosuid,nodev shared:2 - tmpfs tmpfs " .
+			"rw,inode64\n" .
+			"31 22 259:3 / /mnt/pg\\040data rw,noatime shared:20 - xfs " .
+			"/dev/nvme1n1 rw,attr2,inode64,logbufs=8\n" .
+			"32 31 0:45 / /mnt/pg\\040data rw,noatime shared:21 - xfs " .
+			"/dev/nvme2n1 rw,attr2,inode64,logbufs=8\n");
+
+	make_path("$proc/sys/kernel");
+	write_file("$proc/sys/kernel/task_delayacct", "0\n");
+	write_file("$proc/sys/kernel/perf_event_paranoid", "2\n");
+}
+
+sub write_sys {
+	my ($sys) = @_;
+
+	for (my $cpu = 0; $cpu < $ncpus; $cpu++) {
+		my $c = "$sys/devices/system/cpu/cpu$cpu";
+
+		make_path("$c/topology", "$c/cpufreq");
+		write_file("$c/online", "1\n") if ($cpu > 0);
+		write_file("$c/topology/physical_package_id", "0\n");
+		write_file("$c/topology/die_id", "0\n");
+		write_file("$c/topology/core_id", int($cpu / 2) . "\n");
+		write_file("$c/topology/thread_siblings_list",
+				(2 * int($cpu / 2)) . "-" . (2 * int($cpu / 2) + 1) . "\n");
+		write_file("$c/cpufreq/scaling_cur_freq", "2400000\n");
+		write_file("$c/cpufreq/cpuinfo_max_freq", "3600000\n");
+
+		my @caches = ([1, "Data", "32K"], [1, "Instruction", "32K"],
+				[2, "Unified", "1024K"], [3, "Unified", "16384K"]);
+		for (my $index = 0; $index < scalar @caches; $index++) {
+			my $d = "$c/cache/index$index";
+
+			make_path($d);
+			write_file("$d/level", "$caches[$index][0]\n");
+			write_file("$d/type", "$caches[$index][1]\n");
+			write_file("$d/size", "$caches[$index][2]\n");
+			write_file("$d/shared_cpu_list",
+					$index == 3 ? "0-" . ($ncpus - 1) . "\n" :
+					"$cpu\n");
+		}
+	}
+
+	make_path("$sys/devices/system/node/node0");
+	write_file("$sys/devices/system/node/node0/cpulist",
+			"0-" . ($ncpus - 1) . "\n");
+}
+
+foreach my $backends (@sizes) {
+	my $tree = "$dir/$backends";
+
+	remove_tree($tree);
+	write_proc("$tree/proc", $backends);
+	write_sys("$tree/sys");
+}
@@ -0,0 +1,208 @@
+CREATE EXTENSION pg_proctab;
+
+-- Read the trees generated by gen-fixtures.pl instead of /proc and /sys.
+\set fixtures `pwd` '/test/fixtures'
+\set proc10 :fixtures '/10/proc'
+\set proc1000 :fixtures '/1000/proc'
+\set proc10000 :fixtures '/10000/proc'
+\set sys10 :fixtures '/10/sys'
+SET pg_proctab.procfs_root = :'proc10';
+
+-- comm values with spaces and parentheses, stat lines with and without the
+-- fields after delayacct_blkio_ticks and a process without an io file.
+SELECT pid, comm, state, ppid, utime, stime, processor,
+       delayacct_blkio_ticks AS blkio, rchar, syscw, cwrites
+FROM pg_proctab()
+ORDER BY pid;
+
+SELECT pid, fullcomm
+FROM pg_proctab()
+WHERE pid < 1002
+ORDER BY pid;
+
+-- Without shared_preload_libraries there is no cache, so the rows are read on
+-- the call.
+SET pg_proctab.cache_max_age = '1s';
+SELECT count(*), bool_and(sample_age < '1 second') AS fresh
+FROM pg_proctab();
+RESET pg_proctab.cache_max_age;
+
+-- Only the given pids are read, and the files the named columns do not need
+-- are not read at all.
+SELECT pid, comm, fullcomm, username, rchar
+FROM pg_proctab(ARRAY[1001, 1003], ARRAY['pid', 'comm'])
+ORDER BY pid;
+
+SELECT count(*) FROM pg_proctab(ARRAY[1000], ARRAY['nope']);
+
+-- Processes of a fixture tree are only selected by pid.
+SELECT count(*) FROM pg_proctab(ARRAY['client backend']);
+
+SELECT * FROM pg_cputime();
+SELECT * FROM pg_cputime_percpu() ORDER BY cpu;
+
+-- The cpus are those of the sysfs_root tree, not of the machine.
+SET pg_proctab.sysfs_root = :'sys10';
+SELECT cpu, online, package, die, core, thread_siblings, node, l1d_cache,
+       l2_cache, l3_cache, l3_shared_cpus
+FROM pg_cpu_topology()
+ORDER BY cpu;
+RESET pg_proctab.sysfs_root;
+
+SELECT * FROM pg_loadavg();
+SELECT * FROM pg_memusage();
+
+-- Columns a kernel does not have are NULL.
+SELECT major, minor, devname, reads_completed AS reads, sectors_read,
+       writes_completed AS writes, sectors_written, iotime,
+       discards_completed AS discards, flushes_completed AS flushes
+FROM pg_diskusage();
+
+-- The connection of every backend, the queues of unix sockets being unknown.
+SELECT pid, fd, protocol, state, local_address, remote_address, tx_queue,
+       rx_queue, retransmits
+FROM pg_proctab_sockets()
+ORDER BY pid, fd;
+
+SELECT interface, rx_bytes, rx_packets, rx_dropped, rx_multicast, tx_bytes,
+       tx_packets, tx_dropped, tx_carrier
+FROM pg_netdev()
+ORDER BY interface;
+
+-- The first call has nothing to compare with.
+SELECT interface, elapsed, rx_bytes, tx_bytes, rx_bytes_per_sec
+FROM pg_netdev_delta()
+ORDER BY interface;
+
+SELECT interface, elapsed > 0 AS elapsed, rx_bytes, tx_bytes,
+       rx_bytes_per_sec
+FROM pg_netdev_delta()
+ORDER BY interface;
+
+-- The file systems are looked up in the mounts of the fixture.
+SELECT name, mount_point, fs_type, device, bytes_total > 0 AS bytes,
+       bytes_free = bytes_reserved + bytes_available AS reserved
+FROM pg_fsusage()
+ORDER BY name;
+
+-- Interrupts per processor, with the counts that are not per processor.
+SELECT irq, cpu, count, description
+FROM pg_interrupts()
+WHERE irq IN ('24', 'ERR')
+ORDER BY irq, cpu;
+
+-- NET_RX pinned to the first processor, next to the idle time of each
+-- processor and the backends running there.
+SELECT s.cpu, s.count AS net_rx, c.idle, count(p.pid) AS backends
+FROM pg_softirqs() s
+     JOIN pg_cputime_percpu() c ON c.cpu = s.cpu
+     LEFT JOIN pg_proctab() p ON p.processor = s.cpu
+WHERE s.softirq = 'NET_RX'
+GROUP BY s.cpu, s.count, c.idle
+ORDER BY s.cpu;
+
+SELECT softirq, cpu, elapsed, count, per_sec
+FROM pg_softirqs_delta()
+WHERE softirq = 'NET_RX'
+ORDER BY cpu;
+
+SELECT softirq, cpu, elapsed > 0 AS elapsed, count, per_sec
+FROM pg_softirqs_delta()
+WHERE softirq = 'NET_RX'
+ORDER BY cpu;
+
+-- Policies are checked without being set, and those with settings that are
+-- empty or out of range are rejected.
+SELECT pg_check_process_policy('role=x: nice=5 ioprio=be/4');
+SELECT pg_check_process_policy('role=x: nice=');
+SELECT pg_check_process_policy('role=x: ioprio=be/4x');
+
+-- Without shared_preload_libraries no exited process is accounted for.
+SELECT count(*) FROM pg_proctab_accounting;
+SELECT pg_proctab_accounting_reset();
+
+-- Nor is any quantile sampled, though the arguments are still checked.
+SELECT count(*) FROM pg_proctab_quantiles(NULL);
+SELECT * FROM pg_proctab_quantiles('cpu', '{50,101}');
+SELECT pg_proctab_quantiles_reset('iowait');
+SELECT pg_proctab_quantiles_reset();
+
+-- A snapshot holds the rows of pg_proctab(), also after a round trip
+-- through its text form.
+SELECT pid, comm, fullcomm, state, utime, processor, rchar, cwrites,
+       clock_ticks > 0 AS ticks
+FROM pg_proctab_snapshot_unpack(pg_proctab_snapshot()::text::proctab_snapshot)
+ORDER BY pid;
+SELECT 'nope'::proctab_snapshot;
+
+SET client_min_messages = warning;
+SET pg_proctab.procfs_root = :'proc1000';
+SELECT count(*), min(pid), max(pid), sum(utime), count(DISTINCT comm),
+       sum(rchar)
+FROM pg_proctab();
+
+-- Backends in uninterruptible sleep grouped by where they wait in the
+-- kernel, the stack being NULL where it is not readable.
+SELECT state, wchan, split_part(stack, E'\n', 2) AS caller, backends,
+       pids[1:3] AS first_pids
+FROM pg_proctab_stalls();
+
+SET pg_proctab.procfs_root = :'proc10000';
+SELECT count(*), min(pid), max(pid), sum(utime), count(DISTINCT comm),
+       sum(rchar)
+FROM pg_proctab();
+
+-- Rows cached for one procfs_root are not served for another.
+SET pg_proctab.cache_max_age = '1h';
+SET pg_proctab.procfs_root = :'proc1000';
+SELECT count(*), max(pid) FROM pg_proctab();
+SET pg_proctab.procfs_root = :'proc10000';
+SELECT count(*), max(pid) FROM pg_proctab();
+RESET pg_proctab.cache_max_age;
+
+-- The snapshot tables, with partitions for samples of any time.
+\set ECHO none
+\i contrib/create-ps_procstat-tables.sql
+\set ECHO all
+CREATE TABLE ps_snaps_test PARTITION OF ps_snaps DEFAULT;
+CREATE TABLE ps_cpustat_test PARTITION OF ps_cpustat DEFAULT;
+
+-- One sample a minute, the counter being reset between 00:02 and 00:03.
+INSERT INTO ps_snaps(time)
+SELECT t
+FROM generate_series('2024-01-01 00:00:30+00'::timestamptz,
+                     '2024-01-01 00:04:30+00', '1 minute') t;
+INSERT INTO ps_cpustat(snap, time, cpu_user, cpu_nice, cpu_system, cpu_idle,
+                       cpu_iowait)
+SELECT snap, time,
+       (ARRAY[0, 600, 1200, 60, 660])[extract(minute FROM time)::int + 1],
+       0, 0, 0, 0
+FROM ps_snaps;
+
+-- The rate of every minute is taken from the sample of the minute before.
+SET client_min_messages = warning;
+SELECT ps_maintain(NULL, NULL, NULL);
+RESET client_min_messages;
+SELECT to_char(bucket AT TIME ZONE 'UTC', 'HH24:MI') AS bucket, samples, min,
+       avg, max, rate
+FROM ps_rollup_minute
+WHERE metric = 'cpu_user'
+ORDER BY bucket;
+SELECT to_char(bucket AT TIME ZONE 'UTC', 'YYYY-MM-DD HH24:MI') AS bucket,
+       samples, min, avg, max, rate
+FROM ps_rollup_hour
+WHERE metric = 'cpu_user';
+
+-- The counters of a process between two snapshots, as ps-util.pl reports
+-- them.
+CREATE TABLE ps_procstat_test PARTITION OF ps_procstat DEFAULT;
+INSERT INTO ps_procstat(snap, time, pid, comm, state, starttime, utime, stime,
+                        syscr, syscw, reads, writes, cwrites)
+SELECT snap, time, 4242, 'postgres', 'S', 100, 300 * snap, 60 * snap,
+       10 * snap, 5 * snap, 4096 * snap, 8192 * snap, 0
+FROM ps_snaps
+WHERE snap IN (1, 2);
+SELECT p.syscr, p.syscw, p.reads, p.writes, p.cwrites,
+       round(p.cpu_percent * pg_clock_ticks()) AS cpu_percent_ticks
+FROM ps_report_process(1, 2, 4242) p
+WHERE p.status IS NULL;